@@ -0,0 +1,138 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+// message rate and latency of a client streaming tiny telemetry messages, with and without batch frames
+// usage: BatchBenchmark [messages] [threads|io_uring]
+
+enum class TelemetryMessages : uint8_t
+{
+	SAMPLE,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class TelemetryServer : public Server<TelemetryMessages>
+{
+public:
+	TelemetryServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false), mReceived(0U) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+	std::atomic<uint32_t> mReceived;
+	Vector<double> mLatencies;   // microseconds, written by the thread calling ProcessMessage
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<TelemetryMessages> &message) override
+	{
+		int64_t sentTime;
+		uint32_t value;
+		message >> sentTime >> value;
+
+		mLatencies.InsertLast(std::chrono::duration<double, std::micro>(Clock::now().time_since_epoch()).count() - sentTime / 1000.0);
+		mReceived++;
+	}
+};
+
+class TelemetryClient : public Client<TelemetryMessages>
+{
+public:
+	TelemetryClient(const ClientOptions &options) : Client(options) {}
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<TelemetryMessages> &message) override {}
+};
+
+static void Run(const char *name, uint16_t port, IoBackend backend, const BatchOptions &batchOptions, uint32_t messages)
+{
+	const uint32_t window = 256U;   // messages in flight, keeps the queues short
+
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	TelemetryServer *server = new TelemetryServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		return;
+
+	server->mLatencies.Reserve(messages);
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });   // yields: leaves the cpu to the connections
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+	clientOptions.mSocket.mNoDelay = true;
+	clientOptions.mBatch = batchOptions;
+
+	TelemetryClient *client = new TelemetryClient(clientOptions);  // never destroyed either, it outlives the detached threads
+	client->Connect(server->GetHost(), server->GetPort());
+
+	while (!client->IsConnected())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	auto start = Clock::now();
+
+	for (uint32_t i = 0; i < messages; i++)
+	{
+		while (i - server->mReceived >= window)
+			std::this_thread::yield();
+
+		Message<TelemetryMessages> sample(TelemetryMessages::SAMPLE);
+		sample << i << static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+
+		client->Send(sample);
+	}
+
+	while (server->mReceived < messages)
+		std::this_thread::yield();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Vector<double> &latencies = server->mLatencies;
+	std::sort(latencies.Begin(), latencies.End());
+
+	PRINT(name);
+	PRINT(": "); PRINT(messages / seconds / 1e6); PRINT(" M messages/s");
+	PRINT(", latency p50 "); PRINT(latencies[latencies.Size() / 2]);
+	PRINT(" us, p99 "); PRINT(latencies[latencies.Size() * 99 / 100]);
+	PRINTLN(" us");
+
+	client->Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t messages = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 200000U;
+	IoBackend backend = argc > 2 && std::string(argv[2]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	BatchOptions unbatched;
+
+	BatchOptions batched;
+	batched.mEnabled = true;
+	batched.mDelay = std::chrono::microseconds(0);
+
+	BatchOptions delayed = batched;
+	delayed.mDelay = std::chrono::microseconds(200);
+
+	Run("unbatched", 60120, backend, unbatched, messages);
+	Run("batched, no delay", 60121, backend, batched, messages);
+	Run("batched, 200 us delay", 60122, backend, delayed, messages);
+
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
@@ -0,0 +1,213 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+// round trip latency of an echo written as coroutines on both ends (AsyncAccept, AsyncConnect, AsyncReceive, AsyncSend)
+// against the same echo written with OnMessage handlers, both driven from one thread that polls server and client
+// built as C++20 (see CMakeLists.txt), exits with EXIT_FAILURE if a connect fails or an echo is lost or wrong
+// usage: CoroutineBenchmark [round trips] [threads|io_uring]
+
+#ifndef COROUTINES_ENABLED
+#error "CoroutineBenchmark needs C++20 coroutines (Coroutine.h)"
+#endif
+
+enum class EchoMessages : uint8_t
+{
+	PING,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class EchoServer : public Server<EchoMessages>
+{
+public:
+	EchoServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	Task AcceptLoop()
+	{
+		while (true)
+			Echo(co_await AsyncAccept());
+	}
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<EchoMessages> &message) override
+	{
+		Send(sender, message);
+	}
+private:
+	Task Echo(ConnectionPtr connection)
+	{
+		while (std::optional<Message<EchoMessages>> message = co_await AsyncReceive(connection))
+			co_await AsyncSend(connection, *message);
+	}
+};
+
+class PingClient : public Client<EchoMessages>
+{
+public:
+	PingClient(const ClientOptions &options) : Client(options) {}
+
+	Task Run(const std::string host, uint16_t port, uint32_t roundTrips)
+	{
+		if (!co_await AsyncConnect(host, port))
+		{
+			mFailed = true;
+			co_return;
+		}
+
+		for (uint32_t i = 0U; i < roundTrips; i++)
+		{
+			Message<EchoMessages> ping(EchoMessages::PING);
+			ping << i;
+
+			auto start = Clock::now();
+			co_await AsyncSend(ping);
+
+			std::optional<Message<EchoMessages>> pong = co_await AsyncReceive();
+			if (!pong)
+			{
+				mFailed = true;
+				co_return;
+			}
+
+			mSamples.InsertLast(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+
+			uint32_t sequence;
+			*pong >> sequence;
+			mFailed = mFailed || sequence != i;
+		}
+
+		mDone = true;
+	}
+
+	Vector<double> mSamples;   // microseconds
+	uint32_t mPongs = 0U;
+	bool mDone = false;
+	bool mFailed = false;
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<EchoMessages> &message) override { mPongs++; }
+};
+
+static EchoServer *StartServer(uint16_t port, IoBackend backend, bool coroutines)
+{
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	EchoServer *server = new EchoServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (coroutines)
+		server->AcceptLoop();
+
+	if (!server->Start())
+		std::quick_exit(EXIT_FAILURE);
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	return server;
+}
+
+static void Report(const char *name, Vector<double> &samples)
+{
+	std::sort(samples.Begin(), samples.End());
+
+	PRINT(name); PRINT(": p50 "); PRINT(samples[samples.Size() / 2]);
+	PRINT(" us, p99 "); PRINT(samples[samples.Size() * 99 / 100]);
+	PRINT(" us, max "); PRINT(samples.Last());
+	PRINTLN(" us");
+}
+
+static bool RunCoroutines(uint16_t port, IoBackend backend, uint32_t roundTrips)
+{
+	EchoServer *server = StartServer(port, backend, true);
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+	clientOptions.mSocket.mNoDelay = true;
+
+	PingClient *client = new PingClient(clientOptions);  // never destroyed either, its connection is served by the leaked server
+	client->Run(server->GetHost(), server->GetPort(), roundTrips);
+
+	auto deadline = Clock::now() + std::chrono::seconds(30);
+	while (!client->mDone && !client->mFailed && Clock::now() < deadline)
+	{
+		server->Poll();
+		client->Poll();
+		std::this_thread::yield();   // the connections' threads do the sends and receives
+	}
+
+	if (!client->mDone || client->mFailed)
+		return false;
+
+	Report("coroutines", client->mSamples);
+	return true;
+}
+
+static bool RunHandlers(uint16_t port, IoBackend backend, uint32_t roundTrips)
+{
+	EchoServer *server = StartServer(port, backend, false);
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+	clientOptions.mSocket.mNoDelay = true;
+
+	PingClient *client = new PingClient(clientOptions);
+	client->Connect(server->GetHost(), server->GetPort());
+
+	auto deadline = Clock::now() + std::chrono::seconds(30);
+	while (!client->IsConnected() && Clock::now() < deadline)
+		std::this_thread::yield();
+
+	for (uint32_t i = 0U; i < roundTrips && Clock::now() < deadline; i++)
+	{
+		auto start = Clock::now();
+		client->Send(Message<EchoMessages>(EchoMessages::PING));
+
+		while (client->mPongs == i && Clock::now() < deadline)
+		{
+			if (server->Available())
+				server->ProcessMessage();
+			if (client->Available())
+				client->ProcessMessage();
+			std::this_thread::yield();
+		}
+
+		client->mSamples.InsertLast(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	if (client->mPongs != roundTrips)
+		return false;
+
+	Report("handlers", client->mSamples);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t roundTrips = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 10000U;
+	IoBackend backend = argc > 2 && std::string(argv[2]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	if (roundTrips == 0U || !RunCoroutines(60190, backend, roundTrips) || !RunHandlers(60191, backend, roundTrips))
+	{
+		PRINTLN("echo failed");
+		std::quick_exit(EXIT_FAILURE);
+	}
+
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
@@ -0,0 +1,200 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+
+// loss and round trip latency of small unreliable messages echoed over the datagram channel, against the same messages
+// over the connection; paced at a fixed rate, then as a burst that overruns the socket buffers (plain loopback, no netem)
+// usage: DatagramBenchmark [messages] [messages per second] [payload bytes]
+
+enum class BenchMessages : uint8_t
+{
+	POSITION,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class EchoServer : public Server<BenchMessages>
+{
+public:
+	EchoServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<BenchMessages> &message) override
+	{
+		Send(sender, message);  // echo back, the same way it came if the type is unreliable on both sides
+	}
+};
+
+class PositionClient : public Client<BenchMessages>
+{
+public:
+	PositionClient(int messages, const ClientOptions &options) : Client(options) { mSeen.Resize(messages, false); }
+
+	Vector<double> mSamples;   // round trips, microseconds
+	Vector<bool> mSeen;
+	int mDuplicates = 0;
+	int mReordered = 0;        // arrived after a later one
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+
+	void OnMessage(Message<BenchMessages> &message) override
+	{
+		int64_t sent;
+		uint32_t sequence;
+		message >> sent >> sequence;
+
+		if (sequence >= mSeen.Size())
+			return;
+
+		if (mSeen[static_cast<int>(sequence)])
+		{
+			mDuplicates++;
+			return;
+		}
+
+		mSeen[static_cast<int>(sequence)] = true;
+		mSamples.InsertLast((TraceNow() - sent) / 1e3);
+
+		if (static_cast<int64_t>(sequence) < mHighest)
+			mReordered++;
+		mHighest = std::max(mHighest, static_cast<int64_t>(sequence));
+	}
+private:
+	int64_t mHighest = -1;
+};
+
+static void Run(const char *name, uint16_t port, bool datagram, int messages, int rate, int payloadBytes)
+{
+	ServerOptions serverOptions;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	EchoServer *server = new EchoServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	server->Start();
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	if (datagram)
+	{
+		server->StartDatagram();
+		server->SetUnreliable(BenchMessages::POSITION);
+	}
+
+	ClientOptions clientOptions;
+	clientOptions.mSocket.mNoDelay = true;
+
+	PositionClient *client = new PositionClient(messages, clientOptions);
+	if (datagram)
+		client->SetUnreliable(BenchMessages::POSITION);
+
+	client->Connect(server->GetHost(), server->GetPort());
+
+	while (!client->IsConnected() || (datagram && !client->HasDatagram()))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::atomic<bool> done(false);
+
+	std::thread sender([&]
+	{
+		Clock::time_point start = Clock::now();
+
+		for (int i = 0; i < messages; i++)
+		{
+			if (rate > 0)   // open loop: on schedule whatever the replies do
+				std::this_thread::sleep_until(start + std::chrono::nanoseconds(1000000000LL * i / rate));
+
+			Message<BenchMessages> position(BenchMessages::POSITION);
+			for (int b = 0; b < payloadBytes; b++)
+				position << static_cast<uint8_t>(b);
+			position << static_cast<uint32_t>(i) << TraceNow();
+
+			client->Send(position);
+		}
+
+		done = true;
+	});
+
+	// replies until none came for a second, once everything was sent
+	Clock::time_point last = Clock::now();
+	while (!done || Clock::now() - last < std::chrono::seconds(1))
+	{
+		if (client->Available())
+		{
+			client->ProcessMessage();
+			last = Clock::now();
+		}
+		else
+		{
+			if (!done)
+				last = Clock::now();
+			std::this_thread::yield();
+		}
+	}
+
+	sender.join();
+
+	Vector<double> &samples = client->mSamples;
+	std::sort(samples.Begin(), samples.End());
+
+	int received = static_cast<int>(samples.Size());
+
+	PRINT(name);
+	PRINT(": lost ");  PRINT(100.0 * (messages - received) / messages);
+	PRINT(" %, duplicated "); PRINT(client->mDuplicates);
+	PRINT(", reordered "); PRINT(client->mReordered);
+
+	if (received > 0)
+	{
+		double total = 0.0;
+		for (double sample : samples)
+			total += sample;
+
+		PRINT(", rtt mean ");  PRINT(total / received);
+		PRINT(" us, p50 "); PRINT(samples[received / 2]);
+		PRINT(" us, p99 "); PRINT(samples[static_cast<int>(received * 99LL / 100)]);
+		PRINT(" us, max "); PRINT(samples.Last());
+		PRINT(" us");
+	}
+	PRINTLN("");
+
+	if (datagram)
+	{
+		DatagramStats stats = server->GetDatagramStats();
+		PRINT("  server datagrams: sent "); PRINT(stats.mSent); PRINT(", received "); PRINT(stats.mReceived); PRINT(", dropped "); PRINTLN(stats.mDropped);
+	}
+
+	client->Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+	int messages = argc > 1 ? std::atoi(argv[1]) : 20000;
+	int rate = argc > 2 ? std::atoi(argv[2]) : 20000;
+	int payloadBytes = argc > 3 ? std::atoi(argv[3]) : 32;
+
+	Run("tcp, paced", 60180, false, messages, rate, payloadBytes);
+	Run("udp, paced", 60181, true, messages, rate, payloadBytes);
+	Run("tcp, burst", 60182, false, messages, 0, payloadBytes);
+	Run("udp, burst", 60183, true, messages, 0, payloadBytes);
+
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
@@ -0,0 +1,161 @@
+#include "Handlers.h"
+#include "debug.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// dispatching a received message to its code: a switch in a virtual OnMessage (how applications did it), the dense
+// HandlerTable of Server<T> / Client<T> with raw and with decoding handlers, and the per type timing ProcessMessage keeps
+// after TimeHandlers; every message is copied first (as ProcessMessage takes it from the queue), the copy is timed on its own
+// usage: DispatchBenchmark [messages] [types used]
+
+enum class BenchMessages : uint8_t
+{
+	T0, T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11, T12, T13, T14, T15,
+
+	COUNT
+};
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t sSink = 0U;   // keeps the optimizer from dropping the work
+
+static void Report(const char *name, Clock::time_point start, size_t messages)
+{
+	double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	PRINT(name); PRINT(": "); PRINT(nanoseconds / messages); PRINTLN(" ns/message");
+}
+
+static uint32_t Peek(const Message<BenchMessages> &message)
+{
+	uint32_t value;
+	std::memcpy(&value, message.GetBody(), sizeof value);
+
+	return value;
+}
+
+static uint64_t Work(unsigned type, uint32_t value)   // a little different per type, so the cases don't fold into one
+{
+	switch (type % 4U)
+	{
+		case 0U: return value + type;
+		case 1U: return value * type;
+		case 2U: return static_cast<uint64_t>(value) << type;
+		default: return value >> type;
+	}
+}
+
+class Handler
+{
+public:
+	virtual ~Handler() {}
+	virtual void OnMessage(Message<BenchMessages> &message) = 0;
+};
+
+class SwitchHandler : public Handler
+{
+public:
+	void OnMessage(Message<BenchMessages> &message) override
+	{
+		switch (message.GetType())   // the table's handlers do the same work
+		{
+			case BenchMessages::T0: sSink += Work(0U, Peek(message)); break;
+			case BenchMessages::T1: sSink += Work(1U, Peek(message)); break;
+			case BenchMessages::T2: sSink += Work(2U, Peek(message)); break;
+			case BenchMessages::T3: sSink += Work(3U, Peek(message)); break;
+			case BenchMessages::T4: sSink += Work(4U, Peek(message)); break;
+			case BenchMessages::T5: sSink += Work(5U, Peek(message)); break;
+			case BenchMessages::T6: sSink += Work(6U, Peek(message)); break;
+			case BenchMessages::T7: sSink += Work(7U, Peek(message)); break;
+			case BenchMessages::T8: sSink += Work(8U, Peek(message)); break;
+			case BenchMessages::T9: sSink += Work(9U, Peek(message)); break;
+			case BenchMessages::T10: sSink += Work(10U, Peek(message)); break;
+			case BenchMessages::T11: sSink += Work(11U, Peek(message)); break;
+			case BenchMessages::T12: sSink += Work(12U, Peek(message)); break;
+			case BenchMessages::T13: sSink += Work(13U, Peek(message)); break;
+			case BenchMessages::T14: sSink += Work(14U, Peek(message)); break;
+			case BenchMessages::T15: sSink += Work(15U, Peek(message)); break;
+			default: break;
+		}
+	}
+};
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? static_cast<size_t>(std::atoi(argv[1])) : 10000000U;
+	unsigned types = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 16U;
+	types = types < 1U ? 1U : types > 16U ? 16U : types;
+
+	std::mt19937 random(7);
+	Vector<Message<BenchMessages>> messages;
+	for (size_t i = 0; i < 4096; i++)   // a mix of types in random order, so the branch predictor can't learn it
+	{
+		messages.InsertLast(Message<BenchMessages>(static_cast<BenchMessages>(random() % types)));
+		messages.Last() << static_cast<uint32_t>(random());
+	}
+
+	auto start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Message<BenchMessages> message(messages[static_cast<int>(i & 4095U)]);
+		sSink += Peek(message);
+	}
+	Report("copy only", start, count);
+
+	SwitchHandler switchHandler;
+	Handler *handler = &switchHandler;
+
+	start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Message<BenchMessages> message(messages[static_cast<int>(i & 4095U)]);
+		handler->OnMessage(message);
+	}
+	Report("virtual OnMessage switch", start, count);
+
+	HandlerTable<BenchMessages> table;
+	for (unsigned t = 0; t < 16U; t++)
+		table.Set(static_cast<BenchMessages>(t), [t](Message<BenchMessages> &message) { sSink += Work(t, Peek(message)); });
+
+	start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Message<BenchMessages> message(messages[static_cast<int>(i & 4095U)]);
+		table.Dispatch(message);
+	}
+	Report("handler table", start, count);
+
+	HandlerTable<BenchMessages> typed;
+	for (unsigned t = 0; t < 16U; t++)
+		typed.Set<uint32_t>(static_cast<BenchMessages>(t), [t](uint32_t &value) { sSink += Work(t, value); });
+
+	start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Message<BenchMessages> message(messages[static_cast<int>(i & 4095U)]);
+		typed.Dispatch(message);
+	}
+	Report("handler table, decoded", start, count);
+
+	start = Clock::now();
+	for (size_t i = 0; i < count; i++)
+	{
+		Message<BenchMessages> message(messages[static_cast<int>(i & 4095U)]);
+		Clock::time_point begin = Clock::now();
+		table.Dispatch(message);
+		table.Record(message.GetType(), Clock::now() - begin);
+	}
+	Report("handler table, timed per type", start, count);
+
+	Vector<HandlerStats> stats = table.Snapshot();
+	for (size_t i = 0; i < stats.Size() && i < 3; i++)
+	{
+		const HandlerStats &type = stats[static_cast<int>(i)];
+		PRINT("  type "); PRINT(type.mType); PRINT(": "); PRINT(type.mCalls); PRINT(" calls, ");
+		PRINT(static_cast<double>(type.mSum) / type.mCalls); PRINT(" ns mean, "); PRINT(type.mMax); PRINTLN(" ns max");
+	}
+
+	PRINT("("); PRINT(sSink); PRINTLN(")");
+}
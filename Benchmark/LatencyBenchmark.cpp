@@ -0,0 +1,120 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+// request/response round trip latency with and without Nagle's algorithm
+// usage: LatencyBenchmark [round trips] [payload bytes]
+
+enum class BenchMessages : uint8_t
+{
+	PING,
+};
+
+class EchoServer : public Server<BenchMessages>
+{
+public:
+	EchoServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<BenchMessages> &message) override
+	{
+		Send(sender, message);  // echo back
+	}
+};
+
+class PingClient : public Client<BenchMessages>
+{
+public:
+	PingClient(const ClientOptions &options) : Client(options) {}
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<BenchMessages> &message) override {}
+};
+
+static void Run(const char *name, uint16_t port, const SocketOptions &socketOptions, int roundTrips, int payloadBytes)
+{
+	ServerOptions serverOptions;
+	serverOptions.mSocket = socketOptions;
+
+	EchoServer *server = new EchoServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	server->Start();
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mSocket = socketOptions;
+
+	PingClient *client = new PingClient(clientOptions);
+	client->Connect(server->GetHost(), server->GetPort());
+
+	Message<BenchMessages> ping(BenchMessages::PING);
+	for (int i = 0; i < payloadBytes; i++)
+		ping << static_cast<uint8_t>(i);
+
+	Vector<double> samples;
+	samples.Reserve(roundTrips);
+
+	for (int i = 0; i < roundTrips; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		client->Send(ping);
+
+		while (!client->Available())
+			;
+
+		client->ProcessMessage();
+
+		samples.InsertLast(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	std::sort(samples.Begin(), samples.End());
+
+	double total = 0.0;
+	for (double sample : samples)
+		total += sample;
+
+	PRINT(name);
+	PRINT(": mean ");  PRINT(total / roundTrips);
+	PRINT(" us, p50 "); PRINT(samples[roundTrips / 2]);
+	PRINT(" us, p99 "); PRINT(samples[roundTrips * 99 / 100]);
+	PRINT(" us, max "); PRINT(samples.Last());
+	PRINTLN(" us");
+}
+
+int main(int argc, char **argv)
+{
+	int roundTrips = argc > 1 ? std::atoi(argv[1]) : 1000;
+	int payloadBytes = argc > 2 ? std::atoi(argv[2]) : 64;
+
+	SocketOptions nagle;
+	nagle.mNoDelay = false;
+
+	SocketOptions noDelay;
+	noDelay.mNoDelay = true;
+	noDelay.mQuickAck = true;
+
+	Run("nagle + delayed ack", 60100, nagle, roundTrips, payloadBytes);
+	Run("TCP_NODELAY + TCP_QUICKACK", 60101, noDelay, roundTrips, payloadBytes);
+
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
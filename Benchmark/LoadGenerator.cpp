@@ -0,0 +1,565 @@
+#include "Server.h"
+#include "Client.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+// headless load generator: N clients drive one of three workloads at a fixed total rate, open loop (a message is timed
+// from when it was due, not from when it could be sent, so a stalled server shows in the latencies instead of slowing
+// the load down), and it reports the throughput delivered, latency percentiles and the server's cpu time per message
+//   echo    the server sends every message back to its sender
+//   fanout  the server sends every message to all the clients (SendAll)
+//   direct  the server forwards every message to the client it names (Send(id)), a random one other than its sender
+// fanout and direct count deliveries to the generator's own clients: the server mustn't have others
+// exits with failure if messages were dropped or didn't arrive
+// usage: LoadGenerator [local | server | client <host> <port>] [options]
+//   local (default) runs the server in a child process, server only runs one, client connects to one (any address
+//   Client<T>::Connect takes: a host, unix://path or shm://path)
+//   --clients N       connections (10)            --rate R        messages per second, in total (10000)
+//   --workload W      echo, fanout or direct      --size B        payload bytes (64)
+//   --duration S      measured seconds (10)       --warmup S      seconds before measuring (2)
+//   --threads T       sending threads (1)         --backend B     threads or io_uring (threads)
+//   --port P          server's port (60170)       --trace N       traces one message in N both ways (0: off), prints
+//                                                                 where the deliveries' time went (see Trace.h)
+
+enum class LoadMessages : uint8_t
+{
+	HELLO, ECHO, FANOUT, DIRECT, STATS,
+};
+
+enum class Workload
+{
+	ECHO, FANOUT, DIRECT,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static const int sDrainSeconds = 5;   // after the last send, for the messages still on their way
+
+struct Options
+{
+	uint32_t mClients = 10U;
+	double mRate = 10000.0;
+	Workload mWorkload = Workload::ECHO;
+	uint32_t mSize = 64U;
+	double mDuration = 10.0;
+	double mWarmup = 2.0;
+	uint32_t mThreads = 1U;
+	IoBackend mBackend = IoBackend::THREADS;
+	uint16_t mPort = 60170;
+	TraceOptions mTrace;
+};
+
+static int64_t Nanoseconds(Clock::time_point time) { return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count(); }
+
+static uint64_t CpuNanoseconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+class LoadServer : public Server<LoadMessages>
+{
+public:
+	LoadServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false), mHandled(0U) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+	uint64_t mHandled;   // messages, only the thread calling ProcessMessage touches it
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<LoadMessages> &message) override
+	{
+		mHandled++;
+
+		switch (message.GetType())
+		{
+		case LoadMessages::HELLO:   // the id direct messages are addressed to
+		{
+			Message<LoadMessages> reply(LoadMessages::HELLO);
+			reply << sender->GetId();
+			Send(sender, reply);
+			break;
+		}
+		case LoadMessages::ECHO:
+			Send(sender, message);
+			break;
+		case LoadMessages::FANOUT:
+			SendAll(message);
+			break;
+		case LoadMessages::DIRECT:
+		{
+			uint32_t target;
+			message >> target;
+			Send(target, message);
+			break;
+		}
+		case LoadMessages::STATS:   // cpu time and messages so far, the difference of two is the cost of a message
+		{
+			uint32_t index;
+			message >> index;
+
+			Message<LoadMessages> reply(LoadMessages::STATS);
+			reply << index << CpuNanoseconds() << mHandled;
+			Send(sender, reply);
+			break;
+		}
+		}
+	}
+};
+
+struct Results
+{
+	LatencyHistogram mLatency;             // measured deliveries, from when they were due to be sent
+	std::atomic<uint64_t> mReceived{ 0U };  // measured deliveries
+	std::atomic<int64_t> mMeasureStart{ 0 };
+	std::atomic<int64_t> mMeasureEnd{ 0 };  // sends due from start to end are measured
+	std::atomic<uint64_t> mServerCpu[2] = {};
+	std::atomic<uint64_t> mServerHandled[2] = {};
+	std::atomic<uint32_t> mStats{ 0U };      // STATS replies received
+};
+
+class LoadClient : public Client<LoadMessages>
+{
+public:
+	LoadClient(const ClientOptions &options, Results &results) : Client(options), mResults(results) {}
+
+	std::atomic<uint32_t> mServerId{ 0U };
+	std::atomic<bool> mReady{ false };   // the server told its id
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+
+	void OnMessage(Message<LoadMessages> &message) override
+	{
+		switch (message.GetType())
+		{
+		case LoadMessages::HELLO:
+		{
+			uint32_t id;
+			message >> id;
+			mServerId = id;
+			mReady = true;
+			break;
+		}
+		case LoadMessages::STATS:
+		{
+			uint32_t index;
+			uint64_t cpu, handled;
+			message >> handled >> cpu >> index;
+			mResults.mServerCpu[index] = cpu;
+			mResults.mServerHandled[index] = handled;
+			mResults.mStats++;
+			break;
+		}
+		default:
+		{
+			int64_t due;
+			message >> due;
+
+			if (due >= mResults.mMeasureStart && due < mResults.mMeasureEnd)
+			{
+				mResults.mLatency.Record(static_cast<uint64_t>(Nanoseconds(Clock::now()) - due));
+				mResults.mReceived++;
+			}
+			break;
+		}
+		}
+	}
+private:
+	Results &mResults;
+};
+
+static bool ParseOptions(int argc, char **argv, int first, Options &options)
+{
+	for (int i = first; i < argc; i += 2)
+	{
+		if (i + 1 >= argc)
+			return false;
+
+		const char *name = argv[i];
+		const char *value = argv[i + 1];
+
+		if (std::strcmp(name, "--clients") == 0)
+			options.mClients = static_cast<uint32_t>(std::atoi(value));
+		else if (std::strcmp(name, "--rate") == 0)
+			options.mRate = std::atof(value);
+		else if (std::strcmp(name, "--size") == 0)
+			options.mSize = static_cast<uint32_t>(std::atoi(value));
+		else if (std::strcmp(name, "--duration") == 0)
+			options.mDuration = std::atof(value);
+		else if (std::strcmp(name, "--warmup") == 0)
+			options.mWarmup = std::atof(value);
+		else if (std::strcmp(name, "--threads") == 0)
+			options.mThreads = static_cast<uint32_t>(std::atoi(value));
+		else if (std::strcmp(name, "--port") == 0)
+			options.mPort = static_cast<uint16_t>(std::atoi(value));
+		else if (std::strcmp(name, "--trace") == 0)
+			options.mTrace.mSampleEvery = static_cast<uint32_t>(std::atoi(value));
+		else if (std::strcmp(name, "--workload") == 0 && std::strcmp(value, "echo") == 0)
+			options.mWorkload = Workload::ECHO;
+		else if (std::strcmp(name, "--workload") == 0 && std::strcmp(value, "fanout") == 0)
+			options.mWorkload = Workload::FANOUT;
+		else if (std::strcmp(name, "--workload") == 0 && std::strcmp(value, "direct") == 0)
+			options.mWorkload = Workload::DIRECT;
+		else if (std::strcmp(name, "--backend") == 0 && std::strcmp(value, "threads") == 0)
+			options.mBackend = IoBackend::THREADS;
+		else if (std::strcmp(name, "--backend") == 0 && std::strcmp(value, "io_uring") == 0)
+			options.mBackend = IoBackend::IO_URING;
+		else
+			return false;
+	}
+
+	return options.mClients > 0U && options.mRate > 0.0 && options.mDuration > 0.0 && options.mWarmup >= 0.0 && options.mThreads > 0U &&
+		!(options.mWorkload == Workload::DIRECT && options.mClients < 2U);
+}
+
+// processes messages until the process is killed, ready (if valid) gets the host it listens on
+static void RunServer(const Options &options, int ready)
+{
+	ServerOptions serverOptions;
+	serverOptions.mBackend = options.mBackend;
+	serverOptions.mTrace = options.mTrace;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	LoadServer server(options.mPort, serverOptions);
+	if (!server.Start())
+		std::exit(EXIT_FAILURE);
+
+	while (!server.mListening)
+		std::this_thread::yield();
+
+	PRINT("listening on "); PRINT(server.GetHost()); PRINT(" port "); PRINTLN(server.GetPort());
+	std::fflush(stdout);
+
+	if (ready >= 0)
+	{
+		if (write(ready, server.GetHost().c_str(), server.GetHost().size()) != static_cast<ssize_t>(server.GetHost().size()))
+			std::exit(EXIT_FAILURE);
+		close(ready);
+	}
+
+	uint32_t idle = 0U;
+	while (true)
+	{
+		if (server.Available())
+		{
+			server.ProcessMessage();
+			idle = 0U;
+		}
+		else if (++idle < 1000U)   // yields while busy, sleeps once idle: an idle server shouldn't count as load
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+}
+
+// sends every threads-th client's share of the rate, from start to end
+static void Drive(const Options &options, Vector<LoadClient*> &clients, const Message<LoadMessages> &payload, uint32_t thread,
+	Clock::time_point start, Clock::time_point end, Results &results, std::atomic<uint64_t> &sent, std::atomic<uint64_t> &dropped)
+{
+	const LoadMessages types[] = { LoadMessages::ECHO, LoadMessages::FANOUT, LoadMessages::DIRECT };
+	const LoadMessages type = types[static_cast<int>(options.mWorkload)];
+
+	uint32_t count = 0U;   // clients of this thread
+	for (uint32_t i = thread; i < options.mClients; i += options.mThreads)
+		count++;
+
+	if (count == 0U)
+		return;
+
+	const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.mThreads / options.mRate));
+	uint32_t random = 2463534242U + thread;   // xorshift, picks direct messages' targets
+	uint32_t next = 0U;
+	Clock::time_point due = start;
+
+	while (due < end)
+	{
+		Clock::time_point now = Clock::now();
+
+		if (due > now)
+		{
+			if (due - now > std::chrono::microseconds(200))
+				std::this_thread::sleep_for(due - now - std::chrono::microseconds(100));
+			else
+				std::this_thread::yield();
+			continue;
+		}
+
+		uint32_t index = thread + next * options.mThreads;
+		next = next + 1U == count ? 0U : next + 1U;
+
+		Message<LoadMessages> message(payload);
+		message << Nanoseconds(due);
+
+		if (type == LoadMessages::DIRECT)
+		{
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+
+			uint32_t target = random % (options.mClients - 1U);
+			target += target >= index ? 1U : 0U;
+			message << clients[static_cast<int>(target)]->mServerId.load();
+		}
+
+		bool measured = Nanoseconds(due) >= results.mMeasureStart;
+		if (!clients[static_cast<int>(index)]->Send(message))
+		{
+			if (measured)
+				dropped++;
+		}
+		else if (measured)
+			sent++;
+
+		due += interval;   // behind schedule, the next ones go right away and their latency shows it
+	}
+}
+
+// the traced deliveries of all the clients (the server's leg back to them), warmup included
+static void PrintTrace(Vector<LoadClient*> &clients)
+{
+	HistogramSnapshot stages[static_cast<size_t>(TraceStage::COUNT)];
+
+	for (size_t i = 0; i < clients.Size(); i++)
+	{
+		TraceSnapshot trace = clients[static_cast<int>(i)]->GetTrace();
+
+		for (size_t s = 0; s < static_cast<size_t>(TraceStage::COUNT); s++)
+		{
+			HistogramSnapshot &total = stages[s];
+			if (total.mCounts.Empty())
+				total.mCounts.Resize(LatencyHistogram::sBucketCount, 0U);
+
+			for (size_t b = 0; b < trace.mStages[s].mCounts.Size(); b++)
+				total.mCounts[static_cast<int>(b)] += trace.mStages[s].mCounts[static_cast<int>(b)];
+
+			total.mCount += trace.mStages[s].mCount;
+			total.mSum += trace.mStages[s].mSum;
+			total.mMax = std::max(total.mMax, trace.mStages[s].mMax);
+		}
+	}
+
+	PRINT("traced "); PRINT(stages[0].mCount); PRINTLN(" deliveries:");
+	for (size_t s = 0; s < static_cast<size_t>(TraceStage::COUNT); s++)
+	{
+		PRINT("  "); PRINT(TraceStageName(static_cast<TraceStage>(s))); PRINT(" p50 "); PRINT(stages[s].Percentile(0.5) / 1e3);
+		PRINT(" us, p99 "); PRINT(stages[s].Percentile(0.99) / 1e3); PRINT(" us, mean "); PRINT(stages[s].mCount ? stages[s].mSum / 1e3 / stages[s].mCount : 0.0); PRINTLN(" us");
+	}
+}
+
+static bool RunLoad(const Options &options, const std::string &host, uint16_t port)
+{
+	Results results;
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = options.mBackend;
+	clientOptions.mTrace = options.mTrace;
+	clientOptions.mSocket.mNoDelay = true;
+
+	Vector<LoadClient*> clients;   // never destroyed: Client<T>'s threads may still be winding down at quick_exit
+	for (uint32_t i = 0; i < options.mClients; i++)
+	{
+		LoadClient *client = new LoadClient(clientOptions, results);
+		client->Connect(host, port);
+		clients.InsertLast(client);
+	}
+
+	std::atomic<bool> receiving{ true };
+	std::thread receiver([&clients, &receiving]
+	{
+		while (receiving)
+		{
+			bool any = false;
+			for (size_t i = 0; i < clients.Size(); i++)
+				while (clients[static_cast<int>(i)]->Available())
+				{
+					clients[static_cast<int>(i)]->ProcessMessage();
+					any = true;
+				}
+
+			if (!any)
+				std::this_thread::yield();
+		}
+	});
+
+	auto deadline = Clock::now() + std::chrono::seconds(10);
+	for (size_t i = 0; i < clients.Size(); i++)
+	{
+		while (!clients[static_cast<int>(i)]->IsConnected() && Clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+		clients[static_cast<int>(i)]->Send(Message<LoadMessages>(LoadMessages::HELLO));
+	}
+
+	for (size_t i = 0; i < clients.Size(); i++)
+		while (!clients[static_cast<int>(i)]->mReady && Clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	for (size_t i = 0; i < clients.Size(); i++)
+		if (!clients[static_cast<int>(i)]->mReady)
+		{
+			PRINTLN("couldn't connect all the clients");
+			receiving = false;
+			receiver.join();
+			return false;
+		}
+
+	Message<LoadMessages> payload(options.mWorkload == Workload::ECHO ? LoadMessages::ECHO : options.mWorkload == Workload::FANOUT ? LoadMessages::FANOUT : LoadMessages::DIRECT);
+	for (uint32_t i = 0; i < options.mSize; i++)
+		payload << static_cast<uint8_t>(i);
+
+	auto start = Clock::now() + std::chrono::milliseconds(10);
+	auto measureStart = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.mWarmup));
+	auto end = measureStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.mDuration));
+	results.mMeasureStart = Nanoseconds(measureStart);
+	results.mMeasureEnd = Nanoseconds(end);
+
+	std::atomic<uint64_t> sent{ 0U }, dropped{ 0U };
+	Vector<std::thread> drivers;
+	for (uint32_t i = 0; i < options.mThreads; i++)
+		drivers.InsertLast(std::thread(Drive, std::cref(options), std::ref(clients), std::cref(payload), i, start, end, std::ref(results), std::ref(sent), std::ref(dropped)));
+
+	Message<LoadMessages> stats(LoadMessages::STATS);   // rides behind the load, so it counts what was sent before it
+	std::this_thread::sleep_until(measureStart);
+	uint64_t clientCpu = CpuNanoseconds();
+	clients[0]->Send(Message<LoadMessages>(stats) << 0U);
+
+	std::this_thread::sleep_until(end);
+	clients[0]->Send(Message<LoadMessages>(stats) << 1U);
+
+	for (size_t i = 0; i < drivers.Size(); i++)
+		drivers[static_cast<int>(i)].join();
+
+	clientCpu = CpuNanoseconds() - clientCpu;
+	double seconds = std::chrono::duration<double>(Clock::now() - measureStart).count();
+
+	uint64_t expected = sent * (options.mWorkload == Workload::FANOUT ? options.mClients : 1U);
+	auto drained = Clock::now() + std::chrono::seconds(sDrainSeconds);
+	while ((results.mReceived < expected || results.mStats < 2U) && Clock::now() < drained)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	receiving = false;
+	receiver.join();
+
+	HistogramSnapshot latency = results.mLatency.Snapshot();
+	uint64_t received = results.mReceived;
+	uint64_t handled = results.mStats < 2U ? 0U : results.mServerHandled[1] - results.mServerHandled[0];
+
+	PRINT("sent "); PRINT(sent.load()); PRINT(" ("); PRINT(sent / options.mDuration); PRINT(" messages/s, target "); PRINT(options.mRate);
+	PRINT("), dropped "); PRINTLN(dropped.load());
+	PRINT("delivered "); PRINT(received); PRINT(" of "); PRINT(expected); PRINT(" ("); PRINT(received / seconds); PRINTLN(" messages/s)");
+	PRINT("latency p50 "); PRINT(latency.Percentile(0.5) / 1e3); PRINT(" us, p99 "); PRINT(latency.Percentile(0.99) / 1e3);
+	PRINT(" us, p999 "); PRINT(latency.Percentile(0.999) / 1e3); PRINT(" us, max "); PRINT(latency.mMax / 1e3); PRINTLN(" us");
+
+	if (handled > 0U)
+	{
+		double serverCpu = static_cast<double>(results.mServerCpu[1] - results.mServerCpu[0]);
+		PRINT("server cpu "); PRINT(serverCpu / handled / 1e3); PRINT(" us/message received, "); PRINT(serverCpu / (received ? received : 1U) / 1e3);
+		PRINT(" us/message delivered ("); PRINT(serverCpu / 1e9 / options.mDuration * 100); PRINTLN("% of a core)");
+	}
+	else
+		PRINTLN("server cpu unknown (no STATS reply)");
+
+	PRINT("client cpu "); PRINT(clientCpu / 1e3 / (sent ? sent.load() : 1U)); PRINTLN(" us/message sent");
+
+	if (options.mTrace.mSampleEvery > 0U)
+		PrintTrace(clients);
+
+	for (size_t i = 0; i < clients.Size(); i++)
+		clients[static_cast<int>(i)]->Disconnect();
+
+	return dropped == 0U && received == expected;
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	int first = 1;
+	std::string mode = argc > 1 && argv[1][0] != '-' ? argv[1] : "local";
+	std::string host;
+	uint16_t port = 0;
+
+	if (mode == "server" || mode == "local")
+		first = argc > 1 && argv[1][0] != '-' ? 2 : 1;
+	else if (mode == "client" && argc > 3)
+	{
+		host = argv[2];
+		port = static_cast<uint16_t>(std::atoi(argv[3]));
+		first = 4;
+	}
+	else
+		first = argc;   // fails below
+
+	if ((mode != "server" && mode != "local" && mode != "client") || (mode == "client" && host.empty()) || !ParseOptions(argc, argv, first, options))
+	{
+		PRINTLN("usage: LoadGenerator [local | server | client <host> <port>] [--clients N] [--rate R] [--workload echo|fanout|direct]");
+		PRINTLN("                     [--size B] [--duration S] [--warmup S] [--threads T] [--backend threads|io_uring] [--port P] [--trace N]");
+		return EXIT_FAILURE;
+	}
+
+	if (mode == "server")
+		RunServer(options, -1);
+
+	pid_t child = -1;
+	if (mode == "local")   // forked before any thread is started, the server's cpu time is then its own
+	{
+		int ready[2];
+		if (pipe(ready) != 0)
+			return EXIT_FAILURE;
+
+		std::fflush(stdout);
+		child = fork();
+		if (child < 0)
+			return EXIT_FAILURE;
+
+		if (child == 0)
+		{
+			close(ready[0]);
+			RunServer(options, ready[1]);
+		}
+
+		close(ready[1]);
+		char buffer[256];
+		ssize_t size;
+		while ((size = read(ready[0], buffer, sizeof buffer)) > 0)
+			host.append(buffer, static_cast<size_t>(size));
+		close(ready[0]);
+
+		if (host.empty())
+		{
+			PRINTLN("server didn't start");
+			return EXIT_FAILURE;
+		}
+
+		port = options.mPort;
+	}
+
+	bool passed = RunLoad(options, host, port);
+
+	if (child > 0)
+	{
+		kill(child, SIGKILL);   // Server<T>::Stop can't interrupt a blocked accept
+		waitpid(child, nullptr, 0);
+	}
+
+	std::fflush(stdout);
+	std::quick_exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the clients' threads
+}
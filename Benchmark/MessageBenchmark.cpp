@@ -0,0 +1,123 @@
+#include "Message.h"
+#include "ThreadsafeQueue.h"
+#include "Vector.h"
+#include "debug.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// heap allocations and throughput of the message path for small and large bodies: build the message, queue a copy
+// (as Connection<T>::Send does), take it off the queue and read it back; HeapBodyMessage is the former layout,
+// a Message<T> whose body always lives in a Vector<uint8_t>
+// usage: MessageBenchmark [messages]
+
+static size_t sAllocations = 0U;   // the benchmark is single threaded
+
+void *operator new(size_t size)
+{
+	sAllocations++;
+
+	if (size > static_cast<size_t>(PTRDIFF_MAX))   // no object is that large, malloc isn't asked for it
+		throw std::bad_alloc();
+
+	if (void *memory = std::malloc(size ? size : 1))
+		return memory;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+
+enum class BenchMessages : uint8_t
+{
+	SMALL,
+};
+
+template <typename T>
+class HeapBodyMessage
+{
+public:
+	HeapBodyMessage() = default;
+	HeapBodyMessage(T type) : mType(type) {}
+
+	template <typename D>
+	HeapBodyMessage &operator<<(D const &data)
+	{
+		size_t oldSize = mBody.Size();
+
+		mBody.Resize(oldSize + sizeof data);
+		std::memcpy(mBody.Data() + oldSize, &data, sizeof data);
+
+		return *this;
+	}
+
+	template <typename D>
+	HeapBodyMessage &operator>>(D &data)
+	{
+		size_t index = mBody.Size() - sizeof data;
+		std::memcpy(&data, mBody.Data() + index, sizeof data);
+
+		mBody.Resize(index);
+
+		return *this;
+	}
+private:
+	T mType = T();
+	Vector<uint8_t> mBody;
+};
+
+template <typename M>
+static void Run(const char *name, int messages, int bodyWords)
+{
+	ThreadsafeQueue<M> queue;
+	uint64_t checksum = 0U;
+
+	queue.EnQueue(M(BenchMessages::SMALL));   // the queue's own storage is allocated before measuring
+	queue.DeQueue();
+
+	size_t allocations = sAllocations;
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < messages; i++)
+	{
+		M message(BenchMessages::SMALL);
+		for (int word = 0; word < bodyWords; word++)
+			message << static_cast<uint32_t>(i + word);
+
+		queue.EnQueue(message);
+
+		M received = queue.Front();
+		queue.DeQueue();
+
+		for (int word = 0; word < bodyWords; word++)
+		{
+			uint32_t value;
+			received >> value;
+			checksum += value;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	PRINT(name);
+	PRINT(", "); PRINT(bodyWords * sizeof(uint32_t)); PRINT(" byte body: ");
+	PRINT(static_cast<double>(sAllocations - allocations) / messages); PRINT(" allocations/message, ");
+	PRINT(messages / seconds / 1e6); PRINT(" M messages/s");
+	PRINT(" (checksum "); PRINT(checksum); PRINTLN(")");
+}
+
+int main(int argc, char **argv)
+{
+	int messages = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+	for (int bodyWords : { 1, 2, 8, 64 })   // 4 to 256 bytes, the inline storage holds up to 48
+	{
+		Run<Message<BenchMessages>>("Message", messages, bodyWords);
+		Run<HeapBodyMessage<BenchMessages>>("HeapBodyMessage", messages, bodyWords);
+	}
+
+	return EXIT_SUCCESS;
+}
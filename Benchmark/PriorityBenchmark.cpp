@@ -0,0 +1,149 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+
+// delay of a heartbeat queued right behind a bulk transfer on the same connection, on the bulk's lane
+// and on the HIGH lane (the bulk is fragmented, the heartbeat's frames interleave with it)
+// usage: PriorityBenchmark [bulk MB] [threads|io_uring]
+
+enum class PriorityMessages : uint8_t
+{
+	REQUEST, BULK, HEARTBEAT,
+};
+
+using Clock = std::chrono::steady_clock;
+
+class BulkServer : public Server<PriorityMessages>
+{
+public:
+	BulkServer(uint16_t port, const ServerOptions &options, uint32_t bulkSize) : Server(port, options), mListening(false), mBulk(PriorityMessages::BULK)
+	{
+		for (uint32_t i = 0; i < bulkSize; i++)
+			mBulk << static_cast<uint8_t>(i * 31U);
+	}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<PriorityMessages> &message) override
+	{
+		uint8_t heartbeatPriority;
+		message >> heartbeatPriority;
+
+		Send(sender, mBulk, Priority::LOW);
+
+		Message<PriorityMessages> heartbeat(PriorityMessages::HEARTBEAT);
+		heartbeat << static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+		Send(sender, heartbeat, static_cast<Priority>(heartbeatPriority));
+	}
+private:
+	Message<PriorityMessages> mBulk;
+};
+
+class BulkClient : public Client<PriorityMessages>
+{
+public:
+	BulkClient(const ClientOptions &options) : Client(options) {}
+
+	uint32_t mBulkSize = 0U;
+	double mHeartbeatDelay = 0.0;   // milliseconds
+	double mBulkDelay = 0.0;
+	bool mHeartbeatReceived = false;
+	bool mBulkReceived = false;
+	bool mBulkIntact = false;
+	Clock::time_point mRequestTime;
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+
+	void OnMessage(Message<PriorityMessages> &message) override
+	{
+		if (message.GetType() == PriorityMessages::HEARTBEAT)
+		{
+			int64_t sentTime;
+			message >> sentTime;
+
+			mHeartbeatDelay = (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count() - sentTime) / 1e6;
+			mHeartbeatReceived = true;
+			return;
+		}
+
+		mBulkDelay = std::chrono::duration<double, std::milli>(Clock::now() - mRequestTime).count();
+		mBulkReceived = true;
+
+		mBulkIntact = true;
+		for (uint32_t i = mBulkSize; mBulkIntact && i-- > 0; )   // read from the end
+		{
+			uint8_t value;
+			message >> value;
+			mBulkIntact = value == static_cast<uint8_t>(i * 31U);
+		}
+	}
+};
+
+int main(int argc, char **argv)
+{
+	uint32_t bulkSize = (argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 10U) * 1024U * 1024U;
+	IoBackend backend = argc > 2 && std::string(argv[2]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+
+	BulkServer *server = new BulkServer(60130, serverOptions, bulkSize);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		return EXIT_FAILURE;
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+
+	BulkClient client(clientOptions);
+	client.mBulkSize = bulkSize;
+	client.Connect(server->GetHost(), server->GetPort());
+
+	while (!client.IsConnected())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	bool intact = true;
+
+	for (Priority priority : { Priority::LOW, Priority::HIGH })
+	{
+		client.mHeartbeatReceived = client.mBulkReceived = false;
+		client.mRequestTime = Clock::now();
+
+		Message<PriorityMessages> request(PriorityMessages::REQUEST);
+		request << static_cast<uint8_t>(priority);
+		client.Send(request);
+
+		while (!client.mHeartbeatReceived || !client.mBulkReceived)
+			if (client.Available())
+				client.ProcessMessage();
+			else
+				std::this_thread::yield();
+
+		intact = intact && client.mBulkIntact;
+
+		PRINT(priority == Priority::HIGH ? "heartbeat on HIGH lane" : "heartbeat behind bulk on LOW lane");
+		PRINT(": heartbeat after "); PRINT(client.mHeartbeatDelay);
+		PRINT(" ms, "); PRINT(bulkSize / (1024 * 1024)); PRINT(" MB bulk after "); PRINT(client.mBulkDelay);
+		PRINT(" ms"); PRINTLN(client.mBulkIntact ? "" : " (CORRUPT)");
+	}
+
+	std::quick_exit(intact ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the server's blocked threads
+}
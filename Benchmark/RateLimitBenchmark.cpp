@@ -0,0 +1,203 @@
+#include "Server.h"
+#include "Client.h"
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+// what a rate limit costs per received message (the type, connection and global buckets, the global one shared by
+// several threads), and what it saves: one client flooding broadcasts that the server sends on to every other client,
+// unlimited against a limit on the broadcast type; cpu time of the whole process (clients included)
+// usage: RateLimitBenchmark [operations] [clients] [broadcasts per second] [seconds]
+
+enum class FloodMessages : uint8_t
+{
+	BROADCAST,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double CpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void Admit(uint32_t operations, unsigned threads)
+{
+	RateLimitOptions options;
+	options.mConnection = RateLimit{ 1e9, 1e6, RateLimitPolicy::DROP };   // high enough to let everything through: the cost of the checks only
+	options.mGlobal = RateLimit{ 1e9, 1e6, RateLimitPolicy::DROP };
+	options.SetTypeLimit(0U, RateLimit{ 1e9, 1e6, RateLimitPolicy::DROP });
+
+	RateLimiter limiter(options);
+	std::atomic<uint32_t> passed{ 0U };
+
+	auto start = Clock::now();
+
+	Vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+		workers.InsertLast(std::thread([&limiter, &passed, operations, threads]
+		{
+			RateLimiter::Buckets buckets;   // a connection's
+			limiter.Configure(buckets);
+
+			uint32_t admitted = 0U;
+			int64_t wait;
+			for (uint32_t i = 0; i < operations / threads; i++)
+				admitted += limiter.Admit(buckets, 0U, TraceNow(), wait) == RateVerdict::PASS ? 1U : 0U;
+
+			passed += admitted;
+		}));
+
+	for (size_t t = 0; t < workers.Size(); t++)
+		workers[static_cast<int>(t)].join();
+
+	double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	PRINT(threads); PRINT(" thread(s) admit: "); PRINT(nanoseconds / operations); PRINT(" ns/op, passed "); PRINTLN(passed.load());
+}
+
+class FloodServer : public Server<FloodMessages>
+{
+public:
+	FloodServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<FloodMessages> &message) override
+	{
+		SendAll(message, sender);   // what a chat server does with a message to everyone
+	}
+};
+
+class Listener : public Client<FloodMessages>
+{
+public:
+	std::atomic<uint64_t> mReceived{ 0U };
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override {}
+	void OnMessage(Message<FloodMessages> &message) override { mReceived++; }
+};
+
+static void Flood(const char *name, uint16_t port, const RateLimitOptions &options, int clients, int rate, int seconds)
+{
+	ServerOptions serverOptions;
+	serverOptions.mRateLimits = options;
+
+	FloodServer *server = new FloodServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	server->Start();
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::sleep_for(std::chrono::microseconds(100)); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	Vector<Listener*> listeners;
+	for (int i = 0; i < clients + 1; i++)   // the first one floods
+	{
+		listeners.InsertLast(new Listener());
+		listeners.Last()->Connect(server->GetHost(), server->GetPort());
+	}
+
+	for (size_t i = 0; i < listeners.Size(); i++)
+		while (!listeners[static_cast<int>(i)]->IsConnected())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::atomic<bool> done(false);
+	std::thread drain([&listeners, &done]
+	{
+		while (!done)
+		{
+			bool idle = true;
+			for (size_t i = 0; i < listeners.Size(); i++)
+				while (listeners[static_cast<int>(i)]->Available())
+				{
+					listeners[static_cast<int>(i)]->ProcessMessage();
+					idle = false;
+				}
+
+			if (idle)
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	});
+
+	Message<FloodMessages> broadcast(FloodMessages::BROADCAST);
+	for (int b = 0; b < 64; b++)
+		broadcast << static_cast<uint8_t>(b);
+
+	double cpu = CpuSeconds();
+	auto start = Clock::now();
+	uint64_t sent = 0U;
+
+	for (; sent < static_cast<uint64_t>(rate) * seconds; sent++)   // open loop, on schedule whatever the server does
+	{
+		std::this_thread::sleep_until(start + std::chrono::nanoseconds(1000000000LL * sent / rate));
+		listeners[0]->Send(broadcast);
+	}
+
+	auto Delivered = [&listeners]
+	{
+		uint64_t delivered = 0U;
+		for (size_t i = 1; i < listeners.Size(); i++)
+			delivered += listeners[static_cast<int>(i)]->mReceived;
+		return delivered;
+	};
+
+	uint64_t delivered = Delivered();   // until nothing arrived for half a second
+	for (uint64_t last = ~0ULL; last != delivered; )
+	{
+		last = delivered;
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		delivered = Delivered();
+	}
+
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	done = true;
+	drain.join();
+
+	EndpointMetrics metrics = server->GetMetrics();
+
+	PRINT(name); PRINT(": flooded "); PRINT(sent); PRINT(", passed on "); PRINT(delivered);
+	PRINT(", dropped "); PRINT(metrics.mCounts[static_cast<size_t>(Metric::RATE_DROPPED)]);
+	PRINT(", cpu "); PRINT((CpuSeconds() - cpu) / elapsed * 100.0); PRINTLN(" %");
+
+	for (size_t i = 0; i < listeners.Size(); i++)
+		listeners[static_cast<int>(i)]->Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t operations = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 10000000U;
+	int clients = argc > 2 ? std::atoi(argv[2]) : 8;
+	int rate = argc > 3 ? std::atoi(argv[3]) : 5000;
+	int seconds = argc > 4 ? std::atoi(argv[4]) : 3;
+
+	Admit(operations, 1);
+	Admit(operations, 4);
+
+	RateLimitOptions limited;
+	limited.SetTypeLimit(static_cast<uint32_t>(FloodMessages::BROADCAST), RateLimit{ 100.0, 20.0, RateLimitPolicy::DROP });
+
+	Flood("unlimited", 60195, RateLimitOptions(), clients, rate, seconds);
+	Flood("broadcast limited to 100/s", 60196, limited, clients, rate, seconds);
+
+	std::fflush(stdout);
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
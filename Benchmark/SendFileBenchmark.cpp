@@ -0,0 +1,187 @@
+#include "Server.h"
+#include "Client.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// a server answering file requests with SendFile against reading the file into a message first: throughput and the
+// process' cpu time per MB; every file goes between two small messages on the same lane, which must arrive around it
+// usage: SendFileBenchmark [MB] [requests] [threads|io_uring]
+
+enum class FileMessages : uint8_t
+{
+	REQUEST, BEGIN, FILE, END,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static const char *sPath = "SendFileBenchmark.tmp";
+static const uint64_t sOffset = 4096U;   // the file starts with a page the messages skip
+
+static uint8_t Pattern(uint64_t offset) { return static_cast<uint8_t>(offset * 131U + (offset >> 10)); }
+
+static double CpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+class FileServer : public Server<FileMessages>
+{
+public:
+	FileServer(uint16_t port, const ServerOptions &options, uint32_t size) : Server(port, options), mListening(false), mSize(size), mFd(open(sPath, O_RDONLY)) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<FileMessages> &message) override
+	{
+		uint8_t zeroCopy;
+		message >> zeroCopy;
+
+		Send(sender, Message<FileMessages>(FileMessages::BEGIN), Priority::LOW);
+
+		if (zeroCopy)
+			SendFile(sender, FileMessages::FILE, mFd, sOffset, mSize, Priority::LOW);
+		else
+		{
+			Message<FileMessages> file(FileMessages::FILE);   // read it, then the message copies it again, 8 bytes a field
+			Vector<uint64_t> buffer;
+			buffer.ResizeDefaultInit(mSize / sizeof(uint64_t));
+			if (pread(mFd, buffer.Data(), mSize, sOffset) == static_cast<ssize_t>(mSize))
+				for (size_t i = 0; i < buffer.Size(); i++)
+					file << buffer[static_cast<int>(i)];
+
+			Send(sender, file, Priority::LOW);
+		}
+
+		Send(sender, Message<FileMessages>(FileMessages::END), Priority::LOW);
+	}
+private:
+	uint32_t mSize;
+	int mFd;
+};
+
+class FileClient : public Client<FileMessages>
+{
+public:
+	FileClient(const ClientOptions &options) : Client(options) {}
+
+	std::atomic<bool> mDone{ false };
+	bool mIntact = true;
+	FileMessages mExpected = FileMessages::BEGIN;
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+
+	void OnMessage(Message<FileMessages> &message) override
+	{
+		mIntact = mIntact && message.GetType() == mExpected;   // in order around the file
+
+		if (message.GetType() == FileMessages::FILE)
+		{
+			const uint8_t *data = message.GetBody();
+			for (uint32_t i = 0; i < message.GetBodySize() && mIntact; i += 61)
+				mIntact = data[i] == Pattern(sOffset + i);
+		}
+
+		mExpected = static_cast<FileMessages>(static_cast<uint8_t>(message.GetType()) + 1);
+
+		if (message.GetType() == FileMessages::END)
+		{
+			mExpected = FileMessages::BEGIN;
+			mDone = true;
+		}
+	}
+};
+
+int main(int argc, char **argv)
+{
+	uint32_t size = (argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 64U) * 1024U * 1024U;
+	int requests = argc > 2 ? std::atoi(argv[2]) : 8;
+	IoBackend backend = argc > 3 && std::string(argv[3]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	{
+		std::FILE *file = std::fopen(sPath, "wb");
+		Vector<uint8_t> block(1024 * 1024);
+		for (uint64_t offset = 0; file && offset < sOffset + size; offset += block.Size())
+		{
+			for (size_t i = 0; i < block.Size(); i++)
+				block[static_cast<int>(i)] = Pattern(offset + i);
+			std::fwrite(block.Data(), 1, block.Size(), file);
+		}
+		if (file)
+			std::fclose(file);
+	}
+
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+
+	FileServer *server = new FileServer(60150, serverOptions, size);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		return EXIT_FAILURE;
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+
+	FileClient client(clientOptions);
+	client.Connect(server->GetHost(), server->GetPort());
+
+	while (!client.IsConnected())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	for (uint8_t zeroCopy : { 0, 1 })
+	{
+		auto start = Clock::now();
+		double cpu = CpuSeconds();
+
+		for (int r = 0; r < requests; r++)
+		{
+			client.mDone = false;
+
+			Message<FileMessages> request(FileMessages::REQUEST);
+			request << zeroCopy;
+			client.Send(request);
+
+			while (!client.mDone)
+				if (client.Available())
+					client.ProcessMessage();
+				else
+					std::this_thread::yield();
+		}
+
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		double megabytes = static_cast<double>(size) * requests / (1024 * 1024);
+
+		PRINT(zeroCopy ? "SendFile" : "read + Send");
+		PRINT(": "); PRINT(megabytes / seconds); PRINT(" MB/s, cpu (both ends) ");
+		PRINT((CpuSeconds() - cpu) * 1000 / megabytes); PRINT(" ms/MB");
+		PRINTLN(client.mIntact ? "" : " (CORRUPT)");
+	}
+
+	std::remove(sPath);
+
+	bool intact = client.mIntact;
+	std::fflush(stdout);
+	std::quick_exit(intact ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the server's blocked threads
+}
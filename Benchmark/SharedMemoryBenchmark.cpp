@@ -0,0 +1,161 @@
+#include "Server.h"
+#include "Client.h"
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+// same-host client and server over loopback tcp and over a unix socket (threads and io_uring backends each), and over a
+// shared memory channel: round trip latency of a small message, then throughput and cpu time of a stream of 1 KiB messages
+// usage: SharedMemoryBenchmark [round trips] [messages]
+
+enum class LocalMessages : uint8_t
+{
+	PING, DATA,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double CpuSeconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+class EchoServer : public Server<LocalMessages>
+{
+public:
+	EchoServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false), mReceived(0U) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+	std::atomic<uint32_t> mReceived;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<LocalMessages> &message) override
+	{
+		if (message.GetType() == LocalMessages::PING)
+			Send(sender, message);
+		else
+			mReceived++;
+	}
+};
+
+class PingClient : public Client<LocalMessages>
+{
+public:
+	PingClient(const ClientOptions &options) : Client(options) {}
+
+	std::atomic<uint32_t> mPongs{ 0U };
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<LocalMessages> &message) override { mPongs++; }
+};
+
+static void Run(const char *name, uint16_t port, IoBackend backend, const char *scheme, uint32_t roundTrips, uint32_t messages)   // scheme "" for tcp
+{
+	const uint32_t window = 256U;   // messages in flight, keeps the queues short
+	std::string path = "/tmp/SharedMemoryBenchmark." + std::to_string(port);
+
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	EchoServer *server = new EchoServer(port, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start() || (*scheme && !server->StartLocal(path)))
+		return;
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });   // yields: leaves the cpu to the connections
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+	clientOptions.mSocket.mNoDelay = true;
+
+	PingClient *client = new PingClient(clientOptions);  // never destroyed either, it outlives the detached threads
+	client->Connect(*scheme ? scheme + path : server->GetHost(), server->GetPort());
+
+	while (!client->IsConnected())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	Vector<double> latencies;
+	latencies.Reserve(roundTrips);
+
+	for (uint32_t i = 0; i < roundTrips; i++)
+	{
+		Message<LocalMessages> ping(LocalMessages::PING);
+		ping << i;
+
+		auto start = Clock::now();
+		client->Send(ping);
+
+		while (client->mPongs <= i)
+			if (client->Available())
+				client->ProcessMessage();
+			else
+				std::this_thread::yield();
+
+		latencies.InsertLast(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+	}
+
+	std::sort(latencies.Begin(), latencies.End());
+
+	Message<LocalMessages> data(LocalMessages::DATA);
+	for (uint32_t i = 0; i < 256; i++)
+		data << i;
+
+	auto start = Clock::now();
+	double cpu = CpuSeconds();
+
+	for (uint32_t i = 0; i < messages; i++)
+	{
+		while (i - server->mReceived >= window)
+			std::this_thread::yield();
+
+		client->Send(data);
+	}
+
+	while (server->mReceived < messages)
+		std::this_thread::yield();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	PRINT(name);
+	PRINT(": round trip p50 "); PRINT(latencies[latencies.Size() / 2]);
+	PRINT(" us, p99 "); PRINT(latencies[latencies.Size() * 99 / 100]);
+	PRINT(" us; "); PRINT(messages / seconds / 1e3); PRINT(" K messages/s ("); PRINT(messages * 1024.0 / seconds / (1024 * 1024));
+	PRINT(" MB/s), cpu ");
+	PRINT((CpuSeconds() - cpu) * 1e6 / messages); PRINTLN(" us/message");
+
+	client->Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t roundTrips = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 10000U;
+	uint32_t messages = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 200000U;
+
+	Run("tcp, threads", 60160, IoBackend::THREADS, "", roundTrips, messages);
+	Run("tcp, io_uring", 60161, IoBackend::IO_URING, "", roundTrips, messages);
+	Run("unix, threads", 60162, IoBackend::THREADS, sUnixScheme, roundTrips, messages);
+	Run("unix, io_uring", 60163, IoBackend::IO_URING, sUnixScheme, roundTrips, messages);
+	Run("shared memory", 60164, IoBackend::THREADS, sSharedMemoryScheme, roundTrips, messages);
+
+	std::fflush(stdout);
+	std::quick_exit(EXIT_SUCCESS);  // skip destructors of the servers' blocked threads
+}
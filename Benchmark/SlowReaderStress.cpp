@@ -0,0 +1,220 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+// a peer that reads slowly makes the server's sends fail with EWOULDBLOCK: the server has to keep the unsent
+// remainder and wait for writability without losing or reordering bytes, and without stalling its other clients
+// usage: SlowReaderStress [messages] [threads|io_uring]
+
+enum class StressMessages : uint8_t
+{
+	PING, FLOOD, DATA,
+};
+
+struct WireHeader                 // wire layout of Message<StressMessages>::Header, the slow reader is a plain socket
+{
+	StressMessages mType;
+	uint8_t mFlags;
+	uint32_t mSize;
+	uint32_t mCorrelationId;
+};
+
+static const uint8_t sFragmentFlag = 0x10;   // Message<T>::FLAG_FRAGMENT, the body continues in the next frame
+
+class FloodServer : public Server<StressMessages>
+{
+public:
+	FloodServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<StressMessages> &message) override
+	{
+		if (message.GetType() == StressMessages::PING)
+		{
+			Send(sender, message);
+			return;
+		}
+
+		uint32_t count;
+		message >> count;
+
+		for (uint32_t sequence = 0; sequence < count; sequence++)   // queued at once, far more than the socket buffers hold
+		{
+			Message<StressMessages> data(StressMessages::DATA);
+
+			uint32_t size = sequence * 7919U % 65536U;
+			for (uint32_t i = 0; i < size; i++)
+				data << static_cast<uint8_t>(sequence + i);
+			data << sequence;
+
+			Send(sender, data);
+		}
+	}
+};
+
+class PingClient : public Client<StressMessages>
+{
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<StressMessages> &message) override {}
+};
+
+static SOCKET ConnectSlowReader(const std::string &host, uint16_t port)
+{
+	addrinfo hints, *address;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &address) != 0)
+		Error("cannot get server address");
+
+	SOCKET readerSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	SetSocketOption(readerSocket, SOL_SOCKET, SO_RCVBUF, 16 * 1024, "SO_RCVBUF");   // small window, the server's sends block early
+
+	if (connect(readerSocket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0)
+		Error("connection error");
+
+	freeaddrinfo(address);
+
+	return readerSocket;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t messages = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 2000U;
+	IoBackend backend = argc > 2 && std::string(argv[2]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	ServerOptions serverOptions;
+	serverOptions.mSocket.mSendBufferSize = 32 * 1024;
+	serverOptions.mBackend = backend;
+
+	FloodServer *server = new FloodServer(60110, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		return EXIT_FAILURE;
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	SOCKET reader = ConnectSlowReader(server->GetHost(), server->GetPort());
+
+	WireHeader request = { StressMessages::FLOOD, 0U, sizeof messages, 0U };
+	send(reader, reinterpret_cast<const char*>(&request), sizeof request, MSG_NOSIGNAL);
+	send(reader, reinterpret_cast<const char*>(&messages), sizeof messages, MSG_NOSIGNAL);
+
+	std::atomic<bool> flooding(true);
+	std::atomic<int> roundTrips(0);
+
+	std::thread pingThread([&]   // another client of the same server keeps getting answers meanwhile
+	{
+		PingClient client;
+		client.Connect(server->GetHost(), server->GetPort());
+
+		Message<StressMessages> ping(StressMessages::PING);
+
+		while (flooding)
+		{
+			client.Send(ping);
+
+			while (flooding && !client.Available())
+				std::this_thread::yield();
+
+			if (client.Available())
+			{
+				client.ProcessMessage();
+				roundTrips++;
+			}
+		}
+	});
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<uint8_t> stream;
+	std::vector<uint8_t> body;        // fragments of the current message
+	uint64_t totalBytes = 0U;
+	uint32_t received = 0U;
+	bool corrupt = false;
+
+	while (received < messages && !corrupt)
+	{
+		char buffer[4096];
+		int bytesReceived = recv(reader, buffer, sizeof buffer, 0);
+
+		if (bytesReceived <= 0)
+		{
+			PRINTLN("server closed the connection");
+			break;
+		}
+
+		totalBytes += bytesReceived;
+		stream.insert(stream.end(), buffer, buffer + bytesReceived);
+
+		size_t offset = 0;
+		while (stream.size() - offset >= sizeof(WireHeader))   // verify every complete message: sequence and payload
+		{
+			WireHeader header;
+			memcpy(&header, stream.data() + offset, sizeof header);
+
+			if (stream.size() - offset - sizeof header < header.mSize)
+				break;
+
+			const uint8_t *frameBody = stream.data() + offset + sizeof header;
+			body.insert(body.end(), frameBody, frameBody + header.mSize);
+			offset += sizeof header + header.mSize;
+
+			if (header.mFlags & sFragmentFlag)
+				continue;
+
+			uint32_t sequence;
+			memcpy(&sequence, body.data() + body.size() - sizeof sequence, sizeof sequence);
+
+			corrupt = header.mType != StressMessages::DATA || sequence != received || body.size() != sequence * 7919U % 65536U + sizeof sequence;
+			for (uint32_t i = 0; !corrupt && i < body.size() - sizeof sequence; i++)
+				corrupt = body[i] != static_cast<uint8_t>(sequence + i);
+
+			if (corrupt)
+				break;
+
+			received++;
+			body.clear();
+		}
+
+		stream.erase(stream.begin(), stream.begin() + offset);
+
+		std::this_thread::sleep_for(std::chrono::microseconds(200));   // the slow part
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	flooding = false;
+	pingThread.join();
+
+	PRINT(backend == IoBackend::IO_URING ? "io_uring" : "threads");
+	PRINT(": "); PRINT(received); PRINT("/"); PRINT(messages); PRINT(" messages");
+	PRINT(corrupt ? " CORRUPT" : " intact");
+	PRINT(", "); PRINT(totalBytes / (1024.0 * 1024.0) / seconds); PRINT(" MB/s");
+	PRINT(", "); PRINT(roundTrips.load()); PRINT(" pings answered meanwhile");
+	PRINT(", send errors "); PRINTLN(server->GetErrorCounters().Get(ErrorKind::SEND));
+
+	std::quick_exit(received == messages && !corrupt ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the server's blocked threads
+}
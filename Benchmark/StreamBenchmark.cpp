@@ -0,0 +1,219 @@
+#include "Server.h"
+#include "Client.h"
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// a client uploading a large payload as a stream (from a generator and from a file) and as one message: throughput, bytes
+// produced but not yet consumed by a slow server (bounded by the stream window) and peak resident memory after each run
+// usage: StreamBenchmark [MB] [threads|io_uring]
+
+enum class UploadMessages : uint8_t
+{
+	UPLOAD,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<uint64_t> sProduced(0U);   // bytes the stream's source handed out
+
+static uint8_t Pattern(uint64_t offset) { return static_cast<uint8_t>(offset * 31U + (offset >> 12)); }
+
+static long PeakResidentMB()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_maxrss / 1024;
+}
+
+class UploadServer : public Server<UploadMessages>
+{
+public:
+	UploadServer(uint16_t port, const ServerOptions &options) : Server(port, options), mListening(false), mReceived(0U), mDone(false) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+	std::atomic<uint64_t> mReceived;
+	std::atomic<bool> mDone;
+	bool mIntact = true;
+	uint64_t mMaxOutstanding = 0U;   // produced and not yet consumed, the stream's memory on both ends
+	bool mSlow = false;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnStreamChunk(ConnectionPtr sender, uint32_t streamId, UploadMessages type, const uint8_t *data, size_t size) override
+	{
+		if (size == 0)
+		{
+			mDone = true;
+			return;
+		}
+
+		uint64_t offset = mReceived;
+		for (size_t i = 0; i < size && mIntact; i += 97)
+			mIntact = data[i] == Pattern(offset + i);
+
+		uint64_t outstanding = sProduced - offset;
+		if (outstanding > mMaxOutstanding)
+			mMaxOutstanding = outstanding;
+
+		mReceived += size;
+
+		if (mSlow && (offset / size) % 16 == 0)   // a consumer slower than the network
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	void OnMessage(ConnectionPtr sender, Message<UploadMessages> &message) override
+	{
+		const uint8_t *data = message.GetBody();
+		for (uint32_t i = 0; i < message.GetBodySize() && mIntact; i += 97)
+			mIntact = data[i] == Pattern(i);
+
+		mReceived += message.GetBodySize();
+		mDone = true;
+	}
+};
+
+class UploadClient : public Client<UploadMessages>
+{
+public:
+	UploadClient(const ClientOptions &options) : Client(options) {}
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+	void OnMessage(Message<UploadMessages> &message) override {}
+};
+
+static StreamSource PatternSource(uint64_t size)
+{
+	sProduced = 0U;
+
+	return [size](uint8_t *buffer, size_t capacity)
+	{
+		uint64_t offset = sProduced;
+		size_t count = size - offset < capacity ? static_cast<size_t>(size - offset) : capacity;
+
+		for (size_t i = 0; i < count; i++)
+			buffer[i] = Pattern(offset + i);
+
+		sProduced += count;
+		return count;
+	};
+}
+
+static void Report(const char *name, UploadServer *server, uint64_t size, Clock::time_point start, bool stream)
+{
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	PRINT(name); PRINT(": "); PRINT(size / seconds / (1024 * 1024)); PRINT(" MB/s");
+	if (stream)
+	{
+		PRINT(", max outstanding "); PRINT(server->mMaxOutstanding / 1024); PRINT(" KiB");
+	}
+	PRINT(", peak rss "); PRINT(PeakResidentMB()); PRINT(" MB");
+	PRINTLN(server->mIntact && server->mReceived == size ? "" : " (CORRUPT)");
+}
+
+static void Wait(UploadServer *server)
+{
+	while (!server->mDone)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void Reset(UploadServer *server, bool slow)
+{
+	server->mReceived = 0U;
+	server->mDone = false;
+	server->mMaxOutstanding = 0U;
+	server->mSlow = slow;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t size = (argc > 1 ? static_cast<uint64_t>(std::atoi(argv[1])) : 256U) * 1024U * 1024U;
+	IoBackend backend = argc > 2 && std::string(argv[2]) == "io_uring" ? IoBackend::IO_URING : IoBackend::THREADS;
+
+	ServerOptions serverOptions;
+	serverOptions.mBackend = backend;
+
+	UploadServer *server = new UploadServer(60140, serverOptions);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		return EXIT_FAILURE;
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	ClientOptions clientOptions;
+	clientOptions.mBackend = backend;
+
+	UploadClient client(clientOptions);
+	client.Connect(server->GetHost(), server->GetPort());
+
+	while (!client.IsConnected())
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	PRINT("peak rss before "); PRINT(PeakResidentMB()); PRINTLN(" MB");
+
+	Reset(server, false);
+	auto start = Clock::now();
+	client.SendStream(UploadMessages::UPLOAD, PatternSource(size));
+	Wait(server);
+	Report("stream from generator", server, size, start, true);
+
+	Reset(server, true);
+	start = Clock::now();
+	client.SendStream(UploadMessages::UPLOAD, PatternSource(size / 8));
+	Wait(server);
+	Report("stream to a slow consumer", server, size / 8, start, true);
+
+	const char *path = "StreamBenchmark.tmp";
+	{
+		std::FILE *file = std::fopen(path, "wb");
+		Vector<uint8_t> block(1024 * 1024);
+		for (uint64_t offset = 0; file && offset < size; offset += block.Size())
+		{
+			for (size_t i = 0; i < block.Size(); i++)
+				block[static_cast<int>(i)] = Pattern(offset + i);
+			std::fwrite(block.Data(), 1, block.Size(), file);
+		}
+		if (file)
+			std::fclose(file);
+	}
+
+	Reset(server, false);
+	start = Clock::now();
+	sProduced = size;   // the file source doesn't count, outstanding isn't measured
+	client.SendStream(UploadMessages::UPLOAD, FileStreamSource(path));
+	Wait(server);
+	Report("stream from file", server, size, start, false);
+	std::remove(path);
+
+	Reset(server, false);
+	start = Clock::now();
+	{
+		Message<UploadMessages> upload(UploadMessages::UPLOAD);
+		for (uint64_t i = 0; i < size; i++)
+			upload << Pattern(i);
+
+		client.Send(upload, Priority::LOW);
+	}
+	Wait(server);
+	Report("one message", server, size, start, false);
+
+	bool intact = server->mIntact;
+	std::fflush(stdout);
+	std::quick_exit(intact ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the server's blocked threads
+}
@@ -0,0 +1,102 @@
+#include "TimerWheel.h"
+#include "debug.h"
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <random>
+
+// TimerWheel on its own: scheduling, cancelling and running out many timers (connection heartbeats are one each), against
+// a std::multimap ordered by expiry; the ticks are simulated, every tick up to the last expiry is stepped through
+// usage: TimerBenchmark [timers] [max delay ms] [tick ms]
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t sSink = 0U;   // keeps the optimizer from dropping the work
+
+static void Report(const char *operation, Clock::time_point start, double operations)
+{
+	double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	PRINT(operation); PRINT(": "); PRINT(nanoseconds / operations); PRINTLN(" ns/op");
+}
+
+static void Wheel(const Vector<uint32_t> &delays, std::chrono::milliseconds maxDelay, std::chrono::milliseconds tick)
+{
+	Clock::time_point origin = Clock::now();
+	TimerWheel wheel(tick, origin);
+	Vector<TimerId> ids;
+	ids.Reserve(delays.Size());
+
+	auto start = Clock::now();
+	for (size_t i = 0; i < delays.Size(); i++)
+		ids.InsertLast(wheel.Schedule(std::chrono::milliseconds(delays[static_cast<int>(i)]), [] { sSink++; }));
+	Report("wheel schedule", start, static_cast<double>(delays.Size()));
+
+	start = Clock::now();
+	for (size_t i = 0; i < ids.Size(); i += 2)   // half of them, like heartbeats of connections that went away
+		sSink += wheel.Cancel(ids[static_cast<int>(i)]) ? 1U : 0U;
+	Report("wheel cancel", start, static_cast<double>(ids.Size() / 2));
+
+	Vector<TimerWheel::Callback> due;
+	size_t ticks = 0;
+	Clock::time_point end = Clock::now() + maxDelay + 2 * tick;   // the delays count from when they were scheduled
+
+	start = Clock::now();
+	for (Clock::time_point now = origin; now <= end; now += tick, ticks++)
+	{
+		wheel.Advance(now, due);
+		for (size_t i = 0; i < due.Size(); i++)
+			due[static_cast<int>(i)]();
+		due.Resize(0);
+	}
+	Report("wheel run out, per timer", start, static_cast<double>(delays.Size() - ids.Size() / 2));
+	PRINT("  ("); PRINT(ticks); PRINT(" ticks, "); PRINT(wheel.Size()); PRINTLN(" left)");
+}
+
+static void Map(const Vector<uint32_t> &delays, std::chrono::milliseconds maxDelay, std::chrono::milliseconds tick)
+{
+	using Timers = std::multimap<Clock::time_point, TimerWheel::Callback>;
+
+	Clock::time_point origin = Clock::now();
+	Timers timers;
+	Vector<Timers::iterator> ids;
+	ids.Reserve(delays.Size());
+
+	auto start = Clock::now();
+	for (size_t i = 0; i < delays.Size(); i++)
+		ids.InsertLast(timers.emplace(Clock::now() + std::chrono::milliseconds(delays[static_cast<int>(i)]), [] { sSink++; }));
+	Report("multimap schedule", start, static_cast<double>(delays.Size()));
+
+	start = Clock::now();
+	for (size_t i = 0; i < ids.Size(); i += 2)
+		timers.erase(ids[static_cast<int>(i)]);
+	Report("multimap cancel", start, static_cast<double>(ids.Size() / 2));
+
+	Clock::time_point end = Clock::now() + maxDelay + 2 * tick;
+
+	start = Clock::now();
+	for (Clock::time_point now = origin; now <= end; now += tick)
+		while (!timers.empty() && timers.begin()->first <= now)
+		{
+			timers.begin()->second();
+			timers.erase(timers.begin());
+		}
+	Report("multimap run out, per timer", start, static_cast<double>(delays.Size() - ids.Size() / 2));
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? static_cast<size_t>(std::atoi(argv[1])) : 1000000U;
+	std::chrono::milliseconds maxDelay(argc > 2 ? std::atoi(argv[2]) : 60000);
+	std::chrono::milliseconds tick(argc > 3 ? std::atoi(argv[3]) : 10);
+
+	std::mt19937 random(7);
+	Vector<uint32_t> delays;
+	for (size_t i = 0; i < count; i++)
+		delays.InsertLast(static_cast<uint32_t>(random() % static_cast<uint32_t>(maxDelay.count())));
+
+	Wheel(delays, maxDelay, tick);
+	Map(delays, maxDelay, tick);
+
+	PRINT("("); PRINT(sSink); PRINTLN(")");
+}
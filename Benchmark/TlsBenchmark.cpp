@@ -0,0 +1,325 @@
+#include "Server.h"
+#include "Client.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// what encryption costs: connect to the first echoed message in plaintext, with a full tls handshake (a new client each
+// time) and resumed (the same client reconnecting with its session ticket), then bulk SendFile throughput plain against
+// encrypted; the certificate is a self-signed one generated for localhost, trusted by the client
+// usage: TlsBenchmark [connects] [MB] [requests]
+
+#ifdef TLS_ENABLED
+
+#include <openssl/evp.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+enum class TlsMessages : uint8_t
+{
+	ECHO, REQUEST, FILE,
+};
+
+using Clock = std::chrono::steady_clock;
+
+static const char *sCertificatePath = "TlsBenchmark.crt";
+static const char *sKeyPath = "TlsBenchmark.key";
+static const char *sFilePath = "TlsBenchmark.tmp";
+
+static uint8_t Pattern(uint64_t offset) { return static_cast<uint8_t>(offset * 131U + (offset >> 10)); }
+
+// p-256 key and a certificate naming localhost, ::1 and 127.0.0.1, valid for a day
+static bool GenerateCertificate()
+{
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *certificate = X509_new();
+	bool written = false;
+
+	if (key && certificate)
+	{
+		X509_set_version(certificate, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+		X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+		X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+		X509_set_pubkey(certificate, key);
+
+		X509_NAME *name = X509_get_subject_name(certificate);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+		X509_set_issuer_name(certificate, name);
+
+		X509V3_CTX ctx;
+		X509V3_set_ctx_nodb(&ctx);
+		X509V3_set_ctx(&ctx, certificate, certificate, nullptr, nullptr, 0);
+
+		X509_EXTENSION *names = X509V3_EXT_conf_nid(nullptr, &ctx, NID_subject_alt_name, "DNS:localhost,IP:::1,IP:127.0.0.1");
+		if (names)
+		{
+			X509_add_ext(certificate, names, -1);
+			X509_EXTENSION_free(names);
+		}
+
+		if (X509_sign(certificate, key, EVP_sha256()) > 0)
+		{
+			std::FILE *certificateFile = std::fopen(sCertificatePath, "wb");
+			std::FILE *keyFile = std::fopen(sKeyPath, "wb");
+
+			written = certificateFile && keyFile && PEM_write_X509(certificateFile, certificate) == 1 && PEM_write_PrivateKey(keyFile, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+
+			if (certificateFile)
+				std::fclose(certificateFile);
+			if (keyFile)
+				std::fclose(keyFile);
+		}
+	}
+
+	X509_free(certificate);
+	EVP_PKEY_free(key);
+
+	return written;
+}
+
+class EchoServer : public Server<TlsMessages>
+{
+public:
+	EchoServer(uint16_t port, const ServerOptions &options, uint32_t size) : Server(port, options), mListening(false), mSize(size), mFd(open(sFilePath, O_RDONLY)) {}
+
+	std::string const &GetHost() const { return mHost; }
+	uint16_t GetPort() const { return mPort; }
+
+	std::atomic<bool> mListening;
+	std::atomic<bool> mEncrypted{ false };   // a connection's TlsInfo, for the summary
+	TlsInfo mInfo;
+protected:
+	void OnStart() override {}
+	void OnListen() override { mListening = true; }
+	bool OnClientConnect(ConnectionPtr connection) override { return true; }
+	void OnClientAccepted(ConnectionPtr connection) override {}
+	void OnClientDisconnect(ConnectionPtr connection) override {}
+
+	void OnMessage(ConnectionPtr sender, Message<TlsMessages> &message) override
+	{
+		if (!mEncrypted && sender->GetTlsInfo().mEncrypted)
+		{
+			mInfo = sender->GetTlsInfo();
+			mEncrypted = true;
+		}
+
+		if (message.GetType() == TlsMessages::REQUEST)
+			SendFile(sender, TlsMessages::FILE, mFd, 0U, mSize);
+		else
+			Send(sender, message);
+	}
+private:
+	uint32_t mSize;
+	int mFd;
+};
+
+class EchoClient final : public Client<TlsMessages>  // final: Client<T> has no virtual destructor, so it is only deleted as an EchoClient
+{
+public:
+	EchoClient(const ClientOptions &options) : Client(options) {}
+
+	std::atomic<int> mReceived{ 0 };
+	bool mIntact = true;
+protected:
+	void OnConnect(const std::string host, uint16_t port) override {}
+	void OnDisconnect() override {}
+	void OnConnectionLost() override { PRINTLN("lost connection with server"); }
+
+	void OnMessage(Message<TlsMessages> &message) override
+	{
+		if (message.GetType() == TlsMessages::FILE)
+		{
+			const uint8_t *data = message.GetBody();
+			for (uint32_t i = 0; i < message.GetBodySize() && mIntact; i += 61)
+				mIntact = data[i] == Pattern(i);
+		}
+
+		mReceived++;
+	}
+};
+
+static EchoServer *StartServer(uint16_t port, const TlsOptions &tlsOptions, uint32_t size)
+{
+	ServerOptions serverOptions;
+	serverOptions.mTls = tlsOptions;
+	serverOptions.mSocket.mNoDelay = true;   // latency is measured, don't let Nagle hold back the body
+
+	EchoServer *server = new EchoServer(port, serverOptions, size);  // never destroyed: Server<T> can't be torn down while Listen blocks in accept
+	if (!server->Start())
+		std::quick_exit(EXIT_FAILURE);
+
+	std::thread serverThread([server] { while (true) if (server->Available()) server->ProcessMessage(); else std::this_thread::yield(); });
+	serverThread.detach();
+
+	while (!server->mListening)
+		std::this_thread::yield();
+
+	return server;
+}
+
+static void Wait(EchoClient &client, int received)
+{
+	while (client.mReceived < received)
+		if (client.Available())
+			client.ProcessMessage();
+		else
+			std::this_thread::yield();
+}
+
+// connect, one echo, disconnect; fresh: a new client (and tls context, so no ticket) every time
+static void Reconnect(const char *name, EchoServer *server, const TlsOptions &tlsOptions, int connects, bool fresh)
+{
+	ClientOptions clientOptions;
+	clientOptions.mTls = tlsOptions;
+	clientOptions.mSocket.mNoDelay = true;
+
+	EchoClient *client = new EchoClient(clientOptions);
+	double total = 0.0;
+	int resumed = 0;
+
+	for (int i = 0; i < connects; i++)
+	{
+		if (fresh && i > 0)
+		{
+			delete client;
+			client = new EchoClient(clientOptions);
+		}
+
+		auto start = Clock::now();
+		client->mReceived = 0;
+		client->Connect(server->GetHost(), server->GetPort());
+
+		while (!client->IsConnected())
+			std::this_thread::yield();
+
+		client->Send(Message<TlsMessages>(TlsMessages::ECHO));
+		Wait(*client, 1);
+
+		total += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		resumed += client->GetTlsInfo().mResumed ? 1 : 0;
+
+		client->Disconnect();
+	}
+
+	delete client;
+
+	PRINT(name); PRINT(": "); PRINT(total / connects); PRINT(" us connect to first echo");
+	if (tlsOptions.mEnabled)
+	{
+		PRINT(", resumed "); PRINT(resumed); PRINT("/"); PRINT(connects);
+	}
+	PRINTLN("");
+}
+
+static bool Bulk(const char *name, EchoServer *server, const TlsOptions &tlsOptions, uint32_t size, int requests)
+{
+	ClientOptions clientOptions;
+	clientOptions.mTls = tlsOptions;
+	clientOptions.mSocket.mNoDelay = true;
+
+	EchoClient client(clientOptions);
+	client.Connect(server->GetHost(), server->GetPort());
+
+	while (!client.IsConnected())
+		std::this_thread::yield();
+
+	client.Send(Message<TlsMessages>(TlsMessages::ECHO));   // the handshake is done before the clock starts
+	Wait(client, 1);
+
+	auto start = Clock::now();
+	for (int r = 0; r < requests; r++)
+	{
+		client.Send(Message<TlsMessages>(TlsMessages::REQUEST));
+		Wait(client, r + 2);
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	double megabytes = static_cast<double>(size) * requests / (1024 * 1024);
+
+	TlsInfo info = client.GetTlsInfo();
+
+	PRINT(name); PRINT(": SendFile "); PRINT(megabytes / seconds); PRINT(" MB/s");
+	if (info.mEncrypted)
+	{
+		PRINT(", "); PRINT(info.mVersion); PRINT(" "); PRINT(info.mCipher);
+		PRINT(", client kernel tls send "); PRINT(info.mKernelSend ? "yes" : "no"); PRINT(" receive "); PRINT(info.mKernelReceive ? "yes" : "no");
+	}
+	PRINTLN(client.mIntact ? "" : " (CORRUPT)");
+
+	client.Disconnect();
+	return client.mIntact;
+}
+
+int main(int argc, char **argv)
+{
+	int connects = argc > 1 ? std::atoi(argv[1]) : 200;
+	uint32_t size = (argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 64U) * 1024U * 1024U;
+	int requests = argc > 3 ? std::atoi(argv[3]) : 8;
+
+	if (!GenerateCertificate())
+	{
+		PRINTLN("couldn't generate the certificate");
+		return EXIT_FAILURE;
+	}
+
+	{
+		std::FILE *file = std::fopen(sFilePath, "wb");
+		Vector<uint8_t> block(1024 * 1024);
+		for (uint64_t offset = 0; file && offset < size; offset += block.Size())
+		{
+			for (size_t i = 0; i < block.Size(); i++)
+				block[static_cast<int>(i)] = Pattern(offset + i);
+			std::fwrite(block.Data(), 1, block.Size(), file);
+		}
+		if (file)
+			std::fclose(file);
+	}
+
+	TlsOptions plain;
+
+	TlsOptions serverTls;
+	serverTls.mEnabled = true;
+	serverTls.mCertificateFile = sCertificatePath;
+	serverTls.mPrivateKeyFile = sKeyPath;
+
+	TlsOptions clientTls;
+	clientTls.mEnabled = true;
+	clientTls.mCaFile = sCertificatePath;   // self-signed: it is its own authority
+
+	EchoServer *plainServer = StartServer(60190, plain, size);
+	EchoServer *tlsServer = StartServer(60191, serverTls, size);
+
+	Reconnect("plaintext", plainServer, plain, connects, false);
+	Reconnect("tls, full handshake", tlsServer, clientTls, connects, true);
+	Reconnect("tls, resumed", tlsServer, clientTls, connects, false);
+
+	bool intact = Bulk("plaintext", plainServer, plain, size, requests);
+	intact = Bulk("tls", tlsServer, clientTls, size, requests) && intact;
+
+	if (tlsServer->mEncrypted)
+	{
+		PRINT("server kernel tls send "); PRINT(tlsServer->mInfo.mKernelSend ? "yes" : "no");
+		PRINT(" receive "); PRINTLN(tlsServer->mInfo.mKernelReceive ? "yes" : "no");
+	}
+
+	std::remove(sFilePath);
+	std::remove(sCertificatePath);
+	std::remove(sKeyPath);
+
+	std::fflush(stdout);
+	std::quick_exit(intact ? EXIT_SUCCESS : EXIT_FAILURE);  // skip destructors of the servers' blocked threads
+}
+
+#else
+
+int main()
+{
+	PRINTLN("built without TLS_ENABLED (OpenSSL)");
+}
+
+#endif
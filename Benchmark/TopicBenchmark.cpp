@@ -0,0 +1,118 @@
+#include "Topics.h"
+#include "debug.h"
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+// TopicIndex<S> on its own: subscribe/unsubscribe churn from several threads, and matching a publish to its
+// subscribers (exact topics, with prefix patterns, against scanning every subscriber's topics like a SendAll would)
+// usage: TopicBenchmark [subscribers] [topics] [operations]
+
+using Clock = std::chrono::steady_clock;
+
+struct Subscriber
+{
+	uint32_t mId;
+	std::string mTopic;   // the scan's view: what it subscribed to
+
+	uint32_t GetId() const { return mId; }
+};
+
+using SubscriberPtr = std::shared_ptr<Subscriber>;
+
+static uint64_t sSink = 0U;   // keeps the optimizer from dropping the work
+
+static std::string Topic(uint32_t index) { return "prices.region" + std::to_string(index % 8) + ".symbol" + std::to_string(index); }
+
+static void Report(const char *operation, Clock::time_point start, double operations)
+{
+	double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	PRINT(operation); PRINT(": "); PRINT(nanoseconds / operations); PRINTLN(" ns/op");
+}
+
+static void Churn(Vector<SubscriberPtr> &subscribers, uint32_t topics, uint32_t operations, unsigned threads)
+{
+	TopicIndex<SubscriberPtr> index;
+
+	auto start = Clock::now();
+
+	Vector<std::thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+		workers.InsertLast(std::thread([&subscribers, &index, topics, operations, threads, t]
+		{
+			for (uint32_t i = t; i < operations; i += threads)   // subscribe, then drop a subscription made earlier
+			{
+				const SubscriberPtr &subscriber = subscribers[static_cast<int>(i % subscribers.Size())];
+				index.Subscribe(subscriber, Topic(i % topics));
+
+				if (i >= 64U * threads)
+					index.Unsubscribe(subscribers[static_cast<int>((i - 64U * threads) % subscribers.Size())], Topic((i - 64U * threads) % topics));
+			}
+		}));
+
+	for (size_t t = 0; t < workers.Size(); t++)
+		workers[static_cast<int>(t)].join();
+
+	PRINT(threads); PRINT(" thread(s) ");
+	Report("subscribe + unsubscribe", start, operations);
+}
+
+static void Publish(Vector<SubscriberPtr> &subscribers, uint32_t topics, uint32_t operations, bool patterns)
+{
+	TopicIndex<SubscriberPtr> index;
+
+	for (size_t i = 0; i < subscribers.Size(); i++)
+		index.Subscribe(subscribers[static_cast<int>(i)], subscribers[static_cast<int>(i)]->mTopic);
+
+	if (patterns)   // a few wide subscriptions on top
+		for (uint32_t region = 0; region < 8U; region++)
+			index.Subscribe(subscribers[static_cast<int>(region)], "prices.region" + std::to_string(region) + ".*");
+
+	Vector<SubscriberPtr> matched;
+
+	auto start = Clock::now();
+	for (uint32_t i = 0; i < operations; i++)
+	{
+		matched.Clear();
+		index.Match(Topic(i % topics), matched);
+		sSink += matched.Size();
+	}
+
+	Report(patterns ? "match, exact and prefix subscriptions" : "match, exact subscriptions", start, operations);
+
+	start = Clock::now();
+	for (uint32_t i = 0; i < operations / 16U; i++)   // what a publish costs without an index: every subscriber looked at
+	{
+		matched.Clear();
+		std::string topic = Topic(i % topics);
+
+		for (size_t s = 0; s < subscribers.Size(); s++)
+			if (subscribers[static_cast<int>(s)]->mTopic == topic)
+				matched.InsertLast(subscribers[static_cast<int>(s)]);
+
+		sSink += matched.Size();
+	}
+
+	Report("match, scanning all subscribers", start, operations / 16U);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t count = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 10000U;
+	uint32_t topics = argc > 2 ? static_cast<uint32_t>(std::atoi(argv[2])) : 1000U;
+	uint32_t operations = argc > 3 ? static_cast<uint32_t>(std::atoi(argv[3])) : 1000000U;
+
+	Vector<SubscriberPtr> subscribers;
+	for (uint32_t i = 0; i < count; i++)
+		subscribers.InsertLast(std::make_shared<Subscriber>(Subscriber{ i, Topic(i % topics) }));
+
+	Churn(subscribers, topics, operations, 1);
+	Churn(subscribers, topics, operations, 4);
+	Publish(subscribers, topics, operations, false);
+	Publish(subscribers, topics, operations, true);
+
+	PRINT("("); PRINT(sSink); PRINTLN(")");
+}
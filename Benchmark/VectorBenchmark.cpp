@@ -0,0 +1,159 @@
+#include "Vector.h"
+#include "debug.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Vector<T> against std::vector<T> on the operations the library relies on: growing a message body a field at a time,
+// copying buffers, appending and removing from the front of a queue, for bytes and for non trivially copyable elements
+// usage: VectorBenchmark [repetitions]
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t sSink = 0U;   // keeps the optimizer from dropping the work
+
+static void Report(const char *operation, const char *container, Clock::time_point start, double operations)
+{
+	double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	PRINT(operation); PRINT(" "); PRINT(container); PRINT(": ");
+	PRINT(nanoseconds / operations); PRINTLN(" ns/op");
+}
+
+static void AppendFields(int repetitions)   // Resize + memcpy per 4 byte field, like Message<T>::operator<<
+{
+	const int fields = 256;
+
+	auto start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		Vector<uint8_t> body;
+		for (uint32_t field = 0; field < fields; field++)
+		{
+			size_t size = body.Size();
+			body.ResizeDefaultInit(size + sizeof field);
+			std::memcpy(body.Data() + size, &field, sizeof field);
+		}
+		sSink += body[fields];
+	}
+	Report("append 4 byte fields", "Vector", start, static_cast<double>(repetitions) * fields);
+
+	start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		std::vector<uint8_t> body;
+		for (uint32_t field = 0; field < fields; field++)
+		{
+			size_t size = body.size();
+			body.resize(size + sizeof field);
+			std::memcpy(body.data() + size, &field, sizeof field);
+		}
+		sSink += body[fields];
+	}
+	Report("append 4 byte fields", "std::vector", start, static_cast<double>(repetitions) * fields);
+}
+
+static void CopyBuffer(int repetitions)
+{
+	const size_t size = 64 * 1024;
+
+	Vector<uint8_t> source(size);
+	std::vector<uint8_t> stdSource(size);
+	for (size_t i = 0; i < size; i++)
+		source[static_cast<int>(i)] = stdSource[i] = static_cast<uint8_t>(i);
+
+	auto start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		Vector<uint8_t> copy(source);
+		sSink += copy[r % size];
+	}
+	Report("copy 64 KiB buffer", "Vector", start, repetitions);
+
+	start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		std::vector<uint8_t> copy(stdSource);
+		sSink += copy[r % size];
+	}
+	Report("copy 64 KiB buffer", "std::vector", start, repetitions);
+}
+
+template <typename T, typename Make>
+static void Queue(const char *operation, int repetitions, Make make)   // InsertLast + RemoveFirst with 64 queued, like ThreadsafeQueue
+{
+	const int depth = 64;
+
+	Vector<T> queue;
+	std::vector<T> stdQueue;
+	for (int i = 0; i < depth; i++)
+	{
+		queue.InsertLast(make(i));
+		stdQueue.push_back(make(i));
+	}
+
+	auto start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		queue.InsertLast(make(r));
+		queue.RemoveFirst();
+	}
+	sSink += queue.Size();
+	Report(operation, "Vector", start, repetitions);
+
+	start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		stdQueue.push_back(make(r));
+		stdQueue.erase(stdQueue.begin());
+	}
+	sSink += stdQueue.size();
+	Report(operation, "std::vector", start, repetitions);
+}
+
+template <typename T, typename Make>
+static void Grow(const char *operation, int repetitions, Make make)   // InsertLast without Reserve
+{
+	const int elements = 1024;
+
+	auto start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		Vector<T> vector;
+		for (int i = 0; i < elements; i++)
+			vector.InsertLast(make(i));
+		sSink += vector.Size();
+	}
+	Report(operation, "Vector", start, static_cast<double>(repetitions) * elements);
+
+	start = Clock::now();
+	for (int r = 0; r < repetitions; r++)
+	{
+		std::vector<T> vector;
+		for (int i = 0; i < elements; i++)
+			vector.push_back(make(i));
+		sSink += vector.size();
+	}
+	Report(operation, "std::vector", start, static_cast<double>(repetitions) * elements);
+}
+
+int main(int argc, char **argv)
+{
+	int repetitions = argc > 1 ? std::atoi(argv[1]) : 20000;
+
+	auto makeInt = [](int i) { return static_cast<uint32_t>(i); };
+	auto makeString = [](int i) { return std::string(32, static_cast<char>('a' + i % 26)); };   // heap allocated, not trivially copyable
+
+	AppendFields(repetitions);
+	CopyBuffer(repetitions);
+	Grow<uint32_t>("grow uint32_t", repetitions, makeInt);
+	Grow<std::string>("grow std::string", repetitions / 10, makeString);
+	Queue<uint32_t>("queue uint32_t", repetitions * 10, makeInt);
+	Queue<std::string>("queue std::string", repetitions, makeString);
+
+	PRINT("checksum "); PRINTLN(sSink);
+
+	return EXIT_SUCCESS;
+}
@@ -1,38 +1,115 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include "Socket.h"
 #include <string>
 #include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <random>
 #include "ThreadsafeQueue.h"
+#include "Vector.h"
 #include "Message.h"
 #include "Connection.h"
+#include "Rpc.h"
+#include "SocketOptions.h"
+#include "Connector.h"
+#include "Compression.h"
+#include "NetError.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Datagram.h"
+#include "Tls.h"
+#include "Handlers.h"
+#include "Coroutine.h"
 #include "debug.h"
 
+#ifdef COROUTINES_ENABLED
+#include <deque>
+#include <optional>
+#endif
+
+// how Client<T> connects, the defaults are a plain tcp client: set the members that matter and hand it to the constructor;
+// there are no rate limits on this side, they protect a server from its clients (see RateLimit.h)
+struct ClientOptions : ConnectionOptions
+{
+	ConnectOptions mConnect;
+	TlsOptions mTls;
+};
+
 template <typename T>
 class Client
 {
 public:
-	Client();
+	Client(const ClientOptions &options = ClientOptions());
 	~Client();
 
-	void Connect(const std::string &host, uint16_t port);  
+	// returns right away, OnConnect (or OnConnectFailed) is called from the connect thread
+	// with ConnectOptions::mReconnect the connection is reestablished until Disconnect
+	// host "unix:///path" or "shm:///path" (port unused) reaches a server's StartLocal(path) on the same machine
+	// with TlsOptions::mEnabled, tcp connections are encrypted: OnConnect comes before the handshake, messages sent meanwhile
+	// wait for it, and a failed handshake loses the connection (OnError ErrorKind::TLS)
+	void Connect(const std::string &host, uint16_t port);
 	void Disconnect();
-	void Send(const Message<T> &message);
+	bool Send(const Message<T> &message, Priority priority = Priority::NORMAL);   // false if the message was dropped (not connected and not connecting, or the buffer is full)
+	uint32_t SendStream(T type, StreamSource source, Priority priority = Priority::LOW);   // the stream's id, 0 if not connected (streams aren't buffered)
+	bool SendFile(T type, int fd, uint64_t offset, uint32_t size, Priority priority = Priority::NORMAL);   // see Connection<T>::SendFile, false if not connected (not buffered either)
+
+	// messages of an unreliable type go over the datagram channel once the server offered one and acknowledged the
+	// client's hello (see Datagram.h), until then over the connection; set before sending them
+	bool SetUnreliable(T type, bool unreliable = true) { return mUnreliable.Set(static_cast<uint32_t>(type), unreliable); }   // false if the type's value is too large
+	bool HasDatagram() const { return mDatagram.IsReady(); }
+
+	// typed handlers (see Handlers.h): a message of a type with one goes to it instead of OnMessage; set them before Connect.
+	// SetHandler<D> decodes the body into a D first, one that doesn't decode is reported to OnError (ErrorKind::PROTOCOL)
+	using Handler = typename HandlerTable<T>::Handler;
+	bool SetHandler(T type, Handler handler) { return mHandlers.Set(type, std::move(handler)); }   // false if the type's value is out of range
+	template <typename D, typename F>
+	bool SetHandler(T type, F handler) { return mHandlers.template Set<D>(type, std::move(handler)); }   // F: void(D &data)
+	void TimeHandlers(bool enable = true) { mHandlers.SetTimed(enable); }   // the time per message type in GetMetrics, off by default
 
 	bool Available() const { return !mInMessageQueue.Empty(); }
 	void ProcessMessage();
 
+	using RpcCallback = typename PendingCalls<T>::Callback;
+
+	// rpc: the request is tagged with a correlation id, the server answers with Server<T>::Reply
+	// any number of calls can be in flight; callbacks run on the thread calling ProcessMessage/ExpireCalls
+	void Call(const Message<T> &request, RpcCallback callback, std::chrono::milliseconds timeout = std::chrono::milliseconds(sDefaultCallTimeout));
+	std::future<Message<T>> Call(const Message<T> &request, std::chrono::milliseconds timeout = std::chrono::milliseconds(sDefaultCallTimeout));   // throws RpcTimeoutException on timeout
+	void ExpireCalls();   // fails calls past their deadline (all of them once disconnected and not reconnecting), call it from the message loop when idle
+
 	bool IsConnected() const { std::lock_guard<std::mutex> guard(mMutex);  return mConnection != nullptr; }
+	bool IsConnecting() const { return mConnecting; }   // a connect (or reconnect) is in progress
+
+	const ErrorCounters &GetErrorCounters() const { return mErrorCounters; }
+	EndpointMetrics GetMetrics() const;   // totals over its connections so far, queue depth and latencies, the current connection's
+	TraceSnapshot GetTrace() const { return mTracer.Snapshot(); }   // stages of the traced messages it received (FormatTrace writes a timeline)
+	DatagramStats GetDatagramStats() const { return mDatagram.GetStats(); }   // totals over its connections so far
+	TlsInfo GetTlsInfo() const { std::lock_guard<std::mutex> guard(mMutex);  return mConnection ? mConnection->GetTlsInfo() : TlsInfo(); }
+
+#ifdef COROUTINES_ENABLED
+	class ReceiveAwaiter;
+	class ConnectAwaiter;
+
+	ConnectAwaiter AsyncConnect(const std::string &host, uint16_t port);   // connects like Connect (once, no reconnect) on the connect thread, true once connected
+	ReceiveAwaiter AsyncReceive();                                         // next message, std::nullopt once the connection is lost
+	std::suspend_never AsyncSend(const Message<T> &message) { Send(message); return {}; }   // sends are queued, never wait
+
+	void Poll();   // completes a pending connect and dispatches messages to the waiting coroutine (OnMessage if none ever waited)
+#endif
 protected:
 	virtual void OnConnect(const std::string host, uint16_t port) = 0;
 	virtual void OnDisconnect() = 0;
 	virtual void OnConnectionLost() = 0;
-	virtual void OnMessage(Message<T> &message) = 0;
+	virtual void OnMessage(Message<T> &message) {}   // a message of a type without a handler
+	virtual void OnStreamChunk(uint32_t streamId, T type, const uint8_t *data, size_t size) {}   // size 0: the stream ended
+	virtual void OnConnectFailed() {}   // the connect timed out or failed (and reconnect gave up), buffered messages are dropped
+	virtual void OnError(ErrorKind error, int code) {}   // every failed connect attempt and the error a connection was lost to
 
 	uint32_t mId;
 private:
@@ -40,27 +117,194 @@ private:
 	std::condition_variable mCondVar;
 
 	std::unique_ptr<Connection<T>> mConnection;     
+	ConnectionOptions mConnectionOptions;
 	ThreadsafeQueue<OwnedMessage<T>> mInMessageQueue;
 
+	ConnectOptions mConnectOptions;
+	std::shared_ptr<TlsContext> mTls;   // TlsOptions::mEnabled, keeps the session tickets for resumption
+	SocketError mSetupError;        // constructor failure, reported by Connect
+	std::string mServerHost;
+	uint16_t mServerPort = 0U;
+	std::atomic<bool> mConnecting{ false };
+	std::atomic<bool> mStopConnect{ false };
+	std::thread mConnectThread;
+	std::mutex mConnectMutex;
+	std::condition_variable mConnectCondVar;     // wakes the connect thread when the connection is lost or on Disconnect
+	std::mt19937 mRandom{ std::random_device()() };
+
+	struct BufferedMessage
+	{
+		Message<T> mMessage;
+		Priority mPriority;
+	};
+
+	std::mutex mSendMutex;                       // orders buffered messages before the ones sent after the connect
+	Vector<BufferedMessage> mBufferedMessages;   // sent while connecting
+
+	void ConnectThread();
+	void DropBufferedMessages();
+
+	ErrorCounters mErrorCounters;
+	void ReportError(ErrorKind error, int code);
+
+	MetricCounters mClosedCounters;       // of the connections before the current one
+	ErrorCounters mDisconnects;           // connections lost or closed, by their error
+	LatencyHistogram mDispatchLatency;    // from the connection queuing a message to ProcessMessage taking it
+	LatencyHistogram mHandlerLatency;     // time in the callbacks of ProcessMessage
+	HandlerTable<T> mHandlers;            // and by message type
+	Tracer mTracer;                       // traced messages it received
+	void RetireConnection();              // mMutex held
+	void Dispatch(OwnedMessage<T> &message);
+
+	PendingCalls<T> mPendingCalls;
+	static const unsigned sDefaultCallTimeout = 5000U;   // milliseconds
+
+	bool Attach(SOCKET connectionSocket, const sockaddr *serverAddress, std::shared_ptr<ShmChannel> channel);   // false if the connection couldn't be set up
+
+	sockaddr_storage mServerAddress = {};    // the connection's peer, the datagram channel's is the same but for the port
+	DatagramChannel<T> mDatagram{ mInMessageQueue };
+	UnreliableTypes mUnreliable;
+	SocketError OpenDatagram();              // takes the connection's offer, mMutex held
+
+	static const unsigned sLostCheckInterval = 100;   // milliseconds between looks at the connection: it notifies without mMutex, one can be missed
+
 	std::thread mCheckConnectionLostThread;
 	void CheckConnectionLostThread()   
 	{
 		std::unique_lock<std::mutex> lock(mMutex);
-		mCondVar.wait(lock, [&] { return mConnection == nullptr ? true : !mConnection->mIsOpen.load(); }); 
+
+		for (;;)   // a datagram offer arrives on the way
+		{
+			if (!mCondVar.wait_for(lock, std::chrono::milliseconds(static_cast<long>(sLostCheckInterval)), [&] { return mConnection == nullptr ? true : !mConnection->mIsOpen.load() || mConnection->HasDatagramOffer(); }))
+				continue;
+
+			if (!mConnection || !mConnection->mIsOpen)
+				break;
+
+			SocketError error = OpenDatagram();
+			if (error.mKind != ErrorKind::NONE)
+			{
+				lock.unlock();
+				ReportError(error.mKind, error.mCode);
+				lock.lock();
+			}
+		}
 
 		if (mConnection)   // server closed connection (notify from connection) otherwise connection is null and client closed connection (notify from Disconnect or from destructor)
 		{
+			SocketError error = { mConnection->GetError(), mConnection->GetErrorCode() };
+
+			RetireConnection();
 			mConnection.reset();   // destroys the connection (calls Connection<T>::Close()) and sets pointer to null
+			lock.unlock();         // OnConnectionLost may Send
+
+			if (error.mKind != ErrorKind::NONE)
+				ReportError(error.mKind, error.mCode);
+
 			OnConnectionLost();
+
+#ifdef COROUTINES_ENABLED
+			mConnectionLost = true;
+#endif
+
+			{
+				std::lock_guard<std::mutex> guard(mConnectMutex);
+			}
+			mConnectCondVar.notify_one();   // reconnect
 		}
 	}
+
+#ifdef COROUTINES_ENABLED
+	std::deque<Message<T>> mInbox;                   // messages that arrived while no coroutine was waiting (loop thread only)
+	ReceiveAwaiter *mReceiveWaiter = nullptr;
+	bool mAsyncReceive = false;                      // set by the first AsyncReceive: messages no longer go to OnMessage
+	std::atomic<bool> mConnectionLost{ false };
+
+	ConnectAwaiter *mConnectWaiter = nullptr;
+	SOCKET mPendingSocket = INVALID_SOCKET;          // what the connect thread connected, attached by CheckConnect on the loop thread
+	sockaddr_storage mPendingAddress;
+	std::shared_ptr<ShmChannel> mPendingChannel;     // of an shm:// connect, its handshake is already done
+	SocketError mPendingError;
+	std::atomic<bool> mPendingDone{ false };         // set by the connect thread once the above are
+
+	bool StartConnect(const std::string &host, uint16_t port, ConnectAwaiter *waiter);
+	void CheckConnect();
+#endif
 };
 
+#ifdef COROUTINES_ENABLED
+
+template <typename T>
+class Client<T>::ReceiveAwaiter
+{
+	friend class Client<T>;
+public:
+	ReceiveAwaiter(Client &client) : mClient(client) {}
+
+	bool await_ready()
+	{
+		if (!mClient.mInbox.empty())
+		{
+			mMessage.emplace(std::move(mClient.mInbox.front()));
+			mClient.mInbox.pop_front();
+
+			return true;
+		}
+
+		return !mClient.IsConnected() && !mClient.Available();
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		mClient.mReceiveWaiter = this;
+	}
+
+	std::optional<Message<T>> await_resume() { return std::move(mMessage); }
+private:
+	Client &mClient;
+	std::optional<Message<T>> mMessage;
+	std::coroutine_handle<> mHandle;
+};
+
+template <typename T>
+class Client<T>::ConnectAwaiter
+{
+	friend class Client<T>;
+public:
+	ConnectAwaiter(Client &client, const std::string &host, uint16_t port) : mClient(client), mHost(host), mPort(port), mConnected(false) {}
+
+	bool await_ready() { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		return mClient.StartConnect(mHost, mPort, this);   // resumes right away if the connect failed immediately
+	}
+
+	bool await_resume() { return mConnected; }
+private:
+	Client &mClient;
+	std::string mHost;
+	uint16_t mPort;
+	bool mConnected;
+	std::coroutine_handle<> mHandle;
+};
+
+#endif  // COROUTINES_ENABLED
+
 template <typename T>
-Client<T>::Client()
+Client<T>::Client(const ClientOptions &options) : mConnectionOptions(options), mConnectOptions(options.mConnect)
 {
 	WSAData wsa;
 	WSAStartup(MAKEWORD(2, 2), &wsa);
+
+	std::string tlsError;
+	if (options.mTls.mEnabled && !(mTls = TlsContext::Create(options.mTls, false, tlsError)))
+	{
+		DbgPrint("tls: " + tlsError);
+		mSetupError = { ErrorKind::TLS, 0 };
+	}
 }
 
 template <typename T>
@@ -73,44 +317,212 @@ Client<T>::~Client()
 template <typename T>
 void Client<T>::Connect(std::string const &host, uint16_t port)
 {
-	addrinfo hints, *serverAddress;
+	if (mConnecting || mConnectThread.joinable() || IsConnected())
+		Disconnect();
+
+	if (mSetupError.mKind != ErrorKind::NONE)
+	{
+		ReportError(mSetupError.mKind, mSetupError.mCode);
+		OnConnectFailed();
+		return;
+	}
+
+	mServerHost = host;
+	mServerPort = port;
+
+	mStopConnect = false;
+	mConnecting = true;
+	mConnectThread = std::thread(&Client::ConnectThread, this);
+}
+
+template <typename T>
+void Client<T>::ConnectThread()
+{
+	unsigned failedAttempts = 0U;
+
+	while (!mStopConnect)
+	{
+		sockaddr_storage serverAddress;
+		SocketError error;
+		std::shared_ptr<ShmChannel> channel;
+#ifdef __linux__
+		SOCKET connectionSocket = IsSharedMemoryAddress(mServerHost) ? SharedMemoryConnect(mServerHost, channel, serverAddress, error)
+			: IsUnixAddress(mServerHost) ? UnixConnect(mServerHost, serverAddress, error)
+			: HappyEyeballsConnect(mServerHost, mServerPort, mConnectionOptions.mSocket, mConnectOptions, mStopConnect, serverAddress, error);
+#else
+		SOCKET connectionSocket = HappyEyeballsConnect(mServerHost, mServerPort, mConnectionOptions.mSocket, mConnectOptions, mStopConnect, serverAddress, error);
+#endif
+
+		if (connectionSocket != INVALID_SOCKET)
+		{
+			if (mCheckConnectionLostThread.joinable())   // previous connection's
+				mCheckConnectionLostThread.join();
+		}
+
+		if (connectionSocket != INVALID_SOCKET && Attach(connectionSocket, reinterpret_cast<const sockaddr*>(&serverAddress), std::move(channel)))
+		{
+			failedAttempts = 0U;
+
+			if (!mConnectOptions.mReconnect)
+				break;
+
+			std::unique_lock<std::mutex> lock(mConnectMutex);
+			mConnectCondVar.wait(lock, [&] { return mStopConnect || !IsConnected(); });
+
+			continue;   // reconnect right away, back off only if that fails
+		}
+
+		if (mStopConnect)
+			break;
+
+		if (error.mKind != ErrorKind::NONE)
+			ReportError(error.mKind, error.mCode);
+
+		failedAttempts++;
+
+		if (!mConnectOptions.mReconnect || (mConnectOptions.mMaxAttempts != 0U && failedAttempts >= mConnectOptions.mMaxAttempts))
+		{
+			mConnecting = false;
+			DropBufferedMessages();
+			OnConnectFailed();
+
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mConnectMutex);
+		mConnectCondVar.wait_for(lock, ReconnectDelay(mConnectOptions, failedAttempts, mRandom), [&] { return mStopConnect.load(); });
+	}
+
+	mConnecting = false;
+}
+
+template <typename T>
+void Client<T>::ReportError(ErrorKind error, int code)
+{
+	mErrorCounters.Increment(error);
 
-	memset(&hints, 0, sizeof hints);
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	//hints.ai_flags = AI_PASSIVE;
+	DbgPrint(std::string("error: ") + ErrorKindName(error) + " (" + std::to_string(code) + ")");
 
-	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &serverAddress) != 0)
-		Error("cannot get connection address");
+	OnError(error, code);
+}
 
-	SOCKET connectionSocket;
-	if ((connectionSocket = socket(serverAddress->ai_family, serverAddress->ai_socktype, serverAddress->ai_protocol)) == INVALID_SOCKET)
-		Error("cannot create connection socket");
+template <typename T>
+void Client<T>::RetireConnection()
+{
+	mDatagram.Close();
+	mClosedCounters.Add(mConnection->GetCounters());
+	mDisconnects.Increment(mConnection->GetError());
+}
 
-	if (connect(connectionSocket, serverAddress->ai_addr, serverAddress->ai_addrlen) != 0)
-		Error("connection error");
+template <typename T>
+SocketError Client<T>::OpenDatagram()
+{
+	uint16_t port;
+	uint32_t connectionId;
+	uint64_t token;
+	SocketError error;
+
+	if (!mConnection->TakeDatagramOffer(port, connectionId, token) || (mServerAddress.ss_family != AF_INET && mServerAddress.ss_family != AF_INET6))
+		return error;
+
+	mDatagram.Close();   // a previous connection's, if it went without being retired
+	mDatagram.Connect(reinterpret_cast<const sockaddr*>(&mServerAddress), port, connectionId, token, error);
+
+	return error;
+}
 
+template <typename T>
+void Client<T>::DropBufferedMessages()
+{
+	std::lock_guard<std::mutex> guard(mSendMutex);
+	mBufferedMessages.Clear();
+}
+
+template <typename T>
+bool Client<T>::Attach(SOCKET connectionSocket, const sockaddr *serverAddress, std::shared_ptr<ShmChannel> channel)
+{
 	char serverHost[INET6_ADDRSTRLEN];
-	if (serverAddress->ai_family == AF_INET)
-		inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(serverAddress->ai_addr)->sin_addr, serverHost, sizeof serverHost);
-	else  // serverAddress->ai_family == AF_INET6
-		inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(serverAddress->ai_addr)->sin6_addr, serverHost, sizeof serverHost);
+	uint16_t serverPort = 0U;
+
+	bool local = serverAddress->sa_family == AF_UNIX;   // unix:// or shm://: the address as given, no port
+
+	if (local)
+		serverHost[0] = '\0';
+	else if (serverAddress->sa_family == AF_INET)
+		inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(serverAddress)->sin_addr, serverHost, sizeof serverHost);
+	else  // serverAddress->sa_family == AF_INET6
+		inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(serverAddress)->sin6_addr, serverHost, sizeof serverHost);
+
+	if (!local)
+		serverPort = serverAddress->sa_family == AF_INET ? ntohs(reinterpret_cast<const sockaddr_in*>(serverAddress)->sin_port) : ntohs(reinterpret_cast<const sockaddr_in6*>(serverAddress)->sin6_port);
+
+	std::string host = local ? mServerHost : serverHost;
+
+	SocketError error;
+
+	std::unique_ptr<TlsSession> tls;
+	if (mTls && !local && !(tls = mTls->NewSession(connectionSocket, mServerHost)))
+	{
+		closesocket(connectionSocket);
+		ReportError(ErrorKind::TLS, 0);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> sendGuard(mSendMutex);
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		mServerAddress = {};
+		std::memcpy(&mServerAddress, serverAddress, serverAddress->sa_family == AF_INET ? sizeof(sockaddr_in) : serverAddress->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sa_family_t));
+
+		mConnection = std::make_unique<Connection<T>>(Connection<T>::Owner::CLIENT, 0U, host, serverPort, connectionSocket, mInMessageQueue, mCondVar, mConnectionOptions, std::move(channel), std::move(tls));
+
+		if (mConnection->GetError() != ErrorKind::NONE)   // failed to set up, the destructor closes the socket
+		{
+			error = { mConnection->GetError(), mConnection->GetErrorCode() };
+			mConnection.reset();
+		}
+		else
+		{
+			for (const BufferedMessage &buffered : mBufferedMessages)
+				mConnection->Send(buffered.mMessage, buffered.mPriority);
+			mBufferedMessages.Clear();
+		}
+	}
 
-	uint16_t serverPort = serverAddress->ai_family == AF_INET ? ntohs(reinterpret_cast<sockaddr_in*>(serverAddress->ai_addr)->sin_port) : ntohs(reinterpret_cast<sockaddr_in6*>(serverAddress->ai_addr)->sin6_port);
+	if (error.mKind != ErrorKind::NONE)
+	{
+		ReportError(error.mKind, error.mCode);
+		return false;
+	}
 
-	mConnection = std::make_unique<Connection<T>>(Connection<T>::Owner::CLIENT, 0U, serverHost, serverPort, connectionSocket, mInMessageQueue, mCondVar);
 	mCheckConnectionLostThread = std::thread(&Client::CheckConnectionLostThread, this);    // started after connection is created (notify always after wait)
-	OnConnect(mConnection->GetHost(), mConnection->GetPort());
+	OnConnect(host, serverPort);
+
+	return true;
 }
 
 template <typename T>
 void Client<T>::Disconnect()
 {
+	{
+		std::lock_guard<std::mutex> guard(mConnectMutex);
+		mStopConnect = true;
+	}
+	mConnectCondVar.notify_one();
+
+	if (mConnectThread.joinable() && mConnectThread.get_id() != std::this_thread::get_id())   // the connect thread may Disconnect from OnConnect
+		mConnectThread.join();
+
+	mConnecting = false;
+	DropBufferedMessages();
+
 	if (mConnection)  // if a connection pointer is valid Disconnect has been called from client code or destructor, else the CheckConnectionLostThread called it
 	{
 		{
 			std::lock_guard<std::mutex> lock(mMutex);
+			if (mConnection)
+				RetireConnection();
 			mConnection.reset();      // destroys the connection (calls Connection<T>::Close()) and sets pointer to null
 		}
 
@@ -122,10 +534,47 @@ void Client<T>::Disconnect()
 }
 
 template <typename T>
-void Client<T>::Send(const Message<T> &message)
+bool Client<T>::Send(const Message<T> &message, Priority priority)
 {
-	if (mConnection)
-		mConnection->Send(message);
+	if (mUnreliable.Contains(static_cast<uint32_t>(message.GetType())) && mDatagram.Send(message))
+		return true;
+
+	std::lock_guard<std::mutex> sendGuard(mSendMutex);
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		if (mConnection)
+		{
+			mConnection->Send(message, priority);
+			return true;
+		}
+	}
+
+	if (!mConnecting || mBufferedMessages.Size() >= mConnectOptions.mMaxBufferedMessages)
+		return false;
+
+	mBufferedMessages.InsertLast(BufferedMessage{ message, priority });
+
+	return true;
+}
+
+template <typename T>
+uint32_t Client<T>::SendStream(T type, StreamSource source, Priority priority)
+{
+	std::lock_guard<std::mutex> sendGuard(mSendMutex);
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	return mConnection ? mConnection->SendStream(type, std::move(source), priority) : 0U;
+}
+
+template <typename T>
+bool Client<T>::SendFile(T type, int fd, uint64_t offset, uint32_t size, Priority priority)
+{
+	std::lock_guard<std::mutex> sendGuard(mSendMutex);
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	return mConnection && mConnection->SendFile(type, fd, offset, size, priority);
 }
 
 template <typename T>
@@ -134,7 +583,235 @@ void Client<T>::ProcessMessage()
 	OwnedMessage<T> message = mInMessageQueue.Front();
 	mInMessageQueue.DeQueue();
 
-	OnMessage(message);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mDispatchLatency.Record(start - message.GetReceived());
+
+	Dispatch(message);
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	mHandlerLatency.Record(end - start);
+
+	if (mHandlers.IsTimed())
+		mHandlers.Record(message.GetType(), end - start);
+
+	if (const std::shared_ptr<TraceSpan> &trace = message.GetTrace())
+	{
+		trace->mPoints[static_cast<size_t>(TraceStage::HANDLER)] = TraceTime(start);
+		trace->mPoints[TraceSpan::sPointCount - 1] = TraceTime(end);
+		mTracer.Record(*trace);
+	}
+}
+
+template <typename T>
+void Client<T>::Dispatch(OwnedMessage<T> &message)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (mPendingCalls.Due(now))   // a lost connection's calls are failed by ExpireCalls on the idle path
+		mPendingCalls.Expire(now);
+
+	if (message.IsStreamChunk())   // its correlation id is the stream's
+	{
+		OnStreamChunk(message.GetStreamId(), message.GetType(), message.GetBody(), message.GetBodySize());
+
+		std::lock_guard<std::mutex> guard(mMutex);
+		if (mConnection)
+			mConnection->ConsumeStream(message.GetStreamId(), message.GetBodySize());
+
+		return;
+	}
+
+	if (message.GetCorrelationId() != 0U && mPendingCalls.Complete(message.GetCorrelationId(), message))   // response to a call
+		return;
+
+#ifdef COROUTINES_ENABLED
+	if (mAsyncReceive)
+	{
+		if (ReceiveAwaiter *waiter = mReceiveWaiter)
+		{
+			mReceiveWaiter = nullptr;
+
+			waiter->mMessage.emplace(message);
+			waiter->mHandle.resume();
+		}
+		else
+			mInbox.push_back(message);
+
+		return;
+	}
+#endif
+
+	HandlerResult result = mHandlers.Dispatch(message);
+	if (result == HandlerResult::MALFORMED)
+		ReportError(ErrorKind::PROTOCOL, 0);
+	else if (result == HandlerResult::UNHANDLED)
+		OnMessage(message);
+}
+
+template <typename T>
+EndpointMetrics Client<T>::GetMetrics() const
+{
+	EndpointMetrics metrics;
+
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	if (mConnection)
+		metrics.mConnections.InsertLast(mConnection->GetMetrics());
+
+	for (size_t i = 0; i < static_cast<size_t>(Metric::COUNT); i++)
+		metrics.mCounts[i] = mClosedCounters.Get(static_cast<Metric>(i)) + (mConnection ? metrics.mConnections[0].mCounts[i] : 0U);
+
+	for (size_t i = 0; i < static_cast<size_t>(ErrorKind::COUNT); i++)
+		metrics.mDisconnects[i] = mDisconnects.Get(static_cast<ErrorKind>(i));
+
+	metrics.mQueuedIn = mInMessageQueue.Size();
+	metrics.mDispatchLatency = mDispatchLatency.Snapshot();
+	metrics.mHandlerLatency = mHandlerLatency.Snapshot();
+	metrics.mHandlers = mHandlers.Snapshot();
+
+	return metrics;
+}
+
+template <typename T>
+void Client<T>::Call(const Message<T> &request, RpcCallback callback, std::chrono::milliseconds timeout)
+{
+	uint32_t correlationId = IsConnected() || IsConnecting() ? mPendingCalls.Add(std::move(callback), std::chrono::steady_clock::now() + timeout) : 0U;
+
+	if (correlationId == 0U)   // not connected or too many calls in flight
+	{
+		callback(nullptr);
+		return;
+	}
+
+	Message<T> call(request);
+	call.SetCorrelationId(correlationId);
+
+	if (!Send(call))   // dropped while connecting
+		mPendingCalls.Fail(correlationId);
+}
+
+template <typename T>
+std::future<Message<T>> Client<T>::Call(const Message<T> &request, std::chrono::milliseconds timeout)
+{
+	std::shared_ptr<std::promise<Message<T>>> promise = std::make_shared<std::promise<Message<T>>>();
+
+	Call(request, [promise](Message<T> *response)
+	{
+		if (response)
+			promise->set_value(*response);
+		else
+			promise->set_exception(std::make_exception_ptr(RpcTimeoutException()));
+	}, timeout);
+
+	return promise->get_future();
+}
+
+template <typename T>
+void Client<T>::ExpireCalls()
+{
+	if (!IsConnected() && !IsConnecting())
+		mPendingCalls.FailAll();
+	else
+		mPendingCalls.Expire(std::chrono::steady_clock::now());
+}
+
+#ifdef COROUTINES_ENABLED
+
+template <typename T>
+typename Client<T>::ConnectAwaiter Client<T>::AsyncConnect(const std::string &host, uint16_t port)
+{
+	return ConnectAwaiter(*this, host, port);
+}
+
+template <typename T>
+typename Client<T>::ReceiveAwaiter Client<T>::AsyncReceive()
+{
+	mAsyncReceive = true;
+
+	return ReceiveAwaiter(*this);
 }
 
-#endif 
\ No newline at end of file
+template <typename T>
+bool Client<T>::StartConnect(const std::string &host, uint16_t port, ConnectAwaiter *waiter)
+{
+	if (mConnecting || mConnectThread.joinable() || IsConnected())
+		Disconnect();
+
+	if (mSetupError.mKind != ErrorKind::NONE)
+	{
+		ReportError(mSetupError.mKind, mSetupError.mCode);
+		return false;
+	}
+
+	mServerHost = host;
+	mServerPort = port;
+
+	mStopConnect = false;
+	mPendingDone = false;
+	mConnectWaiter = waiter;
+
+	mConnectThread = std::thread([this]   // resolving and racing the addresses block, the loop thread only polls mPendingDone
+	{
+		mPendingError = SocketError();
+#ifdef __linux__
+		mPendingSocket = IsSharedMemoryAddress(mServerHost) ? SharedMemoryConnect(mServerHost, mPendingChannel, mPendingAddress, mPendingError)
+			: IsUnixAddress(mServerHost) ? UnixConnect(mServerHost, mPendingAddress, mPendingError)
+			: HappyEyeballsConnect(mServerHost, mServerPort, mConnectionOptions.mSocket, mConnectOptions, mStopConnect, mPendingAddress, mPendingError);
+#else
+		mPendingSocket = HappyEyeballsConnect(mServerHost, mServerPort, mConnectionOptions.mSocket, mConnectOptions, mStopConnect, mPendingAddress, mPendingError);
+#endif
+		mPendingDone = true;
+	});
+
+	return true;
+}
+
+template <typename T>
+void Client<T>::CheckConnect()
+{
+	if (!mPendingDone)
+		return;
+
+	if (mConnectThread.joinable())   // unless a Disconnect already joined it
+		mConnectThread.join();
+
+	ConnectAwaiter *waiter = mConnectWaiter;
+	mConnectWaiter = nullptr;
+
+	if (mPendingSocket != INVALID_SOCKET && !mStopConnect)
+		waiter->mConnected = Attach(mPendingSocket, reinterpret_cast<const sockaddr*>(&mPendingAddress), std::move(mPendingChannel));
+	else if (mPendingSocket != INVALID_SOCKET)   // Disconnect while connecting
+		closesocket(mPendingSocket);
+	else if (mPendingError.mKind != ErrorKind::NONE)
+		ReportError(mPendingError.mKind, mPendingError.mCode);
+
+	mPendingSocket = INVALID_SOCKET;
+	mPendingChannel = nullptr;
+
+	waiter->mHandle.resume();
+}
+
+template <typename T>
+void Client<T>::Poll()
+{
+	bool connectionLost = mConnectionLost.exchange(false);   // taken before the messages: the connection queues its last messages before it is lost
+
+	if (mConnectWaiter)
+		CheckConnect();
+
+	ExpireCalls();
+
+	while (Available())
+		ProcessMessage();
+
+	if (connectionLost && mReceiveWaiter)
+	{
+		ReceiveAwaiter *waiter = mReceiveWaiter;
+		mReceiveWaiter = nullptr;
+
+		waiter->mHandle.resume();
+	}
+}
+
+#endif  // COROUTINES_ENABLED
+
+#endif
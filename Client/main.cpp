@@ -7,9 +7,32 @@ enum class MyMessages: uint8_t
 	SERVER_ACCEPT, SERVER_REFUSE, TEXT_MSG,
 };
 
+struct TextMessage   // as the server forwards it: the text, the recipient and the sender pushed in that order
+{
+	uint32_t mSenderId = 0U;
+	uint32_t mRecipientId = 0U;
+	std::string mText;
+
+	bool Decode(Message<MyMessages> &message)
+	{
+		if (message.GetBodySize() < 3 * sizeof(uint32_t))
+			return false;
+
+		message >> mSenderId >> mRecipientId >> mText;
+		return true;
+	}
+};
+
 class MyClient : public Client<MyMessages>
 {
 public:
+	MyClient()
+	{
+		SetHandler<uint32_t>(MyMessages::SERVER_ACCEPT, [this](uint32_t &id) { OnAccepted(id); });
+		SetHandler(MyMessages::SERVER_REFUSE, [this](Message<MyMessages> &message) { OnRefused(message); });
+		SetHandler<TextMessage>(MyMessages::TEXT_MSG, [this](TextMessage &text) { OnText(text); });
+	}
+
 	~MyClient()
 	{
 		if (mConsoleThread.joinable())
@@ -34,52 +57,33 @@ public:
 		PRINTLN("lost connection with server");
 	}
 
-	void OnMessage(Message<MyMessages> &message) override
+	void OnAccepted(uint32_t id)
 	{
-		switch (message.GetType())
-		{
-			case MyMessages::SERVER_ACCEPT:
-			{
-				uint32_t id;
-				message >> mId;
+		mId = id;
 
-				Message<MyMessages> cmsg(MyMessages::TEXT_MSG);
-				cmsg << "hello from client ";
-				cmsg << 0U;
-				cmsg << mId;
+		Message<MyMessages> cmsg(MyMessages::TEXT_MSG);
+		cmsg << "hello from client ";
+		cmsg << 0U;
+		cmsg << mId;
 
-				Send(cmsg);
+		Send(cmsg);
 
-				mConsoleThread = std::thread(&MyClient::ConsoleThread, this);
-			}
-			break;
-
-			case MyMessages::SERVER_REFUSE:
-			{
-				std::string reason;
-				message >> reason;
-
-				PRINT("server refused connection: ");  PRINTLN(reason);
-				
-				Disconnect();
-			}
-			break;
-
-			case MyMessages::TEXT_MSG:
-			{
-				uint32_t senderId;
-				message >> senderId;
+		mConsoleThread = std::thread(&MyClient::ConsoleThread, this);
+	}
 
-				uint32_t recipientId;
-				message >> recipientId;
+	void OnRefused(Message<MyMessages> &message)
+	{
+		std::string reason;
+		message >> reason;
 
-				std::string s;
-				message >> s;
+		PRINT("server refused connection: ");  PRINTLN(reason);
+		
+		Disconnect();
+	}
 
-				PRINT("["); PRINT(std::to_string(senderId)); PRINT("] : "); PRINTLN(s);
-			}
-			break;
-		}
+	void OnText(const TextMessage &text)
+	{
+		PRINT("["); PRINT(std::to_string(text.mSenderId)); PRINT("] : "); PRINTLN(text.mText);
 	}
 private:
 	std::thread mConsoleThread;
@@ -126,7 +130,7 @@ int main(int argc, char **argv)
 	MyClient client;
 	client.Connect("localhost", 60005);
 
-	while (client.IsConnected())
+	while (client.IsConnected() || client.IsConnecting())
 	{
 		if (client.Available())
 			client.ProcessMessage();
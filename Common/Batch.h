@@ -0,0 +1,20 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <chrono>
+#include <cstdint>
+
+// packing small messages into batch frames, on the sending side only (every connection unpacks the frames it receives):
+// a message of at most mMaxMessageSize body bytes joins the connection's open batch instead of being queued on its own,
+// the batch is queued as one frame once it holds mMaxBytes or mMaxMessages, or mDelay after its first message
+// (0: as soon as the connection's thread gets to it), so a burst of tiny messages costs one header, queue push and send
+struct BatchOptions
+{
+	bool mEnabled = false;
+	std::chrono::microseconds mDelay{ 200 };   // the latency a lone message may pay
+	uint32_t mMaxBytes = 16U * 1024U;          // batch frame body
+	uint32_t mMaxMessages = 1024U;
+	uint32_t mMaxMessageSize = 512U;           // larger messages go on their own (after the open batch), at most 65535
+};
+
+#endif  // BATCH_H
@@ -0,0 +1,129 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "Vector.h"
+#include "Lz4.h"
+
+// a dictionary both ends load (e.g. samples of typical payloads): every frame may reference it, which is what makes
+// small messages compress; it's immutable and shared by all connections, so a broadcast is still compressed only once
+class CompressionDictionary
+{
+public:
+	static const size_t sMaxSize = sLz4MaxDistance;   // older bytes can't be referenced
+
+	CompressionDictionary(const uint8_t *data, size_t size)
+	{
+		if (size > sMaxSize)   // the end of a dictionary is the part closest to the data
+		{
+			data += size - sMaxSize;
+			size = sMaxSize;
+		}
+
+		mData = Vector<uint8_t>(size);
+		std::memcpy(mData.Data(), data, size);
+
+		mId = 2166136261U;   // FNV-1a, the peers compare ids to know they loaded the same dictionary
+		for (size_t i = 0; i < size; i++)
+			mId = (mId ^ data[i]) * 16777619U;
+		if (mId == 0U)
+			mId = 1U;
+
+		mTable = Vector<uint32_t>(sLz4HashTableSize);
+		Lz4IndexPrefix(mData.Data(), mData.Size(), mTable.Data());
+	}
+
+	const Vector<uint8_t> &GetData() const { return mData; }
+	const Vector<uint32_t> &GetTable() const { return mTable; }   // hash table of the dictionary, copied for every frame
+	uint32_t GetId() const { return mId; }
+private:
+	Vector<uint8_t> mData;
+	Vector<uint32_t> mTable;
+	uint32_t mId;
+};
+
+enum class Codec : uint8_t
+{
+	NONE = 0x00,
+	LZ4 = 0x01,
+};
+
+// per connection compression, negotiated when the connection is established: each side announces the codecs it decodes
+// and its dictionary, a side compresses only bodies of at least mThreshold bytes and only once the peer announced
+struct CompressionOptions
+{
+	bool mEnabled = false;
+	uint32_t mThreshold = 256U;                                     // smaller bodies go raw
+	std::shared_ptr<const CompressionDictionary> mDictionary;       // used for peers that announced the same one
+
+	void SetDictionary(const uint8_t *data, size_t size) { mDictionary = std::make_shared<const CompressionDictionary>(data, size); }
+	uint32_t GetDictionaryId() const { return mDictionary ? mDictionary->GetId() : 0U; }
+};
+
+// compressed body: raw size (4 bytes) followed by an LZ4 block, false (compressed untouched) if it doesn't save anything
+// Buffer is a byte container with Size(), Data() and Resize() (a message body)
+template <typename Buffer>
+bool CompressBody(const Buffer &body, Buffer &compressed, const CompressionDictionary *dictionary)
+{
+	uint32_t rawSize = static_cast<uint32_t>(body.Size());
+
+	thread_local Vector<uint32_t> table(sLz4HashTableSize);
+	thread_local Vector<uint8_t> input;
+	thread_local Vector<uint8_t> output;
+
+	const uint8_t *base = body.Data();
+	size_t prefixSize = 0;
+
+	if (dictionary)   // the compressor wants dictionary and body contiguous
+	{
+		prefixSize = dictionary->GetData().Size();
+
+		input.ResizeDefaultInit(prefixSize + rawSize);
+		std::memcpy(input.Data(), dictionary->GetData().Data(), prefixSize);
+		std::memcpy(input.Data() + prefixSize, body.Data(), rawSize);
+		base = input.Data();
+
+		std::memcpy(table.Data(), dictionary->GetTable().Data(), sLz4HashTableSize * sizeof(uint32_t));
+	}
+	else
+		std::memset(table.Data(), 0, sLz4HashTableSize * sizeof(uint32_t));
+
+	size_t capacity = rawSize - rawSize / 16;   // give up unless it saves at least 1/16
+	if (output.Size() < capacity)
+		output.ResizeDefaultInit(capacity);
+
+	size_t compressedSize = Lz4Compress(base, prefixSize, rawSize, output.Data(), capacity, table.Data());
+	if (compressedSize == 0)
+		return false;
+
+	compressed.Resize(sizeof rawSize + compressedSize);
+	std::memcpy(compressed.Data(), &rawSize, sizeof rawSize);
+	std::memcpy(compressed.Data() + sizeof rawSize, output.Data(), compressedSize);
+
+	return true;
+}
+
+template <typename Buffer>
+bool DecompressBody(const Buffer &compressed, Buffer &body, const CompressionDictionary *dictionary, size_t maxSize)
+{
+	uint32_t rawSize;
+
+	if (compressed.Size() < sizeof rawSize)
+		return false;
+
+	std::memcpy(&rawSize, compressed.Data(), sizeof rawSize);
+
+	if (rawSize > maxSize)   // don't let a peer make us allocate anything it likes
+		return false;
+
+	body.Resize(rawSize);
+
+	const uint8_t *prefix = dictionary ? dictionary->GetData().Data() : nullptr;
+	size_t prefixSize = dictionary ? dictionary->GetData().Size() : 0;
+
+	return Lz4Decompress(compressed.Data() + sizeof rawSize, compressed.Size() - sizeof rawSize, body.Data(), rawSize, prefix, prefixSize);
+}
+
+#endif  // COMPRESSION_H
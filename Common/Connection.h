@@ -2,12 +2,60 @@
 #define CONNECTION_H
 
 #include <memory>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <unordered_map>
 #include "ThreadsafeQueue.h"
 #include "Message.h"
+#include "SocketOptions.h"
+#include "Compression.h"
+#include "Batch.h"
+#include "Stream.h"
+#include "FileBody.h"
+#include "SharedMemory.h"
+#include "NetError.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Tls.h"
+#include "RateLimit.h"
 #include "debug.h"
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include "IoUring.h"
+#endif
+
+enum class IoBackend
+{
+	THREADS,    // one thread per connection polling a non blocking socket
+	IO_URING,   // multishot receive into provided buffers, sends from a registered buffer (Linux 6.0+, falls back to THREADS)
+};
+
+// outbound lanes of a connection: each lane is a FIFO, the lanes share the socket by weighted round robin over frames
+// of at most sFragmentSize body bytes, so a bulk transfer on a lower lane delays a HIGH message by a few frames only
+enum class Priority : uint8_t
+{
+	HIGH,       // control messages, heartbeats
+	NORMAL,
+	LOW,        // bulk transfers
+
+	COUNT
+};
+
+// what a connection is set up with, shared by ServerOptions (its accepted connections) and ClientOptions
+struct ConnectionOptions
+{
+	SocketOptions mSocket;
+	IoBackend mBackend = IoBackend::THREADS;
+	CompressionOptions mCompression;
+	BatchOptions mBatch;
+	TraceOptions mTrace;                   // sampling of the messages it sends
+};
+
 template <typename T>
 class Connection : public std::enable_shared_from_this<Connection<T>>
 {
@@ -16,17 +64,54 @@ public:
 private:
 	using std::enable_shared_from_this<Connection>::shared_from_this;
 public:
-	Connection(Owner owner, uint32_t id, const std::string host, uint16_t port, SOCKET socket, ThreadsafeQueue<OwnedMessage<T>> &inMessageQueue, std::condition_variable &condVar);
+	Connection(Owner owner, uint32_t id, const std::string host, uint16_t port, SOCKET socket, ThreadsafeQueue<OwnedMessage<T>> &inMessageQueue, std::condition_variable &condVar, const ConnectionOptions &options = ConnectionOptions(), std::shared_ptr<ShmChannel> channel = nullptr, std::unique_ptr<TlsSession> tls = nullptr, std::shared_ptr<RateLimiter> rateLimiter = nullptr);
 	~Connection() { Close(); }
 
-	void Send(const Message<T> &message);  
+	void Send(const Message<T> &message, Priority priority = Priority::NORMAL, bool compress = true);   // compress false: the caller found the body not worth compressing
+
+	// streams: chunks are pulled from source on the connection's thread while the peer's credit lasts, after the messages
+	// queued on the lane before the stream opened and alternating with the ones queued after
+	uint32_t SendStream(T type, StreamSource source, Priority priority = Priority::LOW);   // the stream's id, 0 without a source
+	void ConsumeStream(uint32_t streamId, size_t size);   // a chunk was delivered: credits the sender, size 0 (the end) forgets the stream
+
+	// a message whose body is size bytes of the file at offset, queued like any other and delivered as one message;
+	// the bytes are read as its frames go out (Linux, threads backend: sendfile), false if fd can't be duplicated or size is too large
+	bool SendFile(T type, int fd, uint64_t offset, uint32_t size, Priority priority = Priority::NORMAL);
+
+	// compression: a body is compressed once the peer announced the codec, with the dictionary if both loaded the same
+	bool CanCompress(const Message<T> &message) const;
+	bool UsesDictionary() const { return mCompressionOptions.mDictionary && mPeerDictionaryId == mCompressionOptions.GetDictionaryId(); }
+	static bool Compress(const Message<T> &message, Message<T> &compressed, const CompressionOptions &compressionOptions, bool useDictionary);
 	void Close();
 
+	// udp side channel (see Datagram.h): the server offers its port and the token for this connection, the client takes the offer
+	void OfferDatagram(uint16_t port, uint64_t token);
+	bool HasDatagramOffer() const { return mDatagramOffered.load(std::memory_order_acquire); }
+	bool TakeDatagramOffer(uint16_t &port, uint32_t &connectionId, uint64_t &token);   // false if none arrived (since the last take)
+
+	// liveness (see TimerOptions): a ping is answered by the peer's connection, whatever arrives counts
+	void Ping();
+	std::chrono::steady_clock::time_point GetLastReceive() const;   // a connection that stopped reading for a DELAY counts as receiving until it reads again
+	void CloseIdle() { Fail(ErrorKind::IDLE_TIMEOUT, 0); }
+
+	// rate limits (see RateLimit.h) on a message it received: false if it's not to be queued, dropped or the connection
+	// closed for it; a DELAY passes it and the connection reads nothing more until its token is due, or drops it if it
+	// mustn't delay (the datagram channel's thread)
+	bool Admit(T type, bool mayDelay = true);
+
 	std::atomic<bool> mIsOpen;
 
 	std::string const &GetHost() const { return mHost; }
 	uint16_t GetPort() const { return mPort; }
 	uint32_t GetId() const { return mId; }
+	IoBackend GetBackend() const { return mBackend; }
+
+	ErrorKind GetError() const { return mError; }         // why the connection closed, NONE if the other side closed it
+	int GetErrorCode() const { return mErrorCode; }
+
+	const MetricCounters &GetCounters() const { return mCounters; }
+	ConnectionMetrics GetMetrics() const;
+	TlsInfo GetTlsInfo() const { return mTls ? mTls->GetInfo() : TlsInfo(); }   // not encrypted until its handshake completed
 private:
 	std::string mHost;  // other side's endpoint host
 	uint16_t mPort;     // other side's endpoint port
@@ -35,10 +120,46 @@ private:
 	uint32_t mId;
 
 	SOCKET mSocket;  
+	SocketOptions mSocketOptions;
 
 	std::condition_variable &mCondVar;
 
-	ThreadsafeQueue<Message<T>> mOutMessageQueue;
+	static const unsigned sLaneCount = static_cast<unsigned>(Priority::COUNT);
+	static const unsigned sLaneWeights[sLaneCount];   // frames per round
+	static const size_t sFragmentSize = 16 * 1024;
+	static const size_t sMaxReassembledSize = 256U * 1024U * 1024U;
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Outgoing
+	{
+		Message<T> mMessage;
+		std::shared_ptr<FileBody> mFile;      // SendFile: the body, the message only has the header
+		Clock::time_point mQueueTime = Clock::now();
+		bool mTraced = false;                 // sampled, a TRACE control frame goes right before it
+	};
+
+	struct Lane
+	{
+		ThreadsafeQueue<Outgoing> mQueue;
+		Message<T> mMessage;                  // being sent a frame at a time
+		std::shared_ptr<FileBody> mFile;
+		Clock::time_point mQueueTime;         // when Send queued it
+		size_t mOffset = 0;                   // body bytes of it already framed
+		bool mHasMessage = false;
+		unsigned mCredits = 0;                // frames left in this round
+
+		Message<T> mPartial;                  // receiving side: fragments reassembled so far
+		bool mHasPartial = false;
+		std::shared_ptr<TraceSpan> mTrace;    // ... the sender's stamps of the lane's next message, it's traced
+
+		std::atomic<uint64_t> mQueued{ 0U };  // messages queued so far, a stream waits for the ones queued before it
+		uint64_t mDequeued = 0U;
+		size_t mNextStream = 0;               // round robin over the lane's streams
+		bool mStreamTurn = false;             // the next frame is a chunk if a stream is ready
+	};
+
+	Lane mLanes[sLaneCount];
 	ThreadsafeQueue<OwnedMessage<T>> &mInMessageQueue;
 
 	//std::thread mSendThread;
@@ -46,260 +167,2005 @@ private:
 	//void Send_();
 	//void Receive_();
 
+	void ReceiveFrame(Message<T> &frame);              // reassembles fragments
+	void EnQueueIncoming(const Message<T> &message);   // handles control, compressed and batch frames, queues the rest
+	void EnQueueOutgoing(const Message<T> &message, Priority priority, bool compress);
+	void NotifySend();                                 // wakes the io_uring thread after something was queued
+
+	CompressionOptions mCompressionOptions;
+	std::atomic<uint8_t> mPeerCodecs{ 0U };           // announced by the peer's hello
+	std::atomic<uint32_t> mPeerDictionaryId{ 0U };
+	static const uint32_t sMaxDecompressedSize = 256U * 1024U * 1024U;
+
+	BatchOptions mBatchOptions;
+	std::mutex mBatchMutex;                           // Send and the connection's thread both flush
+	Message<T> mBatch;                                // open batch frame
+	uint32_t mBatchCount = 0U;
+	Clock::time_point mBatchDeadline;
+	std::atomic<bool> mBatchOpen{ false };            // lets the connection's thread skip the lock when there's no batch
+
+	bool AddToBatch(const Message<T> &message);      // true if it opened the batch
+	void FlushBatch();                                // queues the open batch, mBatchMutex held
+	void FlushDueBatch();                             // ... if its delay expired
+	void UnpackBatch(const Message<T> &batch, std::shared_ptr<TraceSpan> trace);   // a traced batch's trace goes with its first message
+
+	enum class Control : uint8_t { HELLO, STREAM_CREDIT, TRACE, DATAGRAM, PING, PONG };   // last byte of a control frame's body
+	void OnControl(const Message<T> &message);
+	void SendControl(Control kind);   // one without a payload
+
+	std::atomic<Clock::rep> mLastReceive{ Clock::now().time_since_epoch().count() };   // when the last frame arrived
+
+	std::shared_ptr<RateLimiter> mRateLimiter;   // the server's, null without limits
+	RateLimiter::Buckets mRateBuckets;
+	std::atomic<int64_t> mReceiveResume{ 0 };    // TraceNow of the end of a DELAY, nothing is read before it
+	bool mThrottled = false;                     // ... and it's not over yet, the connection's thread only
+
+	bool Throttled();                            // clears mThrottled once the DELAY is over
+
+	std::atomic<bool> mDatagramOffered{ false };   // receiving side: the offer below arrived, the owner's thread waiting on mCondVar takes it
+	uint16_t mDatagramPort = 0U;
+	uint32_t mDatagramConnectionId = 0U;
+	uint64_t mDatagramToken = 0U;
+
+	TraceOptions mTraceOptions;
+	std::atomic<uint32_t> mTraceSampled{ 0U };  // messages looked at for sampling
+	Message<T> mTraceFrame;                   // TRACE frame being sent
+	std::shared_ptr<TraceSpan> mIncomingTrace;   // of the message ReceiveFrame hands to EnQueueIncoming
+
+	void NextTraceFrame(unsigned laneIndex);
+
+	struct OutStream
+	{
+		uint32_t mId;
+		T mType;
+		unsigned mLane;
+		StreamSource mSource;
+		uint64_t mStartAfter;                 // its lane's mQueued when it opened
+		size_t mCredit;                       // bytes the peer still accepts, the connection's thread only
+	};
+
+	std::mutex mStreamMutex;                  // SendStream, ConsumeStream and the connection's thread
+	Vector<std::shared_ptr<OutStream>> mOutStreams;
+	std::atomic<bool> mHasStreams{ false };   // lets NextFrame skip the lock
+	uint32_t mNextStreamId = 1U;
+	std::unordered_map<uint32_t, uint32_t> mStreamConsumed;   // receiving side: bytes delivered since the last credit
+	Vector<uint8_t> mFrameBuffer;             // chunk being sent, file bytes on their way to the socket without sendfile
+
+	std::shared_ptr<OutStream> ReadyStream(unsigned laneIndex);   // a stream of the lane with credit, null if none
+	void NextStreamFrame(unsigned laneIndex, const std::shared_ptr<OutStream> &stream);
+
+	MetricCounters mCounters;
+	LatencyHistogram mSendLatency;            // from Send to the message's last frame taken for the socket
+
+	std::atomic<ErrorKind> mError{ ErrorKind::NONE };
+	std::atomic<int> mErrorCode{ 0 };
+	void Fail(ErrorKind error, int code);   // records the first error and closes the connection
+
+	IoBackend mBackend;
+
+	typename Message<T>::Header mFrameHeader; // frame being sent (or staged into the io_uring send buffer)
+	const uint8_t *mFrameBody = nullptr;      // points into its lane's message
+	std::shared_ptr<FileBody> mFrameFile;     // ... or the body is read from this file
+	uint64_t mFrameFileOffset = 0U;
+	size_t mFrameBytes = 0;                   // bytes of it already sent, header first
+	bool mHasFrame = false;
+
+	bool NextFrame();                         // picks the lane of the next frame, false if every lane is empty
+
+	Message<T> mInMessage;                    // message being reassembled from received data
+	size_t mInBytes = 0;
+
+	size_t Consume(const uint8_t *data, size_t size);   // bytes framed, less than size if a DELAY stopped it
+
+	static const unsigned sPollTimeout = 10;  // milliseconds a blocked send waits for writability before looking at mIsOpen again
+	static const unsigned sMaxReceivesPerPass = 16;
+	static const unsigned sReceiveBufferSize = 16 * 1024;
+
+	Vector<uint8_t> mReceiveBuffer;           // every receive lands here: frames are at most sFragmentSize, so a body is copied out of it a frame at a time
+	size_t mHeldOffset = 0;                   // what a DELAY left unframed in it, framed before the next receive
+	size_t mHeldSize = 0;
+
 	std::thread mRunThread;
 	void Run();	
+	bool SendPending();                       // false if the socket's send buffer is full
+	bool ReceivePending();                    // false if there was nothing to receive
+	long Transmit(const void *data, size_t size, int flags);   // send, or write into the shared memory channel
+	long Receive(void *data, size_t size);    // recv, or read through the tls session
+
+	std::shared_ptr<ShmChannel> mChannel;     // same-host connection: frames go through it, the socket only tells when the peer is gone
+
+	std::unique_ptr<TlsSession> mTls;         // encrypted connection (see Tls.h)
+	bool Handshake();                         // false if it failed or the connection closed meanwhile
+	bool UserSpaceTls() const { return mTls && !mTls->KernelSend(); }   // frames are encrypted by SSL_write, no sendfile
+
+#ifdef __linux__
+	static const unsigned sRingEntries = 64;
+	static const unsigned sReceiveBufferCount = 64;
+	static const unsigned sSendBufferSize = 64 * 1024;
+	static const unsigned sDrainTimeout = 1000;   // milliseconds a closing connection waits for its cancelled operations
+
+	enum : uint64_t { WAKE_EVENT, RECEIVE_EVENT, SEND_EVENT, CANCEL_EVENT, BUFFERS_EVENT, BATCH_EVENT, DRAIN_EVENT, RESUME_EVENT };   // completion user data
+
+	IoUring mRing;
+	ProvidedBuffers mReceiveBuffers;
+	unsigned mInFlight = 0;                   // submitted operations that will still complete (buffer provides don't, unless they fail)
+
+	int mWakeFd = -1;                         // eventfd signaled by Send and Close
+	uint64_t mWakeValue = 0;
+	std::atomic<bool> mWakePending{ false };
+
+	Vector<uint8_t> mSendBuffer;              // registered fixed buffer, messages are staged back to back
+	size_t mSendBytes = 0;
+	size_t mSendOffset = 0;
+	bool mSending = false;
+
+	__kernel_timespec mBatchTimeout = {};     // the open batch's remaining delay
+	bool mBatchTimerArmed = false;
+
+	struct HeldReceive
+	{
+		uint16_t mBufferId;
+		size_t mOffset;                       // bytes of it already framed
+		size_t mSize;
+	};
+
+	bool mReceiveArmed = false;               // the multishot receive still completes
+	Vector<HeldReceive> mHeldReceives;        // received during a DELAY, framed (and their buffers recycled) once it's over
+	__kernel_timespec mResumeTimeout = {};
+	bool mResumeTimerArmed = false;
+
+	static const unsigned sSpinMicroseconds = 50;   // the shared memory loop yields this long after its last progress before it sleeps
+	void RunSharedMemory();
+	bool ReceiveShared();                     // false if there was nothing to receive
+	bool HasOutgoing();                       // a frame could be sent (ignoring space in the channel)
+
+	bool InitIoUring();
+	void RunIoUring();
+	void Wake();
+	void ArmWake();
+	void ArmReceive();
+	void ArmResumeTimer();
+	void ReceiveHeld();                       // frames the held receives, re-arms the receive once they're all framed
+	void Cancel(uint64_t userData, uint32_t flags);   // completes as CANCEL_EVENT
+	void StartSend();
+	void ArmBatchTimer();
+	void WriteSendBuffer();
+	void OnCompletion(const io_uring_cqe &cqe);
+#endif
 };
 
 template <typename T>
-Connection<T>::Connection(Owner owner, uint32_t id, const std::string host, uint16_t port, SOCKET socket, ThreadsafeQueue<OwnedMessage<T>> &inMessageQueue, std::condition_variable &condVar)
-	: mOwner(owner), mId(id), mHost(host), mPort(port), mSocket(socket), mInMessageQueue(inMessageQueue), mCondVar(condVar)
+Connection<T>::Connection(Owner owner, uint32_t id, const std::string host, uint16_t port, SOCKET socket, ThreadsafeQueue<OwnedMessage<T>> &inMessageQueue, std::condition_variable &condVar, const ConnectionOptions &options, std::shared_ptr<ShmChannel> channel, std::unique_ptr<TlsSession> tls, std::shared_ptr<RateLimiter> rateLimiter)
+	: mOwner(owner), mId(id), mHost(host), mPort(port), mSocket(socket), mSocketOptions(options.mSocket), mInMessageQueue(inMessageQueue), mCondVar(condVar), mCompressionOptions(options.mCompression), mBatchOptions(options.mBatch), mRateLimiter(std::move(rateLimiter)), mTraceOptions(options.mTrace), mChannel(std::move(channel)), mTls(std::move(tls)), mBackend(options.mBackend)
 {
+	mBatchOptions.mMaxMessageSize = std::min(mBatchOptions.mMaxMessageSize, 65535U);   // an entry's size has 16 bits
+	mBatch.mHeader.mFlags = Message<T>::FLAG_BATCH;
+
+	if (mRateLimiter)
+		mRateLimiter->Configure(mRateBuckets);
+
+	if (mChannel)   // a unix socket, the tcp options don't apply; the channel has its own thread loop
+	{
+		mSocketOptions.mQuickAck = false;
+		mBackend = IoBackend::THREADS;
+	}
+	else
+	{
+		mSocketOptions.mQuickAck = mSocketOptions.mQuickAck && IsTcpSocket(socket);   // unix:// connections have no acks to hurry
+		ApplySocketOptions(socket, mSocketOptions);
+	}
+
+	if (mTls)   // the handshake and SSL_read run on the threads backend's loop
+		mBackend = IoBackend::THREADS;
+
 	unsigned long socketMode = 1U;
 	if (ioctlsocket(socket, FIONBIO, &socketMode) != 0)  // set non blocking socket
-		Error("error setting socket i/o mode");
+	{
+		mError = ErrorKind::SOCKET_MODE;   // no thread is started, the owner sees the connection closed
+		mErrorCode = WSAGetLastError();
+		mIsOpen = false;
+
+		return;
+	}
+
+#ifdef __linux__
+	if (mBackend == IoBackend::IO_URING && !InitIoUring())
+#else
+	if (mBackend == IoBackend::IO_URING)
+#endif
+	{
+		DbgPrint("io_uring unavailable, falling back to threads backend");
+		mBackend = IoBackend::THREADS;
+	}
+
+	if (mCompressionOptions.mEnabled)   // hello: the first message on the wire, ahead of whatever the owner sends on connect
+	{
+		Message<T> hello;
+		hello.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+		hello << static_cast<uint8_t>(Codec::LZ4) << mCompressionOptions.GetDictionaryId() << static_cast<uint8_t>(Control::HELLO);
+
+		mLanes[static_cast<unsigned>(Priority::HIGH)].mQueue.EnQueue(Outgoing{ hello, nullptr });
+		mLanes[static_cast<unsigned>(Priority::HIGH)].mQueued++;
+	}
 
 	mIsOpen = true;
 	//mSendThread = std::thread(&Connection<T>::Send_, this);
 	//mReceiveThread = std::thread(&Connection<T>::Receive_, this);
+#ifdef __linux__
+	if (mChannel)
+	{
+		mRunThread = std::thread(&Connection<T>::RunSharedMemory, this);
+		return;
+	}
+
+	if (mBackend == IoBackend::IO_URING)
+	{
+		mRunThread = std::thread(&Connection<T>::RunIoUring, this);
+		return;
+	}
+#endif
 	mRunThread = std::thread(&Connection<T>::Run, this);
 }
 
 template <typename T>
-void Connection<T>::Send(const Message<T> &message)
-{
-	mOutMessageQueue.EnQueue(message);
-}
+const unsigned Connection<T>::sLaneWeights[Connection<T>::sLaneCount] = { 8, 4, 1 };
 
 template <typename T>
-void Connection<T>::Close()
+void Connection<T>::Send(const Message<T> &message, Priority priority, bool compress)
 {
-	if (mIsOpen)
-		mIsOpen = false;
+	if (mBatchOptions.mEnabled && priority == Priority::NORMAL)   // only the NORMAL lane batches
+	{
+		std::lock_guard<std::mutex> guard(mBatchMutex);
 
-	//if (mSendThread.joinable())
-	//	mSendThread.join();
+		if (message.mHeader.mFlags == 0U && message.mBody.Size() <= mBatchOptions.mMaxMessageSize)
+		{
+			bool flushed = false;
 
-	//if (mReceiveThread.joinable())
-	//	mReceiveThread.join();
+			if (mBatchCount > 0U && mBatch.mBody.Size() + sizeof(T) + sizeof(uint16_t) + sizeof(uint32_t) + message.mBody.Size() > mBatchOptions.mMaxBytes)
+			{
+				FlushBatch();   // doesn't fit
+				flushed = true;
+			}
 
-	if (mRunThread.joinable())
-		mRunThread.join();
+			bool opened = AddToBatch(message);
 
-	closesocket(mSocket);
-}
+			if (mBatchCount >= mBatchOptions.mMaxMessages)
+			{
+				FlushBatch();
+				flushed = true;
+			}
 
-//template <typename T>
-//void Connection<T>::Send_()
-//{
-//	while (mIsOpen)
-//	{
-//		// get from outgoing queue and send 
-//		if (!mOutMessageQueue.Empty())
-//		{
-//			Message<T> outMessage = mOutMessageQueue.Front();
-//			mOutMessageQueue.DeQueue();
-//
-//			int sendFlags = 0;
-//			int totalBytesSent = 0;
-//
-//			while (totalBytesSent < sizeof(Message<T>::Header))
-//			{
-//				int bytesSent = send(mSocket, reinterpret_cast<char*>(&outMessage.mHeader) + totalBytesSent, sizeof(Message<T>::Header) - totalBytesSent, sendFlags);
-//				totalBytesSent += bytesSent;
-//
-//				if (bytesSent == SOCKET_ERROR)
-//					Error("error sending message");
-//			}
-//
-//			totalBytesSent = 0;
-//			while (totalBytesSent < outMessage.mBody.Size())
-//			{
-//				int bytesSent = send(mSocket, reinterpret_cast<char*>(outMessage.mBody.Data()) + totalBytesSent, outMessage.mBody.Size() - totalBytesSent, sendFlags);
-//				totalBytesSent += bytesSent;
-//
-//				if (bytesSent == SOCKET_ERROR)
-//					Error("error sending message");
-//			}
-//		}
-//	}
-//}
+			if (flushed || opened)   // otherwise the thread was told when the batch opened, it flushes once the delay expires
+				NotifySend();
 
-//template <typename T>
-//void Connection<T>::Receive_()
-//{
-//	thread_local static bool skip = false;  // used in non blocking mode
-//
-//	while (mIsOpen)
-//	{
-//		skip = false;
-//
-//		Message<T> inMessage;
-//
-//		int recvFlags = 0;
-//		int totalBytesReceived = 0;
-//
-//		while (totalBytesReceived < sizeof(Message<T>::Header))  // receive message header
-//		{
-//			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(&inMessage.mHeader) + totalBytesReceived, sizeof(Message<T>::Header) - totalBytesReceived, recvFlags);
-//
-//			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
-//			{
-//				skip = true;
-//				break;
-//			}
-//
-//			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
-//				//Error("error receiving message");
-//			//else if (bytesReceived == 0)  // other side closed connection
-//			{
-//				mIsOpen = false;
-//				skip = true;
-//				mCondVar.notify_one();
-//
-//				break;
-//			}
-//
-//			totalBytesReceived += bytesReceived;
-//		}
-//
-//		if (skip)
-//			continue;
-//
-//		inMessage.mBody.Resize(inMessage.mHeader.mSize);
-//
-//		totalBytesReceived = 0;
-//		while (totalBytesReceived < inMessage.mBody.Size())  // receive message body
-//		{
-//			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(inMessage.mBody.Data()) + totalBytesReceived, inMessage.mBody.Size() - totalBytesReceived, recvFlags);
-//
-//			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
-//				continue;
-//
-//			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
-//				//Error("error receiving message");
-//			//else if (bytesReceived == 0)  // other side closed connection
-//			{
-//				mIsOpen = false;
-//				skip = true;
-//				mCondVar.notify_one();
-//
-//				break;
-//			}
-//
-//			totalBytesReceived += bytesReceived;
-//		}
-//
-//		if (skip)
-//			continue;
-//
-//		if (mOwner == Owner::SERVER)
-//			mInMessageQueue.EnQueue(OwnedMessage<T>(shared_from_this(), inMessage));  // put received message into incoming queue	
-//		else
-//			mInMessageQueue.EnQueue(OwnedMessage<T>(nullptr, inMessage));
-//	}                                                                      
-//}
+			return;
+		}
+
+		FlushBatch();   // the open batch goes first, messages keep their order
+		EnQueueOutgoing(message, priority, compress);
+	}
+	else
+		EnQueueOutgoing(message, priority, compress);
+
+	NotifySend();
+}
 
 template <typename T>
-void Connection<T>::Run()
+uint32_t Connection<T>::SendStream(T type, StreamSource source, Priority priority)
 {
-	while (mIsOpen)
-	{
-		if (!mOutMessageQueue.Empty())   // while there are outgoing messages in queue send 
-		{
-			Message<T> outMessage = mOutMessageQueue.Front();
-			mOutMessageQueue.DeQueue();
+	if (!source)
+		return 0U;
 
-			int sendFlags = 0;
-			int totalBytesSent = 0;
+	unsigned laneIndex = static_cast<unsigned>(priority);
 
-			while (totalBytesSent < sizeof(Message<T>::Header))
-			{
-				int bytesSent = send(mSocket, reinterpret_cast<char*>(&outMessage.mHeader) + totalBytesSent, sizeof(Message<T>::Header) - totalBytesSent, sendFlags);
-				totalBytesSent += bytesSent;
+	if (mBatchOptions.mEnabled && priority == Priority::NORMAL)   // the open batch goes first
+	{
+		std::lock_guard<std::mutex> guard(mBatchMutex);
+		FlushBatch();
+	}
 
-				if (bytesSent == SOCKET_ERROR)
-					Error("error sending message");
-			}
+	std::shared_ptr<OutStream> stream = std::make_shared<OutStream>();
+	stream->mType = type;
+	stream->mLane = laneIndex;
+	stream->mSource = std::move(source);
+	stream->mStartAfter = mLanes[laneIndex].mQueued;
+	stream->mCredit = sStreamWindow;
 
-			totalBytesSent = 0;
-			while (totalBytesSent < outMessage.mBody.Size())
-			{
-				int bytesSent = send(mSocket, reinterpret_cast<char*>(outMessage.mBody.Data()) + totalBytesSent, outMessage.mBody.Size() - totalBytesSent, sendFlags);
-				totalBytesSent += bytesSent;
+	{
+		std::lock_guard<std::mutex> guard(mStreamMutex);
 
-				if (bytesSent == SOCKET_ERROR)
-					Error("error sending message");
-			}
-		}
+		stream->mId = mNextStreamId++;
+		if (mNextStreamId == 0U)
+			mNextStreamId = 1U;
 
-		thread_local static bool skip = false;  // used in non blocking mode
+		mOutStreams.InsertLast(stream);
+		mHasStreams = true;
+	}
 
-		skip = false;
+	NotifySend();
 
-		Message<T> inMessage;
+	return stream->mId;
+}
 
-		int recvFlags = 0;
-		int totalBytesReceived = 0;
+// credit goes back in batches of half the window, on the HIGH lane so a busy lane doesn't stall its own streams
+template <typename T>
+void Connection<T>::ConsumeStream(uint32_t streamId, size_t size)
+{
+	uint32_t credit;
+	{
+		std::lock_guard<std::mutex> guard(mStreamMutex);
 
-		while (totalBytesReceived < sizeof(Message<T>::Header))  // receive message header
+		if (size == 0)
 		{
-			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(&inMessage.mHeader) + totalBytesReceived, sizeof(Message<T>::Header) - totalBytesReceived, recvFlags);
+			mStreamConsumed.erase(streamId);
+			return;
+		}
 
-			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
-			{
-				skip = true;
-				break;
-			}
+		uint32_t &consumed = mStreamConsumed[streamId];
+		consumed += static_cast<uint32_t>(size);
 
-			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
-				//Error("error receiving message");
-			//else if (bytesReceived == 0)  // other side closed connection
-			{
-				mIsOpen = false;
-				skip = true;
-				mCondVar.notify_one();
+		if (consumed < sStreamWindow / 2)
+			return;
 
-				break;
-			}
+		credit = consumed;
+		consumed = 0U;
+	}
 
-			totalBytesReceived += bytesReceived;
-		}
+	Message<T> message;
+	message.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+	message << streamId << credit << static_cast<uint8_t>(Control::STREAM_CREDIT);
 
-		if (skip)
-			continue;
+	EnQueueOutgoing(message, Priority::HIGH, false);
+	NotifySend();
+}
 
-		inMessage.mBody.Resize(inMessage.mHeader.mSize);
+template <typename T>
+void Connection<T>::OfferDatagram(uint16_t port, uint64_t token)
+{
+	Message<T> message;
+	message.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+	message << mId << token << port << static_cast<uint8_t>(Control::DATAGRAM);
 
-		totalBytesReceived = 0;
-		while (totalBytesReceived < inMessage.mBody.Size())  // receive message body
-		{
-			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(inMessage.mBody.Data()) + totalBytesReceived, inMessage.mBody.Size() - totalBytesReceived, recvFlags);
+	EnQueueOutgoing(message, Priority::HIGH, false);
+	NotifySend();
+}
 
-			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
-				continue;
+template <typename T>
+void Connection<T>::Ping()
+{
+	SendControl(Control::PING);
+}
+
+template <typename T>
+std::chrono::steady_clock::time_point Connection<T>::GetLastReceive() const
+{
+	Clock::time_point received = Clock::time_point(Clock::duration(mLastReceive.load(std::memory_order_relaxed)));
+	Clock::time_point resume = Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(mReceiveResume.load(std::memory_order_relaxed))));
+
+	return std::max(received, resume);
+}
+
+template <typename T>
+bool Connection<T>::Throttled()
+{
+	if (mThrottled && TraceNow() >= mReceiveResume.load(std::memory_order_relaxed))
+		mThrottled = false;
+
+	return mThrottled;
+}
+
+template <typename T>
+bool Connection<T>::Admit(T type, bool mayDelay)
+{
+	if (!mRateLimiter)
+		return true;
+
+	int64_t now = TraceNow();
+	int64_t wait;
+
+	switch (mRateLimiter->Admit(mRateBuckets, static_cast<uint32_t>(type), now, wait, mayDelay))
+	{
+		case RateVerdict::PASS:
+			return true;
+
+		case RateVerdict::DISCONNECT:
+			Fail(ErrorKind::RATE_LIMIT, 0);
+			return false;
+
+		case RateVerdict::DELAY:
+			if (mayDelay)   // its token was taken ahead of time: it goes on, nothing more is read until then (sends and pings go on)
+			{
+				mCounters.Add(Metric::RATE_DELAYED);
+				mReceiveResume.store(std::max(mReceiveResume.load(std::memory_order_relaxed), now + wait), std::memory_order_relaxed);
+				mThrottled = true;
+
+				return true;
+			}
+
+			mCounters.Add(Metric::RATE_DROPPED);   // a datagram isn't waited for
+			return false;
+
+		case RateVerdict::DROP:
+			mCounters.Add(Metric::RATE_DROPPED);
+			return false;
+	}
+
+	return false;
+}
+
+template <typename T>
+void Connection<T>::SendControl(Control kind)
+{
+	Message<T> message;
+	message.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+	message << static_cast<uint8_t>(kind);
+
+	EnQueueOutgoing(message, Priority::HIGH, false);
+	NotifySend();
+}
+
+template <typename T>
+bool Connection<T>::TakeDatagramOffer(uint16_t &port, uint32_t &connectionId, uint64_t &token)
+{
+	if (!mDatagramOffered.exchange(false, std::memory_order_acquire))
+		return false;
+
+	port = mDatagramPort;
+	connectionId = mDatagramConnectionId;
+	token = mDatagramToken;
+
+	return true;
+}
+
+template <typename T>
+bool Connection<T>::SendFile(T type, int fd, uint64_t offset, uint32_t size, Priority priority)
+{
+	if (size > sMaxReassembledSize)   // the receiver would drop the connection, send it as a stream
+		return false;
+
+	std::shared_ptr<FileBody> file = FileBody::Open(fd, offset);
+	if (!file)
+		return false;
+
+	Message<T> message(type);
+	message.mHeader.mSize = size;
+
+	Lane &lane = mLanes[static_cast<unsigned>(priority)];
+
+	if (mBatchOptions.mEnabled && priority == Priority::NORMAL)
+	{
+		std::lock_guard<std::mutex> guard(mBatchMutex);
+
+		FlushBatch();   // the open batch goes first
+		lane.mQueue.EnQueue(Outgoing{ message, std::move(file) });
+		lane.mQueued++;
+	}
+	else
+	{
+		lane.mQueue.EnQueue(Outgoing{ message, std::move(file) });
+		lane.mQueued++;
+	}
+
+	NotifySend();
+
+	return true;
+}
+
+template <typename T>
+void Connection<T>::EnQueueOutgoing(const Message<T> &message, Priority priority, bool compress)
+{
+	Lane &lane = mLanes[static_cast<unsigned>(priority)];
+
+	Outgoing outgoing{ Message<T>(), nullptr };
+
+	if (!(compress && CanCompress(message) && Compress(message, outgoing.mMessage, mCompressionOptions, UsesDictionary())))
+		outgoing.mMessage = message;
+
+	if (mTraceOptions.mSampleEvery > 0U && !(message.mHeader.mFlags & Message<T>::FLAG_CONTROL))
+		outgoing.mTraced = mTraceSampled.fetch_add(1U, std::memory_order_relaxed) % mTraceOptions.mSampleEvery == 0U;
+
+	lane.mQueue.EnQueue(std::move(outgoing));
+	lane.mQueued++;
+}
+
+template <typename T>
+void Connection<T>::NotifySend()
+{
+#ifdef __linux__
+	if (mChannel)
+		mChannel->WakeSelf();
+	else if (mBackend == IoBackend::IO_URING && !mWakePending.exchange(true))   // one wakeup per drain of the queue
+		Wake();
+#endif
+}
+
+// batch frame body: for every message its type, body size (uint16_t), correlation id and body, in order
+template <typename T>
+bool Connection<T>::AddToBatch(const Message<T> &message)
+{
+	bool opened = mBatchCount == 0U;
+
+	if (opened)
+		mBatchDeadline = Clock::now() + mBatchOptions.mDelay;
+
+	uint16_t size = static_cast<uint16_t>(message.mBody.Size());
+
+	size_t offset = mBatch.mBody.Size();
+	mBatch.mBody.Resize(offset + sizeof(T) + sizeof size + sizeof(uint32_t) + size);
+
+	uint8_t *entry = mBatch.mBody.Data() + offset;
+	std::memcpy(entry, &message.mHeader.mType, sizeof(T));
+	std::memcpy(entry + sizeof(T), &size, sizeof size);
+	std::memcpy(entry + sizeof(T) + sizeof size, &message.mHeader.mCorrelationId, sizeof(uint32_t));
+	std::memcpy(entry + sizeof(T) + sizeof size + sizeof(uint32_t), message.mBody.Data(), size);
+
+	mBatch.mHeader.mSize = static_cast<uint32_t>(mBatch.mBody.Size());
+	mBatchCount++;
+	mBatchOpen = true;
+
+	return opened;
+}
+
+template <typename T>
+void Connection<T>::FlushBatch()
+{
+	if (mBatchCount == 0U)
+		return;
+
+	EnQueueOutgoing(mBatch, Priority::NORMAL, true);   // a batch of compressible messages compresses as a whole
+	mCounters.Add(Metric::MESSAGES_OUT, mBatchCount);
+
+	mBatch = Message<T>();
+	mBatch.mHeader.mFlags = Message<T>::FLAG_BATCH;
+	mBatchCount = 0U;
+	mBatchOpen = false;
+}
+
+template <typename T>
+void Connection<T>::FlushDueBatch()
+{
+	std::lock_guard<std::mutex> guard(mBatchMutex);
+
+	if (mBatchCount > 0U && Clock::now() >= mBatchDeadline)
+		FlushBatch();
+}
+
+template <typename T>
+void Connection<T>::UnpackBatch(const Message<T> &batch, std::shared_ptr<TraceSpan> trace)
+{
+	const size_t entryHeaderSize = sizeof(T) + sizeof(uint16_t) + sizeof(uint32_t);
+
+	Vector<OwnedMessage<T>> messages;
+	std::shared_ptr<Connection<T>> sender = mOwner == Owner::SERVER ? shared_from_this() : nullptr;
+
+	const uint8_t *data = batch.mBody.Data();
+	size_t remaining = batch.mBody.Size();
+
+	while (remaining > 0)
+	{
+		T type;
+		uint16_t size;
+		uint32_t correlationId;
+
+		if (remaining < entryHeaderSize)
+		{
+			Fail(ErrorKind::PROTOCOL, 0);
+			return;
+		}
+
+		std::memcpy(&type, data, sizeof type);
+		std::memcpy(&size, data + sizeof type, sizeof size);
+		std::memcpy(&correlationId, data + sizeof type + sizeof size, sizeof correlationId);
+
+		if (remaining - entryHeaderSize < size)
+		{
+			Fail(ErrorKind::PROTOCOL, 0);
+			return;
+		}
+
+		if (!Admit(type))
+		{
+			if (!mIsOpen)
+				return;
+
+			data += entryHeaderSize + size;
+			remaining -= entryHeaderSize + size;
+			continue;
+		}
+
+		Message<T> message(type);
+		message.mHeader.mCorrelationId = correlationId;
+		message.mHeader.mSize = size;
+		message.mBody.Resize(size);
+		std::memcpy(message.mBody.Data(), data + entryHeaderSize, size);
+
+		messages.InsertLast(OwnedMessage<T>(sender, message, std::move(trace)));
+
+		data += entryHeaderSize + size;
+		remaining -= entryHeaderSize + size;
+	}
+
+	mCounters.Add(Metric::MESSAGES_IN, messages.Size());
+	mInMessageQueue.EnQueueAll(messages);   // one lock for the whole batch
+}
+
+template <typename T>
+bool Connection<T>::CanCompress(const Message<T> &message) const
+{
+	return mCompressionOptions.mEnabled && (mPeerCodecs & static_cast<uint8_t>(Codec::LZ4)) && message.mBody.Size() >= mCompressionOptions.mThreshold && !(message.mHeader.mFlags & Message<T>::FLAG_COMPRESSED);
+}
+
+template <typename T>
+bool Connection<T>::Compress(const Message<T> &message, Message<T> &compressed, const CompressionOptions &compressionOptions, bool useDictionary)
+{
+	if (!CompressBody(message.mBody, compressed.mBody, useDictionary ? compressionOptions.mDictionary.get() : nullptr))
+		return false;
+
+	compressed.mHeader = message.mHeader;
+	compressed.mHeader.mFlags |= Message<T>::FLAG_COMPRESSED | (useDictionary ? static_cast<uint8_t>(Message<T>::FLAG_DICTIONARY) : static_cast<uint8_t>(0U));
+	compressed.mHeader.mSize = static_cast<uint32_t>(compressed.mBody.Size());
+
+	return true;
+}
+
+template <typename T>
+void Connection<T>::Fail(ErrorKind error, int code)
+{
+	ErrorKind none = ErrorKind::NONE;
+	if (mError.compare_exchange_strong(none, error))
+		mErrorCode = code;
+
+	mIsOpen = false;
+	mCondVar.notify_one();
+}
+
+template <typename T>
+ConnectionMetrics Connection<T>::GetMetrics() const
+{
+	ConnectionMetrics metrics;
+	metrics.mId = mId;
+	metrics.mHost = mHost;
+	metrics.mPort = mPort;
+
+	for (size_t i = 0; i < static_cast<size_t>(Metric::COUNT); i++)
+		metrics.mCounts[i] = mCounters.Get(static_cast<Metric>(i));
+
+	for (unsigned i = 0; i < sLaneCount; i++)
+		metrics.mQueuedOut += mLanes[i].mQueue.Size();
+
+	metrics.mSendLatency = mSendLatency.Snapshot();
+
+	return metrics;
+}
+
+template <typename T>
+void Connection<T>::Close()
+{
+	if (mIsOpen)
+		mIsOpen = false;
+
+#ifdef __linux__
+	if (mBackend == IoBackend::IO_URING && mWakeFd >= 0)
+		Wake();   // the ring thread is blocked waiting for completions
+#endif
+
+	//if (mSendThread.joinable())
+	//	mSendThread.join();
+
+	//if (mReceiveThread.joinable())
+	//	mReceiveThread.join();
+
+	if (mRunThread.joinable())
+		mRunThread.join();
+
+#ifdef __linux__
+	if (mWakeFd >= 0)
+	{
+		close(mWakeFd);
+		mWakeFd = -1;
+	}
+#endif
+
+	closesocket(mSocket);
+}
+
+//template <typename T>
+//void Connection<T>::Send_()
+//{
+//	while (mIsOpen)
+//	{
+//		// get from outgoing queue and send 
+//		if (!mOutMessageQueue.Empty())
+//		{
+//			Message<T> outMessage = mOutMessageQueue.Front();
+//			mOutMessageQueue.DeQueue();
+//
+//			int sendFlags = 0;
+//			int totalBytesSent = 0;
+//
+//			while (totalBytesSent < sizeof(Message<T>::Header))
+//			{
+//				int bytesSent = send(mSocket, reinterpret_cast<char*>(&outMessage.mHeader) + totalBytesSent, sizeof(Message<T>::Header) - totalBytesSent, sendFlags);
+//				totalBytesSent += bytesSent;
+//
+//				if (bytesSent == SOCKET_ERROR)
+//					Error("error sending message");
+//			}
+//
+//			totalBytesSent = 0;
+//			while (totalBytesSent < outMessage.mBody.Size())
+//			{
+//				int bytesSent = send(mSocket, reinterpret_cast<char*>(outMessage.mBody.Data()) + totalBytesSent, outMessage.mBody.Size() - totalBytesSent, sendFlags);
+//				totalBytesSent += bytesSent;
+//
+//				if (bytesSent == SOCKET_ERROR)
+//					Error("error sending message");
+//			}
+//		}
+//	}
+//}
+
+//template <typename T>
+//void Connection<T>::Receive_()
+//{
+//	thread_local static bool skip = false;  // used in non blocking mode
+//
+//	while (mIsOpen)
+//	{
+//		skip = false;
+//
+//		Message<T> inMessage;
+//
+//		int recvFlags = 0;
+//		int totalBytesReceived = 0;
+//
+//		while (totalBytesReceived < sizeof(Message<T>::Header))  // receive message header
+//		{
+//			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(&inMessage.mHeader) + totalBytesReceived, sizeof(Message<T>::Header) - totalBytesReceived, recvFlags);
+//
+//			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+//			{
+//				skip = true;
+//				break;
+//			}
+//
+//			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
+//				//Error("error receiving message");
+//			//else if (bytesReceived == 0)  // other side closed connection
+//			{
+//				mIsOpen = false;
+//				skip = true;
+//				mCondVar.notify_one();
+//
+//				break;
+//			}
+//
+//			totalBytesReceived += bytesReceived;
+//		}
+//
+//		if (skip)
+//			continue;
+//
+//		inMessage.mBody.Resize(inMessage.mHeader.mSize);
+//
+//		totalBytesReceived = 0;
+//		while (totalBytesReceived < inMessage.mBody.Size())  // receive message body
+//		{
+//			int bytesReceived = recv(mSocket, reinterpret_cast<char*>(inMessage.mBody.Data()) + totalBytesReceived, inMessage.mBody.Size() - totalBytesReceived, recvFlags);
+//
+//			if (bytesReceived == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+//				continue;
+//
+//			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
+//				//Error("error receiving message");
+//			//else if (bytesReceived == 0)  // other side closed connection
+//			{
+//				mIsOpen = false;
+//				skip = true;
+//				mCondVar.notify_one();
+//
+//				break;
+//			}
+//
+//			totalBytesReceived += bytesReceived;
+//		}
+//
+//		if (skip)
+//			continue;
+//
+//		if (mOwner == Owner::SERVER)
+//			mInMessageQueue.EnQueue(OwnedMessage<T>(shared_from_this(), inMessage));  // put received message into incoming queue	
+//		else
+//			mInMessageQueue.EnQueue(OwnedMessage<T>(nullptr, inMessage));
+//	}                                                                      
+//}
+
+template <typename T>
+void Connection<T>::Run()
+{
+	BlockSigPipe();   // sendfile and SSL_write can't be passed MSG_NOSIGNAL
+	mReceiveBuffer = Vector<uint8_t>(sReceiveBufferSize);
+
+	if (mTls && !Handshake())
+		return;
+
+	while (mIsOpen)
+	{
+		if (mBatchOpen)
+			FlushDueBatch();
+
+		bool sendBlocked = !SendPending();
+
+		if (!mIsOpen)
+			break;
+
+		bool received = ReceivePending();
+
+		if (mThrottled && !received && mIsOpen)   // not reading: wait for the DELAY's end (or writability) instead of spinning
+		{
+			int64_t remaining = mReceiveResume.load(std::memory_order_relaxed) - TraceNow();
+			pollfd socketPoll = { mSocket, static_cast<short>(sendBlocked ? POLLOUT : 0), 0 };
+
+			if (remaining > 0)
+				poll(&socketPoll, 1, static_cast<int>(std::min<int64_t>((remaining + 999999) / 1000000, sPollTimeout)));
+		}
+		else if (sendBlocked && !received && mIsOpen)   // nothing to do until the peer reads or sends: wait instead of spinning
+		{
+			pollfd socketPoll = { mSocket, POLLIN | POLLOUT, 0 };
+			poll(&socketPoll, 1, sPollTimeout);
+		}
+	}
+
+	if (mTls)
+		mTls->Shutdown();   // here rather than in Close: the close_notify is a write too, and SIGPIPE is blocked on this thread only
+}
+
+template <typename T>
+bool Connection<T>::SendPending()
+{
+	const size_t headerSize = sizeof(typename Message<T>::Header);
+
+	while (true)
+	{
+		if (!mHasFrame && !NextFrame())
+			return true;
+
+		size_t frameSize = headerSize + mFrameHeader.mSize;
+
+		while (mFrameBytes < frameSize)   // a partial send keeps its remainder for the next pass
+		{
+			long bytesSent;
+			size_t offered = frameSize - mFrameBytes;
+
+			if (mFrameBytes < headerSize)
+			{
+				int flags = 0;
+#ifdef MSG_MORE
+				if (mFrameFile)   // the header waits for the body from sendfile instead of leaving in a segment of its own
+					flags = MSG_MORE;
+#endif
+				offered = headerSize - mFrameBytes;
+				bytesSent = Transmit(reinterpret_cast<const char*>(&mFrameHeader) + mFrameBytes, offered, flags);
+			}
+			else if (mFrameFile)
+			{
+				if (mFrameBuffer.Empty())
+					mFrameBuffer.ResizeDefaultInit(sFragmentSize);
+
+				uint64_t offset = mFrameFileOffset + (mFrameBytes - headerSize);
+
+				if (mChannel || UserSpaceTls())   // read and written into the ring (or SSL_write), re-read after a partial write
+				{
+					bytesSent = mFrameFile->Read(offset, mFrameBuffer.Data(), std::min(offered, mFrameBuffer.Size()));
+					if (bytesSent > 0)
+					{
+						offered = static_cast<size_t>(bytesSent);
+						bytesSent = Transmit(mFrameBuffer.Data(), offered, 0);
+					}
+				}
+				else
+					bytesSent = mFrameFile->Send(mSocket, offset, offered, mFrameBuffer.Data(), mFrameBuffer.Size());
+
+				if (bytesSent == 0)   // the file is shorter than the message announced, its frames can't be completed
+				{
+					Fail(ErrorKind::SEND, EIO);
+					return true;
+				}
+			}
+			else
+				bytesSent = Transmit(reinterpret_cast<const char*>(mFrameBody) + (mFrameBytes - headerSize), offered, 0);
+
+			mCounters.Add(Metric::SEND_CALLS);
+
+			if (bytesSent == SOCKET_ERROR)
+			{
+				if (WSAGetLastError() == WSAEWOULDBLOCK)
+				{
+					mCounters.Add(Metric::SEND_BLOCKED);
+					return false;
+				}
+
+				Fail(ErrorKind::SEND, WSAGetLastError());
+				return true;
+			}
+
+			mCounters.Add(Metric::BYTES_OUT, static_cast<uint64_t>(bytesSent));
+			if (static_cast<size_t>(bytesSent) < offered)
+				mCounters.Add(Metric::PARTIAL_SENDS);
+
+			mFrameBytes += bytesSent;
+		}
+
+		mHasFrame = false;
+	}
+}
+
+template <typename T>
+long Connection<T>::Transmit(const void *data, size_t size, int flags)
+{
+#ifdef __linux__
+	if (mChannel)
+	{
+		size_t written = mChannel->Write(data, size);
+
+		if (written == 0)
+		{
+			errno = mChannel->Corrupt() ? EPROTO : EWOULDBLOCK;
+			return SOCKET_ERROR;
+		}
+
+		return static_cast<long>(written);
+	}
+#endif
+
+	if (UserSpaceTls())
+		return mTls->Write(data, size);
+
+	return send(mSocket, static_cast<const char*>(data), static_cast<int>(size), flags | MSG_NOSIGNAL);
+}
+
+template <typename T>
+long Connection<T>::Receive(void *data, size_t size)
+{
+	if (mTls)
+		return mTls->Read(data, size);
+
+	return recv(mSocket, static_cast<char*>(data), static_cast<int>(size), 0);
+}
+
+// the connection's thread, before anything else goes over the socket: frames queued meanwhile wait for it
+template <typename T>
+bool Connection<T>::Handshake()
+{
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(mTls->GetHandshakeTimeout());
+
+	while (mIsOpen)
+	{
+		TlsStep step = mTls->Handshake();
+
+		if (step == TlsStep::DONE)
+			return true;
+
+		if (step == TlsStep::FAILED || Clock::now() >= deadline)
+		{
+			Fail(ErrorKind::TLS, step == TlsStep::FAILED ? mTls->GetError() : ETIMEDOUT);
+			return false;
+		}
+
+		pollfd socketPoll = { mSocket, static_cast<short>(step == TlsStep::WANT_READ ? POLLIN : POLLOUT), 0 };
+		poll(&socketPoll, 1, sPollTimeout);
+	}
+
+	return false;
+}
+
+template <typename T>
+bool Connection<T>::NextFrame()
+{
+	int next = -1;
+
+	std::shared_ptr<OutStream> stream;
+
+	for (int round = 0; round < 2 && next < 0; round++)   // highest lane with work and credits left, else a new round
+	{
+		bool work = false;
+
+		for (unsigned i = 0; i < sLaneCount && next < 0; i++)
+		{
+			Lane &lane = mLanes[i];
+			std::shared_ptr<OutStream> ready = mHasStreams ? ReadyStream(i) : nullptr;
+
+			if (!lane.mHasMessage && lane.mQueue.Empty() && !ready)
+				continue;
+
+			work = true;
+
+			if (lane.mCredits > 0)
+			{
+				next = static_cast<int>(i);
+				stream = std::move(ready);
+			}
+		}
+
+		if (!work)
+			return false;
+
+		if (next < 0)
+			for (unsigned i = 0; i < sLaneCount; i++)
+				mLanes[i].mCredits = sLaneWeights[i];
+	}
+
+	Lane &lane = mLanes[next];
+	lane.mCredits--;
+
+	// a chunk never goes between the fragments of a message: the receiver appends the lane's next frame to them
+	if (stream && !lane.mHasMessage && (lane.mStreamTurn || lane.mQueue.Empty()))
+	{
+		lane.mStreamTurn = false;
+		NextStreamFrame(static_cast<unsigned>(next), stream);
+
+		return true;
+	}
+
+	lane.mStreamTurn = true;
+
+	if (!lane.mHasMessage)
+	{
+		Outgoing outgoing = lane.mQueue.Front();
+		lane.mQueue.DeQueue();
+		lane.mMessage = std::move(outgoing.mMessage);
+		lane.mFile = std::move(outgoing.mFile);
+		lane.mQueueTime = outgoing.mQueueTime;
+		lane.mDequeued++;
+
+		if (!(lane.mMessage.mHeader.mFlags & (Message<T>::FLAG_CONTROL | Message<T>::FLAG_BATCH)))   // a batch's messages counted when it was flushed
+			mCounters.Add(Metric::MESSAGES_OUT);
+		lane.mOffset = 0;
+		lane.mHasMessage = true;
+
+		if (outgoing.mTraced)   // its first frame follows on the lane, nothing goes between them
+		{
+			NextTraceFrame(static_cast<unsigned>(next));
+			return true;
+		}
+	}
+
+	size_t bodySize = lane.mFile ? lane.mMessage.mHeader.mSize : lane.mMessage.mBody.Size();
+	size_t remaining = bodySize - lane.mOffset;
+	size_t size = remaining < sFragmentSize ? remaining : sFragmentSize;
+
+	mFrameHeader = lane.mMessage.mHeader;   // a fragment repeats the message's header, with its own size
+	mFrameHeader.mSize = static_cast<uint32_t>(size);
+	mFrameHeader.mFlags |= static_cast<uint8_t>(next << Message<T>::FLAG_LANE_SHIFT) | (size < remaining ? static_cast<uint8_t>(Message<T>::FLAG_FRAGMENT) : static_cast<uint8_t>(0U));
+	mFrameBody = lane.mFile ? nullptr : lane.mMessage.mBody.Data() + lane.mOffset;
+	mFrameFile = lane.mFile;
+	mFrameFileOffset = lane.mOffset;
+	mFrameBytes = 0;
+	mHasFrame = true;
+
+	lane.mOffset += size;
+	if (lane.mOffset == bodySize)   // its body stays until the lane dequeues again, after this frame is sent
+	{
+		mSendLatency.Record(Clock::now() - lane.mQueueTime);
+
+		lane.mHasMessage = false;
+		lane.mFile = nullptr;       // the frame holds the file until it's sent
+	}
+
+	return true;
+}
+
+// a TRACE control frame: when the lane's message was queued and when it was taken for the socket, the lane it follows on
+template <typename T>
+void Connection<T>::NextTraceFrame(unsigned laneIndex)
+{
+	mTraceFrame = Message<T>();
+	mTraceFrame << TraceTime(mLanes[laneIndex].mQueueTime) << TraceNow() << static_cast<uint8_t>(laneIndex) << static_cast<uint8_t>(Control::TRACE);
+
+	mFrameHeader = mTraceFrame.mHeader;
+	mFrameHeader.mFlags = static_cast<uint8_t>(Message<T>::FLAG_CONTROL | (laneIndex << Message<T>::FLAG_LANE_SHIFT));
+	mFrameBody = mTraceFrame.mBody.Data();
+	mFrameFile = nullptr;
+	mFrameBytes = 0;
+	mHasFrame = true;
+}
+
+template <typename T>
+std::shared_ptr<typename Connection<T>::OutStream> Connection<T>::ReadyStream(unsigned laneIndex)
+{
+	Lane &lane = mLanes[laneIndex];
+
+	std::lock_guard<std::mutex> guard(mStreamMutex);
+
+	size_t count = mOutStreams.Size();
+
+	for (size_t n = 0; n < count; n++)
+	{
+		size_t index = (lane.mNextStream + n) % count;
+		const std::shared_ptr<OutStream> &stream = mOutStreams[static_cast<int>(index)];
+
+		if (stream->mLane == laneIndex && stream->mCredit > 0 && lane.mDequeued >= stream->mStartAfter)
+		{
+			lane.mNextStream = index + 1;
+			return stream;
+		}
+	}
+
+	return nullptr;
+}
+
+// a chunk frame: the stream's type and id, FLAG_STREAM and at most sFragmentSize bytes (its credit permitting) of the source, 
+// an empty one ends the stream
+template <typename T>
+void Connection<T>::NextStreamFrame(unsigned laneIndex, const std::shared_ptr<OutStream> &stream)
+{
+	if (mFrameBuffer.Empty())
+		mFrameBuffer.ResizeDefaultInit(sFragmentSize);
+
+	size_t capacity = stream->mCredit < sFragmentSize ? stream->mCredit : sFragmentSize;
+	size_t size = stream->mSource(mFrameBuffer.Data(), capacity);   // outside the lock, the source may read a file
+
+	if (size > capacity)
+		size = capacity;
+
+	mFrameHeader = typename Message<T>::Header();
+	mFrameHeader.mType = stream->mType;
+	mFrameHeader.mFlags = static_cast<uint8_t>(Message<T>::FLAG_STREAM | (laneIndex << Message<T>::FLAG_LANE_SHIFT));
+	mFrameHeader.mSize = static_cast<uint32_t>(size);
+	mFrameHeader.mCorrelationId = stream->mId;
+	mFrameBody = mFrameBuffer.Data();
+	mFrameFile = nullptr;
+	mFrameBytes = 0;
+	mHasFrame = true;
+
+	mCounters.Add(Metric::MESSAGES_OUT);
+	stream->mCredit -= size;
+
+	if (size > 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(mStreamMutex);
+
+	for (size_t i = 0; i < mOutStreams.Size(); i++)
+		if (mOutStreams[static_cast<int>(i)] == stream)
+		{
+			mOutStreams.Remove(static_cast<int>(i));
+			break;
+		}
+
+	mHasStreams = !mOutStreams.Empty();
+}
+
+template <typename T>
+bool Connection<T>::ReceivePending()
+{
+	if (mHeldSize > 0)   // what a DELAY stopped in the last receive goes before anything new
+	{
+		if (Throttled())
+			return false;
+
+		size_t framed = Consume(mReceiveBuffer.Data() + mHeldOffset, mHeldSize);
+		mHeldOffset += framed;
+		mHeldSize = mIsOpen ? mHeldSize - framed : 0U;
+
+		if (mHeldSize > 0)
+			return true;
+	}
+
+	for (unsigned i = 0; i < sMaxReceivesPerPass && mIsOpen; i++)
+	{
+		if (Throttled())
+			return i > 0;
+
+		long bytesReceived = Receive(reinterpret_cast<char*>(mReceiveBuffer.Data()), mReceiveBuffer.Size());
+		mCounters.Add(Metric::RECEIVE_CALLS);
+
+		if (bytesReceived == SOCKET_ERROR)
+		{
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				Fail(ErrorKind::RECEIVE, WSAGetLastError());
+
+			return i > 0;
+		}
+
+		if (bytesReceived == 0)  // other side closed connection
+		{
+			mIsOpen = false;
+			mCondVar.notify_one();
+
+			return true;
+		}
+
+		mCounters.Add(Metric::BYTES_IN, static_cast<uint64_t>(bytesReceived));
+
+		size_t framed = Consume(mReceiveBuffer.Data(), bytesReceived);
+
+		if (framed < static_cast<size_t>(bytesReceived) && mIsOpen)
+		{
+			mHeldOffset = framed;
+			mHeldSize = bytesReceived - framed;
+
+			return true;
+		}
+	}
+
+	return true;
+}
+
+template <typename T>
+void Connection<T>::ReceiveFrame(Message<T> &frame)
+{
+	unsigned laneIndex = (frame.mHeader.mFlags & Message<T>::FLAG_LANE_MASK) >> Message<T>::FLAG_LANE_SHIFT;
+	bool more = (frame.mHeader.mFlags & Message<T>::FLAG_FRAGMENT) != 0;
+
+	mLastReceive.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+
+	if (laneIndex >= sLaneCount)
+	{
+		Fail(ErrorKind::PROTOCOL, 0);
+		return;
+	}
+
+	frame.mHeader.mFlags &= ~(Message<T>::FLAG_FRAGMENT | Message<T>::FLAG_LANE_MASK);
+
+	Lane &lane = mLanes[laneIndex];
+
+	if (lane.mHasPartial)   // a lane is a FIFO: its next frame continues the partial message, up to the frame without FLAG_FRAGMENT
+	{
+		size_t size = lane.mPartial.mBody.Size();
+
+		if (size + frame.mBody.Size() > sMaxReassembledSize)
+		{
+			Fail(ErrorKind::PROTOCOL, 0);
+			return;
+		}
+
+		lane.mPartial.mBody.Resize(size + frame.mBody.Size());
+		std::memcpy(lane.mPartial.mBody.Data() + size, frame.mBody.Data(), frame.mBody.Size());
+		lane.mPartial.mHeader.mSize = static_cast<uint32_t>(lane.mPartial.mBody.Size());
+
+		if (more)
+			return;
+
+		lane.mHasPartial = false;
+		if (lane.mTrace)
+		{
+			lane.mTrace->mPoints[static_cast<size_t>(TraceStage::DECODE)] = TraceNow();   // read
+			mIncomingTrace = std::move(lane.mTrace);
+		}
+		EnQueueIncoming(lane.mPartial);
+		lane.mPartial = Message<T>();
+
+		return;
+	}
+
+	if (more)
+	{
+		lane.mPartial = std::move(frame);
+		lane.mHasPartial = true;
+
+		return;
+	}
+
+	if (lane.mTrace && !(frame.mHeader.mFlags & Message<T>::FLAG_CONTROL))
+	{
+		lane.mTrace->mPoints[static_cast<size_t>(TraceStage::DECODE)] = TraceNow();   // read
+		mIncomingTrace = std::move(lane.mTrace);
+	}
+
+	EnQueueIncoming(frame);
+}
+
+template <typename T>
+void Connection<T>::EnQueueIncoming(const Message<T> &message)
+{
+	if (mSocketOptions.mQuickAck)  // the kernel drops back to delayed acks after a while
+		RearmQuickAck(mSocket);
+
+	std::shared_ptr<TraceSpan> trace = std::move(mIncomingTrace);
+
+	if (message.mHeader.mFlags & Message<T>::FLAG_CONTROL)
+	{
+		OnControl(message);
+		return;
+	}
+
+	if (!(message.mHeader.mFlags & (Message<T>::FLAG_BATCH | Message<T>::FLAG_STREAM)) && !Admit(message.mHeader.mType))   // before the work of decompressing it; a batch's messages one by one
+		return;
+
+	const Message<T> *incoming = &message;
+	Message<T> decompressed;
+
+	if (message.mHeader.mFlags & Message<T>::FLAG_COMPRESSED)
+	{
+		const CompressionDictionary *dictionary = mCompressionOptions.mDictionary.get();
+		bool useDictionary = (message.mHeader.mFlags & Message<T>::FLAG_DICTIONARY) != 0;
+
+		if ((useDictionary && !dictionary) || !DecompressBody(message.mBody, decompressed.mBody, useDictionary ? dictionary : nullptr, sMaxDecompressedSize))
+		{
+			Fail(ErrorKind::PROTOCOL, 0);
+			return;
+		}
+
+		decompressed.mHeader = message.mHeader;
+		decompressed.mHeader.mFlags &= ~(Message<T>::FLAG_COMPRESSED | Message<T>::FLAG_DICTIONARY);
+		decompressed.mHeader.mSize = static_cast<uint32_t>(decompressed.mBody.Size());
+
+		incoming = &decompressed;
+	}
+
+	if (trace)
+	{
+		trace->mConnectionId = mId;
+		trace->mType = static_cast<uint32_t>(incoming->mHeader.mType);
+		trace->mPoints[static_cast<size_t>(TraceStage::QUEUED_IN)] = TraceNow();   // queued, the messages of a batch as one
+	}
+
+	if (incoming->mHeader.mFlags & Message<T>::FLAG_BATCH)
+	{
+		UnpackBatch(*incoming, std::move(trace));
+		return;
+	}
+
+	mCounters.Add(Metric::MESSAGES_IN);
+
+	if (mOwner == Owner::SERVER)
+		mInMessageQueue.EnQueue(OwnedMessage<T>(shared_from_this(), *incoming, std::move(trace)));  // put received message into incoming queue	
+	else
+		mInMessageQueue.EnQueue(OwnedMessage<T>(nullptr, *incoming, std::move(trace)));
+}
+
+template <typename T>
+void Connection<T>::OnControl(const Message<T> &message)
+{
+	Message<T> control(message);
+
+	uint8_t kind;
+	if (control.mBody.Empty())
+	{
+		Fail(ErrorKind::PROTOCOL, 0);
+		return;
+	}
+
+	control >> kind;
+
+	switch (static_cast<Control>(kind))
+	{
+		case Control::HELLO:   // the peer's codecs and dictionary
+		{
+			uint32_t dictionaryId = 0U;
+			uint8_t codecs = 0U;
+			if (control.mBody.Size() == sizeof dictionaryId + sizeof codecs)
+				control >> dictionaryId >> codecs;
+
+			mPeerDictionaryId = dictionaryId;
+			mPeerCodecs = codecs;
+			break;
+		}
+
+		case Control::STREAM_CREDIT:   // arrives on the connection's thread, the only one touching mCredit
+		{
+			uint32_t streamId, credit;
+			if (control.mBody.Size() != sizeof streamId + sizeof credit)
+			{
+				Fail(ErrorKind::PROTOCOL, 0);
+				break;
+			}
+
+			control >> credit >> streamId;
+
+			std::lock_guard<std::mutex> guard(mStreamMutex);
 
-			if (bytesReceived == SOCKET_ERROR || bytesReceived == 0)
-				//Error("error receiving message");
-			//else if (bytesReceived == 0)  // other side closed connection
+			for (size_t i = 0; i < mOutStreams.Size(); i++)
+				if (mOutStreams[static_cast<int>(i)]->mId == streamId)
+				{
+					mOutStreams[static_cast<int>(i)]->mCredit += credit;
+					break;
+				}
+			break;   // a stream that already ended is gone
+		}
+
+		case Control::TRACE:   // the lane's next message is traced, the connection's thread is the only one touching mTrace
+		{
+			int64_t queued, written;
+			uint8_t laneIndex;
+			if (control.mBody.Size() != sizeof queued + sizeof written + sizeof laneIndex)
 			{
-				mIsOpen = false;
-				skip = true;
-				mCondVar.notify_one();
+				Fail(ErrorKind::PROTOCOL, 0);
+				break;
+			}
+
+			control >> laneIndex >> written >> queued;
+
+			if (laneIndex >= sLaneCount)
+			{
+				Fail(ErrorKind::PROTOCOL, 0);
+				break;
+			}
+
+			std::shared_ptr<TraceSpan> trace = std::make_shared<TraceSpan>();
+			trace->mPoints[static_cast<size_t>(TraceStage::QUEUED_OUT)] = queued;
+			trace->mPoints[static_cast<size_t>(TraceStage::NETWORK)] = written;
+			mLanes[laneIndex].mTrace = std::move(trace);
+			break;
+		}
+
+		case Control::DATAGRAM:   // the server's udp port and this connection's token, once
+		{
+			uint32_t connectionId;
+			uint64_t token;
+			uint16_t port;
+			if (control.mBody.Size() != sizeof connectionId + sizeof token + sizeof port || mDatagramPort != 0U)
+			{
+				Fail(ErrorKind::PROTOCOL, 0);
+				break;
+			}
+
+			control >> port >> token >> connectionId;
+
+			if (port == 0U)
+			{
+				Fail(ErrorKind::PROTOCOL, 0);
+				break;
+			}
+
+			mDatagramConnectionId = connectionId;
+			mDatagramToken = token;
+			mDatagramPort = port;
+			mDatagramOffered.store(true, std::memory_order_release);
+			mCondVar.notify_one();
+			break;
+		}
+
+		case Control::PING:   // answered on the connection's thread, ahead of the queued messages
+			SendControl(Control::PONG);
+			break;
+
+		case Control::PONG:   // its arrival was the point
+			break;
+
+		default:
+			Fail(ErrorKind::PROTOCOL, 0);
+			break;
+	}
+}
+
+template <typename T>
+size_t Connection<T>::Consume(const uint8_t *data, size_t size)
+{
+	const size_t headerSize = sizeof(typename Message<T>::Header);
+	size_t offered = size;
+
+	while (size > 0 && mIsOpen && !mThrottled)   // the rest of what was read is dropped once a frame failed the connection, and kept after a DELAY
+	{
+		if (mInBytes < headerSize)  // receive message header
+		{
+			size_t count = std::min(headerSize - mInBytes, size);
+			std::memcpy(reinterpret_cast<uint8_t*>(&mInMessage.mHeader) + mInBytes, data, count);
+
+			mInBytes += count;
+			data += count;
+			size -= count;
 
+			if (mInBytes < headerSize)
 				break;
+
+			if (mInMessage.mHeader.mSize > sFragmentSize)   // senders fragment every message, a larger frame only claims a size to make us allocate it
+			{
+				Fail(ErrorKind::PROTOCOL, 0);
+
+				mInMessage = Message<T>();
+				mInBytes = 0;
+
+				return offered - size;
+			}
+
+			mInMessage.mBody.Resize(mInMessage.mHeader.mSize);
+		}
+
+		size_t bodyBytes = mInBytes - headerSize;  // receive message body
+		size_t count = std::min(mInMessage.mHeader.mSize - bodyBytes, size);
+		std::memcpy(mInMessage.mBody.Data() + bodyBytes, data, count);
+
+		mInBytes += count;
+		data += count;
+		size -= count;
+
+		if (mInBytes == headerSize + mInMessage.mHeader.mSize)
+		{
+			ReceiveFrame(mInMessage);
+
+			mInMessage = Message<T>();
+			mInBytes = 0;
+		}
+	}
+
+	return offered - size;
+}
+
+#ifdef __linux__
+
+// a thread per connection like Run, sleeping on the channel's eventfd and the socket when there's nothing to do
+template <typename T>
+void Connection<T>::RunSharedMemory()
+{
+	Clock::time_point lastProgress = Clock::now();
+
+	while (mIsOpen)
+	{
+		if (mBatchOpen)
+			FlushDueBatch();
+
+		bool sendBlocked = !SendPending();
+
+		if (!mIsOpen)
+			break;
+
+		bool received = ReceiveShared();
+
+		if (received || !mIsOpen)
+		{
+			lastProgress = Clock::now();
+			continue;
+		}
+
+		if (Clock::now() - lastProgress < std::chrono::microseconds(static_cast<long>(sSpinMicroseconds)))   // the peer often answers within a few scheduler slices: cheaper than a wakeup
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (mChannel->Corrupt())
+		{
+			Fail(ErrorKind::PROTOCOL, 0);
+			break;
+		}
+
+		mChannel->SetSleep(sendBlocked ? ShmChannel::SLEEP_FOR_SPACE : ShmChannel::SLEEP_FOR_DATA);
+
+		// checked again after saying so: whatever arrives or is queued from now on wakes us
+		bool throttled = Throttled();
+		bool idle = (throttled || !mChannel->CanRead()) && (sendBlocked ? !mChannel->CanWrite() : !HasOutgoing()) && !mBatchOpen;
+		int timeout = static_cast<int>(sPollTimeout);
+
+		if (throttled)   // what's readable waits in the ring for the DELAY's end
+			timeout = static_cast<int>(std::max<int64_t>(std::min<int64_t>((mReceiveResume.load(std::memory_order_relaxed) - TraceNow() + 999999) / 1000000, timeout), 0));
+
+		if (idle && !mChannel->Wait(mSocket, timeout))
+		{
+			ReceiveShared();   // what it wrote before closing
+
+			mIsOpen = false;
+			mCondVar.notify_one();
+		}
+
+		mChannel->SetSleep(ShmChannel::AWAKE);
+	}
+}
+
+template <typename T>
+bool Connection<T>::ReceiveShared()
+{
+	bool received = false;
+
+	for (unsigned i = 0; i < sMaxReceivesPerPass && mIsOpen && !Throttled(); i++)
+	{
+		size_t size;
+		const uint8_t *data = mChannel->Readable(size);
+
+		if (size == 0)
+			break;
+
+		mCounters.Add(Metric::RECEIVE_CALLS);
+
+		size_t framed = Consume(data, size);   // framing straight from the ring, a DELAY leaves the rest in it
+		size_t released = mIsOpen ? framed : size;
+
+		mCounters.Add(Metric::BYTES_IN, released);
+		mChannel->Release(released);
+
+		received = true;
+	}
+
+	return received;
+}
+
+template <typename T>
+bool Connection<T>::HasOutgoing()
+{
+	if (mHasFrame)
+		return true;
+
+	for (unsigned i = 0; i < sLaneCount; i++)
+		if (mLanes[i].mHasMessage || !mLanes[i].mQueue.Empty() || (mHasStreams && ReadyStream(i)))
+			return true;
+
+	return false;
+}
+
+template <typename T>
+bool Connection<T>::InitIoUring()
+{
+	// multishot receive and IORING_ASYNC_CANCEL_ANY can't be probed for, they came with 6.0 and 5.19: SEND_ZC (6.0) stands for them
+	static const uint8_t opcodes[] = { IORING_OP_READ, IORING_OP_RECV, IORING_OP_WRITE_FIXED, IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS, IORING_OP_SEND_ZC };
+
+	if (!mRing.Init(sRingEntries))
+		return false;
+
+	if (!mRing.Supports(opcodes, sizeof opcodes))
+	{
+		mRing.Close();
+		return false;
+	}
+
+	mSendBuffer = Vector<uint8_t>(sSendBufferSize);
+	iovec sendBuffer = { mSendBuffer.Data(), mSendBuffer.Size() };
+
+	if (!mReceiveBuffers.Init(mRing, sReceiveBufferCount, sReceiveBufferSize, 0, BUFFERS_EVENT) || !mRing.RegisterBuffers(&sendBuffer, 1) || (mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	{
+		mReceiveBuffers.Free();
+		mRing.Close();
+		return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+void Connection<T>::Wake()
+{
+	uint64_t value = 1U;
+	if (write(mWakeFd, &value, sizeof value) < 0 && errno != EAGAIN)
+		Fail(ErrorKind::IO_URING, errno);
+}
+
+template <typename T>
+void Connection<T>::RunIoUring()
+{
+	BlockSigPipe();   // the write of the send buffer can't be passed MSG_NOSIGNAL, it raises SIGPIPE on this thread
+	ArmWake();
+	ArmReceive();
+
+	while (mIsOpen)
+	{
+		mWakePending = false;   // cleared before draining: a Send racing with the drain signals again
+
+		if (mBatchOpen && !mBatchTimerArmed)
+			ArmBatchTimer();
+
+		if (!mSending)
+			StartSend();
+
+		if (mRing.Submit(1) < 0)  // submit and wait for at least one completion
+		{
+			Fail(ErrorKind::IO_URING, errno);
+			break;
+		}
+
+		for (io_uring_cqe *cqe = mRing.PeekCqe(); cqe; cqe = mRing.PeekCqe())
+		{
+			io_uring_cqe completion = *cqe;
+			mRing.SeenCqe();
+
+			OnCompletion(completion);
+		}
+	}
+
+	// cancel outstanding operations before the buffers they use are released, for sDrainTimeout at most: a ring
+	// that doesn't drain is closed anyway (the kernel cancels what's left, it only loses the receive buffers)
+	Cancel(0U, IORING_ASYNC_CANCEL_ANY);
+	bool cancelledOneByOne = false;
+
+	const long long drainNanoseconds = sDrainTimeout * 1000000LL;
+	__kernel_timespec drainTimeout = { drainNanoseconds / 1000000000, drainNanoseconds % 1000000000 };
+
+	io_uring_sqe *sqe = mRing.GetSqe();   // wakes the wait below if nothing completes, not counted in mInFlight
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uint64_t>(&drainTimeout);
+	sqe->len = 1;
+	sqe->user_data = DRAIN_EVENT;
+
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(static_cast<long>(sDrainTimeout));
+
+	while (mInFlight > 0 && Clock::now() < deadline && mRing.Submit(1) >= 0)
+		for (io_uring_cqe *cqe = mRing.PeekCqe(); cqe; cqe = mRing.PeekCqe())
+		{
+			io_uring_cqe completion = *cqe;
+			mRing.SeenCqe();
+
+			if (!(completion.flags & IORING_CQE_F_MORE) && completion.user_data != BUFFERS_EVENT && completion.user_data != DRAIN_EVENT)
+				mInFlight--;
+
+			if (completion.user_data == CANCEL_EVENT && completion.res < 0 && completion.res != -ENOENT && completion.res != -EALREADY && !cancelledOneByOne)
+			{
+				for (uint64_t userData : { WAKE_EVENT, RECEIVE_EVENT, SEND_EVENT, BATCH_EVENT, RESUME_EVENT })   // CANCEL_ANY refused: by user data, one of each is in flight at most
+					Cancel(userData, 0U);
+				cancelledOneByOne = true;
 			}
+		}
+
+	if (mInFlight > 0)
+		DbgPrint("io_uring operations didn't drain, closing the ring with them");
+}
+
+template <typename T>
+void Connection<T>::Cancel(uint64_t userData, uint32_t flags)
+{
+	io_uring_sqe *sqe = mRing.GetSqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = userData;
+	sqe->cancel_flags = flags;
+	sqe->user_data = CANCEL_EVENT;
+	mInFlight++;
+}
+
+template <typename T>
+void Connection<T>::ArmWake()
+{
+	io_uring_sqe *sqe = mRing.GetSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = mWakeFd;
+	sqe->addr = reinterpret_cast<uint64_t>(&mWakeValue);
+	sqe->len = sizeof mWakeValue;
+	sqe->user_data = WAKE_EVENT;
+	mInFlight++;
+}
+
+template <typename T>
+void Connection<T>::ArmReceive()
+{
+	io_uring_sqe *sqe = mRing.GetSqe();   // one multishot receive keeps completing until the buffers run out
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = mSocket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = mReceiveBuffers.GetGroupId();
+	sqe->user_data = RECEIVE_EVENT;
+	mInFlight++;
 
-			totalBytesReceived += bytesReceived;
+	mReceiveArmed = true;
+}
+
+template <typename T>
+void Connection<T>::ArmResumeTimer()
+{
+	long long nanoseconds = std::max<int64_t>(mReceiveResume.load(std::memory_order_relaxed) - TraceNow(), 0);
+	mResumeTimeout.tv_sec = nanoseconds / 1000000000;
+	mResumeTimeout.tv_nsec = nanoseconds % 1000000000;
+
+	io_uring_sqe *sqe = mRing.GetSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uint64_t>(&mResumeTimeout);
+	sqe->len = 1;
+	sqe->user_data = RESUME_EVENT;
+	mInFlight++;
+
+	mResumeTimerArmed = true;
+}
+
+template <typename T>
+void Connection<T>::ReceiveHeld()
+{
+	while (!mHeldReceives.Empty() && mIsOpen)
+	{
+		if (Throttled())   // another DELAY in what was held
+		{
+			ArmResumeTimer();
+			return;
 		}
 
-		if (skip)
+		HeldReceive &held = mHeldReceives[0];
+		held.mOffset += Consume(mReceiveBuffers.Buffer(held.mBufferId) + held.mOffset, held.mSize - held.mOffset);
+
+		if (held.mOffset < held.mSize && mIsOpen)
 			continue;
 
-		if (mOwner == Owner::SERVER)
-			mInMessageQueue.EnQueue(OwnedMessage<T>(shared_from_this(), inMessage));  // put received message into incoming queue	
-		else
-			mInMessageQueue.EnQueue(OwnedMessage<T>(nullptr, inMessage));
+		mReceiveBuffers.Recycle(held.mBufferId);
+		mHeldReceives.RemoveFirst();
+	}
+
+	if (!mReceiveArmed && mIsOpen)
+		ArmReceive();
+}
+
+template <typename T>
+void Connection<T>::StartSend()
+{
+	const size_t headerSize = sizeof(typename Message<T>::Header);
+
+	mSendBytes = 0;
+	mSendOffset = 0;
+
+	while (mSendBytes < mSendBuffer.Size())   // stage as many frames as fit, a frame may span several writes
+	{
+		if (!mHasFrame && !NextFrame())
+			break;
+
+		size_t frameSize = headerSize + mFrameHeader.mSize;
+
+		while (mFrameBytes < frameSize && mSendBytes < mSendBuffer.Size())
+		{
+			size_t space = mSendBuffer.Size() - mSendBytes;
+			size_t count;
+
+			if (mFrameBytes < headerSize)
+			{
+				count = std::min(headerSize - mFrameBytes, space);
+				std::memcpy(mSendBuffer.Data() + mSendBytes, reinterpret_cast<const uint8_t*>(&mFrameHeader) + mFrameBytes, count);
+			}
+			else if (mFrameFile)   // read straight into the registered buffer, that's the one copy a staged send makes anyway
+			{
+				long bytesRead = mFrameFile->Read(mFrameFileOffset + (mFrameBytes - headerSize), mSendBuffer.Data() + mSendBytes, std::min(frameSize - mFrameBytes, space));
+
+				if (bytesRead <= 0)   // the file is shorter than the message announced (0) or can't be read
+				{
+					Fail(ErrorKind::SEND, bytesRead < 0 ? errno : EIO);
+					return;
+				}
+
+				count = static_cast<size_t>(bytesRead);
+			}
+			else
+			{
+				count = std::min(frameSize - mFrameBytes, space);
+				std::memcpy(mSendBuffer.Data() + mSendBytes, mFrameBody + (mFrameBytes - headerSize), count);
+			}
+
+			mFrameBytes += count;
+			mSendBytes += count;
+		}
+
+		if (mFrameBytes == frameSize)
+			mHasFrame = false;
+	}
+
+	if (mSendBytes > 0)
+		WriteSendBuffer();
+}
+
+template <typename T>
+void Connection<T>::ArmBatchTimer()
+{
+	Clock::duration remaining;
+	{
+		std::lock_guard<std::mutex> guard(mBatchMutex);
+
+		if (mBatchCount == 0U)
+			return;
+
+		remaining = mBatchDeadline - Clock::now();
+
+		if (remaining <= Clock::duration::zero())
+		{
+			FlushBatch();
+			return;
+		}
+	}
+
+	long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+	mBatchTimeout.tv_sec = nanoseconds / 1000000000;
+	mBatchTimeout.tv_nsec = nanoseconds % 1000000000;
+
+	io_uring_sqe *sqe = mRing.GetSqe();
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uint64_t>(&mBatchTimeout);
+	sqe->len = 1;
+	sqe->user_data = BATCH_EVENT;
+	mInFlight++;
+
+	mBatchTimerArmed = true;
+}
+
+template <typename T>
+void Connection<T>::WriteSendBuffer()
+{
+	io_uring_sqe *sqe = mRing.GetSqe();
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = mSocket;
+	sqe->addr = reinterpret_cast<uint64_t>(mSendBuffer.Data() + mSendOffset);
+	sqe->len = static_cast<uint32_t>(mSendBytes - mSendOffset);
+	sqe->buf_index = 0;
+	sqe->user_data = SEND_EVENT;
+	mInFlight++;
+
+	mSending = true;
+	mCounters.Add(Metric::SEND_CALLS);
+}
+
+template <typename T>
+void Connection<T>::OnCompletion(const io_uring_cqe &cqe)
+{
+	if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.user_data != BUFFERS_EVENT)  // last completion of this operation
+		mInFlight--;
+
+	switch (cqe.user_data)
+	{
+		case WAKE_EVENT:
+			if (mIsOpen)
+				ArmWake();
+			break;
+
+		case RECEIVE_EVENT:
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+				mReceiveArmed = false;
+
+			if (cqe.res > 0)
+			{
+				uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+				mCounters.Add(Metric::RECEIVE_CALLS);
+				mCounters.Add(Metric::BYTES_IN, static_cast<uint64_t>(cqe.res));
+
+				size_t framed = mHeldReceives.Empty() && !Throttled() ? Consume(mReceiveBuffers.Buffer(bufferId), cqe.res) : 0U;
+
+				if (framed == static_cast<size_t>(cqe.res) || !mIsOpen)
+					mReceiveBuffers.Recycle(bufferId);
+				else   // a DELAY: kept with its buffer, the receive ends once the buffers run out
+				{
+					mHeldReceives.InsertLast(HeldReceive{ bufferId, framed, static_cast<size_t>(cqe.res) });
+
+					if (!mResumeTimerArmed)
+						ArmResumeTimer();
+				}
+			}
+			else if (cqe.res == 0)  // other side closed connection
+			{
+				mIsOpen = false;
+				mCondVar.notify_one();
+
+				break;
+			}
+			else if (cqe.res != -ENOBUFS)
+			{
+				Fail(ErrorKind::RECEIVE, -cqe.res);
+				break;
+			}
+
+			if (!mReceiveArmed && mHeldReceives.Empty() && mIsOpen)   // multishot receive terminated (e.g. out of buffers)
+				ArmReceive();
+			break;
+
+		case SEND_EVENT:
+			mSending = false;
+
+			if (cqe.res < 0)
+			{
+				Fail(ErrorKind::SEND, -cqe.res);
+				break;
+			}
+
+			mSendOffset += cqe.res;
+			mCounters.Add(Metric::BYTES_OUT, static_cast<uint64_t>(cqe.res));
+
+			if (mSendOffset < mSendBytes)   // partial write
+			{
+				mCounters.Add(Metric::PARTIAL_SENDS);
+				WriteSendBuffer();
+			}
+			break;
+
+		case BUFFERS_EVENT:
+			Fail(ErrorKind::IO_URING, -cqe.res);
+			break;
+
+		case BATCH_EVENT:   // the loop sends what was flushed and arms the timer again for a newer batch
+			mBatchTimerArmed = false;
+			FlushDueBatch();
+			break;
+
+		case RESUME_EVENT:
+			mResumeTimerArmed = false;
+
+			if (mIsOpen)
+				ReceiveHeld();
+			break;
 	}
 }
 
+#endif  // __linux__
+
 #endif  // CONNECTION_H
\ No newline at end of file
@@ -0,0 +1,197 @@
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+#include "Socket.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "SocketOptions.h"
+#include "NetError.h"
+
+// how Client<T> connects: timeout and Happy Eyeballs (RFC 8305) pacing of the attempts,
+// reconnect with jittered exponential backoff and the messages kept while disconnected
+struct ConnectOptions
+{
+	std::chrono::milliseconds mTimeout{ 5000 };            // for one connect, across all of the host's addresses
+	std::chrono::milliseconds mAttemptDelay{ 250 };        // the next address is tried when the previous one hasn't connected by then (or failed)
+
+	bool mReconnect = false;                               // connect again when the connection is lost or the connect failed
+	std::chrono::milliseconds mInitialBackoff{ 100 };      // the first reconnect is immediate, failures then back off up to mMaxBackoff
+	std::chrono::milliseconds mMaxBackoff{ 10000 };
+	unsigned mMaxAttempts = 0U;                            // consecutive failed connects before giving up, 0 never gives up
+
+	size_t mMaxBufferedMessages = 1024U;                   // messages sent while connecting are kept and sent once connected
+};
+
+// delay before the next connect after failedAttempts consecutive failures: uniformly drawn from
+// [0, min(mMaxBackoff, mInitialBackoff * 2^(failedAttempts - 1))] ("full jitter"), so clients dropped
+// together by a server restart don't reconnect in lockstep
+inline std::chrono::milliseconds ReconnectDelay(const ConnectOptions &options, unsigned failedAttempts, std::mt19937 &random)
+{
+	if (failedAttempts == 0U)
+		return std::chrono::milliseconds(0);
+
+	long long ceiling = options.mInitialBackoff.count() << std::min(failedAttempts - 1U, 20U);
+	ceiling = std::min(ceiling, static_cast<long long>(options.mMaxBackoff.count()));
+
+	return std::chrono::milliseconds(std::uniform_int_distribution<long long>(0, ceiling)(random));
+}
+
+// resolves host and races non blocking connects to its addresses, alternating address families and starting
+// a new attempt every mAttemptDelay (or as soon as one fails); the first connected socket wins, the others are closed
+// returns INVALID_SOCKET if every address failed (error is set), the timeout expired (CONNECT_TIMEOUT) or cancel was set (NONE)
+inline SOCKET HappyEyeballsConnect(const std::string &host, uint16_t port, const SocketOptions &socketOptions, const ConnectOptions &connectOptions, const std::atomic<bool> &cancel, sockaddr_storage &connectedAddress, SocketError &error)
+{
+	using Clock = std::chrono::steady_clock;
+
+	addrinfo hints, *serverAddresses;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	error = SocketError();
+
+	int result = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &serverAddresses);
+	if (result != 0)
+	{
+		error = { ErrorKind::RESOLVE, result };
+		return INVALID_SOCKET;
+	}
+
+	std::vector<const addrinfo*> preferred, other;   // resolver's preferred family first, then alternate
+	for (const addrinfo *address = serverAddresses; address; address = address->ai_next)
+		(address->ai_family == serverAddresses->ai_family ? preferred : other).push_back(address);
+
+	std::vector<const addrinfo*> addresses;
+	for (size_t i = 0; i < preferred.size() || i < other.size(); i++)
+	{
+		if (i < preferred.size())
+			addresses.push_back(preferred[i]);
+		if (i < other.size())
+			addresses.push_back(other[i]);
+	}
+
+	struct Attempt
+	{
+		SOCKET mSocket;
+		const addrinfo *mAddress;
+	};
+
+	std::vector<Attempt> attempts;
+	size_t nextAddress = 0U;
+	SOCKET connectedSocket = INVALID_SOCKET;
+
+	Clock::time_point now = Clock::now();
+	Clock::time_point deadline = now + connectOptions.mTimeout;
+	Clock::time_point nextAttemptTime = now;
+
+	while (connectedSocket == INVALID_SOCKET && !cancel && now < deadline)
+	{
+		if (nextAddress < addresses.size() && now >= nextAttemptTime)
+		{
+			const addrinfo *address = addresses[nextAddress++];
+			nextAttemptTime = now + connectOptions.mAttemptDelay;
+
+			SOCKET connectionSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (connectionSocket == INVALID_SOCKET)
+			{
+				error = { ErrorKind::SOCKET, WSAGetLastError() };
+				nextAttemptTime = now;
+				continue;
+			}
+
+			ApplySocketOptions(connectionSocket, socketOptions);   // before connect so buffer sizes affect the window scale
+
+			unsigned long socketMode = 1U;
+			ioctlsocket(connectionSocket, FIONBIO, &socketMode);
+
+			if (connect(connectionSocket, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0)
+			{
+				connectedSocket = connectionSocket;
+				memcpy(&connectedAddress, address->ai_addr, address->ai_addrlen);
+			}
+			else if (WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEINPROGRESS)
+				attempts.push_back({ connectionSocket, address });
+			else
+			{
+				error = { ErrorKind::CONNECT, WSAGetLastError() };
+				closesocket(connectionSocket);
+				nextAttemptTime = now;
+			}
+
+			continue;
+		}
+
+		if (attempts.empty())
+		{
+			if (nextAddress == addresses.size())   // every address failed
+				break;
+
+			now = Clock::now();
+			continue;
+		}
+
+		std::vector<pollfd> pollSockets;   // a failed connect is reported as writable or as an error, depending on the system
+		for (const Attempt &attempt : attempts)
+			pollSockets.push_back({ attempt.mSocket, POLLOUT, 0 });
+
+		Clock::time_point wakeTime = std::min(deadline, now + std::chrono::milliseconds(50));   // wakes up now and then to see cancel
+		if (nextAddress < addresses.size())
+			wakeTime = std::min(wakeTime, nextAttemptTime);
+
+		long long wait = std::max(0LL, static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(wakeTime - now).count()));
+
+		int ready = poll(pollSockets.data(), static_cast<unsigned long>(pollSockets.size()), static_cast<int>((wait + 999) / 1000));   // rounded up: no spinning on a sub-millisecond wait
+		now = Clock::now();
+
+		if (ready <= 0)
+			continue;
+
+		size_t index = 0;
+		for (auto attempt = attempts.begin(); attempt != attempts.end(); index++)   // pollSockets is in the order of attempts
+		{
+			if ((pollSockets[index].revents & (POLLOUT | POLLERR | POLLHUP)) == 0)
+			{
+				++attempt;
+				continue;
+			}
+
+			int connectError = 0;
+			socklen_t errorLength = sizeof connectError;
+			getsockopt(attempt->mSocket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&connectError), &errorLength);
+
+			if (connectError == 0 && connectedSocket == INVALID_SOCKET)
+			{
+				connectedSocket = attempt->mSocket;
+				memcpy(&connectedAddress, attempt->mAddress->ai_addr, attempt->mAddress->ai_addrlen);
+			}
+			else
+			{
+				error = { ErrorKind::CONNECT, connectError };
+				closesocket(attempt->mSocket);
+				nextAttemptTime = now;   // don't wait for the attempt delay once an address failed
+			}
+
+			attempt = attempts.erase(attempt);
+		}
+	}
+
+	for (const Attempt &attempt : attempts)   // attempts still in progress lost the race
+		closesocket(attempt.mSocket);
+
+	if (connectedSocket != INVALID_SOCKET || cancel)
+		error = SocketError();
+	else if (now >= deadline)
+		error = { ErrorKind::CONNECT_TIMEOUT, 0 };
+
+	freeaddrinfo(serverAddresses);
+
+	return connectedSocket;
+}
+
+#endif  // CONNECTOR_H
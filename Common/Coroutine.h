@@ -0,0 +1,30 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+// coroutine support for the Async* apis of Server<T> and Client<T> (C++20, compiled out otherwise)
+// coroutines are resumed by Server<T>::Poll / Client<T>::Poll on the thread running the message loop,
+// a suspended coroutine costs its frame and nothing else (no thread, no polling)
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+
+#define COROUTINES_ENABLED
+
+// fire-and-forget coroutine: starts running when called and frees its frame when it returns
+struct Task
+{
+	struct promise_type
+	{
+		Task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+#endif  // __cpp_impl_coroutine
+
+#endif  // COROUTINE_H
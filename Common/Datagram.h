@@ -0,0 +1,687 @@
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "Socket.h"
+#include "NetError.h"
+#include "Message.h"
+#include "ThreadsafeQueue.h"
+#include "Vector.h"
+#include "debug.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// udp side channel of the tcp connections, for messages that are better lost than late (positions, input, telemetry):
+// Server<T>::StartDatagram opens it, and every tcp connection accepted from then on gets a control frame with the udp port
+// and a random token. The client sends the token back in a hello datagram from its own udp socket until the server
+// acknowledges it, the server then knows the client's address as that connection's. From there on the message types
+// marked with SetUnreliable (both sides) go as one datagram each, the same header and body as on the stream, and are
+// delivered through the same queue with the connection as sender; they may be lost, duplicated or reordered, also relative
+// to the connection's messages. Until the hello is acknowledged, and for messages too large for a datagram, they take the
+// connection. Sends are queued and written by the channel's thread, up to sBatchSize per sendmmsg, receives are read up to
+// sBatchSize per recvmmsg (Linux). The token only keeps stray datagrams from binding an address, it's no authentication.
+
+struct DatagramStats
+{
+	uint64_t mSent = 0U;        // datagrams handed to the kernel
+	uint64_t mReceived = 0U;    // messages delivered
+	uint64_t mDropped = 0U;     // queue full, socket buffer full, malformed or from an unknown address
+};
+
+class UnreliableTypes   // message types with a value below sMaxType, set before sending them
+{
+public:
+	static const uint32_t sMaxType = 256;
+
+	bool Set(uint32_t type, bool unreliable)
+	{
+		if (type >= sMaxType)
+			return false;
+
+		uint64_t bit = uint64_t(1U) << (type % 64U);
+		if (unreliable)
+			mBits[type / 64U].fetch_or(bit, std::memory_order_relaxed);
+		else
+			mBits[type / 64U].fetch_and(~bit, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	bool Contains(uint32_t type) const { return type < sMaxType && (mBits[type / 64U].load(std::memory_order_relaxed) >> (type % 64U) & 1U) != 0U; }
+private:
+	std::atomic<uint64_t> mBits[sMaxType / 64U] = {};
+};
+
+template <typename T>
+class Connection;
+
+template <typename T>
+class DatagramChannel
+{
+	using ConnectionPtr = std::shared_ptr<Connection<T>>;
+public:
+	static const size_t sMaxDatagramSize = 1232;   // fits the ipv6 minimum mtu (1280) with the ip and udp headers, never fragmented
+	static const unsigned sBatchSize = 32;         // datagrams per sendmmsg / recvmmsg
+	static const size_t sMaxQueued = 4096;         // datagrams waiting for the channel's thread, more are dropped
+	static const unsigned sHelloInterval = 50;     // milliseconds between a client's hellos
+	static const unsigned sHelloAttempts = 40;     // ... before it gives up, unreliable messages then keep taking the connection
+
+	DatagramChannel(ThreadsafeQueue<OwnedMessage<T>> &inMessageQueue) : mInMessageQueue(inMessageQueue) {}
+	~DatagramChannel() { Close(); }
+
+	// server side: one socket for every client
+	bool Bind(const std::string &host, uint16_t port, SocketError &error);
+	uint64_t Offer(const ConnectionPtr &connection);   // the token its client has to send back
+	void Forget(uint32_t connectionId);                // the connection closed
+	bool Send(const ConnectionPtr &connection, const Message<T> &message);   // false if its client has no address yet or the message doesn't fit
+
+	// client side: a socket connected to the server's
+	bool Connect(const sockaddr *serverAddress, uint16_t port, uint32_t connectionId, uint64_t token, SocketError &error);
+	bool Send(const Message<T> &message);              // false until the server acknowledged the hello, or if the message doesn't fit
+
+	void Close();
+	bool IsOpen() const { return mRunning; }
+	bool IsReady() const { return mReady.load(std::memory_order_acquire); }   // client: acknowledged
+	uint16_t GetPort() const { return mPort; }
+	DatagramStats GetStats() const;
+private:
+	enum class Control : uint8_t { HELLO, ACK };   // last byte of a control datagram's body, like the connection's control frames
+
+	struct Pending
+	{
+		sockaddr_storage mAddress;
+		socklen_t mAddressSize;
+		size_t mOffset;                           // in the bytes queued with it
+		size_t mSize;
+	};
+
+	struct Peer
+	{
+		std::weak_ptr<Connection<T>> mConnection;
+		uint64_t mToken = 0U;
+		sockaddr_storage mAddress = {};
+		socklen_t mAddressSize = 0;               // 0 until its hello came
+	};
+
+	using Header = typename Message<T>::Header;
+
+	ThreadsafeQueue<OwnedMessage<T>> &mInMessageQueue;
+
+	SOCKET mSocket = INVALID_SOCKET;
+	uint16_t mPort = 0U;
+	bool mServer = false;
+	std::thread mThread;
+	std::atomic<bool> mRunning{ false };
+
+	std::mutex mSendMutex;                        // senders and the channel's thread
+	Vector<Pending> mPending;
+	Vector<uint8_t> mPendingBytes;                // the queued datagrams back to back
+	Vector<Pending> mSending;                     // channel's thread: taken from mPending
+	Vector<uint8_t> mSendingBytes;
+
+	std::mutex mPeerMutex;                        // server: offers and client addresses
+	std::unordered_map<uint32_t, Peer> mPeers;    // by connection id
+	std::unordered_map<std::string, uint32_t> mAddresses;   // AddressKey -> connection id
+	std::mt19937_64 mRandom{ std::random_device()() };
+
+	uint32_t mConnectionId = 0U;                  // client: its connection's id on the server, and the token for it
+	uint64_t mToken = 0U;
+	std::atomic<bool> mReady{ false };
+
+	std::atomic<uint64_t> mSent{ 0U };
+	std::atomic<uint64_t> mReceived{ 0U };
+	std::atomic<uint64_t> mDropped{ 0U };
+
+	int mWakeFd = -1;                             // eventfd: something was queued, or Close
+
+	bool Open(int family, SocketError &error);
+	bool Queue(const sockaddr_storage *address, socklen_t addressSize, const Message<T> &message);
+	void Run();
+	void SendQueued();
+	void Receive(const sockaddr_storage &from, socklen_t fromSize, const uint8_t *data, size_t size);
+	void OnControl(const sockaddr_storage &from, socklen_t fromSize, Message<T> &control);
+	void SendHello();
+
+	static std::string AddressKey(const sockaddr_storage &address);
+};
+
+template <typename T>
+bool DatagramChannel<T>::Open(int family, SocketError &error)
+{
+#ifdef __linux__
+	if ((mSocket = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP)) == INVALID_SOCKET)
+	{
+		error = { ErrorKind::SOCKET, errno };
+		return false;
+	}
+
+	if ((mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	{
+		error = { ErrorKind::SOCKET, errno };
+		Close();
+		return false;
+	}
+
+	mPending.Resize(0);
+	mPendingBytes.Resize(0);
+
+	return true;
+#else
+	error = { ErrorKind::SOCKET, 0 };   // no sendmmsg / recvmmsg
+	return false;
+#endif
+}
+
+template <typename T>
+bool DatagramChannel<T>::Bind(const std::string &host, uint16_t port, SocketError &error)
+{
+	addrinfo hints = {}, *address;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	int result = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &address);
+	if (result != 0)
+	{
+		error = { ErrorKind::RESOLVE, result };
+		return false;
+	}
+
+	if (!Open(address->ai_family, error))
+	{
+		freeaddrinfo(address);
+		return false;
+	}
+
+	if (bind(mSocket, address->ai_addr, static_cast<socklen_t>(address->ai_addrlen)) != 0)
+	{
+		error = { ErrorKind::BIND, WSAGetLastError() };
+		freeaddrinfo(address);
+		Close();
+		return false;
+	}
+
+	freeaddrinfo(address);
+
+	sockaddr_storage bound;
+	socklen_t boundSize = sizeof bound;
+	getsockname(mSocket, reinterpret_cast<sockaddr*>(&bound), &boundSize);
+	mPort = ntohs(bound.ss_family == AF_INET ? reinterpret_cast<sockaddr_in*>(&bound)->sin_port : reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port);
+
+	mServer = true;
+	mRunning = true;
+	mThread = std::thread(&DatagramChannel::Run, this);
+
+	return true;
+}
+
+template <typename T>
+bool DatagramChannel<T>::Connect(const sockaddr *serverAddress, uint16_t port, uint32_t connectionId, uint64_t token, SocketError &error)
+{
+	sockaddr_storage address = {};
+	socklen_t addressSize;
+
+	if (serverAddress->sa_family == AF_INET)
+	{
+		addressSize = sizeof(sockaddr_in);
+		std::memcpy(&address, serverAddress, addressSize);
+		reinterpret_cast<sockaddr_in*>(&address)->sin_port = htons(port);
+	}
+	else  // serverAddress->sa_family == AF_INET6
+	{
+		addressSize = sizeof(sockaddr_in6);
+		std::memcpy(&address, serverAddress, addressSize);
+		reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = htons(port);
+	}
+
+	if (!Open(serverAddress->sa_family, error))
+		return false;
+
+	if (connect(mSocket, reinterpret_cast<const sockaddr*>(&address), addressSize) != 0)   // datagrams from anyone else are dropped by the kernel
+	{
+		error = { ErrorKind::CONNECT, WSAGetLastError() };
+		Close();
+		return false;
+	}
+
+	mPort = port;
+	mServer = false;
+	mConnectionId = connectionId;
+	mToken = token;
+	mRunning = true;
+	mThread = std::thread(&DatagramChannel::Run, this);
+
+	return true;
+}
+
+template <typename T>
+void DatagramChannel<T>::Close()
+{
+	{
+		std::lock_guard<std::mutex> guard(mSendMutex);   // Queue doesn't queue or write to the eventfd from here on
+		mRunning = false;
+		mReady = false;
+	}
+
+#ifdef __linux__
+	if (mThread.joinable())
+	{
+		uint64_t one = 1U;
+		if (write(mWakeFd, &one, sizeof one) < 0) {}
+		mThread.join();
+	}
+
+	if (mWakeFd >= 0)
+		close(mWakeFd);
+	mWakeFd = -1;
+#endif
+
+	if (mSocket != INVALID_SOCKET)
+		closesocket(mSocket);
+	mSocket = INVALID_SOCKET;
+
+	std::lock_guard<std::mutex> guard(mPeerMutex);
+	mPeers.clear();
+	mAddresses.clear();
+}
+
+template <typename T>
+uint64_t DatagramChannel<T>::Offer(const ConnectionPtr &connection)
+{
+	std::lock_guard<std::mutex> guard(mPeerMutex);
+
+	Peer &peer = mPeers[connection->GetId()];
+	peer.mConnection = connection;
+	peer.mToken = mRandom() | 1U;   // never 0
+
+	return peer.mToken;
+}
+
+template <typename T>
+void DatagramChannel<T>::Forget(uint32_t connectionId)
+{
+	std::lock_guard<std::mutex> guard(mPeerMutex);
+
+	auto it = mPeers.find(connectionId);
+	if (it == mPeers.end())
+		return;
+
+	if (it->second.mAddressSize > 0)
+		mAddresses.erase(AddressKey(it->second.mAddress));
+
+	mPeers.erase(it);
+}
+
+template <typename T>
+bool DatagramChannel<T>::Send(const ConnectionPtr &connection, const Message<T> &message)
+{
+	if (!mRunning || message.mBody.Size() > sMaxDatagramSize - sizeof(Header))
+		return false;
+
+	sockaddr_storage address;
+	socklen_t addressSize;
+	{
+		std::lock_guard<std::mutex> guard(mPeerMutex);
+
+		auto it = mPeers.find(connection->GetId());
+		if (it == mPeers.end() || it->second.mAddressSize == 0)
+			return false;
+
+		address = it->second.mAddress;
+		addressSize = it->second.mAddressSize;
+	}
+
+	Queue(&address, addressSize, message);
+
+	return true;
+}
+
+template <typename T>
+bool DatagramChannel<T>::Send(const Message<T> &message)
+{
+	if (!IsReady() || message.mBody.Size() > sMaxDatagramSize - sizeof(Header))
+		return false;
+
+	Queue(nullptr, 0, message);
+
+	return true;
+}
+
+// lost like any datagram if the queue is full
+template <typename T>
+bool DatagramChannel<T>::Queue(const sockaddr_storage *address, socklen_t addressSize, const Message<T> &message)
+{
+	std::lock_guard<std::mutex> guard(mSendMutex);
+
+	if (!mRunning)
+		return false;
+
+	if (mPending.Size() >= sMaxQueued)
+	{
+		mDropped.fetch_add(1U, std::memory_order_relaxed);
+		return false;
+	}
+
+	Header header = message.mHeader;
+	header.mFlags &= Message<T>::FLAG_CONTROL;   // the stream's framing flags don't apply
+	header.mSize = static_cast<uint32_t>(message.mBody.Size());
+
+	Pending pending;
+	if (address)
+		pending.mAddress = *address;
+	pending.mAddressSize = addressSize;
+	pending.mOffset = mPendingBytes.Size();
+	pending.mSize = sizeof header + message.mBody.Size();
+
+	mPendingBytes.ResizeDefaultInit(pending.mOffset + pending.mSize);
+	std::memcpy(mPendingBytes.Data() + pending.mOffset, &header, sizeof header);
+	if (!message.mBody.Empty())
+		std::memcpy(mPendingBytes.Data() + pending.mOffset + sizeof header, message.mBody.Data(), message.mBody.Size());
+
+	mPending.InsertLast(pending);
+
+#ifdef __linux__
+	if (mPending.Size() == 1U)   // the channel's thread takes everything queued once woken
+	{
+		uint64_t one = 1U;
+		if (write(mWakeFd, &one, sizeof one) < 0) {}
+	}
+#endif
+
+	return true;
+}
+
+template <typename T>
+void DatagramChannel<T>::Run()
+{
+#ifdef __linux__
+	static const size_t sReceiveSize = sMaxDatagramSize + 1;   // a larger datagram comes out truncated
+
+	Vector<uint8_t> buffers(sBatchSize * sReceiveSize);
+	iovec vectors[sBatchSize];
+	sockaddr_storage addresses[sBatchSize];
+	mmsghdr messages[sBatchSize];
+
+	unsigned hellos = 0U;
+	if (!mServer)
+		SendHello();
+
+	while (mRunning)
+	{
+		pollfd fds[2] = { { mSocket, POLLIN, 0 }, { mWakeFd, POLLIN, 0 } };
+		bool helloDue = !mServer && !mReady && hellos < sHelloAttempts;
+
+		int ready = poll(fds, 2, helloDue ? static_cast<int>(sHelloInterval) : -1);
+
+		if (ready == 0 && helloDue)   // no ack yet
+		{
+			if (++hellos < sHelloAttempts)
+				SendHello();
+			else
+				DbgPrint("datagram hello not acknowledged, unreliable messages stay on the connection");
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			uint64_t value;
+			if (read(mWakeFd, &value, sizeof value) < 0) {}
+		}
+
+		if (!mRunning)
+			break;
+
+		SendQueued();
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		for (;;)   // until the socket is drained
+		{
+			for (unsigned i = 0; i < sBatchSize; i++)
+			{
+				vectors[i] = { buffers.Data() + i * sReceiveSize, sReceiveSize };
+				messages[i].msg_hdr = {};
+				messages[i].msg_hdr.msg_iov = &vectors[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+				messages[i].msg_hdr.msg_name = &addresses[i];
+				messages[i].msg_hdr.msg_namelen = sizeof addresses[i];
+			}
+
+			int count = recvmmsg(mSocket, messages, sBatchSize, MSG_DONTWAIT, nullptr);
+			if (count <= 0)
+				break;   // EAGAIN, or an icmp error of a connected socket: the peer isn't listening (yet)
+
+			for (int i = 0; i < count; i++)
+			{
+				if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+					mDropped.fetch_add(1U, std::memory_order_relaxed);
+				else
+					Receive(addresses[i], messages[i].msg_hdr.msg_namelen, static_cast<const uint8_t*>(vectors[i].iov_base), messages[i].msg_len);
+			}
+
+			if (count < static_cast<int>(sBatchSize))
+				break;
+		}
+	}
+#endif
+}
+
+// whatever is queued, sBatchSize datagrams per call; a full socket buffer drops the rest rather than waiting for room
+template <typename T>
+void DatagramChannel<T>::SendQueued()
+{
+#ifdef __linux__
+	{
+		std::lock_guard<std::mutex> guard(mSendMutex);
+
+		mSending.Resize(0);
+		mSendingBytes.Resize(0);
+		mSending.Swap(mPending);
+		mSendingBytes.Swap(mPendingBytes);
+	}
+
+	iovec vectors[sBatchSize];
+	mmsghdr messages[sBatchSize];
+
+	for (size_t first = 0; first < mSending.Size(); )
+	{
+		unsigned count = static_cast<unsigned>(std::min(static_cast<size_t>(sBatchSize), mSending.Size() - first));
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			Pending &pending = mSending[static_cast<int>(first + i)];
+
+			vectors[i] = { mSendingBytes.Data() + pending.mOffset, pending.mSize };
+			messages[i].msg_hdr = {};
+			messages[i].msg_hdr.msg_iov = &vectors[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+			messages[i].msg_hdr.msg_name = pending.mAddressSize > 0 ? &pending.mAddress : nullptr;
+			messages[i].msg_hdr.msg_namelen = pending.mAddressSize;
+		}
+
+		int sent = sendmmsg(mSocket, messages, count, MSG_DONTWAIT);
+
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			mDropped.fetch_add(mSending.Size() - first, std::memory_order_relaxed);
+			break;
+		}
+
+		if (sent < 0)   // the first one's destination failed (or an earlier icmp error surfaced): it's lost, the rest goes on
+		{
+			mDropped.fetch_add(1U, std::memory_order_relaxed);
+			first++;
+			continue;
+		}
+
+		mSent.fetch_add(static_cast<uint64_t>(sent), std::memory_order_relaxed);
+		first += static_cast<size_t>(sent);
+	}
+#endif
+}
+
+template <typename T>
+void DatagramChannel<T>::Receive(const sockaddr_storage &from, socklen_t fromSize, const uint8_t *data, size_t size)
+{
+	Message<T> message;
+
+	if (size < sizeof(Header))
+	{
+		mDropped.fetch_add(1U, std::memory_order_relaxed);
+		return;
+	}
+
+	std::memcpy(&message.mHeader, data, sizeof(Header));
+
+	if (message.mHeader.mSize != size - sizeof(Header) || (message.mHeader.mFlags & ~Message<T>::FLAG_CONTROL) != 0U)
+	{
+		mDropped.fetch_add(1U, std::memory_order_relaxed);
+		return;
+	}
+
+	message.mBody.Resize(message.mHeader.mSize);
+	if (message.mHeader.mSize > 0U)
+		std::memcpy(message.mBody.Data(), data + sizeof(Header), message.mHeader.mSize);
+
+	if (message.mHeader.mFlags & Message<T>::FLAG_CONTROL)
+	{
+		OnControl(from, fromSize, message);
+		return;
+	}
+
+	ConnectionPtr sender;
+
+	if (mServer)
+	{
+		std::lock_guard<std::mutex> guard(mPeerMutex);
+
+		auto address = mAddresses.find(AddressKey(from));
+		if (address != mAddresses.end())
+		{
+			auto peer = mPeers.find(address->second);
+			if (peer != mPeers.end())
+				sender = peer->second.mConnection.lock();
+		}
+
+		if (!sender || !sender->mIsOpen)
+		{
+			mDropped.fetch_add(1U, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	if (sender && !sender->Admit(message.GetType(), false))   // counted by the connection; this thread serves every peer, it doesn't wait
+		return;
+
+	mReceived.fetch_add(1U, std::memory_order_relaxed);
+	mInMessageQueue.EnQueue(OwnedMessage<T>(std::move(sender), message));
+}
+
+// server: a hello with its connection's token binds the address it came from to the connection (the first one only,
+// a repeated hello is acknowledged again); client: the ack of its hello
+template <typename T>
+void DatagramChannel<T>::OnControl(const sockaddr_storage &from, socklen_t fromSize, Message<T> &control)
+{
+	uint8_t kind;
+	uint32_t connectionId;
+	uint64_t token;
+
+	if (control.mBody.Empty())
+	{
+		mDropped.fetch_add(1U, std::memory_order_relaxed);
+		return;
+	}
+
+	control >> kind;
+
+	if (mServer && static_cast<Control>(kind) == Control::HELLO && control.mBody.Size() == sizeof connectionId + sizeof token)
+	{
+		control >> token >> connectionId;
+
+		{
+			std::lock_guard<std::mutex> guard(mPeerMutex);
+
+			auto it = mPeers.find(connectionId);
+			if (it == mPeers.end() || it->second.mToken != token)
+			{
+				mDropped.fetch_add(1U, std::memory_order_relaxed);
+				return;
+			}
+
+			if (it->second.mAddressSize == 0)
+			{
+				it->second.mAddress = from;
+				it->second.mAddressSize = fromSize;
+				mAddresses[AddressKey(from)] = connectionId;
+			}
+			else if (AddressKey(it->second.mAddress) != AddressKey(from))
+			{
+				mDropped.fetch_add(1U, std::memory_order_relaxed);
+				return;
+			}
+		}
+
+		Message<T> ack;
+		ack.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+		ack << connectionId << static_cast<uint8_t>(Control::ACK);
+		Queue(&from, fromSize, ack);
+	}
+	else if (!mServer && static_cast<Control>(kind) == Control::ACK && control.mBody.Size() == sizeof connectionId)
+	{
+		control >> connectionId;
+
+		if (connectionId == mConnectionId)
+			mReady.store(true, std::memory_order_release);
+	}
+	else
+		mDropped.fetch_add(1U, std::memory_order_relaxed);
+}
+
+template <typename T>
+void DatagramChannel<T>::SendHello()
+{
+	Message<T> hello;
+	hello.mHeader.mFlags = Message<T>::FLAG_CONTROL;
+	hello << mConnectionId << mToken << static_cast<uint8_t>(Control::HELLO);
+
+	Queue(nullptr, 0, hello);
+	SendQueued();
+}
+
+template <typename T>
+DatagramStats DatagramChannel<T>::GetStats() const
+{
+	DatagramStats stats;
+	stats.mSent = mSent.load(std::memory_order_relaxed);
+	stats.mReceived = mReceived.load(std::memory_order_relaxed);
+	stats.mDropped = mDropped.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+// family, port and address: what tells two udp peers apart (not the ipv6 flow label)
+template <typename T>
+std::string DatagramChannel<T>::AddressKey(const sockaddr_storage &address)
+{
+	if (address.ss_family == AF_INET)
+	{
+		const sockaddr_in &in = reinterpret_cast<const sockaddr_in&>(address);
+		return std::string(reinterpret_cast<const char*>(&in.sin_port), sizeof in.sin_port) + std::string(reinterpret_cast<const char*>(&in.sin_addr), sizeof in.sin_addr);
+	}
+
+	const sockaddr_in6 &in6 = reinterpret_cast<const sockaddr_in6&>(address);
+	return std::string(1, '6') + std::string(reinterpret_cast<const char*>(&in6.sin6_port), sizeof in6.sin6_port)
+		+ std::string(reinterpret_cast<const char*>(&in6.sin6_addr), sizeof in6.sin6_addr) + std::string(reinterpret_cast<const char*>(&in6.sin6_scope_id), sizeof in6.sin6_scope_id);
+}
+
+#endif  // DATAGRAM_H
@@ -0,0 +1,79 @@
+#ifndef FILE_BODY_H
+#define FILE_BODY_H
+
+#include "Socket.h"
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <io.h>
+#elif defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+// body of a message sent with SendFile: a range of a file, read when its frames go out instead of when it's queued;
+// the descriptor is duplicated so the caller may close its own right away, the copy closes with the last frame
+class FileBody
+{
+public:
+	static std::shared_ptr<FileBody> Open(int fd, uint64_t offset)   // null if the descriptor can't be duplicated
+	{
+#ifdef _WIN32
+		int copy = _dup(fd);
+#else
+		int copy = dup(fd);
+#endif
+		return copy < 0 ? nullptr : std::shared_ptr<FileBody>(new FileBody(copy, offset));
+	}
+
+	~FileBody()
+	{
+#ifdef _WIN32
+		_close(mFd);
+#else
+		close(mFd);
+#endif
+	}
+
+	FileBody(const FileBody&) = delete;
+	FileBody &operator=(const FileBody&) = delete;
+
+	// reads size bytes at offset (relative to the range) into buffer, returns how many, 0 at the end of the file, -1 on errors
+	long Read(uint64_t offset, uint8_t *buffer, size_t size) const
+	{
+#ifdef _WIN32
+		if (_lseeki64(mFd, static_cast<long long>(mOffset + offset), SEEK_SET) < 0)   // the descriptor is only read by the connection's thread
+			return -1;
+		return _read(mFd, buffer, static_cast<unsigned>(size));
+#else
+		return static_cast<long>(pread(mFd, buffer, size, static_cast<off_t>(mOffset + offset)));
+#endif
+	}
+
+	// sends size bytes at offset to the socket, returns how many, 0 at the end of the file, SOCKET_ERROR if the send failed
+	// (WSAGetLastError tells why, WSAEWOULDBLOCK if the socket is full); Linux: sendfile, the bytes never enter user space,
+	// elsewhere they're read into scratch first
+	long Send(SOCKET socket, uint64_t offset, size_t size, uint8_t *scratch, size_t scratchSize) const
+	{
+#ifdef __linux__
+		static_cast<void>(scratch);   // sendfile needs no copy
+		static_cast<void>(scratchSize);
+
+		off_t position = static_cast<off_t>(mOffset + offset);
+		return static_cast<long>(sendfile(socket, mFd, &position, size));
+#else
+		long count = Read(offset, scratch, size < scratchSize ? size : scratchSize);   // re-read after a partial send, the file stays put
+		if (count <= 0)
+			return count;
+		return send(socket, reinterpret_cast<const char*>(scratch), static_cast<int>(count), MSG_NOSIGNAL);
+#endif
+	}
+private:
+	FileBody(int fd, uint64_t offset) : mFd(fd), mOffset(offset) {}
+
+	int mFd;
+	uint64_t mOffset;
+};
+
+#endif  // FILE_BODY_H
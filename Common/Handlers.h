@@ -0,0 +1,197 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include "Message.h"
+#include "Metrics.h"
+#include "Vector.h"
+
+// number of values of a message enum: its COUNT enumerator if it has one, else every value of a one byte enum;
+// 0 for a wider enum without COUNT (its handlers are kept in a map), specialize it to give such an enum a dense table
+template <typename T, typename = void>
+struct MessageTypeCount
+{
+	static const size_t sValue = sizeof(T) == 1 ? 256 : 0;
+};
+
+template <typename T>
+struct MessageTypeCount<T, decltype(void(T::COUNT))>
+{
+	static const size_t sValue = static_cast<size_t>(T::COUNT);
+};
+
+// how a typed handler's struct is read from the body: with its member bool Decode(Message<T> &message) (false: malformed),
+// else a trivially copyable struct is the whole body, as written by message << data
+template <typename D, typename T>
+auto DecodeMessage(Message<T> &message, D &data, int) -> decltype(static_cast<bool>(data.Decode(message)))
+{
+	return data.Decode(message);
+}
+
+template <typename D, typename T>
+bool DecodeMessage(Message<T> &message, D &data, long)
+{
+	static_assert(std::is_trivially_copyable<D>::value, "a handler's struct needs a bool Decode(Message<T> &) member or to be trivially copyable");
+
+	if (message.GetBodySize() != sizeof data)
+		return false;
+
+	message >> data;
+	return true;
+}
+
+enum class HandlerResult { UNHANDLED, HANDLED, MALFORMED };   // MALFORMED: the body didn't decode, the handler wasn't called
+
+// handlers by message type in a dense array sized by the enum's range: dispatch is an index, no switch, no lookup
+// (an enum of unknown range: a map under a lock, entries made by Set and Record); Args are what comes before the
+// message (a Server<T>'s sender), set them before messages arrive.
+// Once timed, also keeps the time spent on each type (whoever handled it), to find the types that cost the most
+template <typename T, typename... Args>
+class HandlerTable
+{
+public:
+	static const size_t sTypeCount = MessageTypeCount<T>::sValue;   // 0: the entries are kept in a map
+
+	using Handler = std::function<void(Args..., Message<T> &message)>;
+
+	bool Set(T type, Handler handler)   // an empty handler removes it; false if the type's value is out of range
+	{
+		if (!handler)
+			return Install(type, Decoder());
+
+		return Install(type, Decoder([handler](Args... args, Message<T> &message) { handler(args..., message); return true; }));
+	}
+
+	template <typename D, typename F>   // F: void(Args..., D &data)
+	bool Set(T type, F handler)
+	{
+		return Install(type, Decoder([handler](Args... args, Message<T> &message)
+		{
+			D data;
+			if (!DecodeMessage(message, data, 0))
+				return false;
+
+			handler(args..., data);
+			return true;
+		}));
+	}
+
+	HandlerResult Dispatch(Args... args, Message<T> &message)
+	{
+		Entry *entry = Find(static_cast<size_t>(message.GetType()), false);
+		if (!entry || !entry->mHandler)
+			return HandlerResult::UNHANDLED;
+
+		if (entry->mHandler(args..., message))
+			return HandlerResult::HANDLED;
+
+		entry->mMalformed.fetch_add(1U, std::memory_order_relaxed);
+		return HandlerResult::MALFORMED;
+	}
+
+	void SetTimed(bool timed) { mTimed.store(timed, std::memory_order_relaxed); }   // off by default: Record costs more than a dispatch
+	bool IsTimed() const { return mTimed.load(std::memory_order_relaxed); }
+
+	void Record(T type, std::chrono::steady_clock::duration elapsed)
+	{
+		Entry *found = Find(static_cast<size_t>(type), true);
+		if (!found)
+			return;
+
+		long long count = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		uint64_t nanoseconds = static_cast<uint64_t>(count > 0 ? count : 0);
+
+		Entry &entry = *found;
+		entry.mCalls.fetch_add(1U, std::memory_order_relaxed);
+		entry.mSum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+		uint64_t max = entry.mMax.load(std::memory_order_relaxed);
+		while (nanoseconds > max && !entry.mMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+			;
+	}
+
+	Vector<HandlerStats> Snapshot() const   // the types seen so far, the costliest first
+	{
+		Vector<HandlerStats> stats;
+
+		auto add = [&stats](size_t type, const Entry &entry)
+		{
+			uint64_t calls = entry.mCalls.load(std::memory_order_relaxed);
+			uint64_t malformed = entry.mMalformed.load(std::memory_order_relaxed);
+
+			if (calls > 0U || malformed > 0U)
+				stats.InsertLast(HandlerStats{ static_cast<uint32_t>(type), calls, entry.mSum.load(std::memory_order_relaxed), entry.mMax.load(std::memory_order_relaxed), malformed });
+		};
+
+		for (size_t i = 0; i < sTypeCount; i++)
+			add(i, mEntries[i]);
+
+		if (sTypeCount == 0)
+		{
+			std::lock_guard<std::mutex> guard(mSparseMutex);
+
+			for (const auto &entry : mSparseEntries)
+				add(entry.first, *entry.second);
+		}
+
+		std::sort(stats.Begin(), stats.End(), [](const HandlerStats &a, const HandlerStats &b) { return a.mSum > b.mSum; });
+
+		return stats;
+	}
+private:
+	using Decoder = std::function<bool(Args..., Message<T> &message)>;   // false: malformed
+
+	struct Entry
+	{
+		Decoder mHandler;
+		std::atomic<uint64_t> mCalls{ 0U };
+		std::atomic<uint64_t> mSum{ 0U };        // nanoseconds
+		std::atomic<uint64_t> mMax{ 0U };
+		std::atomic<uint64_t> mMalformed{ 0U };
+	};
+
+	std::array<Entry, sTypeCount> mEntries;
+	std::atomic<bool> mTimed{ false };
+
+	mutable std::mutex mSparseMutex;   // sTypeCount 0: entries are only ever added, they stay where they are
+	std::unordered_map<size_t, std::unique_ptr<Entry>> mSparseEntries;
+
+	Entry *Find(size_t index, bool create)   // nullptr if the value is out of range (or has no entry and create is false)
+	{
+		if (sTypeCount > 0)
+			return index < sTypeCount ? &mEntries[index] : nullptr;
+
+		std::lock_guard<std::mutex> guard(mSparseMutex);
+
+		auto found = mSparseEntries.find(index);
+		if (found != mSparseEntries.end())
+			return found->second.get();
+
+		if (!create)
+			return nullptr;
+
+		return mSparseEntries.emplace(index, std::unique_ptr<Entry>(new Entry())).first->second.get();
+	}
+
+	bool Install(T type, Decoder &&decoder)
+	{
+		Entry *entry = Find(static_cast<size_t>(type), true);
+		if (!entry)
+			return false;
+
+		entry->mHandler = std::move(decoder);
+		return true;
+	}
+};
+
+#endif  // HANDLERS_H
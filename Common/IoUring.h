@@ -0,0 +1,273 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+// minimal io_uring wrapper (raw system calls, no liburing): submission/completion rings,
+// registered (fixed) buffers and provided buffers for multishot receive
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+class IoUring
+{
+public:
+	IoUring() = default;
+	~IoUring() { Close(); }
+
+	IoUring(const IoUring &) = delete;
+	IoUring &operator=(const IoUring &) = delete;
+
+	bool Init(unsigned entries);   // false if io_uring is unavailable (old kernel, seccomp, ...)
+	void Close();
+
+	bool IsValid() const { return mRingFd >= 0; }
+
+	io_uring_sqe *GetSqe();                 // next free submission entry (zeroed), submits pending entries if the queue is full
+	int Submit(unsigned minComplete = 0);   // submit queued entries and wait for at least minComplete completions
+
+	io_uring_cqe *PeekCqe();                // next completion or nullptr
+	void SeenCqe();                         // release the completion returned by PeekCqe
+
+	bool RegisterBuffers(const iovec *buffers, unsigned count);
+	bool Supports(const uint8_t *opcodes, unsigned count);   // false if the kernel lacks one of the opcodes (or can't be asked, before 5.6)
+private:
+	int mRingFd = -1;
+
+	void *mSqRing = nullptr;
+	size_t mSqRingSize = 0;
+	void *mCqRing = nullptr;
+	size_t mCqRingSize = 0;
+	io_uring_sqe *mSqes = nullptr;
+	size_t mSqesSize = 0;
+
+	unsigned *mSqHead = nullptr;
+	unsigned *mSqTail = nullptr;
+	unsigned mSqMask = 0;
+	unsigned mSqEntries = 0;
+	unsigned *mSqArray = nullptr;
+	unsigned mSqLocalTail = 0;   // entries handed out by GetSqe but not yet published to the kernel
+
+	unsigned *mCqHead = nullptr;
+	unsigned *mCqTail = nullptr;
+	unsigned mCqMask = 0;
+	io_uring_cqe *mCqes = nullptr;
+};
+
+inline bool IoUring::Init(unsigned entries)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof params);
+
+	mRingFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if (mRingFd < 0)
+		return false;
+
+	mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)   // both rings share one mapping
+		mSqRingSize = mCqRingSize = mSqRingSize > mCqRingSize ? mSqRingSize : mCqRingSize;
+
+	mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+	if (mSqRing == MAP_FAILED)
+	{
+		mSqRing = nullptr;
+		Close();
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		mCqRing = mSqRing;
+	else if ((mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+	{
+		mCqRing = nullptr;
+		Close();
+		return false;
+	}
+
+	mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	mSqes = static_cast<io_uring_sqe*>(sqes);
+
+	uint8_t *sqRing = static_cast<uint8_t*>(mSqRing);
+	mSqHead = reinterpret_cast<unsigned*>(sqRing + params.sq_off.head);
+	mSqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+	mSqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+	mSqEntries = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_entries);
+	mSqArray = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+	mSqLocalTail = *mSqTail;
+
+	uint8_t *cqRing = static_cast<uint8_t*>(mCqRing);
+	mCqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+	mCqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+	mCqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+	mCqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+
+	return true;
+}
+
+inline void IoUring::Close()
+{
+	if (mSqes)
+		munmap(mSqes, mSqesSize);
+
+	if (mCqRing && mCqRing != mSqRing)
+		munmap(mCqRing, mCqRingSize);
+
+	if (mSqRing)
+		munmap(mSqRing, mSqRingSize);
+
+	if (mRingFd >= 0)
+		close(mRingFd);
+
+	mSqes = nullptr;
+	mSqRing = mCqRing = nullptr;
+	mRingFd = -1;
+}
+
+inline io_uring_sqe *IoUring::GetSqe()
+{
+	if (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) >= mSqEntries)   // submission queue full
+		Submit();
+
+	unsigned index = mSqLocalTail & mSqMask;
+	mSqArray[index] = index;
+	mSqLocalTail++;
+
+	io_uring_sqe *sqe = &mSqes[index];
+	std::memset(sqe, 0, sizeof *sqe);
+
+	return sqe;
+}
+
+inline int IoUring::Submit(unsigned minComplete)
+{
+	unsigned tail = *mSqTail;
+	unsigned toSubmit = mSqLocalTail - tail;
+
+	__atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);   // publish new entries to the kernel
+
+	int result;
+	do
+		result = static_cast<int>(syscall(__NR_io_uring_enter, mRingFd, toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0U, nullptr, 0));
+	while (result < 0 && errno == EINTR);
+
+	return result;
+}
+
+inline io_uring_cqe *IoUring::PeekCqe()
+{
+	unsigned head = *mCqHead;
+
+	if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+		return nullptr;
+
+	return &mCqes[head & mCqMask];
+}
+
+inline void IoUring::SeenCqe()
+{
+	__atomic_store_n(mCqHead, *mCqHead + 1, __ATOMIC_RELEASE);
+}
+
+inline bool IoUring::RegisterBuffers(const iovec *buffers, unsigned count)
+{
+	return syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+}
+
+inline bool IoUring::Supports(const uint8_t *opcodes, unsigned count)
+{
+	const unsigned probeOps = 256;
+	alignas(io_uring_probe) uint8_t buffer[sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op)] = {};
+	io_uring_probe *probe = reinterpret_cast<io_uring_probe*>(buffer);
+
+	if (syscall(__NR_io_uring_register, mRingFd, IORING_REGISTER_PROBE, probe, probeOps) != 0)
+		return false;
+
+	for (unsigned i = 0; i < count; i++)
+		if (opcodes[i] > probe->last_op || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+			return false;
+
+	return true;
+}
+
+// a group of equally sized receive buffers the kernel picks from (IOSQE_BUFFER_SELECT),
+// handed back with Recycle once the completion's data has been consumed
+class ProvidedBuffers
+{
+public:
+	ProvidedBuffers() = default;
+	~ProvidedBuffers() { Free(); }
+
+	ProvidedBuffers(const ProvidedBuffers &) = delete;
+	ProvidedBuffers &operator=(const ProvidedBuffers &) = delete;
+
+	bool Init(IoUring &ring, unsigned count, unsigned bufferSize, uint16_t groupId, uint64_t userData);   // queues the buffers, submitted with the ring's next Submit
+	void Free();
+
+	uint8_t *Buffer(uint16_t bufferId) const { return mBuffers + static_cast<size_t>(bufferId) * mBufferSize; }
+	void Recycle(uint16_t bufferId) { Provide(bufferId, 1); }
+
+	uint16_t GetGroupId() const { return mGroupId; }
+private:
+	IoUring *mRing = nullptr;
+	uint8_t *mBuffers = nullptr;
+	size_t mBuffersSize = 0;
+
+	unsigned mBufferSize = 0;
+	uint16_t mGroupId = 0;
+	uint64_t mUserData = 0;   // only failed provide operations complete (IOSQE_CQE_SKIP_SUCCESS)
+
+	void Provide(uint16_t firstBufferId, unsigned count);
+};
+
+inline bool ProvidedBuffers::Init(IoUring &ring, unsigned count, unsigned bufferSize, uint16_t groupId, uint64_t userData)
+{
+	mRing = &ring;
+	mBufferSize = bufferSize;
+	mGroupId = groupId;
+	mUserData = userData;
+
+	mBuffersSize = static_cast<size_t>(count) * bufferSize;
+	void *buffersMemory = mmap(nullptr, mBuffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffersMemory == MAP_FAILED)
+		return false;
+	mBuffers = static_cast<uint8_t*>(buffersMemory);
+
+	Provide(0, count);
+
+	return true;
+}
+
+inline void ProvidedBuffers::Free()
+{
+	if (mBuffers)   // the kernel's references go away with the ring
+		munmap(mBuffers, mBuffersSize);
+
+	mBuffers = nullptr;
+}
+
+inline void ProvidedBuffers::Provide(uint16_t firstBufferId, unsigned count)
+{
+	io_uring_sqe *sqe = mRing->GetSqe();
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = static_cast<int>(count);
+	sqe->addr = reinterpret_cast<uint64_t>(Buffer(firstBufferId));
+	sqe->len = mBufferSize;
+	sqe->off = firstBufferId;
+	sqe->buf_group = mGroupId;
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = mUserData;
+}
+
+#endif  // IO_URING_H
@@ -0,0 +1,154 @@
+#ifndef LOCAL_SOCKET_H
+#define LOCAL_SOCKET_H
+
+#include "Socket.h"
+#include "NetError.h"
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+// same-host connections through a unix socket: Client<T>::Connect("unix:///path/to/socket", 0) reaches a server started
+// with Server<T>::StartLocal("/path/to/socket") and carries the frames like a tcp socket would, without the tcp/ip stack
+// (no segmentation, checksums, acks or loopback device: a send copies straight into the peer's receive queue)
+static const char sUnixScheme[] = "unix://";
+
+inline bool IsUnixAddress(const std::string &host) { return host.compare(0, sizeof sUnixScheme - 1, sUnixScheme) == 0; }
+
+// the byte a local client sends first, with the descriptors the transport needs (SCM_RIGHTS)
+enum class LocalTransport : uint8_t
+{
+	SHARED_MEMORY,   // the channel's memfd and both eventfds, the socket then only tells when the peer is gone
+	STREAM,          // none, the frames follow on the socket
+};
+
+inline size_t LocalDescriptorCount(LocalTransport transport) { return transport == LocalTransport::SHARED_MEMORY ? 3U : 0U; }
+
+#ifdef __linux__
+
+#include <sys/un.h>
+
+static const size_t sMaxLocalDescriptors = 3;
+
+// connects the unix socket at path (a local connect completes or fails right away), connectedAddress is its sockaddr_un
+inline SOCKET LocalConnect(const std::string &path, sockaddr_storage &connectedAddress, SocketError &error)
+{
+	sockaddr_un serverAddress = {};
+	serverAddress.sun_family = AF_UNIX;
+
+	if (path.empty() || path.size() >= sizeof serverAddress.sun_path)
+	{
+		error = { ErrorKind::RESOLVE, ENAMETOOLONG };
+		return INVALID_SOCKET;
+	}
+
+	std::memcpy(serverAddress.sun_path, path.c_str(), path.size());
+	std::memcpy(&connectedAddress, &serverAddress, sizeof serverAddress);
+
+	SOCKET connectionSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connectionSocket == INVALID_SOCKET)
+	{
+		error = { ErrorKind::SOCKET, errno };
+		return INVALID_SOCKET;
+	}
+
+	if (connect(connectionSocket, reinterpret_cast<const sockaddr*>(&serverAddress), sizeof serverAddress) != 0)
+	{
+		error = { ErrorKind::CONNECT, errno };
+		close(connectionSocket);
+		return INVALID_SOCKET;
+	}
+
+	return connectionSocket;
+}
+
+inline bool SendLocalHello(SOCKET socket, LocalTransport transport, const int *fds, SocketError &error)
+{
+	size_t count = LocalDescriptorCount(transport);
+	uint8_t byte = static_cast<uint8_t>(transport);
+	iovec data = { &byte, 1 };
+
+	alignas(cmsghdr) char control[CMSG_SPACE(sMaxLocalDescriptors * sizeof(int))] = {};
+	msghdr message = {};
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+
+	if (count > 0)
+	{
+		message.msg_control = control;
+		message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(count * sizeof(int));
+		std::memcpy(CMSG_DATA(header), fds, count * sizeof(int));
+	}
+
+	if (sendmsg(socket, &message, MSG_NOSIGNAL) != 1)
+	{
+		error = { ErrorKind::CONNECT, errno };
+		return false;
+	}
+
+	return true;
+}
+
+// server side: the transport and its LocalDescriptorCount(transport) descriptors in fds (sMaxLocalDescriptors room)
+// descriptors of a malformed hello are closed
+inline bool ReceiveLocalHello(SOCKET socket, LocalTransport &transport, int *fds, SocketError &error)
+{
+	uint8_t byte;
+	iovec data = { &byte, 1 };
+
+	alignas(cmsghdr) char control[CMSG_SPACE(sMaxLocalDescriptors * sizeof(int))] = {};
+	msghdr message = {};
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof control;
+
+	ssize_t received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+	if (received != 1)
+	{
+		error = { received < 0 ? ErrorKind::ACCEPT : ErrorKind::PROTOCOL, received < 0 ? errno : EPROTO };
+		return false;
+	}
+
+	size_t count = 0;
+	cmsghdr *header = CMSG_FIRSTHDR(&message);
+	if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+	{
+		count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		std::memcpy(fds, CMSG_DATA(header), count * sizeof(int));
+	}
+
+	transport = static_cast<LocalTransport>(byte);
+
+	if (byte > static_cast<uint8_t>(LocalTransport::STREAM) || (message.msg_flags & MSG_CTRUNC) || count != LocalDescriptorCount(transport))
+	{
+		error = { ErrorKind::PROTOCOL, EPROTO };
+		for (size_t i = 0; i < count; i++)
+			close(fds[i]);
+		return false;
+	}
+
+	return true;
+}
+
+// client side of a unix:// address: connected, the server then treats the socket like an accepted tcp socket
+inline SOCKET UnixConnect(const std::string &address, sockaddr_storage &connectedAddress, SocketError &error)
+{
+	SOCKET connectionSocket = LocalConnect(address.substr(sizeof sUnixScheme - 1), connectedAddress, error);
+
+	if (connectionSocket != INVALID_SOCKET && !SendLocalHello(connectionSocket, LocalTransport::STREAM, nullptr, error))
+	{
+		close(connectionSocket);
+		return INVALID_SOCKET;
+	}
+
+	return connectionSocket;
+}
+
+#endif  // __linux__
+
+#endif  // LOCAL_SOCKET_H
@@ -0,0 +1,217 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+// self-contained LZ4 block format codec (greedy single-probe matching, output readable by any LZ4 decoder)
+// both directions take an optional prefix: bytes that logically precede the block and that matches
+// may reference (a dictionary), the compressor needs the prefix and the input contiguous in memory
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+static const unsigned sLz4HashLog = 12;                      // 4096 entry hash table
+static const size_t sLz4HashTableSize = size_t(1) << sLz4HashLog;
+static const size_t sLz4MaxDistance = 65535;
+
+inline size_t Lz4CompressBound(size_t size) { return size + size / 255 + 16; }
+
+inline uint32_t Lz4Read32(const uint8_t *data)
+{
+	uint32_t value;
+	std::memcpy(&value, data, sizeof value);
+	return value;
+}
+
+inline uint32_t Lz4Hash(uint32_t sequence) { return (sequence * 2654435761U) >> (32 - sLz4HashLog); }
+
+inline uint8_t *Lz4WriteLength(uint8_t *output, size_t length)   // length beyond the token's 15
+{
+	for (; length >= 255; length -= 255)
+		*output++ = 255;
+	*output++ = static_cast<uint8_t>(length);
+
+	return output;
+}
+
+// hashes every position of a prefix into table, so that Lz4Compress finds matches in it
+inline void Lz4IndexPrefix(const uint8_t *prefix, size_t prefixSize, uint32_t *table)
+{
+	std::memset(table, 0, sLz4HashTableSize * sizeof(uint32_t));
+
+	for (size_t position = 0; position + sizeof(uint32_t) <= prefixSize; position++)
+		table[Lz4Hash(Lz4Read32(prefix + position))] = static_cast<uint32_t>(position);
+}
+
+// compresses base[prefixSize, prefixSize + size) into output, table holds positions relative to base
+// (zeroed, or filled by Lz4IndexPrefix for the same prefix); returns the compressed size, 0 if it exceeds capacity
+inline size_t Lz4Compress(const uint8_t *base, size_t prefixSize, size_t size, uint8_t *output, size_t capacity, uint32_t *table)
+{
+	const size_t minMatch = 4, lastLiterals = 5, matchFindLimit = 12;   // format rules: the last 5 bytes are literals, the last match starts 12 bytes before the end
+
+	const uint8_t *input = base + prefixSize;
+	const uint8_t *inputEnd = input + size;
+	const uint8_t *position = input;
+	const uint8_t *anchor = input;   // start of the pending literals
+
+	uint8_t *out = output;
+	uint8_t *outEnd = output + capacity;
+
+	if (size > matchFindLimit)
+	{
+		const uint8_t *matchLimit = inputEnd - lastLiterals;
+		const uint8_t *searchLimit = inputEnd - matchFindLimit;
+
+		while (position < searchLimit)
+		{
+			uint32_t sequence = Lz4Read32(position);
+			uint32_t &entry = table[Lz4Hash(sequence)];
+			const uint8_t *match = base + entry;
+			entry = static_cast<uint32_t>(position - base);
+
+			if (match >= position || static_cast<size_t>(position - match) > sLz4MaxDistance || Lz4Read32(match) != sequence)
+			{
+				position++;
+				continue;
+			}
+
+			while (position > anchor && match > base && position[-1] == match[-1])   // extend backwards into the literals
+			{
+				position--;
+				match--;
+			}
+
+			const uint8_t *matchEnd = position + minMatch;
+			for (const uint8_t *reference = match + minMatch; matchEnd < matchLimit && *matchEnd == *reference; reference++)
+				matchEnd++;
+
+			size_t literals = static_cast<size_t>(position - anchor);
+			size_t matchLength = static_cast<size_t>(matchEnd - position) - minMatch;
+
+			if (static_cast<size_t>(outEnd - out) < 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1)
+				return 0;
+
+			uint8_t *token = out++;
+			*token = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+			if (literals >= 15)
+				out = Lz4WriteLength(out, literals - 15);
+
+			std::memcpy(out, anchor, literals);
+			out += literals;
+
+			size_t offset = static_cast<size_t>(position - match);
+			*out++ = static_cast<uint8_t>(offset);
+			*out++ = static_cast<uint8_t>(offset >> 8);
+
+			*token |= static_cast<uint8_t>(matchLength < 15 ? matchLength : 15);
+			if (matchLength >= 15)
+				out = Lz4WriteLength(out, matchLength - 15);
+
+			position = anchor = matchEnd;
+
+			if (position < searchLimit)   // the position just before the next search is a likely match start too
+				table[Lz4Hash(Lz4Read32(position - 2))] = static_cast<uint32_t>(position - 2 - base);
+		}
+	}
+
+	size_t literals = static_cast<size_t>(inputEnd - anchor);   // last sequence: literals only
+
+	if (static_cast<size_t>(outEnd - out) < 1 + literals / 255 + 1 + literals)
+		return 0;
+
+	uint8_t *token = out++;
+	*token = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+	if (literals >= 15)
+		out = Lz4WriteLength(out, literals - 15);
+
+	std::memcpy(out, anchor, literals);
+	out += literals;
+
+	return static_cast<size_t>(out - output);
+}
+
+// decompresses exactly outputSize bytes, matches may reach back into prefix; false on malformed input
+inline bool Lz4Decompress(const uint8_t *input, size_t inputSize, uint8_t *output, size_t outputSize, const uint8_t *prefix = nullptr, size_t prefixSize = 0)
+{
+	const uint8_t *in = input;
+	const uint8_t *inEnd = input + inputSize;
+	uint8_t *out = output;
+	uint8_t *outEnd = output + outputSize;
+
+	while (in < inEnd)
+	{
+		unsigned token = *in++;
+
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			uint8_t extra;
+			do
+			{
+				if (in == inEnd)
+					return false;
+
+				extra = *in++;
+				literals += extra;
+			} while (extra == 255);
+		}
+
+		if (literals > static_cast<size_t>(inEnd - in) || literals > static_cast<size_t>(outEnd - out))
+			return false;
+
+		std::memcpy(out, in, literals);
+		out += literals;
+		in += literals;
+
+		if (in == inEnd)   // the last sequence has no match
+			break;
+
+		if (inEnd - in < 2)
+			return false;
+
+		size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+		in += 2;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			uint8_t extra;
+			do
+			{
+				if (in == inEnd)
+					return false;
+
+				extra = *in++;
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		matchLength += 4;
+
+		size_t produced = static_cast<size_t>(out - output);
+
+		if (offset == 0 || offset > produced + prefixSize || matchLength > static_cast<size_t>(outEnd - out))
+			return false;
+
+		if (offset > produced)   // starts in the prefix
+		{
+			size_t fromPrefix = offset - produced < matchLength ? offset - produced : matchLength;
+			std::memcpy(out, prefix + prefixSize - (offset - produced), fromPrefix);
+
+			out += fromPrefix;
+			matchLength -= fromPrefix;
+		}
+
+		const uint8_t *match = out - offset;
+
+		if (offset >= matchLength)
+			std::memcpy(out, match, matchLength);
+		else
+			for (size_t i = 0; i < matchLength; i++)   // overlapping: repeats the last offset bytes
+				out[i] = match[i];
+
+		out += matchLength;
+	}
+
+	return out == outEnd;
+}
+
+#endif  // LZ4_H
@@ -1,16 +1,24 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
-#include "Vector.h"
+#include "SmallBuffer.h"
 #include <string>
+#include <memory>
+#include <chrono>
 
 template <typename T>
 class Connection;
 
+template <typename T>
+class DatagramChannel;
+
+struct TraceSpan;
+
 template <typename T>
 class Message
 {
 	friend class Connection<T>;
+	friend class DatagramChannel<T>;
 public:
 
 	/*template <typename D>
@@ -37,10 +45,18 @@ public:
 		return message;
 	}*/
 
-	Message(T type) : mHeader{ type, 0U } {}
+	Message(T type) : mHeader{ type, 0U, 0U, 0U } {}
 
 	T GetType() const { return mHeader.mType; }
 
+	uint32_t GetCorrelationId() const { return mHeader.mCorrelationId; }           // 0 unless the message is an rpc request or response
+	void SetCorrelationId(uint32_t correlationId) { mHeader.mCorrelationId = correlationId; }
+
+	bool IsStreamChunk() const { return (mHeader.mFlags & FLAG_STREAM) != 0; }   // delivered through OnStreamChunk, not OnMessage
+	uint32_t GetStreamId() const { return mHeader.mCorrelationId; }              // a chunk carries its stream's id instead
+	const uint8_t *GetBody() const { return mBody.Data(); }                     // raw body, for chunks read as a whole
+	uint32_t GetBodySize() const { return static_cast<uint32_t>(mBody.Size()); }
+
 	template <typename D>
 	Message<T> &operator<<(D const &data)
 	{
@@ -114,13 +130,29 @@ public:
 private:
 	Message() = default;  // only Connection<T> can call default ctor
 
+	enum : uint8_t
+	{
+		FLAG_COMPRESSED = 0x01,             // body is compressed (see CompressBody)
+		FLAG_DICTIONARY = 0x02,             // ... against the connection's dictionary
+		FLAG_CONTROL = 0x04,                // connection level message, never delivered
+		FLAG_BATCH = 0x08,                  // body packs several messages (see Connection<T>::AddToBatch)
+		FLAG_FRAGMENT = 0x10,               // more fragments of this message follow on the same lane
+		FLAG_LANE_MASK = 0x60,              // priority lane the frame was sent on
+		FLAG_LANE_SHIFT = 5,
+		FLAG_STREAM = 0x80,                 // chunk of a stream, the correlation id is the stream's (see Stream.h)
+	};
+
 	struct Header
 	{
 		T mType = T();  // T mType{};       // type of message (enum)
+		uint8_t mFlags = 0U;                // FLAG_*, set and cleared by the connection
 		uint32_t mSize = 0U;                // size of message's body
+		uint32_t mCorrelationId = 0U;       // pairs an rpc response with its request
 	} mHeader;
 
-	Vector<uint8_t> mBody;                  // message data
+	static const size_t sInlineBodySize = 48;   // most messages (ids, a few integers) fit, they never allocate
+
+	SmallBuffer<sInlineBodySize> mBody;     // message data
 };   
 
 template <typename T>
@@ -129,11 +161,15 @@ class OwnedMessage : public Message<T>
 private:
 	using ConnectionPtr = std::shared_ptr<Connection<T>>;
 public:
-	OwnedMessage(ConnectionPtr sender, const Message<T> &message) : mSender(sender), Message<T>(message) {}
+	OwnedMessage(ConnectionPtr sender, const Message<T> &message, std::shared_ptr<TraceSpan> trace = nullptr) : mSender(sender), Message<T>(message), mTrace(std::move(trace)) {}
 
 	ConnectionPtr GetSender() const { return mSender; }
+	std::chrono::steady_clock::time_point GetReceived() const { return mReceived; }   // queued by the connection
+	const std::shared_ptr<TraceSpan> &GetTrace() const { return mTrace; }           // the sender sampled it for tracing (see Trace.h)
 private:
 	ConnectionPtr mSender;
+	std::chrono::steady_clock::time_point mReceived = std::chrono::steady_clock::now();
+	std::shared_ptr<TraceSpan> mTrace;
 };
 
 #endif  // MESSAGE_H
@@ -0,0 +1,316 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include "NetError.h"
+#include "Vector.h"
+
+// what the connections did: counters and latency histograms, read with Server<T>::GetMetrics / Client<T>::GetMetrics
+// and written out by FormatMetrics (Prometheus text format); a connection's counters are written by its own thread,
+// so the increments stay uncontended, the server's totals are only summed up when a snapshot is taken
+
+enum class Metric
+{
+	MESSAGES_IN,       // queued for the owner: batched messages and stream chunks count one by one, control frames not at all
+	MESSAGES_OUT,      // taken for sending (or added to a batch), same rules
+	BYTES_IN,          // from the socket (or the shared memory channel), frame headers included
+	BYTES_OUT,
+	SEND_CALLS,        // send / sendfile (io_uring: writes submitted, shared memory: ring writes), also those that would block
+	RECEIVE_CALLS,     // recv that got data or would block (io_uring: receive completions, shared memory: ring reads)
+	PARTIAL_SENDS,     // sends that took less than offered
+	SEND_BLOCKED,      // sends that found the send buffer (or the ring) full
+	RATE_DROPPED,      // received messages a rate limit dropped (see RateLimit.h)
+	RATE_DELAYED,      // ... that waited for a rate limit
+
+	COUNT
+};
+
+inline const char *MetricName(Metric metric)
+{
+	static const char *names[] = { "messages_in", "messages_out", "bytes_in", "bytes_out", "send_calls", "receive_calls", "partial_sends", "send_blocked", "rate_dropped", "rate_delayed" };
+	static_assert(sizeof names / sizeof names[0] == static_cast<size_t>(Metric::COUNT), "missing metric name");
+
+	return names[static_cast<size_t>(metric)];
+}
+
+// a cache line of its own: the connection's thread writes it while others read the neighbours; only where new honours
+// the alignment (C++17), else the connections and endpoints holding it would be allocated misaligned
+#ifdef __cpp_aligned_new
+#define METRICS_ALIGNMENT alignas(64)
+#else
+#define METRICS_ALIGNMENT
+#endif
+
+class METRICS_ALIGNMENT MetricCounters
+{
+public:
+	void Add(Metric metric, uint64_t value = 1U) { mCounts[static_cast<size_t>(metric)].fetch_add(value, std::memory_order_relaxed); }
+	void Add(const MetricCounters &other)
+	{
+		for (size_t i = 0; i < static_cast<size_t>(Metric::COUNT); i++)
+			mCounts[i].fetch_add(other.mCounts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	uint64_t Get(Metric metric) const { return mCounts[static_cast<size_t>(metric)].load(std::memory_order_relaxed); }
+private:
+	std::atomic<uint64_t> mCounts[static_cast<size_t>(Metric::COUNT)] = {};
+};
+
+struct HistogramSnapshot
+{
+	Vector<uint64_t> mCounts;        // per bucket of LatencyHistogram
+	uint64_t mCount = 0U;
+	uint64_t mSum = 0U;              // nanoseconds
+	uint64_t mMax = 0U;
+
+	uint64_t Percentile(double fraction) const;   // nanoseconds: the top of the bucket holding it (within 6%), 0 if empty
+};
+
+// HDR style: 16 linear buckets per power of 2 of nanoseconds, so any value is known within 1/16 of itself;
+// recording is a few relaxed atomics, no allocation, no lock
+class LatencyHistogram
+{
+public:
+	static const unsigned sSubBucketBits = 4;
+	static const unsigned sMaxBits = 40;   // 2^40 ns, about 18 minutes: larger values land in the last bucket
+	static const size_t sBucketCount = (sMaxBits - sSubBucketBits + 1) << sSubBucketBits;
+
+	void Record(uint64_t nanoseconds);
+	void Record(std::chrono::steady_clock::duration elapsed)
+	{
+		long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		Record(static_cast<uint64_t>(nanoseconds > 0 ? nanoseconds : 0));
+	}
+	HistogramSnapshot Snapshot() const;
+
+	static size_t BucketIndex(uint64_t value);
+	static uint64_t BucketStart(size_t index);   // lowest value of the bucket
+private:
+	std::atomic<uint64_t> mCounts[sBucketCount] = {};   // their sum is the count
+	std::atomic<uint64_t> mSum{ 0U };
+	std::atomic<uint64_t> mMax{ 0U };
+};
+
+inline size_t LatencyHistogram::BucketIndex(uint64_t value)
+{
+	const uint64_t subBuckets = 1U << sSubBucketBits;
+
+	if (value >= (1ULL << sMaxBits))
+		return sBucketCount - 1;
+
+	if (value < subBuckets)
+		return static_cast<size_t>(value);
+
+	unsigned bits = 0;   // position of the highest bit
+#if defined(__GNUC__) || defined(__clang__)
+	bits = 63U - static_cast<unsigned>(__builtin_clzll(value));
+#else
+	for (uint64_t rest = value; rest > 1U; rest >>= 1)
+		bits++;
+#endif
+
+	return static_cast<size_t>((bits - sSubBucketBits + 1) * subBuckets + ((value >> (bits - sSubBucketBits)) - subBuckets));
+}
+
+inline uint64_t LatencyHistogram::BucketStart(size_t index)
+{
+	const uint64_t subBuckets = 1U << sSubBucketBits;
+
+	if (index < subBuckets)
+		return index;
+
+	unsigned bits = static_cast<unsigned>(index >> sSubBucketBits) + sSubBucketBits - 1;
+
+	return (subBuckets + (index & (subBuckets - 1))) << (bits - sSubBucketBits);
+}
+
+inline void LatencyHistogram::Record(uint64_t nanoseconds)
+{
+	mCounts[BucketIndex(nanoseconds)].fetch_add(1U, std::memory_order_relaxed);
+	mSum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+	uint64_t max = mMax.load(std::memory_order_relaxed);
+	while (nanoseconds > max && !mMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+		;
+}
+
+inline HistogramSnapshot LatencyHistogram::Snapshot() const
+{
+	HistogramSnapshot snapshot;
+	snapshot.mCounts.Resize(sBucketCount, 0U);
+
+	for (size_t i = 0; i < sBucketCount; i++)   // read one by one while recording goes on: the count is theirs, so the percentiles add up
+	{
+		snapshot.mCounts[static_cast<int>(i)] = mCounts[i].load(std::memory_order_relaxed);
+		snapshot.mCount += snapshot.mCounts[static_cast<int>(i)];
+	}
+
+	snapshot.mSum = mSum.load(std::memory_order_relaxed);
+	snapshot.mMax = mMax.load(std::memory_order_relaxed);
+
+	return snapshot;
+}
+
+inline uint64_t HistogramSnapshot::Percentile(double fraction) const
+{
+	if (mCount == 0U)
+		return 0U;
+
+	uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(mCount) + 0.5);
+	rank = rank < 1U ? 1U : rank > mCount ? mCount : rank;
+
+	uint64_t seen = 0U;
+	for (size_t i = 0; i < mCounts.Size(); i++)
+	{
+		seen += mCounts[static_cast<int>(i)];
+
+		if (seen >= rank)
+		{
+			uint64_t top = i + 1 < LatencyHistogram::sBucketCount ? LatencyHistogram::BucketStart(i + 1) - 1 : mMax;
+			return top < mMax ? top : mMax;
+		}
+	}
+
+	return mMax;
+}
+
+struct HandlerStats   // a message type's (see Handlers.h)
+{
+	uint32_t mType = 0U;
+	uint64_t mCalls = 0U;            // messages ProcessMessage took, handled by a typed handler or the callbacks
+	uint64_t mSum = 0U;              // nanoseconds in them
+	uint64_t mMax = 0U;
+	uint64_t mMalformed = 0U;        // bodies the typed handler's struct couldn't be decoded from
+};
+
+struct ConnectionMetrics
+{
+	uint32_t mId = 0U;
+	std::string mHost;
+	uint16_t mPort = 0U;
+
+	uint64_t mCounts[static_cast<size_t>(Metric::COUNT)] = {};
+	size_t mQueuedOut = 0;              // messages waiting in its lanes
+	HistogramSnapshot mSendLatency;     // from Send to its last frame taken for the socket
+
+	uint64_t Get(Metric metric) const { return mCounts[static_cast<size_t>(metric)]; }
+};
+
+// a Server<T>'s (or a Client<T>'s) view
+struct EndpointMetrics
+{
+	uint64_t mCounts[static_cast<size_t>(Metric::COUNT)] = {};               // all connections, closed ones included
+	uint64_t mDisconnects[static_cast<size_t>(ErrorKind::COUNT)] = {};       // by the error the connection closed with, NONE: closed cleanly
+	size_t mQueuedIn = 0;                                                     // received, ProcessMessage hasn't taken them yet
+	HistogramSnapshot mDispatchLatency;                                       // from received to ProcessMessage
+	HistogramSnapshot mHandlerLatency;                                        // time in the callbacks ProcessMessage calls
+	Vector<HandlerStats> mHandlers;                                           // ... by message type, the costliest first (times once TimeHandlers is on)
+
+	Vector<ConnectionMetrics> mConnections;                                   // the open ones
+
+	uint64_t Get(Metric metric) const { return mCounts[static_cast<size_t>(metric)]; }
+};
+
+namespace MetricsFormat
+{
+	inline std::string Number(double value)
+	{
+		char buffer[32];
+		std::snprintf(buffer, sizeof buffer, "%.9g", value);
+
+		return buffer;
+	}
+
+	inline std::string Labels(const ConnectionMetrics &connection)   // without the braces
+	{
+		std::string host;
+		for (char c : connection.mHost)   // a unix socket path may hold anything
+			if (c == '\n')
+				host += "\\n";
+			else
+			{
+				if (c == '\\' || c == '"')
+					host += '\\';
+				host += c;
+			}
+
+		return "id=\"" + std::to_string(connection.mId) + "\",host=\"" + host + "\",port=\"" + std::to_string(connection.mPort) + "\"";
+	}
+
+	inline void Summary(std::string &out, const std::string &name, const HistogramSnapshot &histogram, const std::string &labels)   // labels without braces
+	{
+		static const char *quantiles[] = { "0.5", "0.9", "0.99", "0.999", "1" };
+		static const double fractions[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+		for (size_t i = 0; i < sizeof fractions / sizeof fractions[0]; i++)
+			out += name + "{" + labels + (labels.empty() ? "" : ",") + "quantile=\"" + quantiles[i] + "\"} " + Number(histogram.Percentile(fractions[i]) / 1e9) + "\n";
+
+		out += name + "_sum" + (labels.empty() ? "" : "{" + labels + "}") + " " + Number(histogram.mSum / 1e9) + "\n";
+		out += name + "_count" + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(histogram.mCount) + "\n";
+	}
+}
+
+// Prometheus text exposition: the endpoint's totals, then every open connection's, labelled with its id, host and port
+inline std::string FormatMetrics(const EndpointMetrics &metrics, const std::string &prefix = "net")
+{
+	std::string out;
+
+	for (size_t m = 0; m < static_cast<size_t>(Metric::COUNT); m++)
+	{
+		std::string name = prefix + "_" + MetricName(static_cast<Metric>(m)) + "_total";
+		out += "# TYPE " + name + " counter\n" + name + " " + std::to_string(metrics.mCounts[m]) + "\n";
+	}
+
+	std::string name = prefix + "_disconnects_total";
+	out += "# TYPE " + name + " counter\n";
+	for (size_t k = 0; k < static_cast<size_t>(ErrorKind::COUNT); k++)
+		if (metrics.mDisconnects[k] > 0U || k == static_cast<size_t>(ErrorKind::NONE))
+			out += name + "{reason=\"" + ErrorKindName(static_cast<ErrorKind>(k)) + "\"} " + std::to_string(metrics.mDisconnects[k]) + "\n";
+
+	out += "# TYPE " + prefix + "_connections gauge\n" + prefix + "_connections " + std::to_string(metrics.mConnections.Size()) + "\n";
+	out += "# TYPE " + prefix + "_queued_in gauge\n" + prefix + "_queued_in " + std::to_string(metrics.mQueuedIn) + "\n";
+
+	out += "# TYPE " + prefix + "_dispatch_latency_seconds summary\n";
+	MetricsFormat::Summary(out, prefix + "_dispatch_latency_seconds", metrics.mDispatchLatency, "");
+	out += "# TYPE " + prefix + "_handler_latency_seconds summary\n";
+	MetricsFormat::Summary(out, prefix + "_handler_latency_seconds", metrics.mHandlerLatency, "");
+
+	static const char *handlerNames[] = { "_handler_calls_total", "_handler_seconds_total", "_handler_max_seconds", "_handler_malformed_total" };
+	static const char *handlerTypes[] = { "counter", "counter", "gauge", "counter" };
+	for (size_t h = 0; h < sizeof handlerNames / sizeof handlerNames[0]; h++)
+	{
+		name = prefix + handlerNames[h];
+		out += "# TYPE " + name + " " + handlerTypes[h] + "\n";
+		for (const HandlerStats &handler : metrics.mHandlers)
+		{
+			std::string value = h == 0 ? std::to_string(handler.mCalls) : h == 1 ? MetricsFormat::Number(handler.mSum / 1e9) : h == 2 ? MetricsFormat::Number(handler.mMax / 1e9) : std::to_string(handler.mMalformed);
+			out += name + "{type=\"" + std::to_string(handler.mType) + "\"} " + value + "\n";
+		}
+	}
+
+	for (size_t m = 0; m < static_cast<size_t>(Metric::COUNT); m++)   // grouped by metric, as the format wants
+	{
+		name = prefix + "_connection_" + MetricName(static_cast<Metric>(m)) + "_total";
+		out += "# TYPE " + name + " counter\n";
+		for (const ConnectionMetrics &connection : metrics.mConnections)
+			out += name + "{" + MetricsFormat::Labels(connection) + "} " + std::to_string(connection.mCounts[m]) + "\n";
+	}
+
+	name = prefix + "_connection_queued_out";
+	out += "# TYPE " + name + " gauge\n";
+	for (const ConnectionMetrics &connection : metrics.mConnections)
+		out += name + "{" + MetricsFormat::Labels(connection) + "} " + std::to_string(connection.mQueuedOut) + "\n";
+
+	name = prefix + "_connection_send_latency_seconds";
+	out += "# TYPE " + name + " summary\n";
+	for (const ConnectionMetrics &connection : metrics.mConnections)
+		MetricsFormat::Summary(out, name, connection.mSendLatency, MetricsFormat::Labels(connection));
+
+	return out;
+}
+
+#endif  // METRICS_H
@@ -0,0 +1,56 @@
+#ifndef NET_ERROR_H
+#define NET_ERROR_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// failures are reported to Server<T>::OnError / Client<T>::OnError and counted per kind,
+// a failed connection is closed on its own, the process and the other connections carry on
+enum class ErrorKind
+{
+	NONE,
+	RESOLVE,           // getaddrinfo (code is the getaddrinfo error)
+	SOCKET,            // socket creation
+	BIND,
+	LISTEN,
+	ACCEPT,
+	CONNECT,           // connect refused or failed for every address
+	CONNECT_TIMEOUT,
+	SOCKET_MODE,       // switching the socket to non blocking i/o
+	SEND,
+	RECEIVE,
+	IO_URING,          // ring submission, wakeup or receive buffers
+	PROTOCOL,          // malformed frame (e.g. a compressed body that doesn't decompress)
+	SHARED_MEMORY,     // setting up a shared memory channel (memfd, mmap, eventfd or the descriptor handshake)
+	TLS,               // tls setup or handshake (code is the OpenSSL reason, errno, or 0)
+	IDLE_TIMEOUT,      // nothing arrived for TimerOptions::mIdleTimeout
+	RATE_LIMIT,        // the peer went over a RateLimit with the DISCONNECT policy
+
+	COUNT
+};
+
+inline const char *ErrorKindName(ErrorKind kind)
+{
+	static const char *names[] = { "none", "resolve", "socket", "bind", "listen", "accept", "connect", "connect timeout", "socket mode", "send", "receive", "io_uring", "protocol", "shared memory", "tls", "idle timeout", "rate limit" };
+	static_assert(sizeof names / sizeof names[0] == static_cast<size_t>(ErrorKind::COUNT), "missing error kind name");
+
+	return names[static_cast<size_t>(kind)];
+}
+
+struct SocketError
+{
+	ErrorKind mKind = ErrorKind::NONE;
+	int mCode = 0;     // errno / WSAGetLastError() value
+};
+
+class ErrorCounters
+{
+public:
+	void Increment(ErrorKind kind) { mCounts[static_cast<size_t>(kind)].fetch_add(1U, std::memory_order_relaxed); }
+	uint64_t Get(ErrorKind kind) const { return mCounts[static_cast<size_t>(kind)].load(std::memory_order_relaxed); }
+private:
+	std::atomic<uint64_t> mCounts[static_cast<size_t>(ErrorKind::COUNT)] = {};
+};
+
+#endif  // NET_ERROR_H
@@ -0,0 +1,170 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include "Vector.h"
+
+enum class RateLimitPolicy : uint8_t
+{
+	DROP,         // the message is discarded
+	DELAY,        // the message takes a token ahead of time, the connection stops reading until then and tcp holds back the sender (a datagram is dropped)
+	DISCONNECT,   // the connection is closed with ErrorKind::RATE_LIMIT
+};
+
+struct RateLimit
+{
+	double mRate = 0.0;     // messages per second, 0: no limit
+	double mBurst = 1.0;    // messages let through at once after a quiet spell
+	RateLimitPolicy mPolicy = RateLimitPolicy::DROP;
+};
+
+// limits on the messages a Server<T> receives, applied by the receiving connection before a message is queued for
+// ProcessMessage: its type's limit, then the connection's, then the global one (a message turned away by one gives
+// back what it took from the ones before, so a flood of one type doesn't use up the connection's or everyone's budget);
+// control frames and stream chunks (credit limits those already) aren't counted
+struct RateLimitOptions
+{
+	RateLimit mConnection;      // each connection's messages
+	RateLimit mGlobal;          // all connections' messages together
+	Vector<RateLimit> mTypes;   // each connection's messages of a type, by the type's value
+
+	void SetTypeLimit(uint32_t type, const RateLimit &limit)
+	{
+		if (type >= mTypes.Size())
+			mTypes.Resize(type + 1U);
+		mTypes[static_cast<int>(type)] = limit;
+	}
+
+	bool IsEnabled() const
+	{
+		bool enabled = mConnection.mRate > 0.0 || mGlobal.mRate > 0.0;
+		for (size_t i = 0; i < mTypes.Size(); i++)
+			enabled = enabled || mTypes[static_cast<int>(i)].mRate > 0.0;
+
+		return enabled;
+	}
+};
+
+// token bucket kept as the time it runs empty at (GCRA): a take moves that time one token's interval on, unless it's
+// more than the burst ahead of now; one compare-and-swap, no refill step, safe from any thread
+class TokenBucket
+{
+public:
+	void Configure(const RateLimit &limit)
+	{
+		mInterval = limit.mRate > 0.0 ? std::max<int64_t>(1, static_cast<int64_t>(1e9 / limit.mRate)) : 0;
+		mTolerance = static_cast<int64_t>((std::max(limit.mBurst, 1.0) - 1.0) * static_cast<double>(mInterval));
+	}
+
+	bool IsLimited() const { return mInterval > 0; }
+
+	int64_t Take(int64_t now)   // 0: taken, else nanoseconds until there's one
+	{
+		int64_t emptyAt = mEmptyAt.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			int64_t from = std::max(emptyAt, now);
+			if (from - now > mTolerance)
+				return from - now - mTolerance;
+
+			if (mEmptyAt.compare_exchange_weak(emptyAt, from + mInterval, std::memory_order_relaxed))
+				return 0;
+		}
+	}
+
+	void Force(int64_t now)   // takes one even if there's none: the bucket is in debt until it would have had it
+	{
+		int64_t emptyAt = mEmptyAt.load(std::memory_order_relaxed);
+		while (!mEmptyAt.compare_exchange_weak(emptyAt, std::max(emptyAt, now) + mInterval, std::memory_order_relaxed))
+			;
+	}
+
+	void GiveBack() { mEmptyAt.fetch_sub(mInterval, std::memory_order_relaxed); }
+private:
+	int64_t mInterval = 0;        // nanoseconds per token
+	int64_t mTolerance = 0;       // how far ahead of now the empty time may be, burst - 1 intervals
+	std::atomic<int64_t> mEmptyAt{ 0 };
+};
+
+enum class RateVerdict { PASS, DROP, DELAY, DISCONNECT };
+
+// the options and the global bucket of a server, shared by its connections; each connection keeps its own Buckets
+class RateLimiter
+{
+public:
+	explicit RateLimiter(const RateLimitOptions &options) : mOptions(options) { mGlobal.Configure(options.mGlobal); }
+
+	class Buckets
+	{
+		friend class RateLimiter;
+
+		TokenBucket mConnection;
+		std::unique_ptr<TokenBucket[]> mTypes;   // by type value, up to the last limited one
+		size_t mTypeCount = 0;
+	};
+
+	void Configure(Buckets &buckets) const
+	{
+		buckets.mConnection.Configure(mOptions.mConnection);
+		buckets.mTypeCount = mOptions.mTypes.Size();
+		buckets.mTypes.reset(buckets.mTypeCount > 0 ? new TokenBucket[buckets.mTypeCount] : nullptr);
+
+		for (size_t i = 0; i < buckets.mTypeCount; i++)
+			buckets.mTypes[i].Configure(mOptions.mTypes[static_cast<int>(i)]);
+	}
+
+	// now and wait: nanoseconds; reserve: an empty bucket with the DELAY policy is taken from anyway (Force), the verdict is
+	// then DELAY and wait how long the connection should stop reading, unless a later bucket refuses it outright
+	RateVerdict Admit(Buckets &buckets, uint32_t type, int64_t now, int64_t &wait, bool reserve = false)
+	{
+		struct Check
+		{
+			TokenBucket *mBucket;
+			const RateLimit *mLimit;
+		} checks[] =
+		{
+			{ type < buckets.mTypeCount && buckets.mTypes[type].IsLimited() ? &buckets.mTypes[type] : nullptr, type < buckets.mTypeCount ? &mOptions.mTypes[static_cast<int>(type)] : nullptr },
+			{ buckets.mConnection.IsLimited() ? &buckets.mConnection : nullptr, &mOptions.mConnection },
+			{ mGlobal.IsLimited() ? &mGlobal : nullptr, &mOptions.mGlobal },
+		};
+
+		int64_t delay = 0;
+
+		for (size_t i = 0; i < sizeof checks / sizeof checks[0]; i++)
+		{
+			TokenBucket *bucket = checks[i].mBucket;
+			int64_t bucketWait;
+
+			if (!bucket || (bucketWait = bucket->Take(now)) == 0)
+				continue;
+
+			if (reserve && checks[i].mLimit->mPolicy == RateLimitPolicy::DELAY)
+			{
+				bucket->Force(now);
+				delay = std::max(delay, bucketWait);
+				continue;
+			}
+
+			for (size_t j = 0; j < i; j++)   // what the earlier ones gave goes back
+				if (checks[j].mBucket)
+					checks[j].mBucket->GiveBack();
+
+			wait = bucketWait;
+			return Verdict(checks[i].mLimit->mPolicy);
+		}
+
+		wait = delay;
+		return delay > 0 ? RateVerdict::DELAY : RateVerdict::PASS;
+	}
+private:
+	RateLimitOptions mOptions;
+	TokenBucket mGlobal;
+
+	static RateVerdict Verdict(RateLimitPolicy policy) { return policy == RateLimitPolicy::DROP ? RateVerdict::DROP : policy == RateLimitPolicy::DELAY ? RateVerdict::DELAY : RateVerdict::DISCONNECT; }
+};
+
+#endif  // RATE_LIMIT_H
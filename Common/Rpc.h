@@ -0,0 +1,194 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <chrono>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <exception>
+#include <functional>
+#include "Vector.h"
+#include "Message.h"
+
+class RpcTimeoutException : public std::exception {};
+
+// table of calls waiting for their response, keyed by the correlation id carried in the message header
+// the id packs the slot index (low 16 bits) and the slot's generation (high 16 bits), so completing a call
+// is an index plus a generation check and a late response to a reused slot is recognized as stale
+template <typename T>
+class PendingCalls
+{
+public:
+	using Callback = std::function<void(Message<T> *response)>;   // response is nullptr if the call timed out or failed
+	using TimePoint = std::chrono::steady_clock::time_point;
+
+	uint32_t Add(Callback &&callback, TimePoint deadline);   // returns the call's correlation id, 0 (callback untouched) if the table is full
+	bool Complete(uint32_t correlationId, Message<T> &response);
+	bool Fail(uint32_t correlationId);     // completes the call with nullptr (e.g. the request couldn't be sent)
+	void Expire(TimePoint now);
+	void FailAll();
+	bool Due(TimePoint now) const { return now.time_since_epoch().count() >= mEarliest.load(std::memory_order_relaxed); }   // Expire has something to do, without the lock
+
+	size_t Size() const { std::lock_guard<std::mutex> guard(mMutex); return mSlots.Size() - mFreeSlots.Size(); }
+private:
+	struct Slot
+	{
+		Callback mCallback;
+		uint16_t mGeneration = 1U;
+		bool mInUse = false;
+	};
+
+	using Deadline = std::pair<TimePoint, uint32_t>;
+
+	mutable std::mutex mMutex;
+	Vector<Slot> mSlots;
+	Vector<uint16_t> mFreeSlots;
+	std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> mDeadlines;   // entries of completed calls are skipped when they expire
+	std::atomic<TimePoint::rep> mEarliest{ std::numeric_limits<TimePoint::rep>::max() };     // mDeadlines' top, written with mMutex held
+
+	static const size_t sMaxSlots = 1U << 16;
+
+	bool Take(uint32_t correlationId, Callback &callback);
+	void UpdateEarliest() { mEarliest.store(mDeadlines.empty() ? std::numeric_limits<TimePoint::rep>::max() : mDeadlines.top().first.time_since_epoch().count(), std::memory_order_relaxed); }
+};
+
+template <typename T>
+uint32_t PendingCalls<T>::Add(Callback &&callback, TimePoint deadline)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	uint16_t index;
+	if (!mFreeSlots.Empty())
+	{
+		index = mFreeSlots.Last();
+		mFreeSlots.RemoveLast();
+	}
+	else if (mSlots.Size() < sMaxSlots)
+	{
+		index = static_cast<uint16_t>(mSlots.Size());
+		mSlots.InsertLast(Slot());
+	}
+	else
+		return 0U;
+
+	Slot &slot = mSlots[index];
+	slot.mCallback = std::move(callback);
+	slot.mInUse = true;
+
+	uint32_t correlationId = static_cast<uint32_t>(slot.mGeneration) << 16 | index;
+	mDeadlines.push(Deadline(deadline, correlationId));
+	UpdateEarliest();
+
+	return correlationId;
+}
+
+template <typename T>
+bool PendingCalls<T>::Take(uint32_t correlationId, Callback &callback)
+{
+	uint16_t index = correlationId & 0xFFFFU;
+
+	if (index >= mSlots.Size())
+		return false;
+
+	Slot &slot = mSlots[index];
+	if (!slot.mInUse || slot.mGeneration != correlationId >> 16)
+		return false;
+
+	callback = std::move(slot.mCallback);
+	slot.mCallback = nullptr;
+	slot.mInUse = false;
+
+	if (++slot.mGeneration == 0U)  // generation 0 would allow a correlation id of 0
+		slot.mGeneration = 1U;
+
+	mFreeSlots.InsertLast(index);
+
+	return true;
+}
+
+template <typename T>
+bool PendingCalls<T>::Complete(uint32_t correlationId, Message<T> &response)
+{
+	Callback callback;
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		if (!Take(correlationId, callback))
+			return false;
+	}
+
+	callback(&response);   // outside the lock, the callback may issue new calls
+
+	return true;
+}
+
+template <typename T>
+bool PendingCalls<T>::Fail(uint32_t correlationId)
+{
+	Callback callback;
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		if (!Take(correlationId, callback))
+			return false;
+	}
+
+	callback(nullptr);
+
+	return true;
+}
+
+template <typename T>
+void PendingCalls<T>::Expire(TimePoint now)
+{
+	Vector<Callback> expired;
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		while (!mDeadlines.empty() && mDeadlines.top().first <= now)
+		{
+			Callback callback;
+			if (Take(mDeadlines.top().second, callback))
+				expired.InsertLast(std::move(callback));
+
+			mDeadlines.pop();
+		}
+
+		UpdateEarliest();
+	}
+
+	for (Callback &callback : expired)
+		callback(nullptr);
+}
+
+template <typename T>
+void PendingCalls<T>::FailAll()
+{
+	Vector<Callback> failed;
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		while (!mDeadlines.empty())
+		{
+			Callback callback;
+			if (Take(mDeadlines.top().second, callback))
+				failed.InsertLast(std::move(callback));
+
+			mDeadlines.pop();
+		}
+
+		UpdateEarliest();
+	}
+
+	for (Callback &callback : failed)
+		callback(nullptr);
+}
+
+#endif  // RPC_H
@@ -0,0 +1,281 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <string>
+#include <cstring>
+#include "LocalSocket.h"
+
+class ShmChannel;
+
+// same-host connections through shared memory: Client<T>::Connect("shm:///path/to/socket", 0) reaches a server started
+// with Server<T>::StartLocal("/path/to/socket"); the unix socket only carries the channel's descriptors and tells either
+// side when the other one is gone, the frames go through the channel's rings
+static const char sSharedMemoryScheme[] = "shm://";
+
+inline bool IsSharedMemoryAddress(const std::string &host) { return host.compare(0, sizeof sSharedMemoryScheme - 1, sSharedMemoryScheme) == 0; }
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstdint>
+
+// two byte rings in a memfd mapping, one per direction, each with one writer and one reader; a side about to block
+// says so in the shared header, the other side then writes its eventfd after making progress (data to read, or space to write)
+class ShmChannel
+{
+public:
+	enum Side : unsigned { CLIENT, SERVER };
+	enum Sleep : uint32_t { AWAKE, SLEEP_FOR_DATA, SLEEP_FOR_SPACE };   // SLEEP_FOR_SPACE: also wake on space in the outgoing ring
+
+	static const size_t sRingSize = 1024 * 1024;   // per direction, a power of 2
+
+	static std::shared_ptr<ShmChannel> Create(SocketError &error);   // client side: new memory and eventfds
+
+	~ShmChannel();
+	ShmChannel(const ShmChannel&) = delete;
+	ShmChannel &operator=(const ShmChannel&) = delete;
+
+	// handshake over the connected unix socket: the client sends the memfd and both eventfds (SCM_RIGHTS), the server adopts them
+	bool SendDescriptors(int socket, SocketError &error) const;
+	static std::shared_ptr<ShmChannel> Adopt(const int fds[3], SocketError &error);   // owns them from then on
+
+	size_t Write(const void *data, size_t size);       // as much of data as fits, wakes the peer if it sleeps
+	const uint8_t *Readable(size_t &size) const;       // contiguous bytes to read (size 0 if none), valid until Release
+	void Release(size_t size);                         // they were read, wakes the peer if it waits for space
+	bool Corrupt() const { return mCorrupt; }          // the peer wrote positions that make no sense
+
+	bool CanRead() const { return Incoming().mHead.load(std::memory_order_acquire) != Incoming().mTail.load(std::memory_order_relaxed); }
+	bool CanWrite() const { return Outgoing().mHead.load(std::memory_order_relaxed) - Outgoing().mTail.load(std::memory_order_acquire) < sRingSize; }
+
+	// going to sleep: set the state, check CanRead/CanWrite and the connection's queues again, then Wait
+	void SetSleep(Sleep sleep) { mShared->mSleep[mSide].store(sleep, std::memory_order_seq_cst); }
+	bool Wait(int socket, int timeout);                // false if the peer closed the socket
+	void WakeSelf();                                   // another thread of this side queued something
+
+private:
+	struct Ring
+	{
+		alignas(64) std::atomic<uint64_t> mHead;       // bytes ever written, by the writer
+		alignas(64) std::atomic<uint64_t> mTail;       // bytes ever read, by the reader
+	};
+
+	struct Shared
+	{
+		alignas(64) std::atomic<uint32_t> mSleep[2];   // per side
+		Ring mRings[2];                                // per writing side
+	};
+
+	static const size_t sDataOffset = 4096;            // the rings' data follows the header's page
+	static const size_t sMappingSize = sDataOffset + 2 * sRingSize;
+
+	ShmChannel(Side side, int memoryFd, int clientEventFd, int serverEventFd) : mSide(side), mMemoryFd(memoryFd), mEventFds{ clientEventFd, serverEventFd } {}
+	bool Map(SocketError &error);
+
+	Ring &Outgoing() const { return mShared->mRings[mSide]; }
+	Ring &Incoming() const { return mShared->mRings[1 - mSide]; }
+	uint8_t *Data(unsigned side) const { return reinterpret_cast<uint8_t*>(mShared) + sDataOffset + side * sRingSize; }
+	void Signal(unsigned side) const;
+
+	Side mSide;
+	int mMemoryFd;
+	int mEventFds[2];                                  // per side, written to wake it
+	Shared *mShared = nullptr;
+	mutable bool mCorrupt = false;
+};
+
+inline std::shared_ptr<ShmChannel> ShmChannel::Create(SocketError &error)
+{
+	int memoryFd = memfd_create("shm-channel", MFD_CLOEXEC);
+	if (memoryFd < 0 || ftruncate(memoryFd, sMappingSize) != 0)
+	{
+		error = { ErrorKind::SHARED_MEMORY, errno };
+		if (memoryFd >= 0)
+			close(memoryFd);
+		return nullptr;
+	}
+
+	int clientEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	int serverEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	std::shared_ptr<ShmChannel> channel(new ShmChannel(CLIENT, memoryFd, clientEventFd, serverEventFd));   // closes what it got
+
+	if (clientEventFd < 0 || serverEventFd < 0)
+	{
+		error = { ErrorKind::SHARED_MEMORY, errno };
+		return nullptr;
+	}
+
+	if (!channel->Map(error))
+		return nullptr;
+
+	new (channel->mShared) Shared();   // zeroed by ftruncate already, constructed for the atomics' sake
+	return channel;
+}
+
+inline ShmChannel::~ShmChannel()
+{
+	if (mShared)
+		munmap(mShared, sMappingSize);
+
+	for (int fd : { mMemoryFd, mEventFds[CLIENT], mEventFds[SERVER] })
+		if (fd >= 0)
+			close(fd);
+}
+
+inline bool ShmChannel::Map(SocketError &error)
+{
+	void *memory = mmap(nullptr, sMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, mMemoryFd, 0);
+	if (memory == MAP_FAILED)
+	{
+		error = { ErrorKind::SHARED_MEMORY, errno };
+		return false;
+	}
+
+	mShared = static_cast<Shared*>(memory);
+	return true;
+}
+
+inline bool ShmChannel::SendDescriptors(int socket, SocketError &error) const
+{
+	int fds[3] = { mMemoryFd, mEventFds[CLIENT], mEventFds[SERVER] };
+
+	return SendLocalHello(socket, LocalTransport::SHARED_MEMORY, fds, error);
+}
+
+inline std::shared_ptr<ShmChannel> ShmChannel::Adopt(const int fds[3], SocketError &error)
+{
+	std::shared_ptr<ShmChannel> channel(new ShmChannel(SERVER, fds[0], fds[1], fds[2]));
+
+	struct stat status;
+	if (fstat(fds[0], &status) != 0 || static_cast<size_t>(status.st_size) < sMappingSize)   // the client owns the size
+	{
+		error = { ErrorKind::SHARED_MEMORY, EPROTO };
+		return nullptr;
+	}
+
+	return channel->Map(error) ? channel : nullptr;
+}
+
+inline size_t ShmChannel::Write(const void *data, size_t size)
+{
+	Ring &ring = Outgoing();
+
+	uint64_t head = ring.mHead.load(std::memory_order_relaxed);
+	uint64_t tail = ring.mTail.load(std::memory_order_acquire);
+
+	if (head - tail > sRingSize)
+	{
+		mCorrupt = true;
+		return 0;
+	}
+
+	size_t count = std::min(size, static_cast<size_t>(sRingSize - (head - tail)));
+	if (count == 0)
+		return 0;
+
+	size_t offset = static_cast<size_t>(head & (sRingSize - 1));
+	size_t first = std::min(count, sRingSize - offset);
+
+	std::memcpy(Data(mSide) + offset, data, first);
+	std::memcpy(Data(mSide), static_cast<const uint8_t*>(data) + first, count - first);
+
+	ring.mHead.store(head + count, std::memory_order_release);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);   // pairs with the peer's SetSleep: either it sees the data or we see it sleep
+	if (mShared->mSleep[1 - mSide].load(std::memory_order_relaxed) != AWAKE)
+		Signal(1 - mSide);
+
+	return count;
+}
+
+inline const uint8_t *ShmChannel::Readable(size_t &size) const
+{
+	Ring &ring = Incoming();
+
+	uint64_t head = ring.mHead.load(std::memory_order_acquire);
+	uint64_t tail = ring.mTail.load(std::memory_order_relaxed);
+
+	if (head - tail > sRingSize)
+	{
+		mCorrupt = true;
+		size = 0;
+		return nullptr;
+	}
+
+	size_t offset = static_cast<size_t>(tail & (sRingSize - 1));
+	size = std::min(static_cast<size_t>(head - tail), sRingSize - offset);
+
+	return Data(1 - mSide) + offset;
+}
+
+inline void ShmChannel::Release(size_t size)
+{
+	Ring &ring = Incoming();
+	ring.mTail.store(ring.mTail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mShared->mSleep[1 - mSide].load(std::memory_order_relaxed) == SLEEP_FOR_SPACE)
+		Signal(1 - mSide);
+}
+
+inline bool ShmChannel::Wait(int socket, int timeout)
+{
+	pollfd fds[2] = { { mEventFds[mSide], POLLIN, 0 }, { socket, POLLIN, 0 } };
+	poll(fds, 2, timeout);
+
+	uint64_t value;
+	if (fds[0].revents & POLLIN)
+		while (read(mEventFds[mSide], &value, sizeof value) > 0) {}
+
+	if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))   // nothing but the end is ever sent on the socket after the handshake
+	{
+		char byte;
+		return recv(socket, &byte, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN;
+	}
+
+	return true;
+}
+
+inline void ShmChannel::WakeSelf()
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mShared->mSleep[mSide].load(std::memory_order_relaxed) != AWAKE)
+		Signal(mSide);
+}
+
+inline void ShmChannel::Signal(unsigned side) const
+{
+	uint64_t value = 1U;
+	if (write(mEventFds[side], &value, sizeof value) < 0 && errno != EAGAIN)
+		mCorrupt = true;   // can't wake the peer: it may sleep forever, treat like a broken channel
+}
+
+// connects to the server's unix socket at the path of an shm:// address and hands it a new channel, INVALID_SOCKET on failure
+inline SOCKET SharedMemoryConnect(const std::string &address, std::shared_ptr<ShmChannel> &channel, sockaddr_storage &connectedAddress, SocketError &error)
+{
+	SOCKET connectionSocket = LocalConnect(address.substr(sizeof sSharedMemoryScheme - 1), connectedAddress, error);
+	if (connectionSocket == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+	channel = ShmChannel::Create(error);
+
+	if (!channel || !channel->SendDescriptors(connectionSocket, error))
+	{
+		channel = nullptr;
+		close(connectionSocket);
+		return INVALID_SOCKET;
+	}
+
+	return connectionSocket;
+}
+
+#endif  // __linux__
+
+#endif  // SHARED_MEMORY_H
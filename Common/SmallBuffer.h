@@ -0,0 +1,126 @@
+#ifndef SMALL_BUFFER_H
+#define SMALL_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+// byte buffer with InlineCapacity bytes of storage inside the object: smaller contents never touch the heap,
+// larger ones spill to a heap block that grows geometrically; bytes added by Resize are left uninitialized
+template <size_t InlineCapacity>
+class SmallBuffer
+{
+public:
+	SmallBuffer() : mData(mInline), mSize(0U), mCapacity(InlineCapacity) {}
+	explicit SmallBuffer(size_t size) : SmallBuffer() { Resize(size); }
+	SmallBuffer(const SmallBuffer &other) : SmallBuffer() { Assign(other.mData, other.mSize); }
+	SmallBuffer(SmallBuffer &&other) noexcept : SmallBuffer() { Steal(other); }
+
+	~SmallBuffer() { Release(); }
+
+	SmallBuffer &operator=(const SmallBuffer &other)
+	{
+		if (this != &other)
+			Assign(other.mData, other.mSize);   // reuses our storage when it's big enough
+
+		return *this;
+	}
+
+	SmallBuffer &operator=(SmallBuffer &&other) noexcept
+	{
+		if (this != &other)
+		{
+			Release();
+			Steal(other);
+		}
+
+		return *this;
+	}
+
+	size_t Size() const { return mSize; }
+	size_t Capacity() const { return mCapacity; }
+	bool Empty() const { return mSize == 0U; }
+	bool IsInline() const { return mData == mInline; }
+
+	uint8_t *Data() { return mData; }
+	const uint8_t *Data() const { return mData; }
+
+	void Resize(size_t size)
+	{
+		if (size > mCapacity)
+			Grow(size > 2 * mCapacity ? size : 2 * mCapacity);
+
+		mSize = size;
+	}
+
+	void Reserve(size_t capacity)
+	{
+		if (capacity > mCapacity)
+			Grow(capacity);
+	}
+
+	void Clear() { mSize = 0U; }   // keeps the storage
+private:
+	void Grow(size_t capacity)
+	{
+		uint8_t *data = static_cast<uint8_t*>(operator new(capacity));
+		std::memcpy(data, mData, mSize);
+
+		Release();
+
+		mData = data;
+		mCapacity = capacity;
+	}
+
+	void Assign(const uint8_t *data, size_t size)
+	{
+		if (size > mCapacity)   // exact fit, a copy is rarely appended to
+		{
+			Release();
+
+			mData = static_cast<uint8_t*>(operator new(size));
+			mCapacity = size;
+		}
+
+		std::memcpy(mData, data, size);
+		mSize = size;
+	}
+
+	void Steal(SmallBuffer &other)   // expects our storage released
+	{
+		if (other.IsInline())
+		{
+			mData = mInline;
+			mCapacity = InlineCapacity;
+			std::memcpy(mInline, other.mInline, other.mSize);
+		}
+		else
+		{
+			mData = other.mData;
+			mCapacity = other.mCapacity;
+
+			other.mData = other.mInline;
+			other.mCapacity = InlineCapacity;
+		}
+
+		mSize = other.mSize;
+		other.mSize = 0U;
+	}
+
+	void Release()
+	{
+		if (!IsInline())
+			operator delete(mData);
+
+		mData = mInline;
+		mCapacity = InlineCapacity;
+	}
+
+	uint8_t *mData;                    // mInline or a heap block
+	size_t mSize;
+	size_t mCapacity;
+	uint8_t mInline[InlineCapacity];
+};
+
+#endif  // SMALL_BUFFER_H
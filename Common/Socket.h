@@ -0,0 +1,73 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+// sockets api: WinSock on Windows, BSD sockets elsewhere behind the same names
+
+#ifdef _WIN32
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+inline int poll(pollfd *fds, unsigned long count, int timeout) { return WSAPoll(fds, count, timeout); }
+
+inline void BlockSigPipe() {}   // no SIGPIPE on Windows
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include <cstring>
+#include <cstdint>
+
+typedef int SOCKET;
+
+#define INVALID_SOCKET  (-1)
+#define SOCKET_ERROR    (-1)
+#define WSAEWOULDBLOCK  EWOULDBLOCK
+#define WSAEINPROGRESS  EINPROGRESS
+#define MAKEWORD(low, high)  ((uint16_t)(((uint8_t)(low)) | ((uint16_t)((uint8_t)(high))) << 8))
+
+struct WSAData {};
+
+inline int WSAStartup(uint16_t, WSAData *) { return 0; }
+inline int WSACleanup() { return 0; }
+inline int WSAGetLastError() { return errno; }
+
+inline int closesocket(SOCKET socket) { return close(socket); }
+
+inline int ioctlsocket(SOCKET socket, unsigned long command, unsigned long *argument)
+{
+	int value = static_cast<int>(*argument);
+	return ioctl(socket, command, &value);
+}
+
+// a send to a reset peer must fail with EPIPE instead of killing the process, without touching the application's SIGPIPE
+// disposition: send() is passed MSG_NOSIGNAL (ApplySocketOptions sets SO_NOSIGPIPE where there is no such flag), and the
+// threads running connections block the signal for what takes no flags (sendfile, SSL_write, io_uring writes); a SIGPIPE
+// raised on such a thread stays pending and goes away with it
+inline void BlockSigPipe()
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+#endif  // _WIN32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0   // Windows has no SIGPIPE, macOS uses SO_NOSIGPIPE instead
+#endif
+
+#endif  // SOCKET_H
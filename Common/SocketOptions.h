@@ -0,0 +1,100 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include "Socket.h"
+#include "debug.h"
+
+// tuning applied to the listen socket, to every accepted socket and to the client socket
+// a value of 0 leaves the operating system default in place
+// options the platform doesn't support (TCP_QUICKACK, SO_BUSY_POLL, TCP_NOTSENT_LOWAT are Linux only) are ignored,
+// so are the tcp ones on the unix sockets of unix:// and shm:// connections
+struct SocketOptions
+{
+	bool mNoDelay = false;           // TCP_NODELAY: header and body are sent separately, with Nagle a small body can wait for the peer's (delayed) ack
+	int mSendBufferSize = 0;         // SO_SNDBUF (bytes)
+	int mReceiveBufferSize = 0;      // SO_RCVBUF (bytes), set before listen/connect so the window scale is negotiated accordingly
+	bool mQuickAck = false;          // TCP_QUICKACK: not sticky, re-armed by the connection after every receive
+
+	bool mKeepAlive = false;         // SO_KEEPALIVE
+	int mKeepAliveIdle = 0;          // TCP_KEEPIDLE: seconds of inactivity before the first probe
+	int mKeepAliveInterval = 0;      // TCP_KEEPINTVL: seconds between probes
+	int mKeepAliveCount = 0;         // TCP_KEEPCNT: unanswered probes before the connection is dropped
+
+	int mBusyPoll = 0;               // SO_BUSY_POLL: microseconds to busy poll the device queue on receive
+	int mNotSentLowAt = 0;           // TCP_NOTSENT_LOWAT: bytes of unsent data above which the socket isn't writable
+};
+
+inline void SetSocketOption(SOCKET socket, int level, int option, int value, const char *name)
+{
+	if (setsockopt(socket, level, option, reinterpret_cast<const char*>(&value), sizeof value) != 0)
+		DbgPrint(std::string("cannot set socket option ") + name);
+}
+
+inline bool IsTcpSocket(SOCKET socket)   // false for a unix socket: only the SOL_SOCKET options apply to it
+{
+	sockaddr_storage address;
+	socklen_t addressLength = sizeof address;
+
+	return getsockname(socket, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0 || address.ss_family == AF_INET || address.ss_family == AF_INET6;
+}
+
+inline void ApplySocketOptions(SOCKET socket, const SocketOptions &options)
+{
+	bool tcp = IsTcpSocket(socket);
+
+	if (options.mNoDelay && tcp)
+		SetSocketOption(socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+#ifdef SO_NOSIGPIPE
+	SetSocketOption(socket, SOL_SOCKET, SO_NOSIGPIPE, 1, "SO_NOSIGPIPE");   // no MSG_NOSIGNAL on this platform (see Socket.h)
+#endif
+
+	if (options.mSendBufferSize > 0)
+		SetSocketOption(socket, SOL_SOCKET, SO_SNDBUF, options.mSendBufferSize, "SO_SNDBUF");
+
+	if (options.mReceiveBufferSize > 0)
+		SetSocketOption(socket, SOL_SOCKET, SO_RCVBUF, options.mReceiveBufferSize, "SO_RCVBUF");
+
+#ifdef TCP_QUICKACK
+	if (options.mQuickAck && tcp)
+		SetSocketOption(socket, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+
+	if (options.mKeepAlive)
+	{
+		SetSocketOption(socket, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+
+#ifdef TCP_KEEPIDLE
+		if (options.mKeepAliveIdle > 0 && tcp)
+			SetSocketOption(socket, IPPROTO_TCP, TCP_KEEPIDLE, options.mKeepAliveIdle, "TCP_KEEPIDLE");
+#endif
+#ifdef TCP_KEEPINTVL
+		if (options.mKeepAliveInterval > 0 && tcp)
+			SetSocketOption(socket, IPPROTO_TCP, TCP_KEEPINTVL, options.mKeepAliveInterval, "TCP_KEEPINTVL");
+#endif
+#ifdef TCP_KEEPCNT
+		if (options.mKeepAliveCount > 0 && tcp)
+			SetSocketOption(socket, IPPROTO_TCP, TCP_KEEPCNT, options.mKeepAliveCount, "TCP_KEEPCNT");
+#endif
+	}
+
+#ifdef SO_BUSY_POLL
+	if (options.mBusyPoll > 0)
+		SetSocketOption(socket, SOL_SOCKET, SO_BUSY_POLL, options.mBusyPoll, "SO_BUSY_POLL");
+#endif
+
+#ifdef TCP_NOTSENT_LOWAT
+	if (options.mNotSentLowAt > 0 && tcp)
+		SetSocketOption(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.mNotSentLowAt, "TCP_NOTSENT_LOWAT");
+#endif
+}
+
+inline void RearmQuickAck(SOCKET socket)
+{
+#ifdef TCP_QUICKACK
+	int value = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_QUICKACK, reinterpret_cast<const char*>(&value), sizeof value);
+#endif
+}
+
+#endif  // SOCKET_OPTIONS_H
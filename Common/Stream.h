@@ -0,0 +1,34 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// a stream sends a payload of any size as chunks pulled from its source by the connection's thread, one chunk in memory at a time;
+// the receiver gets every chunk through OnStreamChunk and a chunk of size 0 at the end, and gives credit back once chunks are
+// delivered, so at most sStreamWindow bytes of a stream are in flight or waiting in the receiver's queue
+
+static const uint32_t sStreamWindow = 256U * 1024U;
+
+// fills buffer with up to capacity bytes and returns how many, 0 ends the stream
+using StreamSource = std::function<size_t(uint8_t *buffer, size_t capacity)>;
+
+inline StreamSource FileStreamSource(const std::string &path)   // an empty source (no stream) if the file doesn't open
+{
+	std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(path, std::ios::binary);
+
+	if (!*file)
+		return StreamSource();
+
+	return [file](uint8_t *buffer, size_t capacity)
+	{
+		file->read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(capacity));
+		return static_cast<size_t>(file->gcount());
+	};
+}
+
+#endif  // STREAM_H
@@ -21,6 +21,15 @@ public:
 
     template <typename U>
     void EnQueue(U &&element) { std::lock_guard<std::mutex> guard(mMutex); mContainer.InsertLast(std::forward<U>(element)); }
+    void EnQueueAll(S<T> &elements)   // moves all elements in with one lock acquisition and clears elements
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+
+        for (T &element : elements)
+            mContainer.InsertLast(std::move(element));
+
+        elements.Clear();
+    }
     void DeQueue() { std::lock_guard<std::mutex> guard(mMutex); mContainer.RemoveFirst(); }
 
     T Front() const { std::lock_guard<std::mutex> guard(mMutex); return mContainer.First(); }
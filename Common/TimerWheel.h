@@ -0,0 +1,223 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include "Vector.h"
+
+struct TimerOptions
+{
+	std::chrono::milliseconds mTick{ 10 };          // resolution of the timers, Server<T>::ScheduleAfter / ScheduleEvery included
+	std::chrono::milliseconds mHeartbeat{ 0 };      // a connection that sent nothing for this long is pinged (the peer answers), 0: never
+	std::chrono::milliseconds mIdleTimeout{ 0 };    // ... closed with ErrorKind::IDLE_TIMEOUT after this long, 0: never
+};
+
+using TimerId = uint64_t;   // 0 is none; a node in the low half, its generation in the high half (an id of a timer that's gone cancels nothing)
+
+// hierarchical timing wheel: sLevels wheels of sSlots slots, a slot of level l spans sSlots^l ticks. A timer is linked into
+// the lowest level whose reach (sSlots^(l+1) ticks) covers its wait, in the slot of its expiry tick; when a slot of a
+// higher level comes round its timers move down by what's left of their wait (cascading). Scheduling and cancelling
+// unlink/link a pooled node, a tick looks at one slot per level that turned over: O(1), never a scan of the timers.
+// Not thread safe, Server<T> drives it from its timer thread under a lock
+class TimerWheel
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Callback = std::function<void()>;
+
+	static const unsigned sLevels = 4;
+	static const unsigned sSlotBits = 6;
+	static const unsigned sSlots = 1U << sSlotBits;   // 64^4 ticks (46 hours at 10 ms) ahead at most, a later timer is parked and moved on
+
+	explicit TimerWheel(Clock::duration tick, Clock::time_point start = Clock::now());
+
+	TimerId Schedule(Clock::duration delay, Callback callback, Clock::duration period = Clock::duration::zero());   // period: again every period until cancelled
+	bool Cancel(TimerId id);   // false if it already ran (a one shot) or was cancelled
+
+	// runs the clock up to now: the callbacks of the due timers are appended to due, to be called outside the lock
+	// (a one shot's is moved, a periodic one's copied and the timer rescheduled)
+	void Advance(Clock::time_point now, Vector<Callback> &due);
+
+	size_t Size() const { return mSize; }
+	Clock::duration GetTick() const { return mTick; }
+private:
+	static const uint32_t sNone = 0xFFFFFFFFU;
+	static const uint32_t sFree = 0xFFFFFFFFU;   // mSlot of a node on the free list
+
+	struct Node
+	{
+		uint64_t mExpiry = 0U;        // tick
+		uint64_t mPeriod = 0U;        // ticks, 0: one shot
+		Callback mCallback;
+		uint32_t mPrev = sNone;
+		uint32_t mNext = sNone;       // in its slot, or the free list
+		uint32_t mSlot = sFree;       // level * sSlots + slot
+		uint32_t mGeneration = 1U;
+	};
+
+	Clock::duration mTick;
+	Clock::time_point mStart;
+	uint64_t mCurrent = 0U;           // ticks run
+
+	Vector<Node> mNodes;
+	uint32_t mFreeNodes = sNone;
+	uint32_t mHeads[sLevels * sSlots];
+	size_t mSize = 0;
+
+	uint64_t TickOf(Clock::time_point time) const { return time <= mStart ? 0U : static_cast<uint64_t>((time - mStart) / mTick); }
+	void Link(uint32_t index);        // into the slot its expiry goes to from mCurrent
+	void Unlink(uint32_t index);
+	void Free(uint32_t index);
+	void Cascade(unsigned level, unsigned slot);
+};
+
+inline TimerWheel::TimerWheel(Clock::duration tick, Clock::time_point start) : mTick(tick > Clock::duration::zero() ? tick : Clock::duration(1)), mStart(start)
+{
+	for (uint32_t &head : mHeads)
+		head = sNone;
+}
+
+inline TimerId TimerWheel::Schedule(Clock::duration delay, Callback callback, Clock::duration period)
+{
+	uint32_t index = mFreeNodes;
+	if (index != sNone)
+		mFreeNodes = mNodes[static_cast<int>(index)].mNext;
+	else
+	{
+		index = static_cast<uint32_t>(mNodes.Size());
+		mNodes.Resize(mNodes.Size() + 1U);
+	}
+
+	Node &node = mNodes[static_cast<int>(index)];
+
+	uint64_t expiry = TickOf(Clock::now() + delay + mTick - Clock::duration(1));   // rounded up: never early
+	node.mExpiry = expiry > mCurrent ? expiry : mCurrent + 1U;
+	node.mPeriod = period > Clock::duration::zero() ? static_cast<uint64_t>((period + mTick - Clock::duration(1)) / mTick) : 0U;
+	node.mCallback = std::move(callback);
+
+	Link(index);
+	mSize++;
+
+	return static_cast<TimerId>(node.mGeneration) << 32 | index;
+}
+
+inline bool TimerWheel::Cancel(TimerId id)
+{
+	uint32_t index = static_cast<uint32_t>(id);
+
+	if (index >= mNodes.Size() || mNodes[static_cast<int>(index)].mGeneration != static_cast<uint32_t>(id >> 32) || mNodes[static_cast<int>(index)].mSlot == sFree)
+		return false;
+
+	Unlink(index);
+	Free(index);
+	mSize--;
+
+	return true;
+}
+
+inline void TimerWheel::Advance(Clock::time_point now, Vector<Callback> &due)
+{
+	uint64_t target = TickOf(now);
+
+	if (mSize == 0U && target > mCurrent)   // nothing to run into: the wheel is empty whatever the position
+		mCurrent = target;
+
+	while (mCurrent < target)
+	{
+		uint64_t current = ++mCurrent;
+
+		for (unsigned level = 1; level < sLevels && (current & ((1ULL << (level * sSlotBits)) - 1U)) == 0U; level++)
+			Cascade(level, static_cast<unsigned>(current >> (level * sSlotBits)) & (sSlots - 1U));
+
+		uint32_t &head = mHeads[current & (sSlots - 1U)];
+		uint32_t index = head;
+		head = sNone;
+
+		while (index != sNone)
+		{
+			Node &node = mNodes[static_cast<int>(index)];
+			uint32_t next = node.mNext;
+
+			if (node.mExpiry > current)   // a far one on its way
+				Link(index);
+			else if (node.mPeriod > 0U)
+			{
+				due.InsertLast(node.mCallback);
+				node.mExpiry = current + node.mPeriod;
+				Link(index);
+			}
+			else
+			{
+				due.InsertLast(std::move(node.mCallback));
+				Free(index);
+				mSize--;
+			}
+
+			index = next;
+		}
+	}
+}
+
+inline void TimerWheel::Link(uint32_t index)
+{
+	Node &node = mNodes[static_cast<int>(index)];
+
+	const uint64_t reach = 1ULL << (sLevels * sSlotBits);
+	uint64_t expiry = node.mExpiry - mCurrent < reach ? node.mExpiry : mCurrent + reach - 1U;   // too far: as far as it goes, looked at again from there
+
+	unsigned level = 0;
+	while ((expiry - mCurrent) >> ((level + 1) * sSlotBits) != 0U)
+		level++;
+
+	uint32_t slot = level * sSlots + (static_cast<uint32_t>(expiry >> (level * sSlotBits)) & (sSlots - 1U));   // comes round once within its level's reach
+	uint32_t &head = mHeads[slot];
+
+	node.mSlot = slot;
+	node.mPrev = sNone;
+	node.mNext = head;
+	if (head != sNone)
+		mNodes[static_cast<int>(head)].mPrev = index;
+	head = index;
+}
+
+inline void TimerWheel::Unlink(uint32_t index)
+{
+	Node &node = mNodes[static_cast<int>(index)];
+
+	if (node.mPrev != sNone)
+		mNodes[static_cast<int>(node.mPrev)].mNext = node.mNext;
+	else
+		mHeads[node.mSlot] = node.mNext;
+
+	if (node.mNext != sNone)
+		mNodes[static_cast<int>(node.mNext)].mPrev = node.mPrev;
+}
+
+inline void TimerWheel::Free(uint32_t index)
+{
+	Node &node = mNodes[static_cast<int>(index)];
+
+	node.mCallback = nullptr;
+	node.mSlot = sFree;
+	if (++node.mGeneration == 0U)
+		node.mGeneration = 1U;
+	node.mNext = mFreeNodes;
+	mFreeNodes = index;
+}
+
+inline void TimerWheel::Cascade(unsigned level, unsigned slot)
+{
+	uint32_t &head = mHeads[level * sSlots + slot];
+	uint32_t index = head;
+	head = sNone;
+
+	while (index != sNone)
+	{
+		uint32_t next = mNodes[static_cast<int>(index)].mNext;
+		Link(index);   // lower now, what's left of its wait is within a slot of this level
+		index = next;
+	}
+}
+
+#endif  // TIMER_WHEEL_H
@@ -0,0 +1,385 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include "Socket.h"
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cerrno>
+#include <unordered_map>
+#include "debug.h"
+
+#ifdef TLS_ENABLED
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
+
+// encrypted tcp connections (built with TLS_ENABLED, linked against OpenSSL): the handshake runs in user space on the
+// connection's thread before its first frame, then OpenSSL hands the session keys to the kernel (kTLS, setsockopt SOL_TLS)
+// for each direction the kernel and the cipher support. With kTLS sending, frames go out with plain send and file bodies
+// with sendfile, encrypted by the kernel; otherwise through SSL_write, file bodies read into user space first. Receives go
+// through SSL_read either way: with kTLS receiving it only copies what the kernel decrypted, and handles the records that
+// aren't data (session tickets, key updates, alerts). Clients keep the latest session ticket per server name, a reconnect
+// resumes it (no certificate exchange, one round trip less for TLS 1.2). Local (unix://, shm://) connections stay plain.
+
+struct TlsOptions
+{
+	bool mEnabled = false;
+	std::string mCertificateFile;       // PEM chain: the server's (required), a client's for servers that verify clients
+	std::string mPrivateKeyFile;
+	std::string mCaFile;                // PEM certificates the peer is verified against (client: default paths if empty; server: clients aren't verified if empty)
+	std::string mServerName;            // client: SNI and the name the server's certificate is checked for, the host connected to if empty
+	bool mVerifyPeer = true;            // client: a server certificate that doesn't verify fails the handshake
+	bool mKernelOffload = true;         // kTLS where possible
+	bool mResumption = true;            // client: resume the previous session with the same server name
+	unsigned mHandshakeTimeout = 5000;  // milliseconds
+};
+
+struct TlsInfo
+{
+	bool mEncrypted = false;            // the handshake completed
+	bool mResumed = false;
+	bool mKernelSend = false;           // kTLS, per direction
+	bool mKernelReceive = false;
+	std::string mVersion;
+	std::string mCipher;
+};
+
+enum class TlsStep { DONE, WANT_READ, WANT_WRITE, FAILED };
+
+class TlsContext;
+
+// one connection's tls state, only touched by the connection's thread (GetInfo aside)
+class TlsSession
+{
+	friend class TlsContext;
+public:
+	~TlsSession();
+
+	TlsSession(const TlsSession&) = delete;
+	TlsSession &operator=(const TlsSession&) = delete;
+
+	TlsStep Handshake();                          // a non blocking step, FAILED: GetError tells why
+	long Read(void *data, size_t size);           // like recv: 0 once the peer closed, SOCKET_ERROR with WSAEWOULDBLOCK (or EPROTO)
+	long Write(const void *data, size_t size);    // like send, retried with the same bytes after WSAEWOULDBLOCK
+	void Shutdown();                              // close_notify, without waiting for the peer's
+
+	bool KernelSend() const { return mInfo.mKernelSend; }
+	bool KernelReceive() const { return mInfo.mKernelReceive; }
+	TlsInfo GetInfo() const { return mEstablished.load(std::memory_order_acquire) ? mInfo : TlsInfo(); }
+	int GetError() const { return mError; }       // OpenSSL reason code, or errno
+	unsigned GetHandshakeTimeout() const;          // milliseconds
+private:
+	TlsSession(std::shared_ptr<TlsContext> context, const std::string &name) : mContext(std::move(context)), mName(name) {}
+
+	std::shared_ptr<TlsContext> mContext;         // outlives its sessions: their new session callback finds it
+	std::string mName;                            // client: the server name sessions are kept by
+	TlsInfo mInfo;
+	std::atomic<bool> mEstablished{ false };
+	int mError = 0;
+
+#ifdef TLS_ENABLED
+	SSL *mSsl = nullptr;
+
+	long Failed(int result);                      // maps SSL_get_error to the socket conventions
+#endif
+};
+
+// the SSL_CTX of a server or a client, shared by its connections
+class TlsContext : public std::enable_shared_from_this<TlsContext>
+{
+	friend class TlsSession;
+public:
+	static std::shared_ptr<TlsContext> Create(const TlsOptions &options, bool server, std::string &error);   // null if the certificates or key don't load
+	~TlsContext();
+
+	TlsContext(const TlsContext&) = delete;
+	TlsContext &operator=(const TlsContext&) = delete;
+
+	std::unique_ptr<TlsSession> NewSession(SOCKET socket, const std::string &host);   // host: what a client connected to, null on failure
+private:
+	TlsContext(const TlsOptions &options, bool server) : mOptions(options), mServer(server) {}
+
+	TlsOptions mOptions;
+	bool mServer;
+
+#ifdef TLS_ENABLED
+	SSL_CTX *mContext = nullptr;
+
+	std::mutex mSessionMutex;                                   // client: connections on several threads
+	std::unordered_map<std::string, SSL_SESSION*> mSessions;    // latest ticket per server name
+
+	static int OnNewSession(SSL *ssl, SSL_SESSION *session);
+	static std::string LastError();
+#endif
+};
+
+inline unsigned TlsSession::GetHandshakeTimeout() const { return mContext->mOptions.mHandshakeTimeout; }
+
+#ifdef TLS_ENABLED
+
+inline void SetLastSocketError(int error)
+{
+#ifdef _WIN32
+	WSASetLastError(error);
+#else
+	errno = error;
+#endif
+}
+
+inline std::string TlsContext::LastError()
+{
+	char buffer[256];
+	unsigned long error = ERR_peek_last_error();
+
+	ERR_error_string_n(error, buffer, sizeof buffer);
+	ERR_clear_error();
+
+	return error != 0 ? buffer : "unknown tls error";
+}
+
+inline std::shared_ptr<TlsContext> TlsContext::Create(const TlsOptions &options, bool server, std::string &error)
+{
+	std::shared_ptr<TlsContext> context(new TlsContext(options, server));
+	SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+
+	if (!ctx)
+	{
+		error = LastError();
+		return nullptr;
+	}
+
+	context->mContext = ctx;
+	SSL_CTX_set_app_data(ctx, context.get());
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF | (options.mKernelOffload ? SSL_OP_ENABLE_KTLS : 0));   // a peer closing without close_notify reads as closed, like a plain one
+
+	if (!options.mCertificateFile.empty() && (SSL_CTX_use_certificate_chain_file(ctx, options.mCertificateFile.c_str()) != 1
+		|| SSL_CTX_use_PrivateKey_file(ctx, options.mPrivateKeyFile.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1))
+	{
+		error = LastError();
+		return nullptr;
+	}
+
+	if (server)
+	{
+		if (options.mCertificateFile.empty())
+		{
+			error = "a tls server needs a certificate";
+			return nullptr;
+		}
+
+		static const unsigned char sessionContext[] = "net";   // resumed sessions of clients that were verified
+		SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof sessionContext - 1);
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);   // tls 1.3 and 1.2 tickets are stateless, the cache only serves 1.2 session ids
+
+		if (!options.mCaFile.empty())
+		{
+			if (SSL_CTX_load_verify_locations(ctx, options.mCaFile.c_str(), nullptr) != 1)
+			{
+				error = LastError();
+				return nullptr;
+			}
+
+			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+		}
+	}
+	else
+	{
+		if (options.mVerifyPeer)
+		{
+			if ((options.mCaFile.empty() ? SSL_CTX_set_default_verify_paths(ctx) : SSL_CTX_load_verify_locations(ctx, options.mCaFile.c_str(), nullptr)) != 1)
+			{
+				error = LastError();
+				return nullptr;
+			}
+
+			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+		}
+
+		if (options.mResumption)
+		{
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(ctx, &TlsContext::OnNewSession);
+		}
+	}
+
+	return context;
+}
+
+inline TlsContext::~TlsContext()
+{
+	for (auto &session : mSessions)
+		SSL_SESSION_free(session.second);
+
+	SSL_CTX_free(mContext);
+}
+
+inline std::unique_ptr<TlsSession> TlsContext::NewSession(SOCKET socket, const std::string &host)
+{
+	std::string name = mServer ? std::string() : mOptions.mServerName.empty() ? host : mOptions.mServerName;
+	std::unique_ptr<TlsSession> session(new TlsSession(shared_from_this(), name));
+
+	ERR_clear_error();
+
+	if (!(session->mSsl = SSL_new(mContext)) || SSL_set_fd(session->mSsl, static_cast<int>(socket)) != 1)
+	{
+		DbgPrint("tls: " + LastError());
+		return nullptr;
+	}
+
+	SSL_set_app_data(session->mSsl, session.get());
+
+	if (mServer)
+	{
+		SSL_set_accept_state(session->mSsl);
+		return session;
+	}
+
+	SSL_set_connect_state(session->mSsl);
+
+	in6_addr address6;
+	in_addr address4;
+	bool literal = inet_pton(AF_INET6, name.c_str(), &address6) == 1 || inet_pton(AF_INET, name.c_str(), &address4) == 1;
+
+	if (literal)   // no sni for addresses, the certificate has to name the address
+		X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(session->mSsl), name.c_str());
+	else
+	{
+		SSL_set_tlsext_host_name(session->mSsl, name.c_str());
+		SSL_set1_host(session->mSsl, name.c_str());
+	}
+
+	if (mOptions.mResumption)
+	{
+		std::lock_guard<std::mutex> guard(mSessionMutex);
+
+		auto it = mSessions.find(name);
+		if (it != mSessions.end())
+			SSL_set_session(session->mSsl, it->second);
+	}
+
+	return session;
+}
+
+// client: a session ticket arrived (tls 1.3: after the handshake, read like data), the latest one per name is kept
+inline int TlsContext::OnNewSession(SSL *ssl, SSL_SESSION *newSession)
+{
+	TlsContext *context = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	TlsSession *session = static_cast<TlsSession*>(SSL_get_app_data(ssl));
+
+	std::lock_guard<std::mutex> guard(context->mSessionMutex);
+
+	SSL_SESSION *&slot = context->mSessions[session->mName];
+	if (slot)
+		SSL_SESSION_free(slot);
+	slot = newSession;
+
+	return 1;   // the reference is ours
+}
+
+inline TlsSession::~TlsSession()
+{
+	SSL_free(mSsl);
+}
+
+inline TlsStep TlsSession::Handshake()
+{
+	ERR_clear_error();
+
+	int result = SSL_do_handshake(mSsl);
+	if (result == 1)
+	{
+		mInfo.mEncrypted = true;
+		mInfo.mResumed = SSL_session_reused(mSsl) == 1;
+		mInfo.mKernelSend = BIO_get_ktls_send(SSL_get_wbio(mSsl)) == 1;
+		mInfo.mKernelReceive = BIO_get_ktls_recv(SSL_get_rbio(mSsl)) == 1;
+		mInfo.mVersion = SSL_get_version(mSsl);
+		mInfo.mCipher = SSL_get_cipher_name(mSsl);
+		mEstablished.store(true, std::memory_order_release);
+
+		return TlsStep::DONE;
+	}
+
+	switch (SSL_get_error(mSsl, result))
+	{
+		case SSL_ERROR_WANT_READ:  return TlsStep::WANT_READ;
+		case SSL_ERROR_WANT_WRITE: return TlsStep::WANT_WRITE;
+		case SSL_ERROR_SYSCALL:
+			mError = errno != 0 ? errno : ECONNRESET;
+			DbgPrint("tls handshake: connection failed");
+			return TlsStep::FAILED;
+		default:
+			mError = ERR_GET_REASON(ERR_peek_last_error());
+			DbgPrint("tls handshake: " + TlsContext::LastError());
+			return TlsStep::FAILED;
+	}
+}
+
+inline long TlsSession::Failed(int result)
+{
+	int error = SSL_get_error(mSsl, result);
+
+	if (error == SSL_ERROR_ZERO_RETURN)
+		return 0;
+
+	if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)   // a write may need to read (a key update), and the reverse
+		SetLastSocketError(WSAEWOULDBLOCK);
+	else if (error != SSL_ERROR_SYSCALL || errno == 0)
+		SetLastSocketError(EPROTO);
+
+	ERR_clear_error();
+
+	return SOCKET_ERROR;
+}
+
+inline long TlsSession::Read(void *data, size_t size)
+{
+	ERR_clear_error();
+
+	int result = SSL_read(mSsl, data, static_cast<int>(size));
+	return result > 0 ? result : Failed(result);
+}
+
+inline long TlsSession::Write(const void *data, size_t size)
+{
+	ERR_clear_error();
+
+	int result = SSL_write(mSsl, data, static_cast<int>(size));
+	return result > 0 ? result : Failed(result);
+}
+
+inline void TlsSession::Shutdown()
+{
+	if (mEstablished)
+	{
+		ERR_clear_error();
+		SSL_shutdown(mSsl);
+		ERR_clear_error();
+	}
+}
+
+#else  // TLS_ENABLED
+
+inline std::shared_ptr<TlsContext> TlsContext::Create(const TlsOptions &options, bool server, std::string &error)
+{
+	error = "built without TLS_ENABLED (OpenSSL)";
+	return nullptr;
+}
+
+inline TlsContext::~TlsContext() {}
+inline std::unique_ptr<TlsSession> TlsContext::NewSession(SOCKET socket, const std::string &host) { return nullptr; }
+
+inline TlsSession::~TlsSession() {}
+inline TlsStep TlsSession::Handshake() { return TlsStep::FAILED; }
+inline long TlsSession::Read(void *data, size_t size) { return SOCKET_ERROR; }
+inline long TlsSession::Write(const void *data, size_t size) { return SOCKET_ERROR; }
+inline void TlsSession::Shutdown() {}
+
+#endif  // TLS_ENABLED
+
+#endif  // TLS_H
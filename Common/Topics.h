@@ -0,0 +1,242 @@
+#ifndef TOPICS_H
+#define TOPICS_H
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "Vector.h"
+
+// topic -> subscribers index of Server<T>::Publish: a subscription is an exact topic ("prices.eu.sap") or a prefix
+// pattern ending in '*' ("prices.eu.*", "*" for every topic). The topics are spread over sShardCount shards by hash, each
+// with its own lock, so subscribing, unsubscribing and publishing on different topics don't contend; a topic's
+// subscribers are a dense array (the fan-out walks it) with a position per subscriber id (removal swaps the last one in)
+template <typename S>   // shared pointer to a subscriber, S->GetId() unique among the live ones
+class TopicIndex
+{
+public:
+	static const size_t sShardCount = 16;
+	static const size_t sMaxTopicSize = 255;
+
+	static bool IsValid(const std::string &topic);   // not empty, at most sMaxTopicSize bytes, '*' only at the end
+
+	bool Subscribe(const S &subscriber, const std::string &topic);     // false if invalid or already subscribed
+	bool Unsubscribe(const S &subscriber, const std::string &topic);   // false if it wasn't subscribed
+	void UnsubscribeAll(uint32_t id);                                  // a subscriber that went away
+
+	void Match(const std::string &topic, Vector<S> &subscribers) const;   // appends the subscribers of topic, each once
+	size_t Size() const { return mSize; }   // subscriptions
+private:
+	struct Subscribers
+	{
+		Vector<S> mList;
+		std::unordered_map<uint32_t, size_t> mPositions;   // in mList, by subscriber id
+	};
+
+	struct Shard
+	{
+		mutable std::mutex mMutex;
+		std::unordered_map<std::string, Subscribers> mTopics;     // exact
+		std::unordered_map<std::string, Subscribers> mPrefixes;   // patterns, without the '*'
+	};
+
+	struct SubscriberShard   // the other way round, to unsubscribe a subscriber that went away from everything
+	{
+		std::mutex mMutex;
+		std::unordered_map<uint32_t, std::unordered_set<std::string>> mTopics;   // as subscribed, patterns with their '*'
+	};
+
+	Shard mShards[sShardCount];
+	SubscriberShard mSubscriberShards[sShardCount];
+	std::atomic<uint32_t> mPrefixLengths[sMaxTopicSize] = {};   // patterns by prefix length: a publish only looks up the lengths in use
+	std::atomic<size_t> mSize{ 0U };
+
+	Shard &ShardOf(const std::string &key) { return mShards[std::hash<std::string>()(key) % sShardCount]; }
+	const Shard &ShardOf(const std::string &key) const { return mShards[std::hash<std::string>()(key) % sShardCount]; }
+	SubscriberShard &SubscriberShardOf(uint32_t id) { return mSubscriberShards[id % sShardCount]; }
+
+	bool Remove(uint32_t id, const std::string &topic);
+	static void Append(const Subscribers &from, Vector<S> &subscribers) { subscribers.Insert(subscribers.End(), from.mList.Begin(), from.mList.End()); }
+};
+
+template <typename S>
+bool TopicIndex<S>::IsValid(const std::string &topic)
+{
+	size_t star = topic.find('*');
+
+	return !topic.empty() && topic.size() <= sMaxTopicSize && (star == std::string::npos || star == topic.size() - 1);
+}
+
+template <typename S>
+bool TopicIndex<S>::Subscribe(const S &subscriber, const std::string &topic)
+{
+	if (!IsValid(topic))
+		return false;
+
+	uint32_t id = subscriber->GetId();
+	bool pattern = topic.back() == '*';
+	std::string key = pattern ? topic.substr(0, topic.size() - 1) : topic;
+
+	{
+		Shard &shard = ShardOf(key);
+		std::lock_guard<std::mutex> guard(shard.mMutex);
+
+		auto &table = pattern ? shard.mPrefixes : shard.mTopics;
+		auto it = table.find(key);
+
+		if (it == table.end())
+		{
+			it = table.emplace(key, Subscribers()).first;
+
+			if (pattern)
+				mPrefixLengths[key.size()]++;
+		}
+		else if (it->second.mPositions.count(id) > 0)
+			return false;
+
+		it->second.mPositions[id] = it->second.mList.Size();
+		it->second.mList.InsertLast(subscriber);
+	}
+
+	SubscriberShard &shard = SubscriberShardOf(id);
+	std::lock_guard<std::mutex> guard(shard.mMutex);
+	shard.mTopics[id].insert(topic);
+
+	mSize++;
+
+	return true;
+}
+
+template <typename S>
+bool TopicIndex<S>::Unsubscribe(const S &subscriber, const std::string &topic)
+{
+	uint32_t id = subscriber->GetId();
+
+	{
+		SubscriberShard &shard = SubscriberShardOf(id);
+		std::lock_guard<std::mutex> guard(shard.mMutex);
+
+		auto it = shard.mTopics.find(id);
+		if (it == shard.mTopics.end() || it->second.erase(topic) == 0)
+			return false;
+
+		if (it->second.empty())
+			shard.mTopics.erase(it);
+	}
+
+	return Remove(id, topic);
+}
+
+template <typename S>
+void TopicIndex<S>::UnsubscribeAll(uint32_t id)
+{
+	std::unordered_set<std::string> topics;
+	{
+		SubscriberShard &shard = SubscriberShardOf(id);
+		std::lock_guard<std::mutex> guard(shard.mMutex);
+
+		auto it = shard.mTopics.find(id);
+		if (it == shard.mTopics.end())
+			return;
+
+		topics.swap(it->second);
+		shard.mTopics.erase(it);
+	}
+
+	for (const std::string &topic : topics)
+		Remove(id, topic);
+}
+
+// takes the subscriber out of the topic's array, the topic goes once it has none
+template <typename S>
+bool TopicIndex<S>::Remove(uint32_t id, const std::string &topic)
+{
+	bool pattern = topic.back() == '*';
+	std::string key = pattern ? topic.substr(0, topic.size() - 1) : topic;
+
+	Shard &shard = ShardOf(key);
+	std::lock_guard<std::mutex> guard(shard.mMutex);
+
+	auto &table = pattern ? shard.mPrefixes : shard.mTopics;
+	auto it = table.find(key);
+	if (it == table.end())
+		return false;
+
+	Subscribers &subscribers = it->second;
+	auto position = subscribers.mPositions.find(id);
+	if (position == subscribers.mPositions.end())
+		return false;
+
+	int index = static_cast<int>(position->second);
+	int last = static_cast<int>(subscribers.mList.Size()) - 1;
+	subscribers.mPositions.erase(position);
+
+	if (index != last)
+	{
+		subscribers.mList[index] = std::move(subscribers.mList[last]);
+		subscribers.mPositions[subscribers.mList[index]->GetId()] = static_cast<size_t>(index);
+	}
+
+	subscribers.mList.RemoveLast();
+
+	if (subscribers.mList.Empty())
+	{
+		table.erase(it);
+
+		if (pattern)
+			mPrefixLengths[key.size()]--;
+	}
+
+	mSize--;
+
+	return true;
+}
+
+template <typename S>
+void TopicIndex<S>::Match(const std::string &topic, Vector<S> &subscribers) const
+{
+	size_t first = subscribers.Size();
+	unsigned lists = 0U;   // matching subscriptions, a subscriber is only in several if there are several
+
+	{
+		const Shard &shard = ShardOf(topic);
+		std::lock_guard<std::mutex> guard(shard.mMutex);
+
+		auto it = shard.mTopics.find(topic);
+		if (it != shard.mTopics.end())
+		{
+			Append(it->second, subscribers);
+			lists++;
+		}
+	}
+
+	size_t longest = std::min(topic.size(), sMaxTopicSize - 1);
+	for (size_t length = 0; length <= longest; length++)
+	{
+		if (mPrefixLengths[length].load(std::memory_order_relaxed) == 0U)
+			continue;
+
+		std::string prefix = topic.substr(0, length);
+		const Shard &shard = ShardOf(prefix);
+		std::lock_guard<std::mutex> guard(shard.mMutex);
+
+		auto it = shard.mPrefixes.find(prefix);
+		if (it != shard.mPrefixes.end())
+		{
+			Append(it->second, subscribers);
+			lists++;
+		}
+	}
+
+	if (lists < 2U)
+		return;
+
+	auto begin = subscribers.AtIndex(first);
+	std::sort(begin, subscribers.End());
+	subscribers.Remove(std::unique(begin, subscribers.End()), subscribers.End());
+}
+
+#endif  // TOPICS_H
@@ -0,0 +1,163 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include "Metrics.h"
+#include "Vector.h"
+
+// message tracing: the sender stamps one message in TraceOptions::mSampleEvery when it's queued and when it's taken for
+// the socket, and announces it to the peer with a control frame right before it on the same lane; the peer stamps it when
+// its last byte is read, when it's queued for ProcessMessage, and around the callbacks, then records the stages in its
+// Tracer (Server<T>::GetTrace / Client<T>::GetTrace). Stamps are steady_clock nanoseconds (CLOCK_MONOTONIC: the vdso
+// reads the tsc), the same clock for every process of a host: the network stage is only meaningful between processes of
+// one host, across hosts it's the clocks' difference as well. Untraced messages cost a branch.
+
+struct TraceOptions
+{
+	uint32_t mSampleEvery = 0U;   // traces one message sent in this many (a batch counts as one; control frames, streams and files aside), 0: none
+};
+
+// stage i of a message runs from its point i to its point i + 1
+enum class TraceStage
+{
+	QUEUED_OUT,   // from Send to taken from its lane for the socket
+	NETWORK,      // ... to its last byte read by the peer: the sender's socket buffer, the wire, the peer's socket buffer
+	DECODE,       // ... to queued for ProcessMessage: reassembly, decompression, unbatching
+	QUEUED_IN,    // ... to ProcessMessage taking it
+	HANDLER,      // ... to the callbacks returning
+
+	COUNT
+};
+
+inline const char *TraceStageName(TraceStage stage)
+{
+	switch (stage)
+	{
+		case TraceStage::QUEUED_OUT: return "queued_out";
+		case TraceStage::NETWORK:    return "network";
+		case TraceStage::DECODE:     return "decode";
+		case TraceStage::QUEUED_IN:  return "queued_in";
+		case TraceStage::HANDLER:    return "handler";
+		default:                     return "unknown";
+	}
+}
+
+inline int64_t TraceTime(std::chrono::steady_clock::time_point time) { return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count(); }
+inline int64_t TraceNow() { return TraceTime(std::chrono::steady_clock::now()); }
+
+struct TraceSpan
+{
+	static const size_t sPointCount = static_cast<size_t>(TraceStage::COUNT) + 1;
+
+	uint64_t mSequence = 0U;            // set by the Tracer
+	uint32_t mConnectionId = 0U;        // the receiving side's
+	uint32_t mType = 0U;
+	int64_t mPoints[sPointCount] = {};  // nanoseconds
+
+	int64_t Duration(TraceStage stage) const { return mPoints[static_cast<size_t>(stage) + 1] - mPoints[static_cast<size_t>(stage)]; }
+};
+
+struct TraceSnapshot
+{
+	HistogramSnapshot mStages[static_cast<size_t>(TraceStage::COUNT)];
+	HistogramSnapshot mTotal;           // from Send to the callbacks returning
+	Vector<TraceSpan> mSpans;           // the latest ones, oldest first
+};
+
+// an endpoint's completed traces: per stage histograms of all of them, and the latest sMaxSpans for a timeline
+class Tracer
+{
+public:
+	static const size_t sMaxSpans = 4096;
+
+	void Record(TraceSpan &span);
+	TraceSnapshot Snapshot() const;
+private:
+	LatencyHistogram mStages[static_cast<size_t>(TraceStage::COUNT)];
+	LatencyHistogram mTotal;
+
+	mutable std::mutex mMutex;          // sampled messages only, it isn't contended
+	Vector<TraceSpan> mSpans;           // ring
+	uint64_t mRecorded = 0U;
+};
+
+inline void Tracer::Record(TraceSpan &span)
+{
+	for (size_t i = 0; i < static_cast<size_t>(TraceStage::COUNT); i++)
+	{
+		int64_t duration = span.Duration(static_cast<TraceStage>(i));
+		mStages[i].Record(static_cast<uint64_t>(duration > 0 ? duration : 0));   // the network stage across hosts may come out negative
+	}
+
+	int64_t total = span.mPoints[TraceSpan::sPointCount - 1] - span.mPoints[0];
+	mTotal.Record(static_cast<uint64_t>(total > 0 ? total : 0));
+
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	span.mSequence = mRecorded;
+
+	if (mSpans.Size() < sMaxSpans)
+		mSpans.InsertLast(span);
+	else
+		mSpans[static_cast<int>(mRecorded % sMaxSpans)] = span;
+
+	mRecorded++;
+}
+
+inline TraceSnapshot Tracer::Snapshot() const
+{
+	TraceSnapshot snapshot;
+
+	for (size_t i = 0; i < static_cast<size_t>(TraceStage::COUNT); i++)
+		snapshot.mStages[i] = mStages[i].Snapshot();
+	snapshot.mTotal = mTotal.Snapshot();
+
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	size_t count = mSpans.Size();
+	size_t first = count < sMaxSpans ? 0U : static_cast<size_t>(mRecorded % sMaxSpans);
+
+	snapshot.mSpans.Reserve(count);
+	for (size_t i = 0; i < count; i++)
+		snapshot.mSpans.InsertLast(mSpans[static_cast<int>((first + i) % count)]);
+
+	return snapshot;
+}
+
+// Trace Event Format (chrome://tracing, Perfetto, speedscope): one track per receiving connection, a traced message is
+// its stages laid end to end, timestamps in microseconds of the steady clock
+inline std::string FormatTrace(const TraceSnapshot &snapshot, const std::string &process = "net")
+{
+	std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	char buffer[256];
+
+	std::string name;
+	for (char c : process)
+		if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20)
+			name += c;
+
+	out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" + name + "\"}}";
+
+	for (const TraceSpan &span : snapshot.mSpans)
+		for (size_t i = 0; i < static_cast<size_t>(TraceStage::COUNT); i++)
+		{
+			int64_t duration = span.Duration(static_cast<TraceStage>(i));
+			if (duration < 0)
+				continue;
+
+			std::snprintf(buffer, sizeof buffer, ",\n{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+				"\"args\":{\"trace\":%llu,\"type\":%u}}", TraceStageName(static_cast<TraceStage>(i)), span.mConnectionId,
+				span.mPoints[i] / 1e3, duration / 1e3, static_cast<unsigned long long>(span.mSequence), span.mType);
+			out += buffer;
+		}
+
+	out += "\n]}\n";
+
+	return out;
+}
+
+#endif  // TRACE_H
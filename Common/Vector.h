@@ -1,9 +1,12 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <new>
 #include <cstddef>
+#include <cstring>
 #include <utility>
 #include <exception>
+#include <type_traits>
 #include <initializer_list>
 
 using std::size_t;
@@ -22,6 +25,8 @@ void swap(Vector<T> &a, Vector<T> &b)
 template <typename T>
 class Vector
 {
+    template <typename U>
+    friend class Vector;
 public:
     typedef T *Iterator;             // random access iterator
     typedef const T *ConstIterator;  // implicit conversion from Iterator to ConstIterator
@@ -54,8 +59,10 @@ public:
     T *Data() { return const_cast<T*>(static_cast<const Vector&>(*this).Data()); }
     const T *Data() const { return mArray; }
 
-    void Resize(size_t size, const T &element = T());
-    void Reserve(size_t size);   // grow - TODO: shrink
+    void Resize(size_t size, const T &element = T());   // grows geometrically, appending one by one is amortized O(1)
+    void ResizeDefaultInit(size_t size);                 // new elements are default-initialized (left uninitialized for scalars)
+    void Reserve(size_t size);                           // grow only
+    void ShrinkToFit();                                  // release unused capacity
     void Clear();
 
     Iterator Begin() { return &mArray[0]; }
@@ -70,7 +77,7 @@ public:
     template <typename U>
     void InsertFirst(U &&element) { Insert(0, std::forward<U>(element)); }
     template <typename U>
-    void InsertLast(U &&element) { Insert(mNumElements, std::forward<U>(element)); }
+    void InsertLast(U &&element);
     template <typename U>
     Iterator Insert(Iterator pos, U &&element);             // insert element before pos and return iterator after inserted element
     template <typename Iter>
@@ -101,6 +108,21 @@ public:
     Iterator AtIndex(size_t index) const { return &mArray[index]; }
     int IndexOf(ConstIterator iterator) { return iterator - mArray; }
 private:
+    // trivially copyable elements (bytes, integers, pointers, PODs) are copied and shifted with memcpy/memmove
+    typedef std::integral_constant<bool, std::is_trivially_copyable<T>::value> TriviallyCopyable;
+
+    size_t GrowthCapacity(size_t size) const { return size > 2 * mCapacity ? size : 2 * mCapacity; }
+    void Reallocate(size_t capacity);
+
+    static void CopyConstruct(T *to, const T *from, size_t count, std::true_type);
+    static void CopyConstruct(T *to, const T *from, size_t count, std::false_type);
+    static void Relocate(T *to, T *from, size_t count, std::true_type);   // move to uninitialized memory and destroy the originals
+    static void Relocate(T *to, T *from, size_t count, std::false_type);
+    static void ShiftUp(T *begin, T *end, size_t by, std::true_type);     // move [begin, end) up by places, end and after are uninitialized
+    static void ShiftUp(T *begin, T *end, size_t by, std::false_type);
+    static void ShiftDown(T *begin, T *end, size_t by, std::true_type);   // move [begin, end) down by places and destroy the last by elements
+    static void ShiftDown(T *begin, T *end, size_t by, std::false_type);
+
     T *mArray;
     size_t mCapacity;
     size_t mNumElements;
@@ -132,51 +154,40 @@ typename Vector<T>::ConstIterator end(const Vector<T> &vector)
 }
 
 template <typename T>
-Vector<T>::Vector(size_t size)
+Vector<T>::Vector(size_t size) : mArray(nullptr), mCapacity(0), mNumElements(0)
 {
-    // allocate untyped memory for array (operator new)
-    void *rawMemory = operator new(size * sizeof(T));
-
-    // construct elements in-place (placement-new)
-    for (size_t i = 0; i < size; i++)
-        new(&static_cast<T*>(rawMemory)[i]) T;  // T default constructible
-
-    // set array, capacity and element count
-    mArray = static_cast<T*>(rawMemory);
-    mCapacity = size;
-    mNumElements = size;
+    ResizeDefaultInit(size);
 }
 
 template <typename T>
-Vector<T>::Vector(const Vector &other)
+Vector<T>::Vector(const Vector &other) : mArray(nullptr), mCapacity(0), mNumElements(0)
 {
-    // allocate untyped memory for array (operator new)
-    void *rawMemory = operator new(other.mCapacity * sizeof(T));
+    // allocate untyped memory for array (operator new), no spare capacity
+    if (other.mNumElements > 0)
+        mArray = static_cast<T*>(operator new(other.mNumElements * sizeof(T)));
 
-    // copy elements (placement-new)
-    for (size_t i = 0; i < other.mNumElements; i++)
-        new(&static_cast<T*>(rawMemory)[i]) T(other.mArray[i]);
+    // copy elements (memcpy or placement-new)
+    CopyConstruct(mArray, other.mArray, other.mNumElements, TriviallyCopyable());
 
-    // set array, capacity and element count
-    mArray = static_cast<T*>(rawMemory);
-    mCapacity = other.mCapacity;
+    // set capacity and element count
+    mCapacity = other.mNumElements;
     mNumElements = other.mNumElements;
 }
 
 template <typename T>
 template <typename U>
-Vector<T>::Vector(const Vector<U> &other)
+Vector<T>::Vector(const Vector<U> &other) : mArray(nullptr), mCapacity(0), mNumElements(0)
 {
     // allocate untyped memory for array (operator new)
-    void *rawMemory = operator new(other.mCapacity * sizeof(T));
+    if (other.mNumElements > 0)
+        mArray = static_cast<T*>(operator new(other.mNumElements * sizeof(T)));
 
     // copy elements (placement-new)
     for (size_t i = 0; i < other.mNumElements; i++)
-        new(&static_cast<T*>(rawMemory)[i]) T(other.mArray[i]);
+        new(&mArray[i]) T(other.mArray[i]);  // T constructible from U
 
-    // set array, capacity and element count
-    mArray = static_cast<T*>(rawMemory);
-    mCapacity = other.mCapacity;
+    // set capacity and element count
+    mCapacity = other.mNumElements;
     mNumElements = other.mNumElements;
 }
 
@@ -189,22 +200,22 @@ Vector<T>::Vector(Vector &&other) : mArray(other.mArray), mCapacity(other.mCapac
 
 template <typename T>
 template <typename U>
-Vector<T>::Vector(Vector<U> &&other)
+Vector<T>::Vector(Vector<U> &&other) : mArray(nullptr), mCapacity(0), mNumElements(0)
 {
     // allocate untyped memory for array (operator new)
-    void  *rawMemory = operator new(other.mCapacity * sizeof(T));
+    if (other.mNumElements > 0)
+        mArray = static_cast<T*>(operator new(other.mNumElements * sizeof(T)));
 
     // move elements (placement-new)
     for (size_t i = 0; i < other.mNumElements; i++)
-        new(&static_cast<T*>(rawMemory)[i]) T(std::move(other.mArray[i]));  // T constructible from U
+        new(&mArray[i]) T(std::move(other.mArray[i]));  // T constructible from U
 
-    // set array, capacity and element count
-    mArray = static_cast<T*>(rawMemory);
-    mCapacity = other.Capacity;
+    // set capacity and element count
+    mCapacity = other.mNumElements;
     mNumElements = other.mNumElements;
 
-    // set moved from array to null
-    other.mArray = nullptr;
+    // release moved from elements and array
+    other.Clear();
 }
 
 template <typename T>
@@ -235,18 +246,43 @@ void Vector<T>::Clear()
 template <typename T>
 void Vector<T>::Resize(size_t size, const T &element)
 {
-    if (size == mNumElements)
-        return;
-    else if (size > mNumElements)
+    if (size > mNumElements)
+    {
+        if (size > mCapacity)
+        {
+            T copy(element);  // element may live in the array we're about to free
+            Reserve(GrowthCapacity(size));
+
+            for (size_t i = mNumElements; i < size; i++)
+                new(&mArray[i]) T(copy);
+        }
+        else
+            for (size_t i = mNumElements; i < size; i++)
+                new(&mArray[i]) T(element);
+    }
+    else  // destroy elements past size
+        for (size_t i = size; i < mNumElements; i++)
+            mArray[i].~T();
+
+    mNumElements = size;
+}
+
+template <typename T>
+void Vector<T>::ResizeDefaultInit(size_t size)
+{
+    if (size > mNumElements)
     {
-        size_t diff = size - mNumElements;
+        if (size > mCapacity)
+            Reserve(GrowthCapacity(size));
 
-        while (diff--)
-            InsertLast(element);
+        for (size_t i = mNumElements; i < size; i++)
+            new(&mArray[i]) T;  // no-op for scalars, a receive buffer isn't zeroed only to be overwritten
     }
-    else  // size < mNumElements
-        while (mNumElements > size)
-            RemoveLast();
+    else
+        for (size_t i = size; i < mNumElements; i++)
+            mArray[i].~T();
+
+    mNumElements = size;
 }
 
 template <typename T>
@@ -255,25 +291,100 @@ void Vector<T>::Reserve(size_t size)
     if (mCapacity >= size)
         return;
 
-    // allocate new array (sizeof(T) * size bytes)
-    void *rawMem = operator new(size * sizeof(T));
+    Reallocate(size);
+}
 
-    // move elements to new array
-    for (size_t i = 0; i < mNumElements; i++)
-        new(&static_cast<T*>(rawMem)[i]) T(std::move(mArray[i]));  // placement-new + std::move
+template <typename T>
+void Vector<T>::ShrinkToFit()
+{
+    if (mCapacity > mNumElements)
+        Reallocate(mNumElements);
+}
 
-    // destroy old elements
-    for (size_t i = 0; i < mNumElements; i++)
-        mArray[i].~T();
+template <typename T>
+void Vector<T>::Reallocate(size_t capacity)
+{
+    // allocate new array (sizeof(T) * capacity bytes)
+    T *array = capacity > 0 ? static_cast<T*>(operator new(capacity * sizeof(T))) : nullptr;
+
+    // move elements to new array and destroy old elements
+    Relocate(array, mArray, mNumElements, TriviallyCopyable());
 
     // free old array
     operator delete(mArray);
 
-    // set new array
-    mArray = static_cast<T*>(rawMem);
+    // set new array and capacity
+    mArray = array;
+    mCapacity = capacity;
+}
+
+template <typename T>
+void Vector<T>::CopyConstruct(T *to, const T *from, size_t count, std::true_type)
+{
+    if (count > 0)
+        std::memcpy(static_cast<void*>(to), from, count * sizeof(T));
+}
+
+template <typename T>
+void Vector<T>::CopyConstruct(T *to, const T *from, size_t count, std::false_type)
+{
+    for (size_t i = 0; i < count; i++)
+        new(&to[i]) T(from[i]);
+}
 
-    // set new capacity
-    mCapacity = size;
+template <typename T>
+void Vector<T>::Relocate(T *to, T *from, size_t count, std::true_type)
+{
+    if (count > 0)
+        std::memcpy(static_cast<void*>(to), from, count * sizeof(T));
+}
+
+template <typename T>
+void Vector<T>::Relocate(T *to, T *from, size_t count, std::false_type)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        new(&to[i]) T(std::move(from[i]));  // placement-new + std::move
+        from[i].~T();
+    }
+}
+
+template <typename T>
+void Vector<T>::ShiftUp(T *begin, T *end, size_t by, std::true_type)
+{
+    if (end > begin)
+        std::memmove(static_cast<void*>(begin + by), begin, (end - begin) * sizeof(T));
+}
+
+template <typename T>
+void Vector<T>::ShiftUp(T *begin, T *end, size_t by, std::false_type)
+{
+    for (T *from = end; from-- != begin; )  // from the last element down, so nothing is overwritten before it's moved
+    {
+        T *to = from + by;
+
+        if (to >= end)
+            new(to) T(std::move(*from));   // move-construct past the end
+        else
+            *to = std::move(*from);        // move-assign
+    }
+}
+
+template <typename T>
+void Vector<T>::ShiftDown(T *begin, T *end, size_t by, std::true_type)
+{
+    if (end > begin)
+        std::memmove(static_cast<void*>(begin - by), begin, (end - begin) * sizeof(T));
+}
+
+template <typename T>
+void Vector<T>::ShiftDown(T *begin, T *end, size_t by, std::false_type)
+{
+    for (T *from = begin; from != end; ++from)
+        *(from - by) = std::move(*from);
+
+    for (T *it = end - by; it != end; ++it)
+        it->~T();
 }
 
 template <typename T>
@@ -303,6 +414,14 @@ void Vector<T>::Swap(Vector &other)
 template <typename T>
 Vector<T> &Vector<T>::operator=(const Vector &other)
 {
+    if (TriviallyCopyable::value && this != &other && mCapacity >= other.mNumElements)  // reuse the array, nothing to destroy
+    {
+        CopyConstruct(mArray, other.mArray, other.mNumElements, TriviallyCopyable());
+        mNumElements = other.mNumElements;
+
+        return *this;
+    }
+
     // copy and swap
     Vector temp(other);  // copy
     Swap(temp);          // swap
@@ -353,12 +472,8 @@ void Vector<T>::Insert(int index, U &&element)
         new(&mArray[index]) T(std::forward<U>(element));   // copy/move-construct element (placement-new)
     else
     {
-        // move-construct new last element 
-        new(&mArray[mNumElements]) T(std::move(mArray[mNumElements - 1]));
-
-        // shift elements up one place
-        for (size_t i = mNumElements - 1; i > index; i--)
-            mArray[i] = std::move(mArray[i - 1]);
+        // shift elements up one place (the last one is move-constructed past the end)
+        ShiftUp(&mArray[index], End(), 1, TriviallyCopyable());
 
         // insert (copy/move-assing) element at index 
         mArray[index] = std::forward<U>(element);
@@ -367,6 +482,16 @@ void Vector<T>::Insert(int index, U &&element)
     mNumElements++;
 }
 
+template <typename T>
+template <typename U>
+void Vector<T>::InsertLast(U &&element)
+{
+    if (mNumElements < mCapacity)  // common case, no shifting and no bounds check
+        new(&mArray[mNumElements++]) T(std::forward<U>(element));
+    else
+        Insert(mNumElements, std::forward<U>(element));
+}
+
 template <typename T>
 template <typename U>
 typename Vector<T>::Iterator Vector<T>::Insert(Iterator pos, U &&element)
@@ -386,13 +511,8 @@ typename Vector<T>::Iterator Vector<T>::Insert(Iterator pos, U &&element)
         new(pos) T(std::forward<U>(element));   // copy/move-construct element (placement-new)
     else
     {
-        // move-construct new last element 
-        Iterator endIt = End();
-        new(endIt) T(std::move(*(endIt - 1)));
-
-        // shift elements up one place
-        for (Iterator it = endIt - 1; it > pos; --it)
-            *it = std::move(*(it - 1));
+        // shift elements up one place (the last one is move-constructed past the end)
+        ShiftUp(pos, End(), 1, TriviallyCopyable());
 
         // insert (copy/move-assing) element at index 
         *pos = std::forward<U>(element);
@@ -413,28 +533,17 @@ typename Vector<T>::Iterator Vector<T>::Insert(Iterator pos, Iter begin, Iter en
     int numElementsToInsert = end - begin;
     int numElementsToShift = End() - pos;
 
-    if (mNumElements + numElementsToInsert >= mCapacity)
+    if (mNumElements + numElementsToInsert > mCapacity)
     {
         size_t index = IndexOf(pos);
-        Reserve(mNumElements + numElementsToInsert);
+        Reserve(GrowthCapacity(mNumElements + numElementsToInsert));
         pos = AtIndex(index);
     }
 
-    Iterator to = End() + numElementsToInsert - 1;
-    Iterator from = End() - 1;
-
-    for (int i = 0, j = numElementsToInsert; i < numElementsToShift; i++)  // shift elements to the end of the array
-    {
-        if (j > 0)
-        {
-            new(to--) T(std::move(*from--));
-            j--;
-        }
-        else
-            *to = std::move(*from--);
-    }
+    // shift elements to the end of the array
+    ShiftUp(pos, End(), numElementsToInsert, TriviallyCopyable());
 
-    while (begin != end)
+    while (begin != end)  // assign over shifted elements, construct past the old end
         if (numElementsToShift > 0)
         {
             *pos++ = *begin++;
@@ -454,12 +563,8 @@ void Vector<T>::Remove(int index)
     if (index < 0 || index >= mNumElements)
         throw IndexOutOfBoundsException();
 
-    // shift elements down one place
-    for (size_t i = index; i < mNumElements - 1; i++)
-        mArray[i] = std::move(mArray[i + 1]);
-
-    // destroy last element
-    mArray[mNumElements - 1].~T();
+    // shift elements down one place and destroy last element
+    ShiftDown(&mArray[index + 1], End(), 1, TriviallyCopyable());
 
     mNumElements--;
 }
@@ -467,13 +572,8 @@ void Vector<T>::Remove(int index)
 template <typename T>
 typename Vector<T>::Iterator Vector<T>::Remove(Iterator pos)
 {
-    // shift elements down one place
-    Iterator it;
-    for (it = pos; it < End() - 1; ++it)
-        *it = std::move(*(it + 1));
-
-    // destroy last element
-    it->~T();
+    // shift elements down one place and destroy last element
+    ShiftDown(pos + 1, End(), 1, TriviallyCopyable());
 
     mNumElements--;
 
@@ -481,20 +581,17 @@ typename Vector<T>::Iterator Vector<T>::Remove(Iterator pos)
 }
 
 template <typename T>
-typename Vector<T>::Iterator Vector<T>::Remove(Iterator begin, Iterator end)
+typename Vector<T>::Iterator Vector<T>::Remove(Iterator begin, Iterator end)  // returns iterator to the element after the removed ones
 {
-    Iterator it1 = begin;
-    Iterator it2 = end;
-
-    while (it1 != begin && it2 != End())
-        *it1++ = std::move(*it2++);
+    if (begin == end)
+        return begin;
 
-    while (it1 != End())
-        it1++->~T();
+    // shift elements after the range down over it and destroy the vacated tail
+    ShiftDown(end, End(), end - begin, TriviallyCopyable());
 
     mNumElements -= end - begin;
 
-    return end;
+    return begin;
 }
 
 #endif  // VECTOR_H
\ No newline at end of file
@@ -1,8 +1,7 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include "Socket.h"
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -11,33 +10,107 @@
 #include "Connection.h"
 #include "ThreadsafeQueue.h"
 #include "Message.h"
+#include "SocketOptions.h"
+#include "Compression.h"
+#include "NetError.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Topics.h"
+#include "Datagram.h"
+#include "Tls.h"
+#include "TimerWheel.h"
+#include "RateLimit.h"
+#include "Handlers.h"
+#include "Coroutine.h"
 #include "debug.h"
 
+#ifdef COROUTINES_ENABLED
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#endif
+
+// how Server<T> is set up, the defaults are a plain tcp server: set the members that matter and hand it to the constructor;
+// the ConnectionOptions are its accepted connections', mSocket also goes to the listen socket
+struct ServerOptions : ConnectionOptions
+{
+	TlsOptions mTls;
+	TimerOptions mTimers;
+	RateLimitOptions mRateLimits;
+};
+
 template <typename T>
 class Server
 {
 protected:
 	using ConnectionPtr = std::shared_ptr<Connection<T>>;  // type alias for a shared pointer to a connection object
 public:
-	Server(uint16_t port);
+	Server(uint16_t port, const ServerOptions &options = ServerOptions());
 	~Server();
 
-	void Start();
+	bool Start();   // false if the listen socket couldn't be set up (reported to OnError)
+	bool StartLocal(const std::string &path);   // after Start: also accepts same-host unix:// and shm:// clients on a unix socket at path (Linux)
+	bool StartDatagram(uint16_t port = 0U);     // after Start: a udp side channel (see Datagram.h) on port (0: the tcp port) for the tcp clients accepted from then on (Linux)
 	void Stop();
-	void Send(ConnectionPtr connection, const Message<T> &message) const;
-	void Send(uint32_t connectionId, const Message<T> &message) const;
-	void SendAll(const Message<T> &message, ConnectionPtr ignore = nullptr) const;
+	void Send(ConnectionPtr connection, const Message<T> &message, Priority priority = Priority::NORMAL) const;
+	void Send(uint32_t connectionId, const Message<T> &message, Priority priority = Priority::NORMAL) const;
+	void SendAll(const Message<T> &message, ConnectionPtr ignore = nullptr, Priority priority = Priority::NORMAL) const;   // compresses once for all recipients
+	uint32_t SendStream(ConnectionPtr connection, T type, StreamSource source, Priority priority = Priority::LOW) const;   // the stream's id, 0 if it wasn't sent
+	bool SendFile(ConnectionPtr connection, T type, int fd, uint64_t offset, uint32_t size, Priority priority = Priority::NORMAL) const;   // a message whose body is read from the file (sendfile), see Connection<T>::SendFile
+	void Reply(ConnectionPtr connection, const Message<T> &request, Message<T> &response) const;   // answers a Client<T>::Call
+
+	// topics (see Topics.h): exact ones, or prefix patterns ending in '*'; a connection's subscriptions go when it closes
+	bool Subscribe(ConnectionPtr connection, const std::string &topic);     // false if the topic is invalid or already subscribed
+	bool Unsubscribe(ConnectionPtr connection, const std::string &topic);   // false if it wasn't subscribed
+	size_t Publish(const std::string &topic, const Message<T> &message, ConnectionPtr ignore = nullptr, Priority priority = Priority::NORMAL) const;   // to every subscriber once, compressed once; the number of them
+	size_t GetSubscriptionCount() const { return mTopics.Size(); }
 	void Disconnect(ConnectionPtr connection);
 
+	// messages of an unreliable type go over the datagram channel to the clients that have one (set before sending them,
+	// Client<T>::SetUnreliable for the other way), false if the type's value is too large
+	bool SetUnreliable(T type, bool unreliable = true) { return mUnreliable.Set(static_cast<uint32_t>(type), unreliable); }
+
+	// tasks run on the server's timer thread (as OnClientDisconnect runs on the removal thread), TimerOptions::mTick apart at best
+	TimerId ScheduleAfter(std::chrono::milliseconds delay, std::function<void()> task);
+	TimerId ScheduleEvery(std::chrono::milliseconds period, std::function<void()> task);   // first after one period
+	bool CancelTimer(TimerId id);   // false if it already ran or was cancelled; a periodic task that's running meanwhile runs to its end
+
+	// typed handlers (see Handlers.h): a message of a type with one goes to it instead of OnMessage; set them before Start.
+	// SetHandler<D> decodes the body into a D first, one that doesn't decode is reported to OnError (ErrorKind::PROTOCOL)
+	using Handler = typename HandlerTable<T, ConnectionPtr>::Handler;
+	bool SetHandler(T type, Handler handler) { return mHandlers.Set(type, std::move(handler)); }   // false if the type's value is out of range
+	template <typename D, typename F>
+	bool SetHandler(T type, F handler) { return mHandlers.template Set<D>(type, std::move(handler)); }   // F: void(ConnectionPtr sender, D &data)
+	void TimeHandlers(bool enable = true) { mHandlers.SetTimed(enable); }   // the time per message type in GetMetrics, off by default
+
 	bool Available() const { return !mInMessageQueue.Empty(); }
 	void ProcessMessage();
+
+	const ErrorCounters &GetErrorCounters() const { return mErrorCounters; }
+	EndpointMetrics GetMetrics() const;   // totals, queue depths and latencies, and every open connection's (FormatMetrics writes it out)
+	TraceSnapshot GetTrace() const { return mTracer.Snapshot(); }   // stages of the traced messages it received (FormatTrace writes a timeline)
+	DatagramStats GetDatagramStats() const { return mDatagram.GetStats(); }
+
+#ifdef COROUTINES_ENABLED
+	class ReceiveAwaiter;
+	class AcceptAwaiter;
+
+	ReceiveAwaiter AsyncReceive(ConnectionPtr connection);    // next message from connection, std::nullopt once it's closed
+	AcceptAwaiter AsyncAccept();                              // next accepted connection, its messages are then only delivered to AsyncReceive
+	std::suspend_never AsyncSend(ConnectionPtr connection, const Message<T> &message) { Send(connection, message); return {}; }  // sends are queued, never wait
+
+	void Poll();   // dispatches accepted connections, messages and disconnections to waiting coroutines (OnMessage for the rest)
+#endif
 protected:
 	virtual void OnStart() = 0;
 	virtual void OnListen() = 0;
 	virtual bool OnClientConnect(ConnectionPtr connection) = 0;
 	virtual void OnClientAccepted(ConnectionPtr connection) = 0;
 	virtual void OnClientDisconnect(ConnectionPtr connection) = 0;
-	virtual void OnMessage(ConnectionPtr sender, Message<T> &message) = 0;
+	virtual void OnMessage(ConnectionPtr sender, Message<T> &message) {}   // a message of a type without a handler
+	virtual void OnStreamChunk(ConnectionPtr sender, uint32_t streamId, T type, const uint8_t *data, size_t size) {}   // size 0: the stream ended
+	virtual void OnError(ConnectionPtr connection, ErrorKind error, int code) {}   // connection is nullptr for errors of the server itself
 
 	std::string mHost;
 	uint16_t mPort;
@@ -47,25 +120,171 @@ private:
 
 	Vector<ConnectionPtr> mConnections;
 	ThreadsafeQueue<OwnedMessage<T>> mInMessageQueue;
+
+	TopicIndex<ConnectionPtr> mTopics;   // locks of its own, Publish doesn't take mMutex
+	size_t SendEach(const Vector<ConnectionPtr> &connections, const Message<T> &message, ConnectionPtr ignore, Priority priority) const;   // SendAll and Publish
+
+	mutable DatagramChannel<T> mDatagram{ mInMessageQueue };   // StartDatagram
+	UnreliableTypes mUnreliable;
+	bool SendDatagram(const ConnectionPtr &connection, const Message<T> &message) const { return mUnreliable.Contains(static_cast<uint32_t>(message.GetType())) && mDatagram.Send(connection, message); }   // false: it takes the connection
 	
 	SOCKET mListenSocket;
+	ConnectionOptions mConnectionOptions;   // of every accepted connection, the socket options also the listen socket's
+	std::shared_ptr<TlsContext> mTls;   // TlsOptions::mEnabled: accepted tcp connections are encrypted
+
+	TimerOptions mTimerOptions;
+	std::mutex mTimerMutex;
+	std::condition_variable mTimerCondVar;
+	TimerWheel mTimers;                 // mTimerMutex
+	std::thread mTimerThread;
+	void RunTimers();
+	void WatchConnection(std::weak_ptr<Connection<T>> connection, std::chrono::steady_clock::duration delay);   // heartbeat and idle timeout
+	void CheckConnection(const std::weak_ptr<Connection<T>> &connection);
+
+	std::shared_ptr<RateLimiter> mRateLimiter;   // RateLimitOptions: the global bucket, null without limits
 
 	std::thread mListenThread;
 	void Listen();
 
+	std::atomic<uint32_t> mNextConnectionId{ 1000U };
+	void AddConnection(SOCKET socket, const std::string &host, uint16_t port, std::shared_ptr<ShmChannel> channel);
+
+	SOCKET mLocalSocket = INVALID_SOCKET;   // unix socket of StartLocal
+	std::string mLocalPath;
+	std::thread mLocalListenThread;
+	void ListenLocal();
+	static const int sLocalPollTimeout = 100;   // milliseconds the local listen thread waits before looking at mIsRunning again
+
 	std::thread mRemoveConnectionsThread;
 	void RemoveConnections();
+	static const unsigned sRemoveCheckInterval = 100;   // milliseconds between looks at the connections: they notify without mMutex, one can be missed
 
 	static const uint8_t sMaxNumConnections = 10;
 	bool mIsRunning;
+
+	ErrorCounters mErrorCounters;
+	SocketError mSetupError;        // constructor failure, reported by Start
+
+	MetricCounters mClosedCounters;       // of the removed connections, the open ones are summed up by GetMetrics
+	ErrorCounters mDisconnects;           // removed connections by the error they closed with
+	LatencyHistogram mDispatchLatency;    // from the connection queuing a message to ProcessMessage taking it
+	LatencyHistogram mHandlerLatency;     // time in the callbacks of ProcessMessage
+	HandlerTable<T, ConnectionPtr> mHandlers;   // and by message type
+	Tracer mTracer;                       // traced messages it received
+	void Dispatch(OwnedMessage<T> &message);
+	void ReportError(ConnectionPtr connection, ErrorKind error, int code);
+
+#ifdef COROUTINES_ENABLED
+	struct Inbox                               // messages of a connection driven by a coroutine
+	{
+		std::deque<Message<T>> mMessages;      // arrived while no coroutine was waiting
+		ReceiveAwaiter *mWaiter = nullptr;
+		bool mClosed = false;
+	};
+
+	std::unordered_map<uint32_t, Inbox> mInboxes;    // loop thread only
+	Vector<AcceptAwaiter*> mAcceptWaiters;
+
+	std::atomic<bool> mAsyncAccept{ false };         // set by the first AsyncAccept: the listen thread queues accepted connections
+	std::atomic<bool> mAsyncReceive{ false };        // set by the first AsyncReceive: the removal thread queues disconnections
+	ThreadsafeQueue<ConnectionPtr> mAcceptedConnections;
+	ThreadsafeQueue<uint32_t> mClosedConnections;
+
+	bool RouteToCoroutine(const OwnedMessage<T> &message);
+#endif
+};
+
+#ifdef COROUTINES_ENABLED
+
+template <typename T>
+class Server<T>::ReceiveAwaiter
+{
+	friend class Server<T>;
+public:
+	ReceiveAwaiter(Server &server, ConnectionPtr connection) : mServer(server), mConnection(connection) {}
+
+	bool await_ready()
+	{
+		Inbox &inbox = mServer.mInboxes[mConnection->GetId()];
+
+		if (!inbox.mMessages.empty())
+		{
+			mMessage.emplace(std::move(inbox.mMessages.front()));
+			inbox.mMessages.pop_front();
+
+			return true;
+		}
+
+		if (inbox.mClosed)
+		{
+			mServer.mInboxes.erase(mConnection->GetId());
+			return true;
+		}
+
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		mServer.mInboxes[mConnection->GetId()].mWaiter = this;
+	}
+
+	std::optional<Message<T>> await_resume() { return std::move(mMessage); }
+private:
+	Server &mServer;
+	ConnectionPtr mConnection;
+	std::optional<Message<T>> mMessage;
+	std::coroutine_handle<> mHandle;
+};
+
+template <typename T>
+class Server<T>::AcceptAwaiter
+{
+	friend class Server<T>;
+public:
+	AcceptAwaiter(Server &server) : mServer(server) {}
+
+	bool await_ready()
+	{
+		if (mServer.mAcceptedConnections.Empty())
+			return false;
+
+		mConnection = mServer.mAcceptedConnections.Front();
+		mServer.mAcceptedConnections.DeQueue();
+
+		return true;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		mHandle = handle;
+		mServer.mAcceptWaiters.InsertLast(this);
+	}
+
+	ConnectionPtr await_resume() { return mConnection; }
+private:
+	Server &mServer;
+	ConnectionPtr mConnection;
+	std::coroutine_handle<> mHandle;
 };
 
+#endif  // COROUTINES_ENABLED
+
 template <typename T>
-Server<T>::Server(uint16_t port) :mListenSocket(INVALID_SOCKET), mIsRunning(false)
+Server<T>::Server(uint16_t port, const ServerOptions &options) :mListenSocket(INVALID_SOCKET), mConnectionOptions(options), mTimerOptions(options.mTimers), mTimers(options.mTimers.mTick), mRateLimiter(options.mRateLimits.IsEnabled() ? std::make_shared<RateLimiter>(options.mRateLimits) : nullptr), mIsRunning(false)
 {
 	WSAData wsa;
 	WSAStartup(MAKEWORD(2, 2), &wsa);
 
+	std::string tlsError;
+	if (options.mTls.mEnabled && !(mTls = TlsContext::Create(options.mTls, true, tlsError)))
+	{
+		DbgPrint("tls: " + tlsError);
+		mSetupError = { ErrorKind::TLS, 0 };
+		return;
+	}
+
 	addrinfo hints, *address;
 
 	memset(&hints, 0, sizeof hints);
@@ -74,8 +293,12 @@ Server<T>::Server(uint16_t port) :mListenSocket(INVALID_SOCKET), mIsRunning(fals
 	hints.ai_protocol = IPPROTO_TCP;
 	//hints.ai_flags = AI_PASSIVE;
 
-	if (getaddrinfo(nullptr, std::to_string(port).c_str(), &hints, &address) != 0)
-		Error("cannot get server address");
+	int result = getaddrinfo(nullptr, std::to_string(port).c_str(), &hints, &address);
+	if (result != 0)
+	{
+		mSetupError = { ErrorKind::RESOLVE, result };
+		return;
+	}
 
 	char stringBuf[INET6_ADDRSTRLEN];
 	if (address->ai_family == AF_INET)
@@ -88,10 +311,22 @@ Server<T>::Server(uint16_t port) :mListenSocket(INVALID_SOCKET), mIsRunning(fals
 	mPort = ntohs(address->ai_family == AF_INET ? reinterpret_cast<sockaddr_in *>(address->ai_addr)->sin_port : reinterpret_cast<sockaddr_in6 *>(address->ai_addr)->sin6_port);
 
 	if ((mListenSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol)) == INVALID_SOCKET)
-		Error("cannot create server socket");
+	{
+		mSetupError = { ErrorKind::SOCKET, WSAGetLastError() };
+		freeaddrinfo(address);
+		return;
+	}
+
+	ApplySocketOptions(mListenSocket, mConnectionOptions.mSocket);  // buffer sizes must be set before listen to affect the advertised window
+
+#ifndef _WIN32
+	SetSocketOption(mListenSocket, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");  // a restarted server can bind while the old connections are in TIME_WAIT
+#endif
 
 	if (bind(mListenSocket, address->ai_addr, address->ai_addrlen) != 0)  
-		Error("cannot bind server socket");
+		mSetupError = { ErrorKind::BIND, WSAGetLastError() };
+
+	freeaddrinfo(address);
 }
 
 template <typename T>
@@ -102,19 +337,43 @@ Server<T>::~Server()
 	if (mRemoveConnectionsThread.joinable())
 		mRemoveConnectionsThread.join();
 
+	{
+		std::lock_guard<std::mutex> guard(mTimerMutex);
+	}
+	mTimerCondVar.notify_one();
+
+	if (mTimerThread.joinable())
+		mTimerThread.join();
+
 	if (mListenThread.joinable())
 		mListenThread.join();  // TODO: accept non-blocking
+
+	if (mLocalListenThread.joinable())
+		mLocalListenThread.join();
 		 
-	closesocket(mListenSocket);
+	if (mListenSocket != INVALID_SOCKET)
+		closesocket(mListenSocket);
+
+	if (mLocalSocket != INVALID_SOCKET)
+	{
+		closesocket(mLocalSocket);
+		unlink(mLocalPath.c_str());
+	}
 
 	WSACleanup();
 }
 
 template <typename T>
-void Server<T>::Start()
+bool Server<T>::Start()
 {
-	if (mIsRunning)  // TODO: error check
-		return;
+	if (mIsRunning)
+		return true;
+
+	if (mSetupError.mKind != ErrorKind::NONE)
+	{
+		ReportError(nullptr, mSetupError.mKind, mSetupError.mCode);
+		return false;
+	}
 
 	mIsRunning = true;
 
@@ -122,6 +381,9 @@ void Server<T>::Start()
 
 	mListenThread = std::thread(&Server::Listen, this);                        // thread that listens for and accepts new connections
 	mRemoveConnectionsThread = std::thread(&Server::RemoveConnections, this);  // thread that waits for clients to disconnect
+	mTimerThread = std::thread(&Server::RunTimers, this);                      // thread that runs the due timers
+
+	return true;
 }
 template <typename T>
 void Server<T>::Stop()
@@ -131,6 +393,19 @@ void Server<T>::Stop()
 	if (mListenThread.joinable())  // TODO: non-blocking listening socket 
 		mListenThread.join();
 
+	if (mLocalListenThread.joinable())
+		mLocalListenThread.join();
+
+	mDatagram.Close();
+
+	{
+		std::lock_guard<std::mutex> guard(mTimerMutex);
+	}
+	mTimerCondVar.notify_one();
+
+	if (mTimerThread.joinable())
+		mTimerThread.join();
+
 	for (std::shared_ptr<Connection<T>> &connection : mConnections)  // lock mutex
 		connection->Close();
 
@@ -142,20 +417,29 @@ template <typename T>
 void Server<T>::Listen()
 {
 	if (listen(mListenSocket, sMaxNumConnections) != 0)
-		Error("listen error");
+	{
+		ReportError(nullptr, ErrorKind::LISTEN, WSAGetLastError());
+		return;
+	}
 
 	OnListen();
 
-	static uint32_t connectionId = 1000U;
-
 	while (mIsRunning)
 	{
 		sockaddr_storage clientAddress;
-		int clientAddressLength = sizeof(sockaddr_storage);
+		socklen_t clientAddressLength = sizeof(sockaddr_storage);
 		SOCKET clientSocket = accept(mListenSocket, reinterpret_cast<sockaddr*>(&clientAddress), &clientAddressLength);    // accept connections (blocking)
 
 		if (clientSocket == INVALID_SOCKET)
-			Error("cannot create client socket");
+		{
+			int code = WSAGetLastError();
+			ReportError(nullptr, ErrorKind::ACCEPT, code);
+
+			if (code == EMFILE || code == ENFILE || code == ENOBUFS || code == ENOMEM)   // out of resources: don't spin on the pending connection
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+			continue;
+		}
 
 		char clientHost[INET6_ADDRSTRLEN];
 		if (clientAddress.ss_family == AF_INET)
@@ -165,47 +449,371 @@ void Server<T>::Listen()
 
 		uint16_t clientPort = clientAddress.ss_family == AF_INET ? ntohs(reinterpret_cast<sockaddr_in *>(&clientAddress)->sin_port) : ntohs(reinterpret_cast<sockaddr_in6 *>(&clientAddress)->sin6_port);
 
-		std::lock_guard<std::mutex> guard(mMutex);
+		AddConnection(clientSocket, clientHost, clientPort, nullptr);
+	}
+}
+
+template <typename T>
+void Server<T>::AddConnection(SOCKET socket, const std::string &host, uint16_t port, std::shared_ptr<ShmChannel> channel)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	std::unique_ptr<TlsSession> tls;
+	if (mTls && IsTcpSocket(socket) && !(tls = mTls->NewSession(socket, host)))   // local clients stay plain
+	{
+		ReportError(nullptr, ErrorKind::TLS, 0);
+		closesocket(socket);
+		return;
+	}
+
+	ConnectionPtr newConnection(new Connection<T>(Connection<T>::Owner::SERVER, mNextConnectionId++, host, port, socket, mInMessageQueue, mCondVar, mConnectionOptions, std::move(channel), std::move(tls), mRateLimiter));
+
+	if (newConnection->GetError() != ErrorKind::NONE)   // failed to set up, the destructor closes the socket
+	{
+		ReportError(newConnection, newConnection->GetError(), newConnection->GetErrorCode());
+		return;
+	}
+
+	if (mDatagram.IsOpen() && IsTcpSocket(socket))   // not to local clients; ahead of anything OnClientConnect sends
+		newConnection->OfferDatagram(mDatagram.GetPort(), mDatagram.Offer(newConnection));
+
+	if (OnClientConnect(newConnection))            // callback called on new connections (TODO: refusal doesn't work, connect and then disconnect?)
+	{
+		mConnections.InsertLast(newConnection);    // if connection is accepted 
+		OnClientAccepted(mConnections.Last());
+
+		if (mTimerOptions.mHeartbeat.count() > 0 || mTimerOptions.mIdleTimeout.count() > 0)
+			WatchConnection(newConnection, std::chrono::steady_clock::duration::zero());
+
+#ifdef COROUTINES_ENABLED
+		if (mAsyncAccept)
+			mAcceptedConnections.EnQueue(newConnection);
+#endif
+	}
+}
+
+template <typename T>
+bool Server<T>::StartLocal(const std::string &path)
+{
+#ifdef __linux__
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+
+	if (!mIsRunning || mLocalSocket != INVALID_SOCKET || path.empty() || path.size() >= sizeof address.sun_path)
+		return false;
+
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+
+	if ((mLocalSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == INVALID_SOCKET)
+	{
+		ReportError(nullptr, ErrorKind::SOCKET, errno);
+		return false;
+	}
+
+	unlink(path.c_str());   // left behind by a server that didn't stop
+	mLocalPath = path;
+
+	if (bind(mLocalSocket, reinterpret_cast<const sockaddr*>(&address), sizeof address) != 0 || listen(mLocalSocket, sMaxNumConnections) != 0)
+	{
+		ReportError(nullptr, ErrorKind::BIND, errno);
+		closesocket(mLocalSocket);
+		mLocalSocket = INVALID_SOCKET;
+		return false;
+	}
+
+	mLocalListenThread = std::thread(&Server::ListenLocal, this);
+	return true;
+#else
+	ReportError(nullptr, ErrorKind::SHARED_MEMORY, 0);
+	return false;
+#endif
+}
+
+template <typename T>
+bool Server<T>::StartDatagram(uint16_t port)
+{
+	if (!mIsRunning || mDatagram.IsOpen())
+		return false;
+
+	SocketError error;
+	if (!mDatagram.Bind(mHost, port == 0U ? mPort : port, error))
+	{
+		ReportError(nullptr, error.mKind, error.mCode);
+		return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+void Server<T>::ListenLocal()
+{
+#ifdef __linux__
+	while (mIsRunning)
+	{
+		pollfd listenPoll = { mLocalSocket, POLLIN, 0 };
+		if (poll(&listenPoll, 1, sLocalPollTimeout) <= 0)
+			continue;
+
+		SOCKET clientSocket = accept4(mLocalSocket, nullptr, nullptr, SOCK_CLOEXEC);
+		if (clientSocket == INVALID_SOCKET)
+		{
+			ReportError(nullptr, ErrorKind::ACCEPT, errno);
+			continue;
+		}
+
+		timeval timeout = { 1, 0 };   // a client that doesn't say hello doesn't hold up the others for long
+		setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
 
-		ConnectionPtr newConnection(new Connection<T>(Connection<T>::Owner::SERVER, connectionId++, clientHost, clientPort, clientSocket, mInMessageQueue, mCondVar));
+		SocketError error;
+		LocalTransport transport;
+		int fds[sMaxLocalDescriptors];
+		std::shared_ptr<ShmChannel> channel;
 
-		if (OnClientConnect(newConnection))            // callback called on new connections (TODO: refusal doesn't work, connect and then disconnect?)
+		if (!ReceiveLocalHello(clientSocket, transport, fds, error) || (transport == LocalTransport::SHARED_MEMORY && !(channel = ShmChannel::Adopt(fds, error))))
 		{
-			mConnections.InsertLast(newConnection);    // if connection is accepted 
-			OnClientAccepted(mConnections.Last());
+			ReportError(nullptr, error.mKind, error.mCode);
+			closesocket(clientSocket);
+			continue;
 		}
+
+		AddConnection(clientSocket, mLocalPath, 0, std::move(channel));   // a unix:// client has no channel, its frames go through the socket
 	}
+#endif
+}
+
+template <typename T>
+void Server<T>::Send(ConnectionPtr connection, const Message<T> &message, Priority priority) const
+{
+	if (connection->mIsOpen && !SendDatagram(connection, message))
+		connection->Send(message, priority);
+}
+
+template <typename T>
+uint32_t Server<T>::SendStream(ConnectionPtr connection, T type, StreamSource source, Priority priority) const
+{
+	return connection->mIsOpen ? connection->SendStream(type, std::move(source), priority) : 0U;
 }
 
 template <typename T>
-void Server<T>::Send(ConnectionPtr connection, const Message<T> &message) const
+bool Server<T>::SendFile(ConnectionPtr connection, T type, int fd, uint64_t offset, uint32_t size, Priority priority) const
 {
-	if (connection->mIsOpen)
-		connection->Send(message);
+	return connection->mIsOpen && connection->SendFile(type, fd, offset, size, priority);
 }
 
 template <typename T>
-void Server<T>::Send(uint32_t connectionId, const Message<T> &message) const
+void Server<T>::Send(uint32_t connectionId, const Message<T> &message, Priority priority) const
 {
 	std::lock_guard<std::mutex> guard(mMutex);
 
 	for (const ConnectionPtr &connection : mConnections)
 	{
-		if (connection->GetId() == connectionId)
-			connection->Send(message);
+		if (connection->GetId() == connectionId && !SendDatagram(connection, message))
+			connection->Send(message, priority);
 	}
 }
 
 template <typename T>
-void Server<T>::SendAll(const Message<T> &message, ConnectionPtr ignore) const
+void Server<T>::SendAll(const Message<T> &message, ConnectionPtr ignore, Priority priority) const
 {
 	std::lock_guard<std::mutex> guard(mMutex);
 
-	for (const ConnectionPtr &connection : mConnections)
+	SendEach(mConnections, message, ignore, priority);
+}
+
+template <typename T>
+bool Server<T>::Subscribe(ConnectionPtr connection, const std::string &topic)
+{
+	if (!mTopics.Subscribe(connection, topic))
+		return false;
+
+	if (!connection->mIsOpen)   // closed meanwhile: RemoveConnections may already have unsubscribed it from everything
 	{
-		if (connection != ignore && connection->mIsOpen)
-			connection->Send(message);
+		mTopics.Unsubscribe(connection, topic);
+		return false;
 	}
+
+	return true;
+}
+
+template <typename T>
+bool Server<T>::Unsubscribe(ConnectionPtr connection, const std::string &topic)
+{
+	return mTopics.Unsubscribe(connection, topic);
+}
+
+// the subscribers are collected shard by shard, the sends happen outside the index's locks
+template <typename T>
+size_t Server<T>::Publish(const std::string &topic, const Message<T> &message, ConnectionPtr ignore, Priority priority) const
+{
+	Vector<ConnectionPtr> subscribers;
+	mTopics.Match(topic, subscribers);
+
+	return SendEach(subscribers, message, ignore, priority);
+}
+
+// a compressible message is compressed once (per dictionary), not once per recipient
+template <typename T>
+size_t Server<T>::SendEach(const Vector<ConnectionPtr> &connections, const Message<T> &message, ConnectionPtr ignore, Priority priority) const
+{
+	Message<T> compressed[2] = { Message<T>(message.GetType()), Message<T>(message.GetType()) };   // without and with dictionary
+	enum { UNTRIED, COMPRESSED, INCOMPRESSIBLE } state[2] = { UNTRIED, UNTRIED };
+	size_t sent = 0;
+
+	for (const ConnectionPtr &connection : connections)
+	{
+		if (connection == ignore || !connection->mIsOpen)
+			continue;
+
+		sent++;
+
+		if (SendDatagram(connection, message))
+			continue;
+
+		if (!connection->CanCompress(message))
+		{
+			connection->Send(message, priority);
+			continue;
+		}
+
+		int variant = connection->UsesDictionary() ? 1 : 0;
+
+		if (state[variant] == UNTRIED)
+			state[variant] = Connection<T>::Compress(message, compressed[variant], mConnectionOptions.mCompression, variant == 1) ? COMPRESSED : INCOMPRESSIBLE;
+
+		if (state[variant] == COMPRESSED)
+			connection->Send(compressed[variant], priority);
+		else
+			connection->Send(message, priority, false);
+	}
+
+	return sent;
+}
+
+template <typename T>
+void Server<T>::Reply(ConnectionPtr connection, const Message<T> &request, Message<T> &response) const
+{
+	response.SetCorrelationId(request.GetCorrelationId());
+
+	Send(connection, response);
+}
+
+template <typename T>
+TimerId Server<T>::ScheduleAfter(std::chrono::milliseconds delay, std::function<void()> task)
+{
+	std::lock_guard<std::mutex> guard(mTimerMutex);
+
+	TimerId id = mTimers.Schedule(delay, std::move(task));
+	if (mTimers.Size() == 1U)
+		mTimerCondVar.notify_one();   // the timer thread sleeps while there are none
+
+	return id;
+}
+
+template <typename T>
+TimerId Server<T>::ScheduleEvery(std::chrono::milliseconds period, std::function<void()> task)
+{
+	std::lock_guard<std::mutex> guard(mTimerMutex);
+
+	TimerId id = mTimers.Schedule(period, std::move(task), period);
+	if (mTimers.Size() == 1U)
+		mTimerCondVar.notify_one();
+
+	return id;
+}
+
+template <typename T>
+bool Server<T>::CancelTimer(TimerId id)
+{
+	std::lock_guard<std::mutex> guard(mTimerMutex);
+
+	return mTimers.Cancel(id);
+}
+
+// ticks while there are timers, the due ones run outside the lock so they can schedule and cancel
+template <typename T>
+void Server<T>::RunTimers()
+{
+	Vector<TimerWheel::Callback> due;
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+	while (mIsRunning)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mTimerMutex);
+
+			if (mTimers.Size() == 0U)
+			{
+				mTimerCondVar.wait(lock, [this] { return mTimers.Size() > 0U || !mIsRunning; });
+				next = std::chrono::steady_clock::now();
+			}
+			else
+				mTimerCondVar.wait_until(lock, next, [this] { return !mIsRunning; });
+
+			if (!mIsRunning)
+				break;
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			mTimers.Advance(now, due);
+
+			next += mTimers.GetTick();
+			if (next < now)   // fell behind (a long task): no catching up tick by tick, Advance already did
+				next = now + mTimers.GetTick();
+		}
+
+		for (size_t i = 0; i < due.Size(); i++)
+			due[static_cast<int>(i)]();
+
+		due.Resize(0);
+	}
+}
+
+template <typename T>
+void Server<T>::WatchConnection(std::weak_ptr<Connection<T>> connection, std::chrono::steady_clock::duration delay)
+{
+	std::lock_guard<std::mutex> guard(mTimerMutex);
+
+	mTimers.Schedule(delay, [this, connection] { CheckConnection(connection); });
+	if (mTimers.Size() == 1U)
+		mTimerCondVar.notify_one();
+}
+
+// one timer per connection, set for its next deadline: a message arriving only stores a timestamp, the timer finds it
+template <typename T>
+void Server<T>::CheckConnection(const std::weak_ptr<Connection<T>> &weakConnection)
+{
+	ConnectionPtr connection = weakConnection.lock();
+	if (!connection || !connection->mIsOpen)
+		return;
+
+	using Duration = std::chrono::steady_clock::duration;
+
+	Duration heartbeat = mTimerOptions.mHeartbeat, idleTimeout = mTimerOptions.mIdleTimeout;
+	Duration idle = std::chrono::steady_clock::now() - connection->GetLastReceive();
+
+	if (idleTimeout > Duration::zero() && idle >= idleTimeout)
+	{
+		connection->CloseIdle();   // the removal thread takes it from here
+		return;
+	}
+
+	Duration wait = Duration::max();
+
+	if (heartbeat > Duration::zero())
+	{
+		if (idle >= heartbeat)
+		{
+			connection->Ping();
+			wait = heartbeat;
+		}
+		else
+			wait = heartbeat - idle;
+	}
+
+	if (idleTimeout > Duration::zero())
+		wait = std::min(wait, idleTimeout - idle);
+
+	WatchConnection(weakConnection, wait);
 }
 
 template <typename T>
@@ -214,7 +822,46 @@ void Server<T>::ProcessMessage()
 	OwnedMessage<T> message(mInMessageQueue.Front());
 	mInMessageQueue.DeQueue();
 
-	OnMessage(message.GetSender(), message);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mDispatchLatency.Record(start - message.GetReceived());
+
+	Dispatch(message);
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	mHandlerLatency.Record(end - start);
+
+	if (mHandlers.IsTimed())
+		mHandlers.Record(message.GetType(), end - start);
+
+	if (const std::shared_ptr<TraceSpan> &trace = message.GetTrace())
+	{
+		trace->mPoints[static_cast<size_t>(TraceStage::HANDLER)] = TraceTime(start);
+		trace->mPoints[TraceSpan::sPointCount - 1] = TraceTime(end);
+		mTracer.Record(*trace);
+	}
+}
+
+template <typename T>
+void Server<T>::Dispatch(OwnedMessage<T> &message)
+{
+	if (message.IsStreamChunk())   // credit goes back once the chunk is handled, the stream's chunks queued here stay within its window
+	{
+		OnStreamChunk(message.GetSender(), message.GetStreamId(), message.GetType(), message.GetBody(), message.GetBodySize());
+		message.GetSender()->ConsumeStream(message.GetStreamId(), message.GetBodySize());
+
+		return;
+	}
+
+#ifdef COROUTINES_ENABLED
+	if (RouteToCoroutine(message))
+		return;
+#endif
+
+	HandlerResult result = mHandlers.Dispatch(message.GetSender(), message);
+	if (result == HandlerResult::MALFORMED)
+		ReportError(message.GetSender(), ErrorKind::PROTOCOL, 0);
+	else if (result == HandlerResult::UNHANDLED)
+		OnMessage(message.GetSender(), message);
 }
 
 template <typename T>
@@ -222,14 +869,28 @@ void Server<T>::RemoveConnections()
 {
 	while (mIsRunning)
 	{
-		std::unique_lock<std::mutex> guard(mMutex);
-		mCondVar.wait(guard);   // this thread waits for a connection to notify that a client has disconnected
+		std::unique_lock<std::mutex> guard(mMutex);   // this thread waits for a connection to notify that a client has disconnected
+		mCondVar.wait_for(guard, std::chrono::milliseconds(static_cast<long>(sRemoveCheckInterval)), [this] { return !mIsRunning || std::any_of(mConnections.Begin(), mConnections.End(), [](const ConnectionPtr &connection) { return !connection->mIsOpen; }); });
 
 		typename Vector<ConnectionPtr>::Iterator it = mConnections.Begin();   // poll which client disconnected from server and remove connection
 		while (it != mConnections.End())
 			if (!(*it)->mIsOpen)
 			{
+				if ((*it)->GetError() != ErrorKind::NONE)
+					ReportError(*it, (*it)->GetError(), (*it)->GetErrorCode());
+
+				mDisconnects.Increment((*it)->GetError());
+				mClosedCounters.Add((*it)->GetCounters());
+				mTopics.UnsubscribeAll((*it)->GetId());
+				mDatagram.Forget((*it)->GetId());
+
 				OnClientDisconnect(*it);
+
+#ifdef COROUTINES_ENABLED
+				if (mAsyncReceive)
+					mClosedConnections.EnQueue((*it)->GetId());
+#endif
+
 				it = mConnections.Remove(it);  // calls Connection's destructor which closes the connection
 			}
 			else
@@ -237,6 +898,45 @@ void Server<T>::RemoveConnections()
 	}
 }
 
+template <typename T>
+EndpointMetrics Server<T>::GetMetrics() const
+{
+	EndpointMetrics metrics;
+
+	std::lock_guard<std::mutex> guard(mMutex);   // a connection isn't both in the list and in the closed counters
+
+	for (const ConnectionPtr &connection : mConnections)
+		metrics.mConnections.InsertLast(connection->GetMetrics());
+
+	for (size_t i = 0; i < static_cast<size_t>(Metric::COUNT); i++)
+	{
+		metrics.mCounts[i] = mClosedCounters.Get(static_cast<Metric>(i));
+
+		for (const ConnectionMetrics &connection : metrics.mConnections)
+			metrics.mCounts[i] += connection.mCounts[i];
+	}
+
+	for (size_t i = 0; i < static_cast<size_t>(ErrorKind::COUNT); i++)
+		metrics.mDisconnects[i] = mDisconnects.Get(static_cast<ErrorKind>(i));
+
+	metrics.mQueuedIn = mInMessageQueue.Size();
+	metrics.mDispatchLatency = mDispatchLatency.Snapshot();
+	metrics.mHandlerLatency = mHandlerLatency.Snapshot();
+	metrics.mHandlers = mHandlers.Snapshot();
+
+	return metrics;
+}
+
+template <typename T>
+void Server<T>::ReportError(ConnectionPtr connection, ErrorKind error, int code)
+{
+	mErrorCounters.Increment(error);
+
+	DbgPrint(std::string("error: ") + ErrorKindName(error) + " (" + std::to_string(code) + ")");
+
+	OnError(connection, error, code);
+}
+
 template <typename T>
 void Server<T>::Disconnect(ConnectionPtr connection)
 {
@@ -245,4 +945,98 @@ void Server<T>::Disconnect(ConnectionPtr connection)
 	// remove from list of connections
 }
 
-#endif  // SERVER_H
+#ifdef COROUTINES_ENABLED
+
+template <typename T>
+typename Server<T>::ReceiveAwaiter Server<T>::AsyncReceive(ConnectionPtr connection)
+{
+	mAsyncReceive = true;
+
+	return ReceiveAwaiter(*this, connection);
+}
+
+template <typename T>
+typename Server<T>::AcceptAwaiter Server<T>::AsyncAccept()
+{
+	mAsyncAccept = true;
+	mAsyncReceive = true;
+
+	return AcceptAwaiter(*this);
+}
+
+template <typename T>
+bool Server<T>::RouteToCoroutine(const OwnedMessage<T> &message)
+{
+	uint32_t connectionId = message.GetSender()->GetId();
+
+	auto it = mInboxes.find(connectionId);
+	if (it == mInboxes.end())
+	{
+		if (!mAsyncAccept)   // connection not driven by a coroutine
+			return false;
+
+		it = mInboxes.emplace(connectionId, Inbox()).first;   // accepted connection whose coroutine hasn't asked yet
+	}
+
+	if (ReceiveAwaiter *waiter = it->second.mWaiter)
+	{
+		it->second.mWaiter = nullptr;
+
+		waiter->mMessage.emplace(message);
+		waiter->mHandle.resume();       // may touch mInboxes, don't use it afterwards
+	}
+	else
+		it->second.mMessages.push_back(message);
+
+	return true;
+}
+
+template <typename T>
+void Server<T>::Poll()
+{
+	// disconnections are taken before the messages: a connection queues its last messages before it is reported closed
+	Vector<uint32_t> closedConnections;
+	while (!mClosedConnections.Empty())
+	{
+		closedConnections.InsertLast(mClosedConnections.Front());
+		mClosedConnections.DeQueue();
+	}
+
+	while (!mAcceptWaiters.Empty() && !mAcceptedConnections.Empty())
+	{
+		AcceptAwaiter *waiter = mAcceptWaiters.First();
+		mAcceptWaiters.RemoveFirst();
+
+		waiter->mConnection = mAcceptedConnections.Front();
+		mAcceptedConnections.DeQueue();
+
+		waiter->mHandle.resume();
+	}
+
+	while (Available())
+		ProcessMessage();
+
+	for (uint32_t connectionId : closedConnections)
+	{
+		auto it = mInboxes.find(connectionId);
+		if (it == mInboxes.end())
+		{
+			if (mAsyncAccept)   // accepted connection whose coroutine hasn't asked yet
+				mInboxes[connectionId].mClosed = true;
+
+			continue;
+		}
+
+		it->second.mClosed = true;
+
+		if (ReceiveAwaiter *waiter = it->second.mWaiter)   // nothing buffered, otherwise the coroutine wouldn't be waiting
+		{
+			mInboxes.erase(it);
+			waiter->mHandle.resume();
+		}
+	}
+}
+
+#endif  // COROUTINES_ENABLED
+
+#endif  // SERVER_H
\ No newline at end of file
@@ -5,10 +5,22 @@ enum class MyMessages : uint8_t
 	SERVER_ACCEPT, SERVER_REFUSE, TEXT_MSG,
 };
 
+// a client typing can't send more than this, a flood of broadcasts (recipient -1) would go out to everyone
+static ServerOptions TextLimits()
+{
+	ServerOptions options;
+	options.mRateLimits.SetTypeLimit(static_cast<uint32_t>(MyMessages::TEXT_MSG), RateLimit{ 10.0, 20.0, RateLimitPolicy::DROP });
+
+	return options;
+}
+
 class MyServer : public Server<MyMessages>
 {
 public:
-	MyServer(uint16_t port) : Server(port) {}
+	MyServer(uint16_t port) : Server(port, TextLimits())
+	{
+		SetHandler(MyMessages::TEXT_MSG, [this](ConnectionPtr sender, Message<MyMessages> &message) { OnText(sender, message); });
+	}
 
 	void OnStart() override
 	{
@@ -61,46 +73,40 @@ public:
 		PRINTLN(connection->GetId());
 	}
 
-	void OnMessage(ConnectionPtr sender, Message<MyMessages> &message)
+	void OnText(ConnectionPtr sender, Message<MyMessages> &message)
 	{
-		switch (message.GetType())
-		{
-			case MyMessages::TEXT_MSG:
-			{
-				uint32_t senderId;
-				message >> senderId;
-
-				uint32_t recipientId;
-				message >> recipientId;
-
-				std::string s;
-				message >> s;
-				
-				message << s;
-				message << recipientId;
-				message << senderId;
-
-				PRINT("[");
-				PRINT(std::to_string(senderId));
-				PRINT("] : ");
-				PRINTLN(s);
-
-				if (recipientId == 0U)
-					break;
-				else if (recipientId == (uint32_t)-1)
-					SendAll(message);
-				else
-					Send(recipientId, message);
-			}
-				break;
-		}
+		uint32_t senderId;
+		message >> senderId;
+
+		uint32_t recipientId;
+		message >> recipientId;
+
+		std::string s;
+		message >> s;
+		
+		message << s;
+		message << recipientId;
+		message << senderId;
+
+		PRINT("[");
+		PRINT(std::to_string(senderId));
+		PRINT("] : ");
+		PRINTLN(s);
+
+		if (recipientId == 0U)
+			return;
+		else if (recipientId == (uint32_t)-1)
+			SendAll(message);
+		else
+			Send(recipientId, message);
 	}
 };
 
 int main(int argc, char **argv)
 {
 	MyServer server(60005);
-	server.Start();
+	if (!server.Start())
+		return 1;
 
 	while (true)
 	{